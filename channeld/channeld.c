@@ -496,29 +496,68 @@ static void handle_peer_announcement_signatures(struct peer *peer, const u8 *msg
 	channel_announcement_negotiate(peer);
 }
 
-static bool get_shared_secret(const struct htlc *htlc,
-			      struct secret *shared_secret)
+/* Sets htlc->shared_secret for all these HTLCs, with a single HSM round
+ * trip: a commit_sig can bring in many new HTLCs at once.  If the onion is
+ * invalid, that HTLC gets an all-zero shared_secret. */
+static void get_shared_secrets(struct htlc **htlcs)
 {
-	struct pubkey ephemeral;
-	struct onionpacket *op;
+	struct pubkey *ephemeral = tal_arr(tmpctx, struct pubkey, 0);
+	struct htlc **ecdh_htlcs = tal_arr(tmpctx, struct htlc *, 0);
+	struct secret *ss;
 	const u8 *msg;
 
-	/* We unwrap the onion now. */
-	op = parse_onionpacket(tmpctx, htlc->routing, TOTAL_PACKET_SIZE);
-	if (!op) {
-		/* Return an invalid shared secret. */
-		memset(shared_secret, 0, sizeof(*shared_secret));
-		return false;
+	for (size_t i = 0; i < tal_count(htlcs); i++) {
+		struct onionpacket *op;
+		struct pubkey *e;
+		struct htlc **h;
+
+		htlcs[i]->shared_secret = tal(htlcs[i], struct secret);
+
+		/* We unwrap the onion now. */
+		op = parse_onionpacket(tmpctx, htlcs[i]->routing,
+				       TOTAL_PACKET_SIZE);
+		if (!op) {
+			/* Return an invalid shared secret. */
+			memset(htlcs[i]->shared_secret, 0,
+			       sizeof(*htlcs[i]->shared_secret));
+			continue;
+		}
+
+		/* Because wire takes struct pubkey. */
+		e = tal_arr_append(&ephemeral);
+		e->pubkey = op->ephemeralkey;
+		h = tal_arr_append(&ecdh_htlcs);
+		*h = htlcs[i];
 	}
 
-	/* Because wire takes struct pubkey. */
-	ephemeral.pubkey = op->ephemeralkey;
-	msg = hsm_req(tmpctx, towire_hsm_ecdh_req(tmpctx, &ephemeral));
-	if (!fromwire_hsm_ecdh_resp(msg, shared_secret))
+	if (tal_count(ecdh_htlcs) == 0)
+		return;
+
+	msg = hsm_req(tmpctx, take(towire_hsm_ecdh_batch_req(NULL,
+							     ephemeral)));
+	if (!fromwire_hsm_ecdh_batch_resp(tmpctx, msg, &ss)
+	    || tal_count(ss) != tal_count(ecdh_htlcs))
 		status_failed(STATUS_FAIL_HSM_IO, "Reading ecdh response");
 
-	/* Gives all-zero shares_secret if it was invalid. */
-	return !memeqzero(shared_secret, sizeof(*shared_secret));
+	/* Gives all-zero shared_secret if it was invalid. */
+	for (size_t i = 0; i < tal_count(ecdh_htlcs); i++)
+		*ecdh_htlcs[i]->shared_secret = ss[i];
+}
+
+/* Derive secrets for the HTLCs they're adding in this commitment. */
+static void get_added_shared_secrets(const struct htlc **changed_htlcs)
+{
+	struct htlc **added = tal_arr(tmpctx, struct htlc *, 0);
+
+	for (size_t i = 0; i < tal_count(changed_htlcs); i++) {
+		struct htlc **h;
+
+		if (changed_htlcs[i]->state != RCVD_ADD_COMMIT)
+			continue;
+		h = tal_arr_append(&added);
+		*h = cast_const(struct htlc *, changed_htlcs[i]);
+	}
+	get_shared_secrets(added);
 }
 
 static void handle_peer_add_htlc(struct peer *peer, const u8 *msg)
@@ -548,10 +587,10 @@ static void handle_peer_add_htlc(struct peer *peer, const u8 *msg)
 			    "Bad peer_add_htlc: %s",
 			    channel_add_err_name(add_err));
 
-	/* If this is wrong, we don't complain yet; when it's confirmed we'll
-	 * send it to the master which handles all HTLC failures. */
-	htlc->shared_secret = tal(htlc, struct secret);
-	get_shared_secret(htlc, htlc->shared_secret);
+	/* We derive the shared_secret once they commit to it, along with
+	 * any others in the same commitment: see get_added_shared_secrets.
+	 * If it's wrong, we don't complain yet; we send it to the master
+	 * which handles all HTLC failures. */
 }
 
 static void handle_peer_feechange(struct peer *peer, const u8 *msg)
@@ -1331,6 +1370,9 @@ static void handle_peer_commit_sig(struct peer *peer, const u8 *msg)
 	status_trace("Received commit_sig with %zu htlc sigs",
 		     tal_count(htlc_sigs));
 
+	/* One HSM request for all the new HTLCs' onions. */
+	get_added_shared_secrets(changed_htlcs);
+
 	/* Tell master daemon, then wait for ack. */
 	msg = got_commitsig_msg(NULL, peer->next_index[LOCAL],
 				channel_feerate(peer->channel, LOCAL),
@@ -2500,17 +2542,19 @@ static void init_shared_secrets(struct channel *channel,
 				const struct added_htlc *htlcs,
 				const enum htlc_state *hstates)
 {
+	struct htlc **theirs = tal_arr(tmpctx, struct htlc *, 0);
+
 	for (size_t i = 0; i < tal_count(htlcs); i++) {
-		struct htlc *htlc;
+		struct htlc **h;
 
 		/* We only derive this for HTLCs *they* added. */
 		if (htlc_state_owner(hstates[i]) != REMOTE)
 			continue;
 
-		htlc = channel_get_htlc(channel, REMOTE, htlcs[i].id);
-		htlc->shared_secret = tal(htlc, struct secret);
-		get_shared_secret(htlc, htlc->shared_secret);
+		h = tal_arr_append(&theirs);
+		*h = channel_get_htlc(channel, REMOTE, htlcs[i].id);
 	}
+	get_shared_secrets(theirs);
 }
 
 /* We do this synchronously. */
@@ -0,0 +1,154 @@
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/htable/htable_type.h>
+#include <ccan/intmap/intmap.h>
+#include <common/memleak.h>
+#include <common/onion_replay.h>
+#include <common/pseudorand.h>
+#include <assert.h>
+#include <string.h>
+
+struct replay_entry {
+	struct secret shared_secret;
+	u64 htlc_id;
+};
+
+static const struct secret *keyof_replay_entry(const struct replay_entry *e)
+{
+	return &e->shared_secret;
+}
+
+static size_t hash_secret(const struct secret *s)
+{
+	return siphash24(siphash_seed(), s->data, sizeof(s->data));
+}
+
+static bool replay_entry_eq(const struct replay_entry *e,
+			    const struct secret *s)
+{
+	return memcmp(&e->shared_secret, s, sizeof(*s)) == 0;
+}
+
+HTABLE_DEFINE_TYPE(struct replay_entry, keyof_replay_entry, hash_secret,
+		   replay_entry_eq, replay_map);
+
+/* All the entries which expire at one height. */
+struct replay_bucket {
+	struct replay_entry **entries;
+};
+
+struct onion_replay {
+	/* Every onion we've accepted, by shared secret. */
+	struct replay_map map;
+	size_t count, max_entries;
+	/* The same entries, bucketed by cltv_expiry. */
+	UINTMAP(struct replay_bucket *) by_expiry;
+};
+
+static void destroy_onion_replay(struct onion_replay *replay)
+{
+	replay_map_clear(&replay->map);
+	uintmap_clear(&replay->by_expiry);
+}
+
+struct onion_replay *onion_replay_new(const tal_t *ctx, size_t max_entries)
+{
+	struct onion_replay *replay = tal(ctx, struct onion_replay);
+
+	assert(max_entries > 0);
+	replay_map_init(&replay->map);
+	replay->count = 0;
+	replay->max_entries = max_entries;
+	uintmap_init(&replay->by_expiry);
+	tal_add_destructor(replay, destroy_onion_replay);
+	return replay;
+}
+
+bool onion_replay_seen(const struct onion_replay *replay,
+		       const struct secret *shared_secret,
+		       u64 htlc_id)
+{
+	const struct replay_entry *e = replay_map_get(&replay->map,
+						      shared_secret);
+	return e && e->htlc_id != htlc_id;
+}
+
+/* Forget one of the onions which expire soonest. */
+static void evict_one(struct onion_replay *replay)
+{
+	struct replay_bucket *bucket;
+	u64 expiry;
+	size_t n;
+
+	bucket = uintmap_first(&replay->by_expiry, &expiry);
+	n = tal_count(bucket->entries);
+	replay_map_del(&replay->map, bucket->entries[n-1]);
+	tal_free(bucket->entries[n-1]);
+	replay->count--;
+	if (n == 1) {
+		uintmap_del(&replay->by_expiry, expiry);
+		tal_free(bucket);
+	} else
+		tal_resize(&bucket->entries, n - 1);
+}
+
+void onion_replay_add(struct onion_replay *replay,
+		      const struct secret *shared_secret,
+		      u32 cltv_expiry, u64 htlc_id)
+{
+	struct replay_entry *e;
+	struct replay_bucket *bucket;
+	size_t n;
+
+	if (replay_map_get(&replay->map, shared_secret))
+		return;
+
+	if (replay->count == replay->max_entries)
+		evict_one(replay);
+
+	e = tal(replay, struct replay_entry);
+	e->shared_secret = *shared_secret;
+	e->htlc_id = htlc_id;
+	replay_map_add(&replay->map, e);
+	replay->count++;
+
+	bucket = uintmap_get(&replay->by_expiry, cltv_expiry);
+	if (!bucket) {
+		bucket = tal(replay, struct replay_bucket);
+		bucket->entries = tal_arr(bucket, struct replay_entry *, 0);
+		uintmap_add(&replay->by_expiry, cltv_expiry, bucket);
+	}
+	n = tal_count(bucket->entries);
+	tal_resize(&bucket->entries, n + 1);
+	bucket->entries[n] = e;
+}
+
+void onion_replay_expire(struct onion_replay *replay, u32 blockheight)
+{
+	struct replay_bucket *bucket;
+	u64 expiry;
+
+	while ((bucket = uintmap_first(&replay->by_expiry, &expiry)) != NULL
+	       && expiry < blockheight) {
+		for (size_t i = 0; i < tal_count(bucket->entries); i++) {
+			replay_map_del(&replay->map, bucket->entries[i]);
+			tal_free(bucket->entries[i]);
+		}
+		replay->count -= tal_count(bucket->entries);
+		uintmap_del(&replay->by_expiry, expiry);
+		tal_free(bucket);
+	}
+}
+
+size_t onion_replay_count(const struct onion_replay *replay)
+{
+	return replay->count;
+}
+
+#if DEVELOPER
+void memleak_remove_onion_replay(struct htable *memtable,
+				 const struct onion_replay *replay)
+{
+	memleak_remove_htable(memtable, &replay->map.raw);
+	memleak_remove_uintmap(memtable, &replay->by_expiry);
+}
+#endif /* DEVELOPER */
@@ -0,0 +1,64 @@
+#ifndef LIGHTNING_COMMON_ONION_REPLAY_H
+#define LIGHTNING_COMMON_ONION_REPLAY_H
+#include "config.h"
+#include <bitcoin/privkey.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+
+/* BOLT #4:
+ *
+ * ...the node MUST check for replays of the packet...
+ */
+/* A replayed onion gives us the same shared secret, so we remember every
+ * shared secret we've accepted until the HTLC's cltv_expiry has passed:
+ * after that a replay would fail the cltv checks anyway.  Lookups are a
+ * single hash probe, so they can be done before we do any onion work.
+ *
+ * The cache never holds more than max_entries: past that, the onions
+ * closest to expiry are forgotten first. */
+struct onion_replay;
+
+/* About 100 bytes each, so this caps the cache at around 50MB. */
+#define ONION_REPLAY_MAX_ENTRIES 500000
+
+struct onion_replay *onion_replay_new(const tal_t *ctx, size_t max_entries);
+
+/**
+ * onion_replay_seen - have we accepted this onion for a different HTLC?
+ * @replay: the replay cache
+ * @shared_secret: the ECDH result for the onion
+ * @htlc_id: unique identifier for the HTLC (eg. its database id)
+ *
+ * The same HTLC is allowed through again (eg. after a restart).
+ */
+bool onion_replay_seen(const struct onion_replay *replay,
+		       const struct secret *shared_secret,
+		       u64 htlc_id);
+
+/**
+ * onion_replay_add - remember an onion we've accepted
+ * @replay: the replay cache
+ * @shared_secret: the ECDH result for the onion
+ * @cltv_expiry: when we can forget about it
+ * @htlc_id: unique identifier for the HTLC
+ */
+void onion_replay_add(struct onion_replay *replay,
+		      const struct secret *shared_secret,
+		      u32 cltv_expiry, u64 htlc_id);
+
+/**
+ * onion_replay_expire - forget onions whose HTLCs expired below blockheight
+ */
+void onion_replay_expire(struct onion_replay *replay, u32 blockheight);
+
+/* Number of onions we're remembering. */
+size_t onion_replay_count(const struct onion_replay *replay);
+
+#if DEVELOPER
+struct htable;
+/* Remove any pointers inside the replay cache (opaque to memleak). */
+void memleak_remove_onion_replay(struct htable *memtable,
+				 const struct onion_replay *replay);
+#endif /* DEVELOPER */
+
+#endif /* LIGHTNING_COMMON_ONION_REPLAY_H */
@@ -427,7 +427,7 @@ struct route_step *process_onionpacket(
 		return tal_free(step);
 	}
 
-	//FIXME:store seen secrets to avoid replay attacks
+	/* Replays are caught by the caller: see common/onion_replay.h */
 	generate_cipher_stream(stream, keys.rho, sizeof(stream));
 
 	memset(paddedheader, 0, sizeof(paddedheader));
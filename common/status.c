@@ -18,6 +18,8 @@ static int status_fd = -1;
 static struct daemon_conn *status_conn;
 volatile bool logging_io = false;
 static bool was_logging_io = false;
+/* lightningd tells us what it would throw away anyway. */
+static enum log_level status_min_level = LOG_IO_OUT;
 
 static void got_sigusr1(int signal UNUSED)
 {
@@ -113,10 +115,19 @@ void status_io(enum log_level iodir, const char *who,
 	status_io_full(iodir, who, tal_dup_arr(tmpctx, u8, data, len, 0));
 }
 
+void status_set_min_level(enum log_level level)
+{
+	status_min_level = level;
+}
+
 void status_vfmt(enum log_level level, const char *fmt, va_list ap)
 {
 	char *str;
 
+	/* Don't bother formatting (or sending) what won't be kept. */
+	if (level < status_min_level)
+		return;
+
 	str = tal_vfmt(NULL, fmt, ap);
 	status_send(take(towire_status_log(NULL, level, str)));
 	tal_free(str);
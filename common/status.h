@@ -23,6 +23,9 @@ void status_fmt(enum log_level level, const char *fmt, ...)
 /* vprintf-style */
 void status_vfmt(enum log_level level, const char *fmt, va_list ap);
 
+/* Silently drop status_fmt() calls below this level (default: none). */
+void status_set_min_level(enum log_level level);
+
 /* Usually we only log the packet names, not contents. */
 extern volatile bool logging_io;
 void status_peer_io(enum log_level iodir, const u8 *p);
@@ -35,6 +35,13 @@ void subdaemon_setup(int argc, char *argv[])
 	for (int i = 1; i < argc; i++) {
 		if (streq(argv[i], "--log-io"))
 			logging_io = true;
+		/* lightningd hands us the level it logs at. */
+		if (strstarts(argv[i], "--log-level=")) {
+			unsigned int level = atoi(argv[i]
+						  + strlen("--log-level="));
+			if (level <= LOG_LEVEL_MAX)
+				status_set_min_level(level);
+		}
 	}
 
 #if DEVELOPER
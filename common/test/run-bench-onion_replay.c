@@ -0,0 +1,115 @@
+#include "../memleak.c"
+#include "../onion_replay.c"
+#include "../pseudorand.c"
+#include <assert.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+static struct secret secret_for(size_t i)
+{
+	struct secret s;
+
+	memset(&s, 0, sizeof(s));
+	memcpy(s.data, &i, sizeof(i));
+	return s;
+}
+
+static void check_replay(void)
+{
+	struct onion_replay *replay = onion_replay_new(tmpctx,
+						       ONION_REPLAY_MAX_ENTRIES);
+	struct secret s1 = secret_for(1), s2 = secret_for(2), s3 = secret_for(3);
+
+	assert(!onion_replay_seen(replay, &s1, 100));
+	onion_replay_add(replay, &s1, 500, 100);
+	/* Same HTLC is not a replay, a different one is. */
+	assert(!onion_replay_seen(replay, &s1, 100));
+	assert(onion_replay_seen(replay, &s1, 101));
+	assert(!onion_replay_seen(replay, &s2, 101));
+
+	/* Adding twice is harmless. */
+	onion_replay_add(replay, &s1, 500, 100);
+	onion_replay_add(replay, &s2, 501, 102);
+	assert(onion_replay_count(replay) == 2);
+
+	/* At 500 it's not expired yet, at 501 it is. */
+	onion_replay_expire(replay, 500);
+	assert(onion_replay_count(replay) == 2);
+	onion_replay_expire(replay, 501);
+	assert(onion_replay_count(replay) == 1);
+	assert(!onion_replay_seen(replay, &s1, 101));
+	assert(onion_replay_seen(replay, &s2, 101));
+
+	onion_replay_expire(replay, 1000);
+	assert(onion_replay_count(replay) == 0);
+	tal_free(replay);
+
+	/* When full, the one closest to expiry goes. */
+	replay = onion_replay_new(tmpctx, 2);
+	onion_replay_add(replay, &s1, 501, 100);
+	onion_replay_add(replay, &s2, 500, 101);
+	onion_replay_add(replay, &s3, 502, 102);
+	assert(onion_replay_count(replay) == 2);
+	assert(onion_replay_seen(replay, &s1, 103));
+	assert(!onion_replay_seen(replay, &s2, 103));
+	assert(onion_replay_seen(replay, &s3, 103));
+	onion_replay_expire(replay, 1000);
+	assert(onion_replay_count(replay) == 0);
+	tal_free(replay);
+}
+
+int main(int argc, char *argv[])
+{
+	struct onion_replay *replay;
+	size_t num_entries = 10000, num_lookups = 100000, num_seen = 0;
+	struct timemono start, mid, end;
+
+	setup_locale();
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_entries = atoi(argv[1]);
+	if (argc > 2)
+		num_lookups = atoi(argv[2]);
+	if (argc > 3)
+		opt_usage_and_exit("[num_entries [num_lookups]]");
+
+	check_replay();
+
+	replay = onion_replay_new(tmpctx, num_entries);
+	start = time_mono();
+	/* Spread them over a typical cltv window. */
+	for (size_t i = 0; i < num_entries; i++) {
+		struct secret s = secret_for(i);
+		onion_replay_add(replay, &s, 1000 + i % 2016, i);
+	}
+	mid = time_mono();
+	/* Half of these are replays. */
+	for (size_t i = 0; i < num_lookups; i++) {
+		struct secret s = secret_for(pseudorand(num_entries * 2));
+		num_seen += onion_replay_seen(replay, &s, -1ULL);
+	}
+	end = time_mono();
+	onion_replay_expire(replay, 1000 + 2016);
+	assert(onion_replay_count(replay) == 0);
+
+	printf("%zu inserts in %"PRIu64" nanoseconds each, %zu lookups (%zu seen) in %"PRIu64" nanoseconds each\n",
+	       num_entries,
+	       time_to_nsec(time_divide(timemono_between(mid, start),
+					num_entries)),
+	       num_lookups, num_seen,
+	       time_to_nsec(time_divide(timemono_between(end, mid),
+					num_lookups)));
+
+	tal_free(tmpctx);
+	opt_free_table();
+	return 0;
+}
@@ -5,7 +5,6 @@
 #include <ccan/crypto/hkdf_sha256/hkdf_sha256.h>
 #include <ccan/crypto/siphash24/siphash24.h>
 #include <ccan/endian/endian.h>
-#include <ccan/fdpass/fdpass.h>
 #include <ccan/io/fdpass/fdpass.h>
 #include <ccan/io/io.h>
 #include <ccan/list/list.h>
@@ -56,7 +55,6 @@
 #include <wire/gen_peer_wire.h>
 #include <wire/peer_wire.h>
 #include <wire/wire_io.h>
-#include <wire/wire_sync.h>
 #include <zlib.h>
 
 #define CONNECT_MAX_REACH_ATTEMPTS 10
@@ -67,6 +65,9 @@
 #define INITIAL_WAIT_SECONDS	1
 #define MAX_WAIT_SECONDS	300
 
+/* RFC 8305 recommends 250ms between happy eyeballs connection attempts. */
+#define CONNECT_ATTEMPT_DELAY_MSEC 250
+
 struct listen_fd {
 	int fd;
 	/* If we bind() IPv6 then IPv4 to same port, we *may* fail to listen()
@@ -109,6 +110,15 @@ struct daemon {
 	/* Connection to main daemon. */
 	struct daemon_conn master;
 
+	/* Connection to gossipd, and requests awaiting replies (in order). */
+	struct daemon_conn gossipd;
+	struct list_head gossipd_reqs;
+	/* Where we receive an fd which comes with a gossipd reply. */
+	int gossipd_fd_in;
+
+	/* Peers waiting for gossipd to give us their gossip fd. */
+	struct list_head awaiting_gossip;
+
 	struct timers timers;
 
 	/* Local and global features to offer to peers. */
@@ -123,6 +133,9 @@ struct daemon {
 	/* @see lightningd.config.use_dns */
 	bool use_dns;
 
+	/* @see lightningd.config.max_concurrent_dials */
+	u32 max_concurrent_dials;
+
 	/* The address that the broken response returns instead of
 	 * NXDOMAIN. NULL if we have not detected a broken resolver. */
 	struct sockaddr *broken_resolver_response;
@@ -141,15 +154,22 @@ struct reaching {
 	/* The ID of the peer (not necessarily unique, in transit!) */
 	struct pubkey id;
 
-	/* We iterate through the tal_count(addrs) */
+	/* We iterate through the tal_count(addrs): this is the next to try */
 	size_t addrnum;
 	struct wireaddr_internal *addrs;
 
 	/* NULL if there wasn't a hint. */
 	struct wireaddr_internal *addrhint;
 
-	/* How far did we get? */
-	const char *connstate;
+	/* Connection attempts in flight (reach_attempt). */
+	struct list_head attempts;
+	size_t num_attempts;
+
+	/* Timer to start the next attempt, if we're waiting for it. */
+	struct oneshot *stagger_timer;
+
+	/* When did we start trying? */
+	struct timemono start;
 
 	/* Accumulated errors */
 	char *errors;
@@ -158,10 +178,27 @@ struct reaching {
 	u32 seconds_waited;
 };
 
+/* One connection attempt to reach->addrs[addrnum]. */
+struct reach_attempt {
+	/* reach->attempts */
+	struct list_node list;
+
+	struct reaching *reach;
+	size_t addrnum;
+	struct io_conn *conn;
+
+	/* How far did we get? */
+	const char *connstate;
+
+	/* When did we start? */
+	struct timemono start;
+};
+
 /* This is a transitory structure: we hand off to the master daemon as soon
  * as we've completed INIT read/write. */
 struct peer {
-	/* For reconnecting peers, this is in daemon->reconnecting. */
+	/* For reconnecting peers, this is in daemon->reconnecting; while
+	 * waiting for gossipd, it's in daemon->awaiting_gossip. */
 	struct list_node list;
 
 	struct daemon *daemon;
@@ -180,10 +217,21 @@ struct peer {
 
 	/* Our connection (and owner) */
 	struct io_conn *conn;
+
+	/* What gossipd gave us (-1 on failure). */
+	int gossip_fd;
+};
+
+/* A request to gossipd: it answers in order, so we queue these. */
+struct gossipd_req {
+	struct list_node list;
+	/* NULL if arg was freed before the reply came. */
+	void (*cb)(struct daemon *daemon, const u8 *reply, int fd, void *arg);
+	void *arg;
 };
 
 /* Mutual recursion */
-static void try_reach_one_addr(struct reaching *reach);
+static void try_reach_more(struct reaching *reach);
 
 static struct peer *find_reconnecting_peer(struct daemon *daemon,
 					   const struct pubkey *id)
@@ -258,13 +306,49 @@ static struct peer *new_peer(struct io_conn *conn,
 	peer->daemon = daemon;
 	init_peer_crypto_state(peer, &peer->pcs);
 	peer->pcs.cs = *cs;
+	peer->gossip_fd = -1;
 
 	return peer;
 }
 
 static void destroy_reaching(struct reaching *reach)
 {
+	struct reach_attempt *a;
+
 	list_del_from(&reach->daemon->reaching, &reach->list);
+
+	/* Don't call destroy_io_conn as the attempts' conns are freed */
+	list_for_each(&reach->attempts, a, list)
+		io_set_finish(a->conn, NULL, NULL);
+}
+
+static struct reach_attempt *find_attempt(struct reaching *reach,
+					  const struct io_conn *conn)
+{
+	struct reach_attempt *a;
+
+	list_for_each(&reach->attempts, a, list)
+		if (a->conn == conn)
+			return a;
+	return NULL;
+}
+
+/* We've won with one attempt: stop dialing, and close the others. */
+static void cancel_other_attempts(struct reaching *reach,
+				  struct reach_attempt *winner)
+{
+	struct reach_attempt *a, *next;
+
+	reach->stagger_timer = tal_free(reach->stagger_timer);
+	list_for_each_safe(&reach->attempts, a, next, list) {
+		if (a == winner)
+			continue;
+		list_del_from(&reach->attempts, &a->list);
+		reach->num_attempts--;
+		io_set_finish(a->conn, NULL, NULL);
+		tal_free(a->conn);
+		tal_free(a);
+	}
 }
 
 static struct reaching *find_reaching(struct daemon *daemon,
@@ -282,10 +366,26 @@ static void reached_peer(struct peer *peer, struct io_conn *conn)
 {
 	/* OK, we've reached the peer successfully, tell everyone. */
 	struct reaching *r = find_reaching(peer->daemon, &peer->id);
+	struct reach_attempt *a;
 
 	if (!r)
 		return;
 
+	a = find_attempt(r, conn);
+	if (a)
+		status_debug("Reached %s via %s after %"PRIu64"msec"
+			     " (%zu of %zu addresses tried)",
+			     type_to_string(tmpctx, struct pubkey, &peer->id),
+			     type_to_string(tmpctx, struct wireaddr_internal,
+					    &r->addrs[a->addrnum]),
+			     time_to_msec(timemono_since(r->start)),
+			     r->addrnum, tal_count(r->addrs));
+	else
+		status_debug("Reached %s by incoming connection after"
+			     " %"PRIu64"msec",
+			     type_to_string(tmpctx, struct pubkey, &peer->id),
+			     time_to_msec(timemono_since(r->start)));
+
 	/* Don't call destroy_io_conn */
 	io_set_finish(conn, NULL, NULL);
 
@@ -294,9 +394,114 @@ static void reached_peer(struct peer *peer, struct io_conn *conn)
 	tal_free(r);
 }
 
-static int get_gossipfd(struct peer *peer)
+static void cancel_gossipd_req(void *arg UNUSED, struct gossipd_req *req)
+{
+	req->cb = NULL;
+}
+
+/* Send msg to gossipd; cb is called with the reply (and fd, if any). */
+#define gossipd_req(d, msg, cb, arg)					\
+	gossipd_req_((d), (msg),					\
+		     typesafe_cb_preargs(void, void *, (cb), (arg),	\
+					 struct daemon *,		\
+					 const u8 *, int),		\
+		     (arg))
+
+static void gossipd_req_(struct daemon *daemon, const u8 *msg,
+			 void (*cb)(struct daemon *daemon,
+				    const u8 *reply, int fd, void *arg),
+			 void *arg)
+{
+	struct gossipd_req *req = tal(daemon, struct gossipd_req);
+
+	req->cb = cb;
+	req->arg = arg;
+	list_add_tail(&daemon->gossipd_reqs, &req->list);
+	tal_add_destructor2(arg, cancel_gossipd_req, req);
+	daemon_conn_send(&daemon->gossipd, msg);
+}
+
+static struct io_plan *gossipd_reply_done(struct io_conn *conn,
+					  struct daemon *daemon)
+{
+	struct gossipd_req *req;
+
+	req = list_pop(&daemon->gossipd_reqs, struct gossipd_req, list);
+	if (!req)
+		status_failed(STATUS_FAIL_GOSSIP_IO,
+			      "Unexpected reply from gossipd: %s",
+			      tal_hex(tmpctx, daemon->gossipd.msg_in));
+
+	if (req->cb) {
+		tal_del_destructor2(req->arg, cancel_gossipd_req, req);
+		req->cb(daemon, daemon->gossipd.msg_in, daemon->gossipd_fd_in,
+			req->arg);
+	} else if (daemon->gossipd_fd_in >= 0)
+		close(daemon->gossipd_fd_in);
+	tal_free(req);
+
+	return daemon_conn_read_next(conn, &daemon->gossipd);
+}
+
+static struct io_plan *gossipd_reply(struct io_conn *conn,
+				     struct daemon_conn *gossipd)
+{
+	struct daemon *daemon = container_of(gossipd, struct daemon, gossipd);
+	bool success;
+
+	daemon->gossipd_fd_in = -1;
+
+	/* A successful new_peer_reply is followed by the fd. */
+	if (fromwire_gossip_new_peer_reply(gossipd->msg_in, &success)
+	    && success)
+		return io_recv_fd(conn, &daemon->gossipd_fd_in,
+				  gossipd_reply_done, daemon);
+
+	return gossipd_reply_done(conn, daemon);
+}
+
+static void gossipd_gone(struct io_conn *unused UNUSED,
+			 struct daemon_conn *dc UNUSED)
+{
+	status_failed(STATUS_FAIL_GOSSIP_IO, "Gossipd connection closed");
+}
+
+static struct peer *find_awaiting_gossip_peer(struct daemon *daemon,
+					      const struct pubkey *id)
+{
+	struct peer *peer;
+
+	list_for_each(&daemon->awaiting_gossip, peer, list)
+		if (pubkey_eq(&peer->id, id))
+			return peer;
+	return NULL;
+}
+
+static void destroy_awaiting_gossip_peer(struct peer *peer)
 {
-	bool gossip_queries_feature, initial_routing_sync, success;
+	list_del_from(&peer->daemon->awaiting_gossip, &peer->list);
+}
+
+static void got_gossipfd(struct daemon *daemon UNUSED,
+			 const u8 *reply, int fd, struct peer *peer)
+{
+	bool success;
+
+	if (!fromwire_gossip_new_peer_reply(reply, &success))
+		status_failed(STATUS_FAIL_GOSSIP_IO,
+			      "Failed parsing msg gossipctl: %s",
+			      tal_hex(tmpctx, reply));
+	if (!success)
+		status_broken("Gossipd did not give us an fd: losing peer %s",
+			      type_to_string(tmpctx, struct pubkey, &peer->id));
+	peer->gossip_fd = fd;
+	io_wake(peer);
+}
+
+/* Ask gossipd for an fd for this peer: got_gossipfd wakes it. */
+static void get_gossipfd(struct peer *peer)
+{
+	bool gossip_queries_feature, initial_routing_sync;
 	u8 *msg;
 
 	gossip_queries_feature
@@ -306,25 +511,9 @@ static int get_gossipfd(struct peer *peer)
 	initial_routing_sync
 		= feature_offered(peer->lfeatures, LOCAL_INITIAL_ROUTING_SYNC);
 
-	/* We do this communication sync. */
 	msg = towire_gossip_new_peer(NULL, &peer->id, gossip_queries_feature,
 				     initial_routing_sync);
-	if (!wire_sync_write(GOSSIPCTL_FD, take(msg)))
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Failed writing to gossipctl: %s",
-			      strerror(errno));
-
-	msg = wire_sync_read(peer, GOSSIPCTL_FD);
-	if (!fromwire_gossip_new_peer_reply(msg, &success))
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Failed parsing msg gossipctl: %s",
-			      tal_hex(tmpctx, msg));
-	if (!success) {
-		status_broken("Gossipd did not give us an fd: losing peer %s",
-			      type_to_string(tmpctx, struct pubkey, &peer->id));
-		return -1;
-	}
-	return fdpass_recv(GOSSIPCTL_FD);
+	gossipd_req(peer->daemon, take(msg), got_gossipfd, peer);
 }
 
 static struct io_plan *peer_close_after_error(struct io_conn *conn,
@@ -350,11 +539,14 @@ static struct io_plan *retry_peer_connected(struct io_conn *conn,
 	return peer_connected(conn, peer);
 }
 
+static struct io_plan *peer_got_gossipfd(struct io_conn *conn,
+					 struct peer *peer);
+
 static struct io_plan *peer_connected(struct io_conn *conn, struct peer *peer)
 {
 	struct daemon *daemon = peer->daemon;
+	struct peer *old;
 	u8 *msg;
-	int gossip_fd;
 
 	/* FIXME: We could do this before exchanging init msgs. */
 	if (pubkey_set_get(&daemon->peers, &peer->id)) {
@@ -368,10 +560,33 @@ static struct io_plan *peer_connected(struct io_conn *conn, struct peer *peer)
 		return io_wait(conn, peer, retry_peer_connected, peer);
 	}
 
+	/* Newest connection wins, as with reconnects above. */
+	old = find_awaiting_gossip_peer(daemon, &peer->id);
+	if (old) {
+		status_trace("peer %s: replacing connection awaiting gossipd",
+			     type_to_string(tmpctx, struct pubkey, &peer->id));
+		tal_free(old->conn);
+	}
+
 	reached_peer(peer, conn);
 
-	gossip_fd = get_gossipfd(peer);
-	if (gossip_fd < 0)
+	/* Other peers can proceed while gossipd gets to this. */
+	list_add_tail(&daemon->awaiting_gossip, &peer->list);
+	tal_add_destructor(peer, destroy_awaiting_gossip_peer);
+	get_gossipfd(peer);
+	return io_wait(conn, peer, peer_got_gossipfd, peer);
+}
+
+static struct io_plan *peer_got_gossipfd(struct io_conn *conn,
+					 struct peer *peer)
+{
+	struct daemon *daemon = peer->daemon;
+	u8 *msg;
+
+	list_del_from(&daemon->awaiting_gossip, &peer->list);
+	tal_del_destructor(peer, destroy_awaiting_gossip_peer);
+
+	if (peer->gossip_fd < 0)
 		return io_close(conn);
 
 	msg = towire_connect_peer_connected(tmpctx, &peer->id, &peer->addr,
@@ -379,7 +594,7 @@ static struct io_plan *peer_connected(struct io_conn *conn, struct peer *peer)
 					    peer->gfeatures, peer->lfeatures);
 	daemon_conn_send(&daemon->master, msg);
 	daemon_conn_send_fd(&daemon->master, io_conn_fd(conn));
-	daemon_conn_send_fd(&daemon->master, gossip_fd);
+	daemon_conn_send_fd(&daemon->master, peer->gossip_fd);
 
 	pubkey_set_add(&daemon->peers,
 		       tal_dup(daemon, struct pubkey, &peer->id));
@@ -807,6 +1022,7 @@ static struct io_plan *connect_init(struct daemon_conn *master,
 		&proposed_listen_announce,
 		&proxyaddr, &daemon->use_proxy_always,
 		&daemon->dev_allow_localhost, &daemon->use_dns,
+		&daemon->max_concurrent_dials,
 		&tor_password)) {
 		master_badmsg(WIRE_CONNECTCTL_INIT, msg);
 	}
@@ -874,24 +1090,34 @@ static struct io_plan *handshake_out_success(struct io_conn *conn,
 					     const struct pubkey *id,
 					     const struct wireaddr_internal *addr,
 					     const struct crypto_state *cs,
-					     struct reaching *reach)
+					     struct reach_attempt *attempt)
 {
-	reach->connstate = "Exchanging init messages";
-	status_trace("Connect OUT to %s",
-		     type_to_string(tmpctx, struct pubkey, id));
+	struct reaching *reach = attempt->reach;
+
+	attempt->connstate = "Exchanging init messages";
+	status_trace("Connect OUT to %s via %s after %"PRIu64"msec",
+		     type_to_string(tmpctx, struct pubkey, id),
+		     type_to_string(tmpctx, struct wireaddr_internal, addr),
+		     time_to_msec(timemono_since(attempt->start)));
+
+	/* First handshake wins. */
+	cancel_other_attempts(reach, attempt);
 	return init_new_peer(conn, id, addr, cs, reach->daemon);
 }
 
-struct io_plan *connection_out(struct io_conn *conn, struct reaching *reach)
+struct io_plan *connection_out(struct io_conn *conn,
+			       struct reach_attempt *attempt)
 {
+	struct reaching *reach = attempt->reach;
+
 	/* FIXME: Timeout */
 	status_trace("Connected out for %s",
 		     type_to_string(tmpctx, struct pubkey, &reach->id));
 
-	reach->connstate = "Cryptographic handshake";
+	attempt->connstate = "Cryptographic handshake";
 	return initiator_handshake(conn, &reach->daemon->id, &reach->id,
-				   &reach->addrs[reach->addrnum],
-				   handshake_out_success, reach);
+				   &reach->addrs[attempt->addrnum],
+				   handshake_out_success, attempt);
 }
 
 static void PRINTF_FMT(5,6)
@@ -927,21 +1153,31 @@ static void PRINTF_FMT(5,6)
 		     err);
 }
 
-static void destroy_io_conn(struct io_conn *conn, struct reaching *reach)
+static void destroy_io_conn(struct io_conn *conn UNUSED,
+			    struct reach_attempt *attempt)
 {
+	struct reaching *reach = attempt->reach;
+
 	tal_append_fmt(&reach->errors,
-		       "%s: %s: %s. ",
+		       "%s: %s: %s (after %"PRIu64"msec). ",
 		       type_to_string(tmpctx, struct wireaddr_internal,
-				      &reach->addrs[reach->addrnum]),
-		       reach->connstate, strerror(errno));
-	reach->addrnum++;
-	try_reach_one_addr(reach);
+				      &reach->addrs[attempt->addrnum]),
+		       attempt->connstate, strerror(errno),
+		       time_to_msec(timemono_since(attempt->start)));
+	list_del_from(&reach->attempts, &attempt->list);
+	reach->num_attempts--;
+	tal_free(attempt);
+	try_reach_more(reach);
 }
 
-static struct io_plan *conn_init(struct io_conn *conn, struct reaching *reach)
+static struct io_plan *conn_init(struct io_conn *conn,
+				 struct reach_attempt *attempt)
 {
 	struct addrinfo *ai = NULL;
-	const struct wireaddr_internal *addr = &reach->addrs[reach->addrnum];
+	const struct wireaddr_internal *addr
+		= &attempt->reach->addrs[attempt->addrnum];
+
+	attempt->conn = conn;
 
 	switch (addr->itype) {
 	case ADDR_INTERNAL_SOCKNAME:
@@ -966,16 +1202,19 @@ static struct io_plan *conn_init(struct io_conn *conn, struct reaching *reach)
 	}
 	assert(ai);
 
-	io_set_finish(conn, destroy_io_conn, reach);
-	return io_connect(conn, ai, connection_out, reach);
+	io_set_finish(conn, destroy_io_conn, attempt);
+	return io_connect(conn, ai, connection_out, attempt);
 }
 
 static struct io_plan *conn_proxy_init(struct io_conn *conn,
-				       struct reaching *reach)
+				       struct reach_attempt *attempt)
 {
 	const char *host = NULL;
 	u16 port;
-	const struct wireaddr_internal *addr = &reach->addrs[reach->addrnum];
+	struct reaching *reach = attempt->reach;
+	const struct wireaddr_internal *addr = &reach->addrs[attempt->addrnum];
+
+	attempt->conn = conn;
 
 	switch (addr->itype) {
 	case ADDR_INTERNAL_FORPROXY:
@@ -996,8 +1235,9 @@ static struct io_plan *conn_proxy_init(struct io_conn *conn,
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "Can't reach to %u address", addr->itype);
 
-	io_set_finish(conn, destroy_io_conn, reach);
-	return io_tor_connect(conn, reach->daemon->proxyaddr, host, port, reach);
+	io_set_finish(conn, destroy_io_conn, attempt);
+	return io_tor_connect(conn, reach->daemon->proxyaddr, host, port,
+			      attempt);
 }
 
 static void append_addr(struct wireaddr_internal **addrs,
@@ -1044,22 +1284,14 @@ static void add_seed_addrs(struct wireaddr_internal **addrs,
 }
 
 static void add_gossip_addrs(struct wireaddr_internal **addrs,
-			     const struct pubkey *id)
+			     const u8 *reply)
 {
-	u8 *msg;
 	struct wireaddr *normal_addrs;
 
-	msg = towire_gossip_get_addrs(NULL, id);
-	if (!wire_sync_write(GOSSIPCTL_FD, take(msg)))
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Failed writing to gossipctl: %s",
-			      strerror(errno));
-
-	msg = wire_sync_read(tmpctx, GOSSIPCTL_FD);
-	if (!fromwire_gossip_get_addrs_reply(tmpctx, msg, &normal_addrs))
+	if (!fromwire_gossip_get_addrs_reply(tmpctx, reply, &normal_addrs))
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "Failed parsing get_addrs_reply gossipctl: %s",
-			      tal_hex(tmpctx, msg));
+			      tal_hex(tmpctx, reply));
 
 	/* Wrap each one in a wireaddr_internal and add to addrs. */
 	for (size_t i = 0; i < tal_count(normal_addrs); i++) {
@@ -1070,18 +1302,14 @@ static void add_gossip_addrs(struct wireaddr_internal **addrs,
 	}
 }
 
+/* Start an attempt on the next address: this can fail immediately, calling
+ * try_reach_more() (which may free reach)! */
 static void try_reach_one_addr(struct reaching *reach)
 {
  	int fd, af;
 	bool use_proxy = reach->daemon->use_proxy_always;
 	const struct wireaddr_internal *addr = &reach->addrs[reach->addrnum];
-
-	if (reach->addrnum == tal_count(reach->addrs)) {
-		connect_failed(reach->daemon, &reach->id, reach->seconds_waited,
-			       reach->addrhint, "%s", reach->errors);
-		tal_free(reach);
-		return;
-	}
+	struct reach_attempt *attempt;
 
  	/* Might not even be able to create eg. IPv6 sockets */
  	af = -1;
@@ -1140,74 +1368,139 @@ static void try_reach_one_addr(struct reaching *reach)
 					      addr),
 			       af, strerror(errno));
 		reach->addrnum++;
-		try_reach_one_addr(reach);
+		try_reach_more(reach);
 		return;
 	}
 
+	attempt = tal(reach, struct reach_attempt);
+	attempt->reach = reach;
+	attempt->addrnum = reach->addrnum++;
+	attempt->conn = NULL;
+	attempt->connstate = "Connection establishment";
+	attempt->start = time_mono();
+	list_add_tail(&reach->attempts, &attempt->list);
+	reach->num_attempts++;
+
+	/* conn_init/conn_proxy_init set attempt->conn. */
 	if (use_proxy)
-		io_new_conn(reach, fd, conn_proxy_init, reach);
+		io_new_conn(reach, fd, conn_proxy_init, attempt);
 	else
-		io_new_conn(reach, fd, conn_init, reach);
+		io_new_conn(reach, fd, conn_init, attempt);
 }
 
-/* Consumes addrhint if not NULL */
-static void try_reach_peer(struct daemon *daemon,
-			   const struct pubkey *id,
-			   u32 seconds_waited,
-			   struct wireaddr_internal *addrhint)
+static void stagger_timeout(struct reaching *reach)
 {
-	struct wireaddr_internal *addrs;
-	bool use_proxy = daemon->use_proxy_always;
-	struct reaching *reach;
+	reach->stagger_timer = NULL;
+	try_reach_more(reach);
+}
 
-	/* Already done?  May happen with timer. */
-	if (pubkey_set_get(&daemon->peers, id))
+/* Happy eyeballs (RFC 8305): rather than waiting for each address to time
+ * out in turn, we start a new attempt every CONNECT_ATTEMPT_DELAY_MSEC (up
+ * to max_concurrent_dials at once) until one completes the handshake. */
+static void try_reach_more(struct reaching *reach)
+{
+	reach->stagger_timer = tal_free(reach->stagger_timer);
+
+	if (reach->addrnum == tal_count(reach->addrs)) {
+		/* Still waiting for some? */
+		if (reach->num_attempts != 0)
+			return;
+
+		status_debug("Failed to reach %s after %"PRIu64"msec"
+			     " (%zu addresses tried)",
+			     type_to_string(tmpctx, struct pubkey, &reach->id),
+			     time_to_msec(timemono_since(reach->start)),
+			     reach->addrnum);
+		connect_failed(reach->daemon, &reach->id, reach->seconds_waited,
+			       reach->addrhint, "%s", reach->errors);
+		tal_free(reach);
 		return;
+	}
 
-	/* If we're trying to reach it right now, that's OK. */
-	if (find_reaching(daemon, id))
+	if (reach->num_attempts >= reach->daemon->max_concurrent_dials)
 		return;
 
-	addrs = tal_arr(tmpctx, struct wireaddr_internal, 0);
-	if (addrhint)
-		append_addr(&addrs, addrhint);
+	/* If this one doesn't work out quickly, try the next one too. */
+	if (reach->addrnum + 1 < tal_count(reach->addrs)
+	    && reach->num_attempts + 1 < reach->daemon->max_concurrent_dials)
+		reach->stagger_timer
+			= new_reltimer(&reach->daemon->timers, reach,
+				       time_from_msec(CONNECT_ATTEMPT_DELAY_MSEC),
+				       stagger_timeout, reach);
+
+	/* Must be last: this may free reach. */
+	try_reach_one_addr(reach);
+}
+
+static void got_gossip_addrs(struct daemon *daemon,
+			     const u8 *reply, int fd UNUSED,
+			     struct reaching *reach)
+{
+	bool use_proxy = daemon->use_proxy_always;
 
-	add_gossip_addrs(&addrs, id);
+	add_gossip_addrs(&reach->addrs, reply);
 
-	if (tal_count(addrs) == 0) {
+	if (tal_count(reach->addrs) == 0) {
 		/* Don't resolve via DNS seed if we're supposed to use proxy. */
 		if (use_proxy) {
 			struct wireaddr_internal unresolved;
 			wireaddr_from_unresolved(&unresolved,
-						 seedname(tmpctx, id),
+						 seedname(tmpctx, &reach->id),
 						 DEFAULT_PORT);
-			append_addr(&addrs, &unresolved);
+			append_addr(&reach->addrs, &unresolved);
 		} else if (daemon->use_dns) {
-			add_seed_addrs(&addrs, id,
+			add_seed_addrs(&reach->addrs, &reach->id,
 				       daemon->broken_resolver_response);
 		}
 	}
 
-	if (tal_count(addrs) == 0) {
-		connect_failed(daemon, id, seconds_waited, addrhint,
-			       "No address known");
+	if (tal_count(reach->addrs) == 0) {
+		connect_failed(daemon, &reach->id, reach->seconds_waited,
+			       reach->addrhint, "No address known");
+		tal_free(reach);
 		return;
 	}
 
 	/* Start connecting to it */
+	try_reach_more(reach);
+}
+
+/* Consumes addrhint if not NULL */
+static void try_reach_peer(struct daemon *daemon,
+			   const struct pubkey *id,
+			   u32 seconds_waited,
+			   struct wireaddr_internal *addrhint)
+{
+	struct reaching *reach;
+
+	/* Already done?  May happen with timer. */
+	if (pubkey_set_get(&daemon->peers, id))
+		return;
+
+	/* If we're trying to reach it right now, that's OK. */
+	if (find_reaching(daemon, id))
+		return;
+
 	reach = tal(daemon, struct reaching);
 	reach->daemon = daemon;
 	reach->id = *id;
-	reach->addrs = tal_steal(reach, addrs);
+	reach->addrs = tal_arr(reach, struct wireaddr_internal, 0);
+	if (addrhint)
+		append_addr(&reach->addrs, addrhint);
 	reach->addrnum = 0;
-	reach->connstate = "Connection establishment";
+	list_head_init(&reach->attempts);
+	reach->num_attempts = 0;
+	reach->stagger_timer = NULL;
+	reach->start = time_mono();
 	reach->seconds_waited = seconds_waited;
 	reach->addrhint = tal_steal(reach, addrhint);
 	reach->errors = tal_strdup(reach, "");
 	list_add_tail(&daemon->reaching, &reach->list);
 	tal_add_destructor(reach, destroy_reaching);
 
-	try_reach_one_addr(reach);
+	/* Ask gossipd for any addresses it knows: got_gossip_addrs goes on. */
+	gossipd_req(daemon, take(towire_gossip_get_addrs(NULL, id)),
+		    got_gossip_addrs, reach);
 }
 
 static struct io_plan *connect_to_peer(struct io_conn *conn,
@@ -1305,6 +1598,8 @@ int main(int argc, char *argv[])
 	pubkey_set_init(&daemon->peers);
 	list_head_init(&daemon->reconnecting);
 	list_head_init(&daemon->reaching);
+	list_head_init(&daemon->gossipd_reqs);
+	list_head_init(&daemon->awaiting_gossip);
 	timers_init(&daemon->timers, time_mono());
 	daemon->broken_resolver_response = NULL;
 	daemon->listen_fds = tal_arr(daemon, struct listen_fd, 0);
@@ -1312,7 +1607,9 @@ int main(int argc, char *argv[])
 	daemon_conn_init(daemon, &daemon->master, STDIN_FILENO, recv_req,
 			 master_gone);
 	status_setup_async(&daemon->master);
-	hsm_setup(HSM_FD);
+	hsm_setup_async(daemon, HSM_FD);
+	daemon_conn_init(daemon, &daemon->gossipd, GOSSIPCTL_FD, gossipd_reply,
+			 gossipd_gone);
 
 	/* When conn closes, everything is freed. */
 	tal_steal(daemon->master.conn, daemon);
@@ -3,8 +3,9 @@
 #include "config.h"
 
 struct io_conn;
-struct reaching;
+struct reach_attempt;
 
-struct io_plan *connection_out(struct io_conn *conn, struct reaching *reach);
+struct io_plan *connection_out(struct io_conn *conn,
+			       struct reach_attempt *attempt);
 
 #endif /* LIGHTNING_CONNECTD_CONNECTD_H */
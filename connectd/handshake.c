@@ -161,6 +161,10 @@ struct handshake {
 	struct sha256 h;
 	struct keypair e;
 	struct secret ss;
+	/* Did the HSM give us ss? */
+	bool ss_ok;
+	/* Has the HSM answered yet? */
+	bool ecdh_done;
 
 	/* Used between the Acts */
 	struct pubkey re;
@@ -346,6 +350,32 @@ static struct io_plan *handshake_failed_(struct io_conn *conn,
 #define handshake_failed(conn, h) \
 	handshake_failed_((conn), (h), __func__, __LINE__)
 
+/* The HSM answers asynchronously, so other handshakes can proceed while we
+ * wait; h is freed along with conn, which cancels the callback. */
+static void ecdh_done(const struct secret *ss, struct handshake *h)
+{
+	h->ss_ok = (ss != NULL);
+	if (ss)
+		h->ss = *ss;
+	h->ecdh_done = true;
+	io_wake(h);
+}
+
+static struct io_plan *ecdh_start(struct io_conn *conn,
+				  struct handshake *h,
+				  struct io_plan *(*next)(struct io_conn *,
+							  struct handshake *))
+{
+	h->ecdh_done = false;
+	hsm_do_ecdh_async(&h->re, ecdh_done, h);
+
+	/* io_wake() before io_wait() is lost, so don't wait for an answer
+	 * we already have. */
+	if (h->ecdh_done)
+		return io_always(conn, next, h);
+	return io_wait(conn, h, next, h);
+}
+
 static struct io_plan *handshake_succeeded(struct io_conn *conn,
 					   struct handshake *h)
 {
@@ -441,6 +471,9 @@ static struct handshake *new_handshake(const tal_t *ctx,
 	return handshake;
 }
 
+static struct io_plan *act_three_initiator2(struct io_conn *conn,
+					    struct handshake *h);
+
 static struct io_plan *act_three_initiator(struct io_conn *conn,
 					   struct handshake *h)
 {
@@ -474,7 +507,13 @@ static struct io_plan *act_three_initiator(struct io_conn *conn,
 	 *     * where `re` is the ephemeral public key of the responder
 	 *
 	 */
-	if (!hsm_do_ecdh(&h->ss, &h->re))
+	return ecdh_start(conn, h, act_three_initiator2);
+}
+
+static struct io_plan *act_three_initiator2(struct io_conn *conn,
+					    struct handshake *h)
+{
+	if (!h->ss_ok)
 		return handshake_failed(conn, h);
 
 	SUPERVERBOSE("# ss=0x%s", tal_hexstr(tmpctx, &h->ss, sizeof(h->ss)));
@@ -866,6 +905,9 @@ static struct io_plan *act_two_responder(struct io_conn *conn,
 }
 
 
+static struct io_plan *act_one_responder3(struct io_conn *conn,
+					  struct handshake *h);
+
 static struct io_plan *act_one_responder2(struct io_conn *conn,
 					 struct handshake *h)
 {
@@ -903,7 +945,13 @@ static struct io_plan *act_one_responder2(struct io_conn *conn,
 	 *    * The responder performs an ECDH between its static private key and
 	 *      the initiator's ephemeral public key.
 	 */
-	if (!hsm_do_ecdh(&h->ss, &h->re))
+	return ecdh_start(conn, h, act_one_responder3);
+}
+
+static struct io_plan *act_one_responder3(struct io_conn *conn,
+					  struct handshake *h)
+{
+	if (!h->ss_ok)
 		return handshake_failed(conn, h);
 
 	SUPERVERBOSE("# ss=0x%s", tal_hexstr(tmpctx, &h->ss, sizeof(h->ss)));
@@ -38,7 +38,7 @@ struct reaching_socks {
 	size_t hlen;
 	in_port_t port;
 	char *host;
-	struct reaching *reach;
+	struct reach_attempt *attempt;
 };
 
 static struct io_plan *connect_finish2(struct io_conn *conn,
@@ -48,7 +48,7 @@ static struct io_plan *connect_finish2(struct io_conn *conn,
 		  (reach->buffer + SIZE_OF_RESPONSE - SIZE_OF_IPV4_RESPONSE),
 		  SIZE_OF_IPV6_RESPONSE - SIZE_OF_RESPONSE - SIZE_OF_IPV4_RESPONSE);
 	status_trace("Now try LN connect out for host %s", reach->host);
-	return connection_out(conn, reach->reach);
+	return connection_out(conn, reach->attempt);
 }
 
 static struct io_plan *connect_finish(struct io_conn *conn,
@@ -69,7 +69,7 @@ static struct io_plan *connect_finish(struct io_conn *conn,
 		} else if ( reach->buffer[3] == SOCKS_TYP_IPV4) {
 			status_trace("Now try LN connect out for host %s",
 				     reach->host);
-			return connection_out(conn, reach->reach);
+			return connection_out(conn, reach->attempt);
 		} else {
 			status_trace
 			    ("Tor connect out for host %s error invalid type return ",
@@ -149,13 +149,13 @@ static struct io_plan *io_tor_connect_do_req(struct io_conn *conn,
 struct io_plan *io_tor_connect(struct io_conn *conn,
 			       const struct addrinfo *tor_proxyaddr,
 			       const char *host, u16 port,
-			       struct reaching *reach)
+			       struct reach_attempt *attempt)
 {
-	struct reaching_socks *reach_tor = tal(reach, struct reaching_socks);
+	struct reaching_socks *reach_tor = tal(attempt, struct reaching_socks);
 
 	reach_tor->port = htons(port);
 	reach_tor->host = tal_strdup(reach_tor, host);
-	reach_tor->reach = reach;
+	reach_tor->attempt = attempt;
 
 	return io_connect(conn, tor_proxyaddr,
 			  &io_tor_connect_do_req, reach_tor);
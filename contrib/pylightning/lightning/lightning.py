@@ -137,6 +137,24 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("getroute", payload)
 
+    def getroutes(self, routes, riskfactor, fromid=None, fuzzpercent=None, seed=None):
+        """
+        Show routes for each of {routes}, a list of dicts with {id},
+        {msatoshi} and optional {cltv} (default 9), using {riskfactor}.
+        An empty route means there is none.  If specified search from
+        {fromid} otherwise use this node as source. Randomize the routes
+        with up to {fuzzpercent} (0.0 -> 100.0, default 75.0) using {seed}
+        as an arbitrary-size string seed.
+        """
+        payload = {
+            "routes": routes,
+            "riskfactor": riskfactor,
+            "fromid": fromid,
+            "fuzzpercent": fuzzpercent,
+            "seed": seed
+        }
+        return self.call("getroutes", payload)
+
     def listchannels(self, short_channel_id=None):
         """
         Show all known channels, accept optional {short_channel_id}
@@ -245,6 +263,12 @@ class LightningRpc(UnixDomainSocketRpc):
         """
         return self.call("dev-crash")
 
+    def dev_dbstats(self):
+        """
+        Show how many database transactions we committed, and avoided
+        """
+        return self.call("dev-dbstats")
+
     def dev_query_scids(self, id, scids):
         """
         Ask peer for a particular set of scids
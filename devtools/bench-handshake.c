@@ -0,0 +1,151 @@
+/* Open many concurrent BOLT #8 handshakes to a local node, to measure how
+ * many handshakes per second its connectd manages. */
+#include <bitcoin/privkey.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/io/io.h>
+#include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
+#include <common/crypto_state.h>
+#include <common/status.h>
+#include <common/utils.h>
+#include <common/wireaddr.h>
+#include <connectd/handshake.h>
+#include <hsmd/client.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <secp256k1_ecdh.h>
+#include <sodium/randombytes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct bench {
+	struct pubkey my_id, their_id;
+	struct wireaddr_internal addr;
+	struct addrinfo *ai;
+	size_t num_ok, num_failed, num_outstanding;
+};
+
+/* We use the same static key for every connection: we hang up before
+ * sending init, so the node never considers any of them a peer. */
+static struct privkey my_priv;
+
+/* We're our own HSM. */
+void hsm_do_ecdh_async_(const struct pubkey *point,
+			void (*cb)(const struct secret *ss, void *arg),
+			void *arg)
+{
+	struct secret ss;
+
+	if (secp256k1_ecdh(secp256k1_ctx, ss.data, &point->pubkey,
+			   my_priv.secret.data) == 1)
+		cb(&ss, arg);
+	else
+		cb(NULL, arg);
+}
+
+void status_fmt(enum log_level level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level < LOG_UNUSUAL)
+		return;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+static struct io_plan *handshake_done(struct io_conn *conn,
+				      const struct pubkey *their_id UNUSED,
+				      const struct wireaddr_internal *addr UNUSED,
+				      const struct crypto_state *cs UNUSED,
+				      struct bench *bench)
+{
+	bench->num_ok++;
+	return io_close(conn);
+}
+
+static struct io_plan *connected(struct io_conn *conn, struct bench *bench)
+{
+	return initiator_handshake(conn, &bench->my_id, &bench->their_id,
+				   &bench->addr, handshake_done, bench);
+}
+
+static struct io_plan *conn_init(struct io_conn *conn, struct bench *bench)
+{
+	return io_connect(conn, bench->ai, connected, bench);
+}
+
+static void conn_finished(struct io_conn *conn UNUSED, struct bench *bench)
+{
+	if (--bench->num_outstanding == 0)
+		io_break(bench);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench *bench;
+	struct addrinfo hints;
+	size_t num = 1000;
+	struct timemono start;
+	double secs;
+	bool ok;
+
+	setup_locale();
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY |
+						 SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	if (argc != 3 && argc != 4)
+		errx(1, "Usage: %s <nodeid> <port> [num-connections]", argv[0]);
+
+	bench = tal(NULL, struct bench);
+	if (!pubkey_from_hexstr(argv[1], strlen(argv[1]), &bench->their_id))
+		errx(1, "Invalid node id '%s'", argv[1]);
+	if (argc == 4)
+		num = atol(argv[3]);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo("127.0.0.1", argv[2], &hints, &bench->ai) != 0)
+		errx(1, "Invalid port '%s'", argv[2]);
+	bench->addr.itype = ADDR_INTERNAL_WIREADDR;
+	if (!parse_wireaddr(tal_fmt(tmpctx, "127.0.0.1:%s", argv[2]),
+			    &bench->addr.u.wireaddr, 0, NULL, NULL))
+		errx(1, "Invalid port '%s'", argv[2]);
+
+	do {
+		randombytes_buf(my_priv.secret.data,
+				sizeof(my_priv.secret.data));
+	} while (!pubkey_from_privkey(&my_priv, &bench->my_id));
+
+	bench->num_ok = bench->num_failed = 0;
+	bench->num_outstanding = num;
+
+	start = time_mono();
+	for (size_t i = 0; i < num; i++) {
+		struct io_conn *conn;
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			err(1, "Creating socket %zu", i);
+		conn = io_new_conn(bench, fd, conn_init, bench);
+		io_set_finish(conn, conn_finished, bench);
+	}
+	io_loop(NULL, NULL);
+	secs = time_to_nsec(timemono_since(start)) / 1000000000.0;
+
+	bench->num_failed = num - bench->num_ok;
+	printf("%zu handshakes (%zu failed) in %f seconds: %f per second\n",
+	       bench->num_ok, bench->num_failed, secs, bench->num_ok / secs);
+
+	ok = (bench->num_failed == 0);
+	freeaddrinfo(bench->ai);
+	tal_free(bench);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return ok ? 0 : 1;
+}
@@ -3,13 +3,18 @@
 #include <ccan/crc/crc.h>
 #include <ccan/endian/endian.h>
 #include <ccan/read_write_all/read_write_all.h>
+#include <ccan/time/time.h>
 #include <common/status.h>
 #include <common/utils.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <gossipd/gen_gossip_store.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <signal.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <wire/gen_peer_wire.h>
 #include <wire/wire.h>
@@ -17,6 +22,12 @@
 #define GOSSIP_STORE_FILENAME "gossip_store"
 #define GOSSIP_STORE_TEMP_FILENAME "gossip_store.tmp"
 
+/* Flush appended records once we have this many bytes buffered */
+#define GOSSIP_STORE_BUFFER_SIZE 65536
+
+/* Write a checkpoint at least this often, even if no blocks arrive */
+#define GOSSIP_STORE_CHECKPOINT_INTERVAL 1000
+
 struct gossip_store {
 	int fd;
 	u8 version;
@@ -36,10 +47,45 @@ struct gossip_store {
 	/* Disable compaction if we encounter an error during a prior
 	 * compaction */
 	bool disable_compaction;
+
+	/* Appended records not yet written to fd */
+	u8 *buf;
+
+	/* Compaction runs in a forked child: this is its pid, or 0 */
+	pid_t compactor;
+	/* The child reports how many records it wrote on this pipe */
+	int compactor_fd;
+	/* The new store the child is writing */
+	int compact_fd;
+	/* Store offset and count when the child was started: everything
+	 * after that has to be copied over once it's done. */
+	off_t compact_offset;
+	size_t compact_count;
+
+	/* Highest block height we've seen a spend for, and the number of
+	 * records since we last wrote a checkpoint. */
+	u32 blockheight;
+	size_t since_checkpoint;
 };
 
+static bool gossip_store_write_buf(int fd, u8 **buf)
+{
+	bool ok = write_all(fd, *buf, tal_count(*buf));
+	tal_resize(buf, 0);
+	return ok;
+}
+
 static void gossip_store_destroy(struct gossip_store *gs)
 {
+	if (gs->compactor) {
+		kill(gs->compactor, SIGKILL);
+		waitpid(gs->compactor, NULL, 0);
+		close(gs->compactor_fd);
+		close(gs->compact_fd);
+		unlink(GOSSIP_STORE_TEMP_FILENAME);
+	}
+	if (gs->fd != -1)
+		gossip_store_write_buf(gs->fd, &gs->buf);
 	close(gs->fd);
 }
 
@@ -53,6 +99,10 @@ struct gossip_store *gossip_store_new(const tal_t *ctx,
 	gs->broadcast = broadcast;
 	gs->rstate = rstate;
 	gs->disable_compaction = false;
+	gs->buf = tal_arr(gs, u8, 0);
+	gs->compactor = 0;
+	gs->blockheight = 0;
+	gs->since_checkpoint = 0;
 
 	tal_add_destructor(gs, gossip_store_destroy);
 
@@ -79,31 +129,24 @@ struct gossip_store *gossip_store_new(const tal_t *ctx,
 	return gs;
 }
 
+/* Returns NULL if we don't know the channel.  It doesn't complain itself:
+ * the compaction child can't talk to the master. */
 static u8 *gossip_store_wrap_channel_announcement(const tal_t *ctx,
 						  struct routing_state *rstate,
 						  const u8 *gossip_msg)
 {
-	secp256k1_ecdsa_signature node_signature_1, node_signature_2;
-	secp256k1_ecdsa_signature bitcoin_signature_1, bitcoin_signature_2;
-	u8 *features;
-	struct bitcoin_blkid chain_hash;
 	struct short_channel_id scid;
 	struct pubkey node_id_1;
 	struct pubkey node_id_2;
-	struct pubkey bitcoin_key_1;
-	struct pubkey bitcoin_key_2;
+	struct chan *chan;
 
 	/* Which channel are we talking about here? */
-	if (!fromwire_channel_announcement(
-		tmpctx, gossip_msg, &node_signature_1, &node_signature_2,
-		&bitcoin_signature_1, &bitcoin_signature_2, &features,
-		&chain_hash, &scid, &node_id_1, &node_id_2, &bitcoin_key_1,
-		&bitcoin_key_2))
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Error parsing channel_announcement");
+	if (!channel_announcement_ids(gossip_msg, &scid, &node_id_1, &node_id_2))
+		return NULL;
 
-	struct chan *chan = get_channel(rstate, &scid);
-	assert(chan && chan->satoshis > 0);
+	chan = get_channel(rstate, &scid);
+	if (!chan || chan->satoshis == 0)
+		return NULL;
 
 	u8 *msg = towire_gossip_store_channel_announcement(ctx, gossip_msg,
 							   chan->satoshis);
@@ -111,64 +154,113 @@ static u8 *gossip_store_wrap_channel_announcement(const tal_t *ctx,
 }
 
 /**
- * Wrap the raw gossip message and write it to fd
+ * Wrap the raw gossip message and append it to buf
  *
- * @param fd File descriptor to write the wrapped message into
+ * @param buf The buffer to append the wrapped message to
  * @param gossip_msg The message to write
- * @return true if the message was wrapped and written
+ * @return true if the message was wrapped and appended
+ *
+ * This runs in the compaction child too, so it leaves any complaining to
+ * the caller.
  */
-static bool gossip_store_append(int fd, struct routing_state *rstate, const u8 *gossip_msg)
+static bool gossip_store_append(u8 **buf, struct routing_state *rstate, const u8 *gossip_msg)
 {
 	int t =  fromwire_peektype(gossip_msg);
 	u32 msglen;
 	beint32_t checksum, belen;
 	const u8 *msg;
 
-	if (t == WIRE_CHANNEL_ANNOUNCEMENT)
+	if (t == WIRE_CHANNEL_ANNOUNCEMENT) {
 		msg = gossip_store_wrap_channel_announcement(tmpctx, rstate, gossip_msg);
-	else if(t == WIRE_CHANNEL_UPDATE)
+		if (!msg)
+			return false;
+	} else if(t == WIRE_CHANNEL_UPDATE)
 		msg = towire_gossip_store_channel_update(tmpctx, gossip_msg);
 	else if(t == WIRE_NODE_ANNOUNCEMENT)
 		msg = towire_gossip_store_node_announcement(tmpctx, gossip_msg);
 	else if(t == WIRE_GOSSIP_LOCAL_ADD_CHANNEL)
 		msg = towire_gossip_store_local_add_channel(tmpctx, gossip_msg);
-	else if(t == WIRE_GOSSIP_STORE_CHANNEL_DELETE)
+	else if(t == WIRE_GOSSIP_STORE_CHANNEL_DELETE
+		|| t == WIRE_GOSSIP_STORE_CHECKPOINT)
 		msg = gossip_msg;
-	else {
-		status_trace("Unexpected message passed to gossip_store: %s",
-			     wire_type_name(t));
+	else
 		return false;
-	}
 
 	msglen = tal_count(msg);
 	belen = cpu_to_be32(msglen);
 	checksum = cpu_to_be32(crc32c(0, msg, msglen));
 
-	return (write(fd, &belen, sizeof(belen)) == sizeof(belen) &&
-		write(fd, &checksum, sizeof(checksum)) == sizeof(checksum) &&
-		write(fd, msg, msglen) == msglen);
+	tal_expand(buf, (const u8 *)&belen, sizeof(belen));
+	tal_expand(buf, (const u8 *)&checksum, sizeof(checksum));
+	tal_expand(buf, msg, msglen);
+	return true;
 }
 
 /**
- * Rewrite the on-disk gossip store, compacting it along the way
+ * Write out the compacted store: this runs in the forked child.
  *
- * Creates a new file, writes all the updates from the `broadcast_state`, and
- * then atomically swaps the files.
+ * The child has a snapshot of the `broadcast_state`, so it can take as long
+ * as it needs without holding up gossipd.  It must not return, nor talk to
+ * the master.
  */
-
-static void gossip_store_compact(struct gossip_store *gs)
+static void gossip_store_compact_child(struct gossip_store *gs,
+				       int fd, int countfd)
 {
 	size_t count = 0;
 	u64 index = 0;
-	int fd;
 	const u8 *msg;
+	u8 *buf = tal_arr(NULL, u8, 0);
+
+	if (!write_all(fd, &gs->version, sizeof(gs->version)))
+		_exit(1);
+
+	while ((msg = next_broadcast(gs->broadcast, 0, UINT32_MAX, &index)) != NULL) {
+		if (!gossip_store_append(&buf, gs->rstate, msg))
+			_exit(1);
+		count++;
+		if (tal_count(buf) >= GOSSIP_STORE_BUFFER_SIZE
+		    && !gossip_store_write_buf(fd, &buf))
+			_exit(1);
+	}
+
+	/* The tail copied over afterwards starts right after a checkpoint
+	 * too, so the counts still line up when we load it. */
+	msg = towire_gossip_store_checkpoint(tmpctx, gs->blockheight, count);
+	if (!gossip_store_append(&buf, gs->rstate, msg))
+		_exit(1);
+	count++;
+
+	if (!gossip_store_write_buf(fd, &buf)
+	    || !write_all(countfd, &count, sizeof(count)))
+		_exit(1);
+	_exit(0);
+}
+
+/**
+ * Rewrite the on-disk gossip store, compacting it along the way
+ *
+ * Forks a child which writes all the updates from the `broadcast_state` into
+ * a new file; gossip_store_compact_done() swaps the files once it's finished.
+ * The route worker threads are paused around the fork() (see route_worker.c),
+ * so the child doesn't inherit anything they were halfway through.
+ */
+static void gossip_store_compact(struct gossip_store *gs)
+{
+	int fd, pipefd[2];
 
 	assert(gs->broadcast);
 	status_trace(
 	    "Compacting gossip_store with %zu entries, %zu of which are stale",
 	    gs->count, gs->count - gs->broadcast->count);
 
-	fd = open(GOSSIP_STORE_TEMP_FILENAME, O_RDWR|O_APPEND|O_CREAT, 0600);
+	/* Everything in the store so far is covered by the snapshot. */
+	gossip_store_checkpoint(gs);
+	gossip_store_flush(gs);
+	if (gs->fd == -1)
+		return;
+
+	fd = open(GOSSIP_STORE_TEMP_FILENAME, O_RDWR|O_APPEND|O_CREAT|O_TRUNC,
+		  0600);
 
 	if (fd < 0) {
 		status_broken(
@@ -176,20 +268,78 @@ static void gossip_store_compact(struct gossip_store *gs)
 		goto disable;
 	}
 
-	if (write(fd, &gs->version, sizeof(gs->version))
-	    != sizeof(gs->version)) {
-		status_broken("Writing version to store: %s", strerror(errno));
-		goto unlink_disable;
+	if (pipe(pipefd) != 0) {
+		status_broken("Creating compaction pipe: %s", strerror(errno));
+		goto close_disable;
 	}
 
-	while ((msg = next_broadcast(gs->broadcast, 0, UINT32_MAX, &index)) != NULL) {
-		if (!gossip_store_append(fd, gs->rstate, msg)) {
-			status_broken("Failed writing to gossip store: %s",
-				      strerror(errno));
-			goto unlink_disable;
+	gs->compact_offset = lseek(gs->fd, 0, SEEK_END);
+	gs->compact_count = gs->count;
+	gs->compactor = fork();
+	if (gs->compactor < 0) {
+		status_broken("Forking gossip_store compaction: %s",
+			      strerror(errno));
+		gs->compactor = 0;
+		close(pipefd[0]);
+		close(pipefd[1]);
+		goto close_disable;
+	}
+	if (gs->compactor == 0) {
+		close(pipefd[0]);
+		gossip_store_compact_child(gs, fd, pipefd[1]);
+	}
 
-		}
-		count++;
+	close(pipefd[1]);
+	gs->compactor_fd = pipefd[0];
+	gs->compact_fd = fd;
+	return;
+
+close_disable:
+	close(fd);
+	unlink(GOSSIP_STORE_TEMP_FILENAME);
+disable:
+	status_trace("Encountered an error while compacting, disabling "
+		     "future compactions.");
+	gs->disable_compaction = true;
+}
+
+/* Copy the records appended since compaction started into the new store */
+static bool gossip_store_copy_tail(struct gossip_store *gs)
+{
+	char buf[GOSSIP_STORE_BUFFER_SIZE];
+	off_t off = gs->compact_offset;
+	ssize_t r;
+
+	while ((r = pread(gs->fd, buf, sizeof(buf), off)) > 0) {
+		if (!write_all(gs->compact_fd, buf, r))
+			return false;
+		off += r;
+	}
+	return r == 0;
+}
+
+/* If the compaction child has finished, swap in the new store */
+static void gossip_store_compact_done(struct gossip_store *gs)
+{
+	int status;
+	size_t count;
+	pid_t ret;
+
+	ret = waitpid(gs->compactor, &status, WNOHANG);
+	if (ret == 0)
+		return;
+
+	gs->compactor = 0;
+	if (ret < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+	    || !read_all(gs->compactor_fd, &count, sizeof(count))) {
+		status_broken("gossip_store compaction child failed");
+		goto unlink_disable;
+	}
+
+	if (!gossip_store_copy_tail(gs)) {
+		status_broken("Failed copying to compacted gossip store: %s",
+			      strerror(errno));
+		goto unlink_disable;
 	}
 
 	if (rename(GOSSIP_STORE_TEMP_FILENAME, GOSSIP_STORE_FILENAME) == -1) {
@@ -201,53 +351,116 @@ static void gossip_store_compact(struct gossip_store *gs)
 
 	status_trace(
 	    "Compaction completed: dropped %zu messages, new count %zu",
-	    gs->count - count, count);
-	gs->count = count;
+	    gs->compact_count - count,
+	    count + gs->count - gs->compact_count);
+	gs->count = count + gs->count - gs->compact_count;
+	close(gs->compactor_fd);
 	close(gs->fd);
-	gs->fd = fd;
+	gs->fd = gs->compact_fd;
 	return;
 
 unlink_disable:
+	close(gs->compactor_fd);
+	close(gs->compact_fd);
 	unlink(GOSSIP_STORE_TEMP_FILENAME);
-disable:
 	status_trace("Encountered an error while compacting, disabling "
 		     "future compactions.");
 	gs->disable_compaction = true;
 }
 
-void gossip_store_add(struct gossip_store *gs, const u8 *gossip_msg)
+void gossip_store_flush(struct gossip_store *gs)
 {
-	/* Only give error message once. */
 	if (gs->fd == -1)
 		return;
 
-	if (!gossip_store_append(gs->fd, gs->rstate, gossip_msg)) {
+	if (tal_count(gs->buf) && !gossip_store_write_buf(gs->fd, &gs->buf)) {
 		status_broken("Failed writing to gossip store: %s",
 			      strerror(errno));
 		gs->fd = -1;
+		return;
+	}
+
+	if (gs->compactor)
+		gossip_store_compact_done(gs);
+}
+
+void gossip_store_add(struct gossip_store *gs, const u8 *gossip_msg)
+{
+	/* Only give error message once. */
+	if (gs->fd == -1)
+		return;
+
+	if (!gossip_store_append(&gs->buf, gs->rstate, gossip_msg)) {
+		int t = fromwire_peektype(gossip_msg);
+
+		if (t == WIRE_CHANNEL_ANNOUNCEMENT)
+			status_failed(STATUS_FAIL_INTERNAL_ERROR,
+				      "Error wrapping channel_announcement");
+		status_trace("Unexpected message passed to gossip_store: %s",
+			     wire_type_name(t));
+		return;
 	}
 
 	gs->count++;
+	if (++gs->since_checkpoint >= GOSSIP_STORE_CHECKPOINT_INTERVAL)
+		gossip_store_checkpoint(gs);
+	if (tal_count(gs->buf) >= GOSSIP_STORE_BUFFER_SIZE)
+		gossip_store_flush(gs);
+
 	if (gs->count >= 1000 && gs->count > gs->broadcast->count * 1.25 &&
-	    !gs->disable_compaction)
+	    !gs->disable_compaction && !gs->compactor)
 		gossip_store_compact(gs);
 }
 
 void gossip_store_add_channel_delete(struct gossip_store *gs,
 				     const struct short_channel_id *scid)
 {
-	u8 *msg = towire_gossip_store_channel_delete(NULL, scid);
-	gossip_store_append(gs->fd, gs->rstate, msg);
+	u8 *msg;
+
+	if (gs->fd == -1)
+		return;
+
+	msg = towire_gossip_store_channel_delete(NULL, scid);
+	gossip_store_append(&gs->buf, gs->rstate, msg);
+	gs->since_checkpoint++;
 	tal_free(msg);
 }
 
-void gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
+void gossip_store_checkpoint(struct gossip_store *gs)
+{
+	u8 *msg;
+
+	if (gs->fd == -1)
+		return;
+
+	msg = towire_gossip_store_checkpoint(NULL, gs->blockheight,
+					     gs->since_checkpoint);
+	gossip_store_append(&gs->buf, gs->rstate, msg);
+	gs->count++;
+	gs->since_checkpoint = 0;
+	tal_free(msg);
+}
+
+void gossip_store_new_blockheight(struct gossip_store *gs, u32 blockheight)
+{
+	if (blockheight <= gs->blockheight)
+		return;
+
+	gs->blockheight = blockheight;
+	gossip_store_checkpoint(gs);
+}
+
+bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs,
+		       u32 *rollback_height)
 {
 	beint32_t belen, becsum;
 	u32 msglen, checksum;
-	u8 *msg, *gossip_msg;
+	u8 *msg = NULL, *gossip_msg;
 	u64 satoshis;
 	struct short_channel_id scid;
+	u32 blockheight, count;
+	/* Did the store end with a checkpoint? */
+	bool clean = true;
 	/* We set/check version byte on creation */
 	off_t known_good = 1;
 	const char *bad;
@@ -257,22 +470,52 @@ void gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 	bool unknown_node;
 	size_t num_delayed_na = 0;
 	u8 **delayed_na = tal_arr(tmpctx, u8 *, num_delayed_na);
+	struct stat st;
+	const u8 *map = NULL, *p, *end;
+	struct timemono start = time_mono();
 
-	if (lseek(fd, known_good, SEEK_SET) < 0) {
-		status_unusual("gossip_store: lseek failure");
+	if (fstat(fd, &st) != 0) {
+		status_unusual("gossip_store: fstat failure");
+		goto truncate_nomsg;
+	}
+	if (st.st_size <= known_good)
+		goto out;
+
+	/* Map the whole store in one go, rather than issuing several read()s
+	 * for every message. */
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		status_unusual("gossip_store: mmap failure: %s",
+			       strerror(errno));
 		goto truncate_nomsg;
 	}
-	while (read(fd, &belen, sizeof(belen)) == sizeof(belen) &&
-	       read(fd, &becsum, sizeof(becsum)) == sizeof(becsum)) {
+	p = map + known_good;
+	end = map + st.st_size;
+	routing_cache_node_ids(rstate, true);
+
+	/* The generated fromwire_ routines want a tal array, but one will do
+	 * for every record. */
+	msg = tal_arr(gs, u8, 0);
+
+	while (end - p >= sizeof(belen) + sizeof(becsum)) {
+		memcpy(&belen, p, sizeof(belen));
+		memcpy(&becsum, p + sizeof(belen), sizeof(becsum));
+		p += sizeof(belen) + sizeof(becsum);
 		msglen = be32_to_cpu(belen);
 		checksum = be32_to_cpu(becsum);
-		msg = tal_arr(gs, u8, msglen);
 
-		if (read(fd, msg, msglen) != msglen) {
+		if (end - p < msglen) {
 			status_unusual("gossip_store: truncated file?");
 			goto truncate_nomsg;
 		}
 
+		tal_resize(&msg, msglen);
+		memcpy(msg, p, msglen);
+		p += msglen;
+		gossip_msg = NULL;
+		clean = false;
+
 		if (checksum != crc32c(0, msg, msglen)) {
 			bad = "Checksum verification failed";
 			goto truncate;
@@ -307,6 +550,7 @@ void gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 				tal_resize(&delayed_na, num_delayed_na+1);
 				delayed_na[num_delayed_na++]
 					= tal_steal(delayed_na, gossip_msg);
+				gossip_msg = NULL;
 			} else
 				stats[2]++;
 		} else if (fromwire_gossip_store_channel_delete(msg, &scid)) {
@@ -320,15 +564,46 @@ void gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 		} else if (fromwire_gossip_store_local_add_channel(
 			       msg, msg, &gossip_msg)) {
 			handle_local_add_channel(rstate, gossip_msg);
+		} else if (fromwire_gossip_store_checkpoint(msg, &blockheight,
+							    &count)) {
+			if (count != gs->since_checkpoint) {
+				bad = "Bad checkpoint count";
+				goto truncate;
+			}
+			gs->blockheight = blockheight;
+			clean = true;
 		} else {
 			bad = "Unknown message";
 			goto truncate;
 		}
-		known_good += sizeof(belen) + msglen;
+		known_good += sizeof(belen) + sizeof(becsum) + msglen;
 		gs->count++;
-		tal_free(msg);
+		if (clean)
+			gs->since_checkpoint = 0;
+		else
+			gs->since_checkpoint++;
+		tal_free(gossip_msg);
 	}
 
+	if (p != end) {
+		status_unusual("gossip_store: truncated file?");
+		goto truncate_nomsg;
+	}
+	goto delayed;
+
+truncate:
+	status_unusual("gossip_store: %s (%s) truncating to %"PRIu64,
+		       bad, tal_hex(msg, msg), (u64)known_good);
+truncate_nomsg:
+	/* Everything up to known_good has been applied; any channel_delete
+	 * we lose after it was for a spend at or above the last checkpoint's
+	 * height, so our caller asks for those again. */
+	clean = false;
+	if (ftruncate(fd, known_good) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Truncating store: %s", strerror(errno));
+
+delayed:
 	for (size_t i = 0; i < tal_count(delayed_na); i++) {
 		if (routing_add_node_announcement(rstate, delayed_na[i], NULL)) {
 			stats[2]++;
@@ -337,22 +612,17 @@ void gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 	}
 	status_trace("Successfully processed %zu/%zu unknown node_announcement",
 		     stats[4], tal_count(delayed_na));
-	goto out;
 
-truncate:
-	status_unusual("gossip_store: %s (%s) truncating to %"PRIu64,
-		       bad, tal_hex(msg, msg), (u64)1);
-truncate_nomsg:
-	/* FIXME: We would like to truncate to known_good, except we would
-	 * miss channel_delete msgs.  If we put block numbers into the store
-	 * as we process them, we can know how far we need to roll back if we
-	 * truncate the store */
-	if (ftruncate(fd, 1) != 0)
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Truncating store: %s", strerror(errno));
 out:
-	status_trace("gossip_store: Read %zu/%zu/%zu/%zu cannounce/cupdate/nannounce/cdelete from store in %"PRIu64" bytes",
+	routing_cache_node_ids(rstate, false);
+	if (map)
+		munmap((void *)map, st.st_size);
+	tal_free(msg);
+	status_trace("gossip_store: Read %zu/%zu/%zu/%zu cannounce/cupdate/nannounce/cdelete from store in %"PRIu64" bytes in %"PRIu64" msec",
 		     stats[0], stats[1], stats[2], stats[3],
-		     (u64)known_good);
+		     (u64)known_good,
+		     time_to_msec(timemono_between(time_mono(), start)));
 	gs->fd = fd;
+	*rollback_height = gs->blockheight;
+	return clean;
 }
@@ -25,18 +25,44 @@ struct gossip_store *gossip_store_new(const tal_t *ctx,
  *
  * @param rstate The routing state to load init.
  * @param gs  The `gossip_store` to read from
+ * @param rollback_height Set to the height of the last checkpoint
+ * @return false if the store didn't end with a checkpoint (we crashed, or
+ *  had to truncate it), so channel_deletes for spends at or after
+ *  rollback_height may be missing.
  */
-void gossip_store_load(struct routing_state *rstate, struct gossip_store *gs);
+bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs,
+		       u32 *rollback_height);
 
 /**
  * Add a gossip message to the gossip_store
  */
 void gossip_store_add(struct gossip_store *gs, const u8 *gossip_msg);
 
+/**
+ * Write out any buffered messages, and finish compaction if it's done.
+ *
+ * Messages added with gossip_store_add() are buffered; gossipd calls this
+ * once per event loop iteration.
+ */
+void gossip_store_flush(struct gossip_store *gs);
+
 /**
  * Remember that we deleted a channel as a result of its outpoint being spent
  */
 void gossip_store_add_channel_delete(struct gossip_store *gs,
 				     const struct short_channel_id *scid);
 
+/**
+ * Note that we have seen a spend at this block height.
+ *
+ * Writes a checkpoint if the height went up: if the store is truncated
+ * later, we only need spends from the last checkpoint's height onwards.
+ */
+void gossip_store_new_blockheight(struct gossip_store *gs, u32 blockheight);
+
+/**
+ * Write a checkpoint record, eg. before a clean exit.
+ */
+void gossip_store_checkpoint(struct gossip_store *gs);
+
 #endif /* LIGHTNING_GOSSIPD_GOSSIP_STORE_H */
@@ -17,6 +17,7 @@
 #include <common/bech32.h>
 #include <common/bech32_util.h>
 #include <common/cryptomsg.h>
+#include <common/daemon.h>
 #include <common/daemon_conn.h>
 #include <common/decode_short_channel_ids.h>
 #include <common/features.h>
@@ -35,6 +36,7 @@
 #include <fcntl.h>
 #include <gossipd/broadcast.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <gossipd/route_worker.h>
 #include <gossipd/routing.h>
 #include <hsmd/client.h>
 #include <hsmd/gen_hsm_client_wire.h>
@@ -115,6 +117,22 @@ struct daemon {
 
 	/* Unapplied local updates waiting for their timers. */
 	struct list_head local_updates;
+
+	/* Threads searching routes for us (NULL to do it ourselves). */
+	struct route_workers *route_workers;
+
+	/* getroute requests: master expects the replies in this order. */
+	struct list_head pending_getroutes;
+};
+
+/* A getroute request, waiting on a route worker or on earlier requests. */
+struct pending_getroute {
+	/* daemon->pending_getroutes */
+	struct list_node list;
+
+	/* Being searched, or NULL once we have the reply. */
+	struct route_job *job;
+	u8 *reply;
 };
 
 struct peer {
@@ -1233,6 +1251,7 @@ static void handle_local_channel_update(struct peer *peer, const u8 *msg)
 
 	/* channeld has reconnected, remove local disable. */
 	chan->local_disabled = false;
+	routing_channel_changed(peer->daemon->rstate, chan);
 	queue_local_update(peer->daemon, local_update, delay);
 }
 
@@ -1395,6 +1414,38 @@ static bool nonlocal_dump_gossip(struct io_conn *conn, struct daemon_conn *dc)
 	return maybe_queue_gossip(peer);
 }
 
+/* Send every reply we have, up to the first request still being searched. */
+static void send_getroute_replies(struct daemon *daemon)
+{
+	struct pending_getroute *pg;
+
+	while ((pg = list_top(&daemon->pending_getroutes,
+			      struct pending_getroute, list)) != NULL
+	       && !pg->job) {
+		list_del_from(&daemon->pending_getroutes, &pg->list);
+		daemon_conn_send(&daemon->master, take(pg->reply));
+		tal_free(pg);
+	}
+}
+
+/* A route worker finished this job. */
+static void getroute_done(struct route_job *job, struct daemon *daemon)
+{
+	struct pending_getroute *pg;
+	struct route_hop *hops;
+
+	list_for_each(&daemon->pending_getroutes, pg, list) {
+		if (pg->job == job)
+			break;
+	}
+	assert(pg->job == job);
+
+	hops = route_job_finish(tmpctx, daemon->rstate, job);
+	pg->reply = towire_gossip_getroute_reply(pg, hops);
+	pg->job = tal_free(job);
+	send_getroute_replies(daemon);
+}
+
 static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 				    u8 *msg)
 {
@@ -1402,24 +1453,81 @@ static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 	u64 msatoshi;
 	u32 final_cltv;
 	u16 riskfactor;
-	u8 *out;
+	struct pending_getroute *pg;
 	struct route_hop *hops;
 	double fuzz;
 	struct siphash_seed seed;
+	struct route_hint *hints;
 
-	fromwire_gossip_getroute_request(msg,
+	fromwire_gossip_getroute_request(tmpctx, msg,
 					 &source, &destination,
 					 &msatoshi, &riskfactor, &final_cltv,
-					 &fuzz, &seed);
-	status_trace("Trying to find a route from %s to %s for %"PRIu64" msatoshi",
+					 &fuzz, &seed, &hints);
+	status_trace("Trying to find a route from %s to %s for %"PRIu64" msatoshi (%zu hints)",
 		     pubkey_to_hexstr(tmpctx, &source),
-		     pubkey_to_hexstr(tmpctx, &destination), msatoshi);
+		     pubkey_to_hexstr(tmpctx, &destination), msatoshi,
+		     tal_count(hints));
+
+	pg = tal(daemon, struct pending_getroute);
+	pg->job = NULL;
+
+	/* The workers only have our graph, not one with the hints in. */
+	if (!daemon->route_workers || tal_count(hints))
+		hops = get_route(tmpctx, daemon->rstate, &source, &destination,
+				 msatoshi, 1, final_cltv,
+				 fuzz, &seed, hints);
+	else
+		pg->job = route_job_new(pg, daemon->rstate,
+					&source, &destination,
+					msatoshi, 1, final_cltv,
+					fuzz, &seed, &hops);
+
+	if (pg->job)
+		route_workers_queue(daemon->route_workers, pg->job);
+	else
+		pg->reply = towire_gossip_getroute_reply(pg, hops);
 
-	hops = get_route(tmpctx, daemon->rstate, &source, &destination,
-			 msatoshi, 1, final_cltv,
-			 fuzz, &seed);
+	list_add_tail(&daemon->pending_getroutes, &pg->list);
+	send_getroute_replies(daemon);
+	return daemon_conn_read_next(conn, &daemon->master);
+}
+
+static struct io_plan *getroutes_req(struct io_conn *conn,
+				     struct daemon *daemon,
+				     u8 *msg)
+{
+	struct pubkey source;
+	u16 riskfactor;
+	double fuzz;
+	struct siphash_seed seed;
+	struct route_query *queries;
+	struct route_hop **routes, *hops;
+	u16 *route_lens;
+	u8 *out;
+
+	if (!fromwire_gossip_getroutes_request(tmpctx, msg,
+					       &source, &riskfactor,
+					       &fuzz, &seed, &queries))
+		master_badmsg(WIRE_GOSSIP_GETROUTES_REQUEST, msg);
+	status_trace("Trying to find %zu routes from %s",
+		     tal_count(queries), pubkey_to_hexstr(tmpctx, &source));
+
+	/* Same riskfactor as getroute_req, so we find the same routes. */
+	routes = get_routes(tmpctx, daemon->rstate, &source, queries,
+			    1, fuzz, &seed);
+
+	route_lens = tal_arr(tmpctx, u16, tal_count(routes));
+	hops = tal_arr(tmpctx, struct route_hop, 0);
+	for (size_t i = 0; i < tal_count(routes); i++) {
+		size_t num = tal_count(hops);
+
+		route_lens[i] = tal_count(routes[i]);
+		tal_resize(&hops, num + route_lens[i]);
+		for (size_t j = 0; j < route_lens[i]; j++)
+			hops[num + j] = routes[i][j];
+	}
 
-	out = towire_gossip_getroute_reply(msg, hops);
+	out = towire_gossip_getroutes_reply(msg, route_lens, hops);
 	daemon_conn_send(&daemon->master, out);
 	return daemon_conn_read_next(conn, &daemon->master);
 }
@@ -1893,6 +2001,7 @@ static void gossip_disable_local_channel(struct daemon *daemon,
 	       pubkey_eq(&rstate->local_id, &chan->nodes[1]->id));
 
 	chan->local_disabled = true;
+	routing_channel_changed(rstate, chan);
 	gossip_disable_outgoing_halfchan(daemon, chan);
 }
 
@@ -1920,22 +2029,35 @@ static struct io_plan *gossip_init(struct daemon_conn *master,
 				   const u8 *msg)
 {
 	struct bitcoin_blkid chain_hash;
-	u32 update_channel_interval;
+	u32 update_channel_interval, blockheight;
+	u16 route_threads;
 
 	if (!fromwire_gossipctl_init(
 		daemon, msg, &daemon->broadcast_interval, &chain_hash,
 		&daemon->id, &daemon->globalfeatures,
 		daemon->rgb,
 		daemon->alias, &update_channel_interval,
-		&daemon->announcable)) {
+		&route_threads, &daemon->announcable)) {
 		master_badmsg(WIRE_GOSSIPCTL_INIT, msg);
 	}
 	/* Prune time is twice update time */
 	daemon->rstate = new_routing_state(daemon, &chain_hash, &daemon->id,
 					   update_channel_interval * 2);
 
-	/* Load stored gossip messages */
-	gossip_store_load(daemon->rstate, daemon->rstate->store);
+	/* If we can't start any, we'll just search routes ourselves. */
+	if (route_threads)
+		daemon->route_workers = route_workers_new(daemon,
+							  route_threads,
+							  getroute_done,
+							  daemon);
+
+	/* Load stored gossip messages; if we crashed, we may have lost some
+	 * channel deletions, so ask master to tell us about spends again. */
+	if (!gossip_store_load(daemon->rstate, daemon->rstate->store,
+			       &blockheight))
+		daemon_conn_send(&daemon->master,
+				 take(towire_gossip_resend_spends(NULL,
+								  blockheight)));
 
 	/* Now disable all local channels, they can't be connected yet. */
 	gossip_disable_local_channels(daemon);
@@ -2049,11 +2171,16 @@ static struct io_plan *handle_outpoint_spent(struct io_conn *conn,
 					     const u8 *msg)
 {
 	struct short_channel_id scid;
+	u32 blockheight;
 	struct chan *chan;
 	struct routing_state *rstate = daemon->rstate;
-	if (!fromwire_gossip_outpoint_spent(msg, &scid))
+	if (!fromwire_gossip_outpoint_spent(msg, &scid, &blockheight))
 		master_badmsg(WIRE_GOSSIP_ROUTING_FAILURE, msg);
 
+	/* Spends arrive in block order: anything we lose from the store
+	 * after this point was spent at or after this height. */
+	gossip_store_new_blockheight(rstate->store, blockheight);
+
 	chan = get_channel(rstate, &scid);
 	if (chan) {
 		status_trace(
@@ -2110,6 +2237,9 @@ static struct io_plan *recv_req(struct io_conn *conn, struct daemon_conn *master
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
 		return getroute_req(conn, daemon, daemon->master.msg_in);
 
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
+		return getroutes_req(conn, daemon, daemon->master.msg_in);
+
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 		return getchannels_req(conn, daemon, daemon->master.msg_in);
 
@@ -2162,6 +2292,7 @@ static struct io_plan *recv_req(struct io_conn *conn, struct daemon_conn *master
 	/* We send these, we don't receive them */
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_PING_REPLY:
 	case WIRE_GOSSIP_SCIDS_REPLY:
@@ -2173,6 +2304,7 @@ static struct io_plan *recv_req(struct io_conn *conn, struct daemon_conn *master
 	case WIRE_GOSSIP_LOCAL_ADD_CHANNEL:
 	case WIRE_GOSSIP_LOCAL_CHANNEL_UPDATE:
 	case WIRE_GOSSIP_GET_TXOUT:
+	case WIRE_GOSSIP_RESEND_SPENDS:
 		break;
 	}
 
@@ -2231,12 +2363,35 @@ static struct io_plan *connectd_req(struct io_conn *conn,
 }
 
 #ifndef TESTING
-static void master_gone(struct io_conn *unused UNUSED, struct daemon_conn *dc UNUSED)
+static void master_gone(struct io_conn *unused UNUSED, struct daemon_conn *dc)
 {
+	struct daemon *daemon = container_of(dc, struct daemon, master);
+
+	/* Don't lose gossip we haven't written out yet, and mark the store
+	 * as complete so we don't ask for spends again next time. */
+	if (daemon->rstate) {
+		gossip_store_checkpoint(daemon->rstate->store);
+		gossip_store_flush(daemon->rstate->store);
+	}
+
 	/* Can't tell master, it's gone. */
 	exit(2);
 }
 
+/* For gossipd_poll: there's only one daemon. */
+static struct daemon *poll_daemon;
+
+/*~ Like lightningd, we override ccan/io's poll(): it's called once per event
+ * loop iteration, so it's where we write out the gossip_store messages we
+ * buffered during that iteration. */
+static int gossipd_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	if (poll_daemon->rstate)
+		gossip_store_flush(poll_daemon->rstate->store);
+
+	return daemon_poll(fds, nfds, timeout);
+}
+
 int main(int argc, char *argv[])
 {
 	setup_locale();
@@ -2246,8 +2401,12 @@ int main(int argc, char *argv[])
 	subdaemon_setup(argc, argv);
 
 	daemon = tal(NULL, struct daemon);
+	/* Not set up until gossipctl_init */
+	daemon->rstate = NULL;
 	list_head_init(&daemon->peers);
 	list_head_init(&daemon->local_updates);
+	daemon->route_workers = NULL;
+	list_head_init(&daemon->pending_getroutes);
 	timers_init(&daemon->timers, time_mono());
 	daemon->broadcast_interval = 30000;
 	daemon->last_announce_timestamp = 0;
@@ -2260,6 +2419,9 @@ int main(int argc, char *argv[])
 	daemon_conn_init(daemon, &daemon->connectd, CONNECTD_FD, connectd_req,
 			 NULL);
 
+	poll_daemon = daemon;
+	io_poll_override(gossipd_poll);
+
 	for (;;) {
 		struct timer *expired = NULL;
 		io_loop(&daemon->timers, &expired);
@@ -0,0 +1,199 @@
+#include "route_worker.h"
+#include <ccan/io/io.h>
+#include <ccan/list/list.h>
+#include <ccan/read_write_all/read_write_all.h>
+#include <common/status.h>
+#include <errno.h>
+#include <gossipd/routing.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The threads can't use tal, so the main thread allocates these. */
+struct route_work {
+	/* In workers->queue until a thread takes it. */
+	struct list_node list;
+	struct route_job *job;
+};
+
+struct route_workers {
+	/* In all_workers, so we can stop them around fork(). */
+	struct list_node list;
+
+	/* Protects queue, busy and paused: threads wait on wake for
+	 * something in queue, and signal idle when busy drops to 0. */
+	pthread_mutex_t lock;
+	pthread_cond_t wake, idle;
+	struct list_head queue;
+
+	/* How many threads are inside route_job_run(). */
+	size_t busy;
+	/* Set while we fork(): threads don't take new work. */
+	bool paused;
+
+	/* Threads write each finished route_work pointer here. */
+	int done_fd;
+	struct route_work *done_work;
+
+	void (*done)(struct route_job *job, void *arg);
+	void *arg;
+};
+
+static LIST_HEAD(all_workers);
+
+static void *route_worker_thread(void *arg)
+{
+	struct route_workers *workers = arg;
+
+	for (;;) {
+		struct route_work *work;
+
+		pthread_mutex_lock(&workers->lock);
+		while (workers->paused || list_empty(&workers->queue))
+			pthread_cond_wait(&workers->wake, &workers->lock);
+		work = list_pop(&workers->queue, struct route_work, list);
+		workers->busy++;
+		pthread_mutex_unlock(&workers->lock);
+
+		route_job_run(work->job);
+
+		pthread_mutex_lock(&workers->lock);
+		if (--workers->busy == 0)
+			pthread_cond_signal(&workers->idle);
+		pthread_mutex_unlock(&workers->lock);
+
+		/* Less than PIPE_BUF, so it can't interleave with others.
+		 * Replies go out in order, so a lost job would hold up every
+		 * later one: we can't log from here, so just die. */
+		if (!write_all(workers->done_fd, &work, sizeof(work)))
+			abort();
+	}
+}
+
+/* The gossip_store compaction child is forked from here: only the thread
+ * which called fork() exists in the child, so make sure the others aren't
+ * in the middle of anything when it's taken. */
+static void pause_workers(void)
+{
+	struct route_workers *workers;
+
+	list_for_each(&all_workers, workers, list) {
+		pthread_mutex_lock(&workers->lock);
+		workers->paused = true;
+		while (workers->busy)
+			pthread_cond_wait(&workers->idle, &workers->lock);
+		pthread_mutex_unlock(&workers->lock);
+	}
+}
+
+static void resume_workers(void)
+{
+	struct route_workers *workers;
+
+	list_for_each(&all_workers, workers, list) {
+		pthread_mutex_lock(&workers->lock);
+		workers->paused = false;
+		pthread_cond_broadcast(&workers->wake);
+		pthread_mutex_unlock(&workers->lock);
+	}
+}
+
+static void destroy_route_workers(struct route_workers *workers)
+{
+	list_del_from(&all_workers, &workers->list);
+}
+
+static struct io_plan *read_done(struct io_conn *conn,
+				 struct route_workers *workers);
+
+static struct io_plan *work_done(struct io_conn *conn,
+				 struct route_workers *workers)
+{
+	struct route_work *work = workers->done_work;
+
+	workers->done(work->job, workers->arg);
+	tal_free(work);
+	return read_done(conn, workers);
+}
+
+static struct io_plan *read_done(struct io_conn *conn,
+				 struct route_workers *workers)
+{
+	return io_read(conn, &workers->done_work, sizeof(workers->done_work),
+		       work_done, workers);
+}
+
+struct route_workers *route_workers_new_(const tal_t *ctx, size_t num,
+					 void (*done)(struct route_job *job,
+						      void *arg),
+					 void *arg)
+{
+	static bool registered_atfork;
+	struct route_workers *workers = tal(ctx, struct route_workers);
+	size_t started = 0;
+	int fds[2];
+
+	if (!registered_atfork) {
+		errno = pthread_atfork(pause_workers, resume_workers, NULL);
+		if (errno != 0) {
+			status_unusual("Could not register fork handlers: %s",
+				       strerror(errno));
+			return tal_free(workers);
+		}
+		registered_atfork = true;
+	}
+
+	pthread_mutex_init(&workers->lock, NULL);
+	pthread_cond_init(&workers->wake, NULL);
+	pthread_cond_init(&workers->idle, NULL);
+	list_head_init(&workers->queue);
+	workers->busy = 0;
+	workers->paused = false;
+	workers->done = done;
+	workers->arg = arg;
+
+	if (pipe(fds) != 0) {
+		status_unusual("Could not create route worker pipe: %s",
+			       strerror(errno));
+		return tal_free(workers);
+	}
+	workers->done_fd = fds[1];
+
+	for (size_t i = 0; i < num; i++) {
+		pthread_t thread;
+
+		errno = pthread_create(&thread, NULL, route_worker_thread,
+				       workers);
+		if (errno != 0) {
+			status_unusual("Could not start route worker: %s",
+				       strerror(errno));
+			break;
+		}
+		/* They live as long as we do. */
+		pthread_detach(thread);
+		started++;
+	}
+
+	if (!started) {
+		close(fds[0]);
+		close(fds[1]);
+		return tal_free(workers);
+	}
+
+	list_add_tail(&all_workers, &workers->list);
+	tal_add_destructor(workers, destroy_route_workers);
+	io_new_conn(workers, fds[0], read_done, workers);
+	return workers;
+}
+
+void route_workers_queue(struct route_workers *workers,
+			 struct route_job *job)
+{
+	struct route_work *work = tal(workers, struct route_work);
+
+	work->job = job;
+	pthread_mutex_lock(&workers->lock);
+	list_add_tail(&workers->queue, &work->list);
+	pthread_cond_signal(&workers->wake);
+	pthread_mutex_unlock(&workers->lock);
+}
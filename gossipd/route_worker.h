@@ -0,0 +1,36 @@
+#ifndef LIGHTNING_GOSSIPD_ROUTE_WORKER_H
+#define LIGHTNING_GOSSIPD_ROUTE_WORKER_H
+#include "config.h"
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+
+/* Threads to do route_job_run() for us, so we can keep handling gossip
+ * while routes are searched. */
+struct route_job;
+struct route_workers;
+
+/**
+ * route_workers_new - start threads to search routes
+ * @ctx: the context to allocate off.
+ * @num: how many threads.
+ * @done: called from io_loop with each job once it has run.
+ * @arg: argument for @done.
+ *
+ * Returns NULL if we can't start any threads at all.
+ */
+#define route_workers_new(ctx, num, done, arg)				\
+	route_workers_new_((ctx), (num),				\
+			   typesafe_cb_preargs(void, void *, (done), (arg), \
+					       struct route_job *),	\
+			   (arg))
+
+struct route_workers *route_workers_new_(const tal_t *ctx, size_t num,
+					 void (*done)(struct route_job *job,
+						      void *arg),
+					 void *arg);
+
+/* Hand @job to the next free thread.  Don't touch it until it's done. */
+void route_workers_queue(struct route_workers *workers,
+			 struct route_job *job);
+
+#endif /* LIGHTNING_GOSSIPD_ROUTE_WORKER_H */
@@ -29,6 +29,129 @@
 /* Proportional fee must be less than 24 bits, so never overflows. */
 #define MAX_PROPORTIONAL_FEE (1 << 24)
 
+/* After this many channel changes, a new search is cheaper than repair. */
+#define ROUTE_SEARCH_MAX_CHANGES 64
+
+/* How many recently found routes we keep, and for how long. */
+#define ROUTE_CACHE_SIZE 16
+#define ROUTE_CACHE_SECS 10
+
+/* How much time between their newest updates channels can share a
+ * prune bucket. */
+#define PRUNE_BUCKET_SECS 3600
+
+/* What a search depends on, other than the graph.  There's no source: we
+ * search backwards from the destination, which finds routes from anywhere. */
+struct route_key {
+	struct pubkey to;
+	u64 msatoshi;
+	double riskfactor;
+	double fuzz;
+	struct siphash_seed base_seed;
+};
+
+struct route_search {
+	/* Does every node's bfg[] hold the search for key? */
+	bool valid;
+	struct route_key key;
+
+	/* We skipped some temporarily unroutable channel which comes back
+	 * after this. */
+	u64 valid_until;
+
+	/* Channels changed since, which bfg_repair() needs to look at. */
+	struct chan **changed;
+};
+
+struct cached_route {
+	struct route_key key;
+	struct pubkey from;
+	time_t expires;
+	/* NULL if unused. */
+	struct chan **route;
+	u64 fee;
+};
+
+struct route_cache {
+	struct cached_route routes[ROUTE_CACHE_SIZE];
+	/* Next one to replace. */
+	size_t next;
+};
+
+/* Channels whose newest update is in the same PRUNE_BUCKET_SECS. */
+struct prune_bucket {
+	struct list_head chans;
+};
+
+/* A half_chan into a node, as a route search sees it. */
+struct route_graph_edge {
+	/* Copy of its fees, delay, minimum and unroutable_until. */
+	struct half_chan hc;
+	u64 capacity_msat;
+	struct short_channel_id scid;
+	/* Indices into nodes[]: it goes from @from to @to. */
+	u32 from, to;
+	/* Only valid while the graph is current. */
+	struct chan *chan;
+};
+
+struct route_graph_node {
+	struct pubkey id;
+	/* The edges into this node. */
+	u32 first_edge, num_edges;
+	/* Only valid while the graph is current. */
+	struct node *node;
+};
+
+/* A copy of the graph which never changes, so route_job_run() can search
+ * it while we keep changing the real one.  We only copy the channels we
+ * could route through; their unroutable_until is checked at search time.
+ * Only the main thread touches refcount: rstate->graph holds one, and each
+ * job another, so it's freed once it's been replaced and the last job
+ * which was searching it is finished. */
+struct route_graph {
+	/* rstate->graph_version when we copied it. */
+	u64 version;
+	size_t refcount;
+	size_t num_nodes;
+	struct route_graph_node *nodes;
+	struct route_graph_edge *edges;
+};
+
+/* What the nodes' bfg[] is in a struct route_job. */
+struct route_job_bfg {
+	u64 total, risk;
+	/* Index of the edge it came from. */
+	u32 prev;
+};
+
+struct route_job {
+	struct route_graph *graph;
+	struct route_key key;
+	/* Indices into graph->nodes[]; we map backwards, as usual. */
+	u32 src, dst;
+	time_t now;
+	u32 final_cltv;
+
+	/* ROUTING_MAX_HOPS+1 for each node: allocated up front, since
+	 * route_job_run() can't use tal. */
+	struct route_job_bfg *bfg;
+
+	/* What route_job_run() found. */
+	u64 valid_until;
+	size_t num_hops;
+	u32 route[ROUTING_MAX_HOPS];
+	u64 fee;
+};
+
+/* The channels from route hints we don't know ourselves, and the nodes at
+ * their ends we don't know either, for one search.  Only their own
+ * chan->nodes[] link them to our graph, so nothing else ever sees them. */
+struct hint_graph {
+	struct node **nodes;
+	struct chan **chans;
+};
+
 /* We've unpacked and checked its signatures, now we wait for master to tell
  * us the txout to check */
 struct pending_cannouncement {
@@ -83,6 +206,17 @@ static struct node_map *empty_node_map(const tal_t *ctx)
 	return map;
 }
 
+/* Channels' destructors need the prune buckets (among other things), so
+ * free them before any of those go. */
+static void destroy_routing_state(struct routing_state *rstate)
+{
+	struct chan *chan;
+	u64 idx;
+
+	while ((chan = uintmap_first(&rstate->chanmap, &idx)) != NULL)
+		tal_free(chan);
+}
+
 struct routing_state *new_routing_state(const tal_t *ctx,
 					const struct bitcoin_blkid *chain_hash,
 					const struct pubkey *local_id,
@@ -98,10 +232,21 @@ struct routing_state *new_routing_state(const tal_t *ctx,
 	rstate->local_channel_announced = false;
 	list_head_init(&rstate->pending_cannouncement);
 	uintmap_init(&rstate->chanmap);
+	uintmap_init(&rstate->prune_buckets);
 
 	rstate->pending_node_map = tal(ctx, struct pending_node_map);
 	pending_node_map_init(rstate->pending_node_map);
 
+	rstate->search = tal(rstate, struct route_search);
+	rstate->search->valid = false;
+	rstate->search->changed = tal_arr(rstate->search, struct chan *, 0);
+	rstate->bfg_mark = 0;
+	rstate->route_cache = talz(rstate, struct route_cache);
+	rstate->graph_version = 0;
+	rstate->graph = NULL;
+	rstate->id_cache = NULL;
+	tal_add_destructor(rstate, destroy_routing_state);
+
 	return rstate;
 }
 
@@ -151,6 +296,7 @@ static struct node *new_node(struct routing_state *rstate,
 	n->node_announcement_index = 0;
 	n->last_timestamp = -1;
 	n->addresses = tal_arr(n, struct wireaddr, 0);
+	n->bfg_mark = 0;
 	node_map_add(rstate->nodes, n);
 	tal_add_destructor2(n, destroy_node, rstate);
 
@@ -249,12 +395,104 @@ static void remove_chan_from_node(struct routing_state *rstate,
 	}
 }
 
+static void route_search_forget(struct route_search *search)
+{
+	search->valid = false;
+	tal_resize(&search->changed, 0);
+}
+
+/* Forget every cached route. */
+static void route_cache_forget(struct route_cache *cache)
+{
+	for (size_t i = 0; i < ROUTE_CACHE_SIZE; i++)
+		cache->routes[i].route = tal_free(cache->routes[i].route);
+}
+
+/* Forget any cached route through this channel. */
+static void route_cache_del_chan(struct route_cache *cache,
+				 const struct chan *chan)
+{
+	for (size_t i = 0; i < ROUTE_CACHE_SIZE; i++) {
+		struct cached_route *r = &cache->routes[i];
+
+		for (size_t j = 0; j < tal_count(r->route); j++) {
+			if (r->route[j] == chan) {
+				r->route = tal_free(r->route);
+				break;
+			}
+		}
+	}
+}
+
+void routing_channel_changed(struct routing_state *rstate, struct chan *chan)
+{
+	struct route_search *search = rstate->search;
+	size_t n = tal_count(search->changed);
+
+	rstate->graph_version++;
+	route_cache_del_chan(rstate->route_cache, chan);
+	if (!search->valid)
+		return;
+
+	if (n == ROUTE_SEARCH_MAX_CHANGES) {
+		route_search_forget(search);
+		return;
+	}
+	tal_resize(&search->changed, n + 1);
+	search->changed[n] = chan;
+}
+
+/* Which bucket the newer of its updates puts it in. */
+static u64 prune_bucket_of(const struct chan *chan)
+{
+	s64 newest = chan->half[0].last_timestamp;
+
+	if (chan->half[1].last_timestamp > newest)
+		newest = chan->half[1].last_timestamp;
+	if (newest < 0)
+		return 0;
+	return newest / PRUNE_BUCKET_SECS;
+}
+
+static void prune_bucket_add(struct routing_state *rstate, struct chan *chan)
+{
+	struct prune_bucket *b;
+
+	chan->prune_bucket = prune_bucket_of(chan);
+	b = uintmap_get(&rstate->prune_buckets, chan->prune_bucket);
+	if (!b) {
+		b = tal(rstate, struct prune_bucket);
+		list_head_init(&b->chans);
+		uintmap_add(&rstate->prune_buckets, chan->prune_bucket, b);
+	}
+	list_add_tail(&b->chans, &chan->prune_list);
+}
+
+static void prune_bucket_del(struct routing_state *rstate, struct chan *chan)
+{
+	struct prune_bucket *b = uintmap_get(&rstate->prune_buckets,
+					     chan->prune_bucket);
+
+	list_del_from(&b->chans, &chan->prune_list);
+	if (list_empty(&b->chans)) {
+		uintmap_del(&rstate->prune_buckets, chan->prune_bucket);
+		tal_free(b);
+	}
+}
+
 static void destroy_chan(struct chan *chan, struct routing_state *rstate)
 {
 	remove_chan_from_node(rstate, chan->nodes[0], chan);
 	remove_chan_from_node(rstate, chan->nodes[1], chan);
 
 	uintmap_del(&rstate->chanmap, chan->scid.u64);
+	prune_bucket_del(rstate, chan);
+
+	/* The search may go through it, and could go through others if it
+	 * was a better route. */
+	rstate->graph_version++;
+	route_search_forget(rstate->search);
+	route_cache_del_chan(rstate->route_cache, chan);
 }
 
 static void init_half_chan(struct routing_state *rstate,
@@ -322,6 +560,13 @@ struct chan *new_chan(struct routing_state *rstate,
 	init_half_chan(rstate, chan, !n1idx);
 
 	uintmap_add(&rstate->chanmap, scid->u64, chan);
+	prune_bucket_add(rstate, chan);
+
+	/* New nodes have no bfg[] at all, and a new channel can make a
+	 * cheaper route than any we cached. */
+	rstate->graph_version++;
+	route_search_forget(rstate->search);
+	route_cache_forget(rstate->route_cache);
 
 	tal_add_destructor2(chan, destroy_chan, rstate);
 	return chan;
@@ -363,74 +608,99 @@ static u64 risk_fee(u64 amount, u32 delay, double riskfactor)
 	return 1 + amount * delay * riskfactor;
 }
 
-/* We track totals, rather than costs.  That's because the fee depends
- * on the current amount passing through. */
-static void bfg_one_edge(struct node *node,
-			 struct chan *chan, int idx,
-			 double riskfactor,
-			 double fuzz, const struct siphash_seed *base_seed)
+/* Scale fees for this channel */
+static double fuzz_fee_scale(const struct short_channel_id *scid,
+			     double fuzz, const struct siphash_seed *base_seed)
 {
-	size_t h;
-	double fee_scale = 1.0;
-	const struct half_chan *c = &chan->half[idx];
+	u64 h;
 
-	if (fuzz != 0.0) {
-		u64 h =	siphash24(base_seed, &chan->scid, sizeof(chan->scid));
+	if (fuzz == 0.0)
+		return 1.0;
 
-		/* Scale fees for this channel */
-		/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
-		 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
-		 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
-		 */
-		fee_scale = 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
-	}
+	h = siphash24(base_seed, scid, sizeof(*scid));
 
-	for (h = 0; h < ROUTING_MAX_HOPS; h++) {
-		struct node *src;
-		/* FIXME: Bias against smaller channels. */
-		u64 fee;
-		u64 risk;
-		u64 requiredcap;
+	/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
+	 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
+	 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
+	 */
+	return 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
+}
 
-		if (node->bfg[h].total == INFINITE)
-			continue;
+/* What it takes to get @total (with @risk so far) through @c, or false if
+ * it won't carry that much. */
+static bool hop_cost(const struct half_chan *c, u64 capacity_msat,
+		     u64 total, u64 risk,
+		     double riskfactor, double fee_scale,
+		     u64 *requiredcap, u64 *newrisk)
+{
+	/* FIXME: Bias against smaller channels. */
+	u64 fee;
 
-		fee = connection_fee(c, node->bfg[h].total) * fee_scale;
-		requiredcap = node->bfg[h].total + fee;
-		risk = node->bfg[h].risk +
-		       risk_fee(requiredcap, c->delay, riskfactor);
+	fee = connection_fee(c, total) * fee_scale;
+	*requiredcap = total + fee;
+	*newrisk = risk + risk_fee(*requiredcap, c->delay, riskfactor);
 
-		if (requiredcap > chan->satoshis * 1000) {
-			/* Skip this edge if the channel has insufficient
-			 * capacity to route the required amount */
-			continue;
-		} else if (requiredcap < c->htlc_minimum_msat) {
-			/* Skip a channels if it indicated that it won't route
-			 * the requeuested amount. */
-			continue;
-		} else if (requiredcap >= MAX_MSATOSHI) {
-			SUPERVERBOSE("...extreme %"PRIu64
-				     " + fee %"PRIu64
-				     " + risk %"PRIu64" ignored",
-				     node->bfg[h].total, fee, risk);
-			continue;
-		}
+	if (*requiredcap > capacity_msat) {
+		/* Skip this edge if the channel has insufficient
+		 * capacity to route the required amount */
+		return false;
+	} else if (*requiredcap < c->htlc_minimum_msat) {
+		/* Skip a channels if it indicated that it won't route
+		 * the requeuested amount. */
+		return false;
+	} else if (*requiredcap >= MAX_MSATOSHI) {
+		SUPERVERBOSE("...extreme %"PRIu64
+			     " + fee %"PRIu64
+			     " + risk %"PRIu64" ignored",
+			     total, fee, *newrisk);
+		return false;
+	}
+	return true;
+}
 
-		/* nodes[0] is src for connections[0] */
-		src = chan->nodes[idx];
-		if (requiredcap + risk <
-		    src->bfg[h + 1].total + src->bfg[h + 1].risk) {
-			SUPERVERBOSE("...%s can reach here in hoplen %zu total %"PRIu64,
-				     type_to_string(tmpctx, struct pubkey,
-						    &src->id),
-				     h, node->bfg[h].total + fee);
-			src->bfg[h+1].total = requiredcap;
-			src->bfg[h+1].risk = risk;
-			src->bfg[h+1].prev = chan;
-		}
+/* We track totals, rather than costs.  That's because the fee depends
+ * on the current amount passing through. */
+static void bfg_one_hop(struct node *node,
+			struct chan *chan, int idx, size_t h,
+			double riskfactor, double fee_scale)
+{
+	struct node *src;
+	u64 risk;
+	u64 requiredcap;
+
+	if (node->bfg[h].total == INFINITE)
+		return;
+
+	if (!hop_cost(&chan->half[idx], chan->satoshis * 1000,
+		      node->bfg[h].total, node->bfg[h].risk,
+		      riskfactor, fee_scale, &requiredcap, &risk))
+		return;
+
+	/* nodes[0] is src for connections[0] */
+	src = chan->nodes[idx];
+	if (requiredcap + risk <
+	    src->bfg[h + 1].total + src->bfg[h + 1].risk) {
+		SUPERVERBOSE("...%s can reach here in hoplen %zu total %"PRIu64,
+			     type_to_string(tmpctx, struct pubkey,
+					    &src->id),
+			     h, requiredcap);
+		src->bfg[h+1].total = requiredcap;
+		src->bfg[h+1].risk = risk;
+		src->bfg[h+1].prev = chan;
 	}
 }
 
+static void bfg_one_edge(struct node *node,
+			 struct chan *chan, int idx,
+			 double riskfactor,
+			 double fuzz, const struct siphash_seed *base_seed)
+{
+	double scale = fuzz_fee_scale(&chan->scid, fuzz, base_seed);
+
+	for (size_t h = 0; h < ROUTING_MAX_HOPS; h++)
+		bfg_one_hop(node, chan, idx, h, riskfactor, scale);
+}
+
 /* Determine if the given half_chan is routable */
 static bool hc_is_routable(const struct chan *chan, int idx, time_t now)
 {
@@ -439,54 +709,119 @@ static bool hc_is_routable(const struct chan *chan, int idx, time_t now)
 		&& chan->half[idx].unroutable_until < now;
 }
 
-/* riskfactor is already scaled to per-block amount */
-static struct chan **
-find_route(const tal_t *ctx, struct routing_state *rstate,
-	   const struct pubkey *from, const struct pubkey *to, u64 msatoshi,
-	   double riskfactor,
-	   double fuzz, const struct siphash_seed *base_seed,
-	   u64 *fee)
+/* The search we skipped this for is only good until it's routable again. */
+static void note_unroutable(struct route_search *search,
+			    const struct half_chan *hc, time_t now)
 {
-	struct chan **route;
-	struct node *n, *src, *dst;
-	struct node_map_iter it;
-	int runs, i, best;
-	/* Call time_now() once at the start, so that our tight loop
-	 * does not keep calling into operating system for the
-	 * current time */
-	time_t now = time_now().ts.tv_sec;
+	if (hc->unroutable_until >= now
+	    && (u64)hc->unroutable_until < search->valid_until)
+		search->valid_until = hc->unroutable_until;
+}
 
-	/* Note: we map backwards, since we know the amount of satoshi we want
-	 * at the end, and need to derive how much we need to send. */
-	dst = get_node(rstate, from);
-	src = get_node(rstate, to);
+static void route_key_init(struct route_key *key,
+			   const struct pubkey *to, u64 msatoshi,
+			   double riskfactor,
+			   double fuzz, const struct siphash_seed *base_seed)
+{
+	memset(key, 0, sizeof(*key));
+	key->to = *to;
+	key->msatoshi = msatoshi;
+	key->riskfactor = riskfactor;
+	key->fuzz = fuzz;
+	/* Without fuzz, the seed is unused (and may be NULL). */
+	if (fuzz != 0.0)
+		key->base_seed = *base_seed;
+}
 
-	if (!src) {
-		status_info("find_route: cannot find %s",
-			    type_to_string(tmpctx, struct pubkey, to));
-		return NULL;
-	} else if (!dst) {
-		status_info("find_route: cannot find myself (%s)",
-			    type_to_string(tmpctx, struct pubkey, to));
-		return NULL;
-	} else if (dst == src) {
-		status_info("find_route: this is %s, refusing to create empty route",
-			    type_to_string(tmpctx, struct pubkey, to));
-		return NULL;
+static bool route_key_eq(const struct route_key *a, const struct route_key *b)
+{
+	return pubkey_eq(&a->to, &b->to)
+		&& a->msatoshi == b->msatoshi
+		&& a->riskfactor == b->riskfactor
+		&& a->fuzz == b->fuzz
+		&& memeq(&a->base_seed, sizeof(a->base_seed),
+			 &b->base_seed, sizeof(b->base_seed));
+}
+
+static const struct cached_route *
+route_cache_find(const struct route_cache *cache,
+		 const struct route_key *key, const struct pubkey *from,
+		 time_t now)
+{
+	for (size_t i = 0; i < ROUTE_CACHE_SIZE; i++) {
+		const struct cached_route *r = &cache->routes[i];
+
+		if (!r->route || r->expires < now)
+			continue;
+		if (!pubkey_eq(&r->from, from) || !route_key_eq(&r->key, key))
+			continue;
+		return r;
 	}
+	return NULL;
+}
 
-	if (msatoshi >= MAX_MSATOSHI) {
-		status_info("find_route: can't route huge amount %"PRIu64,
-			    msatoshi);
+static struct chan **route_cache_get(const tal_t *ctx,
+				     const struct route_cache *cache,
+				     const struct route_key *key,
+				     const struct pubkey *from,
+				     time_t now, u64 *fee)
+{
+	const struct cached_route *r = route_cache_find(cache, key, from, now);
+
+	if (!r)
 		return NULL;
-	}
+	*fee = r->fee;
+	return tal_dup_arr(ctx, struct chan *, r->route,
+			   tal_count(r->route), 0);
+}
+
+static void route_cache_add(struct route_cache *cache,
+			    const struct route_key *key,
+			    const struct pubkey *from,
+			    time_t now, struct chan **route, u64 fee)
+{
+	struct cached_route *r = &cache->routes[cache->next];
+
+	tal_free(r->route);
+	r->key = *key;
+	r->from = *from;
+	r->expires = now + ROUTE_CACHE_SECS;
+	r->route = tal_dup_arr(cache, struct chan *, route,
+			       tal_count(route), 0);
+	r->fee = fee;
+	cache->next = (cache->next + 1) % ROUTE_CACHE_SIZE;
+}
+
+/* Is the nodes' bfg[] this search, give or take search->changed? */
+static bool route_search_repairable(const struct route_search *search,
+				    const struct route_key *key, time_t now)
+{
+	return search->valid
+		&& route_key_eq(&search->key, key)
+		&& (u64)now <= search->valid_until;
+}
+
+/* Fill in every node's bfg[] for this search. */
+static void bfg_search(struct routing_state *rstate, struct node *src,
+		       const struct route_key *key, time_t now,
+		       const struct hint_graph *hints)
+{
+	struct route_search *search = rstate->search;
+	struct node *n;
+	struct node_map_iter it;
+	int runs, i;
+
+	search->valid = true;
+	search->key = *key;
+	search->valid_until = UINT64_MAX;
+	tal_resize(&search->changed, 0);
 
 	/* Reset all the information. */
 	clear_bfg(rstate->nodes);
 
 	/* Bellman-Ford-Gibson: like Bellman-Ford, but keep values for
 	 * every path length. */
-	src->bfg[0].total = msatoshi;
+	src->bfg[0].total = key->msatoshi;
 	src->bfg[0].risk = 0;
 
 	for (runs = 0; runs < ROUTING_MAX_HOPS; runs++) {
@@ -510,15 +845,230 @@ find_route(const tal_t *ctx, struct routing_state *rstate,
 						     chan->local_disabled,
 						     is_halfchan_enabled(&chan->half[idx]),
 						     chan->half[idx].unroutable_until >= now);
+					note_unroutable(search,
+							&chan->half[idx], now);
 					continue;
 				}
-				bfg_one_edge(n, chan, idx,
-					     riskfactor, fuzz, base_seed);
+				bfg_one_edge(n, chan, idx, key->riskfactor,
+					     key->fuzz, &key->base_seed);
 				SUPERVERBOSE("...done");
 			}
 		}
+
+		/* The hints' channels aren't in any of our nodes' chans[]. */
+		for (size_t j = 0; hints && j < tal_count(hints->chans); j++) {
+			struct chan *chan = hints->chans[j];
+
+			for (int idx = 0; idx < 2; idx++) {
+				if (chan->half[idx].flags & ROUTING_FLAGS_DISABLED)
+					continue;
+				bfg_one_edge(chan->nodes[!idx], chan, idx,
+					     key->riskfactor,
+					     key->fuzz, &key->base_seed);
+			}
+		}
+	}
+}
+
+/* Recompute n->bfg[h] from its neighbours' bfg[h-1], unless we already did
+ * on this pass.  If it changed, add n to *moved. */
+static void bfg_recompute(struct route_search *search, struct node *n,
+			  size_t h, u64 mark, time_t now,
+			  struct node ***moved)
+{
+	u64 total = n->bfg[h].total, risk = n->bfg[h].risk;
+	size_t num;
+
+	if (n->bfg_mark == mark)
+		return;
+	n->bfg_mark = mark;
+
+	n->bfg[h].total = INFINITE;
+	n->bfg[h].risk = 0;
+	for (size_t i = 0; i < tal_count(n->chans); i++) {
+		struct chan *chan = n->chans[i];
+		struct node *peer = other_node(n, chan);
+		/* The half from n to peer. */
+		int idx = half_chan_to(peer, chan);
+
+		if (!hc_is_routable(chan, idx, now)) {
+			note_unroutable(search, &chan->half[idx], now);
+			continue;
+		}
+		bfg_one_hop(peer, chan, idx, h - 1, search->key.riskfactor,
+			    fuzz_fee_scale(&chan->scid, search->key.fuzz,
+				      &search->key.base_seed));
+	}
+
+	if (n->bfg[h].total == total && n->bfg[h].risk == risk)
+		return;
+
+	num = tal_count(*moved);
+	tal_resize(moved, num + 1);
+	(*moved)[num] = n;
+}
+
+/* The nodes' bfg[] is the search we want, except some channels changed.
+ * Since bfg[h] only depends on bfg[h-1] of the neighbours, we go up a hop
+ * at a time, recomputing only the ends of those channels, and the
+ * neighbours of anything which moved on the hop before. */
+static void bfg_repair(struct routing_state *rstate, time_t now)
+{
+	struct route_search *search = rstate->search;
+	struct node **moved = tal_arr(tmpctx, struct node *, 0);
+
+	for (size_t h = 1; h <= ROUTING_MAX_HOPS; h++) {
+		struct node **prev_moved = moved;
+		u64 mark = ++rstate->bfg_mark;
+
+		moved = tal_arr(tmpctx, struct node *, 0);
+		for (size_t i = 0; i < tal_count(search->changed); i++) {
+			struct chan *chan = search->changed[i];
+
+			bfg_recompute(search, chan->nodes[0], h, mark, now,
+				      &moved);
+			bfg_recompute(search, chan->nodes[1], h, mark, now,
+				      &moved);
+		}
+		for (size_t i = 0; i < tal_count(prev_moved); i++) {
+			struct node *n = prev_moved[i];
+
+			for (size_t j = 0; j < tal_count(n->chans); j++)
+				bfg_recompute(search,
+					      other_node(n, n->chans[j]),
+					      h, mark, now, &moved);
+		}
+		tal_free(prev_moved);
+	}
+	tal_free(moved);
+	tal_resize(&search->changed, 0);
+}
+
+/* Our node, or one only the route hints know about. */
+static struct node *hint_graph_node(struct routing_state *rstate,
+				    const struct hint_graph *hints,
+				    const struct pubkey *id)
+{
+	struct node *n = get_node(rstate, id);
+
+	for (size_t i = 0; !n && hints && i < tal_count(hints->nodes); i++) {
+		if (pubkey_eq(&hints->nodes[i]->id, id))
+			n = hints->nodes[i];
+	}
+	return n;
+}
+
+static struct node *new_hint_node(struct hint_graph *hints,
+				  const struct pubkey *id)
+{
+	struct node *n = talz(hints, struct node);
+	size_t num = tal_count(hints->nodes);
+
+	n->id = *id;
+	n->last_timestamp = -1;
+	n->chans = tal_arr(n, struct chan *, 0);
+	for (size_t i = 0; i < ARRAY_SIZE(n->bfg); i++)
+		n->bfg[i].total = INFINITE;
+
+	tal_resize(&hints->nodes, num + 1);
+	hints->nodes[num] = n;
+	return n;
+}
+
+static struct hint_graph *new_hint_graph(const tal_t *ctx,
+					 struct routing_state *rstate,
+					 const struct route_hint *hints)
+{
+	struct hint_graph *hg = tal(ctx, struct hint_graph);
+
+	hg->nodes = tal_arr(hg, struct node *, 0);
+	hg->chans = tal_arr(hg, struct chan *, 0);
+
+	for (size_t i = 0; i < tal_count(hints); i++) {
+		const struct route_hint *h = &hints[i];
+		struct node *src, *dst;
+		struct chan *chan;
+		int idx = pubkey_idx(&h->source, &h->destination);
+		size_t num;
+
+		/* If it were public, or ours, we'd know better. */
+		if (get_channel(rstate, &h->scid)
+		    || pubkey_eq(&h->source, &rstate->local_id))
+			continue;
+		if (pubkey_eq(&h->source, &h->destination)
+		    || h->fee_proportional_millionths >= MAX_PROPORTIONAL_FEE)
+			continue;
+
+		src = hint_graph_node(rstate, hg, &h->source);
+		if (!src)
+			src = new_hint_node(hg, &h->source);
+		dst = hint_graph_node(rstate, hg, &h->destination);
+		if (!dst)
+			dst = new_hint_node(hg, &h->destination);
+
+		chan = talz(hg, struct chan);
+		chan->scid = h->scid;
+		chan->nodes[idx] = src;
+		chan->nodes[!idx] = dst;
+		/* We don't know its capacity: hope it's enough. */
+		chan->satoshis = MAX_MSATOSHI / 1000;
+		chan->half[idx].base_fee = h->fee_base_msat;
+		chan->half[idx].proportional_fee = h->fee_proportional_millionths;
+		chan->half[idx].delay = h->cltv_expiry_delta;
+		chan->half[idx].flags = idx;
+		chan->half[idx].last_timestamp = -1;
+		/* The hint only tells us about one direction. */
+		chan->half[!idx].flags = (!idx) | ROUTING_FLAGS_DISABLED;
+		chan->half[!idx].last_timestamp = -1;
+
+		num = tal_count(hg->chans);
+		tal_resize(&hg->chans, num + 1);
+		hg->chans[num] = chan;
+	}
+	return hg;
+}
+
+/* Look up the ends of a route from @from to @to, if we can search it at
+ * all.  We map backwards, so *src is @to and *dst is @from. */
+static bool route_ends(struct routing_state *rstate,
+		       const struct hint_graph *hints,
+		       const struct pubkey *from, const struct pubkey *to,
+		       u64 msatoshi, struct node **src, struct node **dst)
+{
+	*dst = get_node(rstate, from);
+	*src = hint_graph_node(rstate, hints, to);
+
+	if (!*src) {
+		status_info("find_route: cannot find %s",
+			    type_to_string(tmpctx, struct pubkey, to));
+		return false;
+	} else if (!*dst) {
+		status_info("find_route: cannot find myself (%s)",
+			    type_to_string(tmpctx, struct pubkey, to));
+		return false;
+	} else if (*dst == *src) {
+		status_info("find_route: this is %s, refusing to create empty route",
+			    type_to_string(tmpctx, struct pubkey, to));
+		return false;
 	}
 
+	if (msatoshi >= MAX_MSATOSHI) {
+		status_info("find_route: can't route huge amount %"PRIu64,
+			    msatoshi);
+		return false;
+	}
+	return true;
+}
+
+/* Pick the best route the nodes' bfg[] holds from dst back to src. */
+static struct chan **bfg_route(const tal_t *ctx,
+			       struct node *src, struct node *dst,
+			       u64 msatoshi, u64 *fee)
+{
+	struct chan **route;
+	struct node *n;
+	int i, best;
+
 	best = 0;
 	for (i = 1; i <= ROUTING_MAX_HOPS; i++) {
 		if (dst->bfg[i].total < dst->bfg[best].total)
@@ -528,7 +1078,7 @@ find_route(const tal_t *ctx, struct routing_state *rstate,
 	/* No route? */
 	if (dst->bfg[best].total >= INFINITE) {
 		status_trace("find_route: No route to %s",
-			     type_to_string(tmpctx, struct pubkey, to));
+			     type_to_string(tmpctx, struct pubkey, &src->id));
 		return NULL;
 	}
 
@@ -544,10 +1094,209 @@ find_route(const tal_t *ctx, struct routing_state *rstate,
 		route[i] = n->bfg[best-i].prev;
 	}
 	assert(n == src);
+	return route;
+}
 
+/* riskfactor is already scaled to per-block amount */
+static struct chan **
+find_route(const tal_t *ctx, struct routing_state *rstate,
+	   const struct pubkey *from, const struct pubkey *to, u64 msatoshi,
+	   double riskfactor,
+	   double fuzz, const struct siphash_seed *base_seed,
+	   const struct hint_graph *hints,
+	   u64 *fee)
+{
+	struct chan **route;
+	struct node *src, *dst;
+	struct route_key key;
+	/* Call time_now() once at the start, so that our tight loop
+	 * does not keep calling into operating system for the
+	 * current time */
+	time_t now = time_now().ts.tv_sec;
+
+	/* Note: we map backwards, since we know the amount of satoshi we want
+	 * at the end, and need to derive how much we need to send. */
+	if (!route_ends(rstate, hints, from, to, msatoshi, &src, &dst))
+		return NULL;
+
+	route_key_init(&key, to, msatoshi, riskfactor, fuzz, base_seed);
+
+	/* The hints make it a different graph from the one the search and the
+	 * cache are for. */
+	if (hints) {
+		bfg_search(rstate, src, &key, now, hints);
+		route = bfg_route(ctx, src, dst, msatoshi, fee);
+		/* Its bfg[] points into the hints, which won't be around. */
+		route_search_forget(rstate->search);
+		return route;
+	}
+
+	route = route_cache_get(ctx, rstate->route_cache, &key, from, now, fee);
+	if (route)
+		return route;
+
+	/* Asked the same thing again (say, pay retrying after a failure)?
+	 * We only need to fix up what changed since. */
+	if (!route_search_repairable(rstate->search, &key, now))
+		bfg_search(rstate, src, &key, now, NULL);
+	else if (tal_count(rstate->search->changed))
+		bfg_repair(rstate, now);
+
+	route = bfg_route(ctx, src, dst, msatoshi, fee);
+	if (route)
+		route_cache_add(rstate->route_cache, &key, from, now,
+				route, *fee);
 	return route;
 }
 
+/* Set every node's hops_from_source: how few hops from @from it can be
+ * reached (ROUTING_MAX_HOPS+1 if it's too far to be on any route). */
+static void bfg_hops_from(struct routing_state *rstate, struct node *from,
+			  time_t now)
+{
+	struct node *n;
+	struct node_map_iter it;
+	struct node **queue = tal_arr(tmpctx, struct node *, 1);
+
+	for (n = node_map_first(rstate->nodes, &it);
+	     n;
+	     n = node_map_next(rstate->nodes, &it))
+		n->hops_from_source = ROUTING_MAX_HOPS + 1;
+
+	from->hops_from_source = 0;
+	queue[0] = from;
+	for (size_t i = 0; i < tal_count(queue); i++) {
+		n = queue[i];
+		if (n->hops_from_source == ROUTING_MAX_HOPS)
+			continue;
+		for (size_t j = 0; j < tal_count(n->chans); j++) {
+			struct chan *chan = n->chans[j];
+			struct node *peer = other_node(n, chan);
+			/* The half from n to peer. */
+			int idx = half_chan_to(peer, chan);
+			size_t num;
+
+			if (peer->hops_from_source <= n->hops_from_source + 1)
+				continue;
+			if (!hc_is_routable(chan, idx, now))
+				continue;
+			peer->hops_from_source = n->hops_from_source + 1;
+			num = tal_count(queue);
+			tal_resize(&queue, num + 1);
+			queue[num] = peer;
+		}
+	}
+	tal_free(queue);
+}
+
+/* Like bfg_search(), but a hop at a time from src, only expanding nodes
+ * reached on the hop before, and never going where we're too far from the
+ * source to get back in time.  That needs bfg_hops_from() to have been run,
+ * and every bfg[] to start out cleared; we return the nodes we touched so
+ * the caller can clear them again. */
+static struct node **bfg_search_near(const tal_t *ctx,
+				     struct routing_state *rstate,
+				     struct node *src,
+				     const struct route_key *key, time_t now)
+{
+	/* Grown by doubling: it gets big. */
+	struct node **touched = tal_arr(ctx, struct node *, 64);
+	size_t start = 0, end = 1, num = 1;
+
+	src->bfg[0].total = key->msatoshi;
+	src->bfg[0].risk = 0;
+	touched[0] = src;
+
+	for (size_t h = 0; h < ROUTING_MAX_HOPS; h++) {
+		u64 mark = ++rstate->bfg_mark;
+
+		for (size_t i = start; i < end; i++) {
+			struct node *n = touched[i];
+
+			for (size_t j = 0; j < tal_count(n->chans); j++) {
+				struct chan *chan = n->chans[j];
+				int idx = half_chan_to(n, chan);
+				struct node *peer = chan->nodes[idx];
+
+				if (peer->hops_from_source + h + 1
+				    > ROUTING_MAX_HOPS)
+					continue;
+				if (!hc_is_routable(chan, idx, now))
+					continue;
+				bfg_one_hop(n, chan, idx, h, key->riskfactor,
+					    fuzz_fee_scale(&chan->scid, key->fuzz,
+							   &key->base_seed));
+				if (peer->bfg[h+1].total == INFINITE
+				    || peer->bfg_mark == mark)
+					continue;
+				peer->bfg_mark = mark;
+				if (num == tal_count(touched))
+					tal_resize(&touched, num * 2);
+				touched[num++] = peer;
+			}
+		}
+		start = end;
+		end = num;
+	}
+	tal_resize(&touched, num);
+	return touched;
+}
+
+/* find_route() for each of @queries; NULL where there's no route. */
+static struct chan ***
+find_routes(const tal_t *ctx, struct routing_state *rstate,
+	    const struct pubkey *from, const struct route_query *queries,
+	    double riskfactor,
+	    double fuzz, const struct siphash_seed *base_seed,
+	    u64 *fees)
+{
+	struct chan ***routes;
+	struct node *src, *dst;
+	time_t now = time_now().ts.tv_sec;
+	bool searched = false;
+
+	routes = tal_arrz(ctx, struct chan **, tal_count(queries));
+	for (size_t i = 0; i < tal_count(queries); i++) {
+		const struct route_query *q = &queries[i];
+		struct route_key key;
+		struct node **touched;
+
+		if (!route_ends(rstate, NULL, from, &q->destination,
+				q->msatoshi, &src, &dst))
+			continue;
+
+		route_key_init(&key, &q->destination, q->msatoshi, riskfactor,
+			       fuzz, base_seed);
+		routes[i] = route_cache_get(routes, rstate->route_cache, &key,
+					    from, now, &fees[i]);
+		if (routes[i])
+			continue;
+
+		/* What the nodes' bfg[] holds is no longer any search's. */
+		if (!searched) {
+			route_search_forget(rstate->search);
+			clear_bfg(rstate->nodes);
+			bfg_hops_from(rstate, dst, now);
+			searched = true;
+		}
+
+		touched = bfg_search_near(tmpctx, rstate, src, &key, now);
+		routes[i] = bfg_route(routes, src, dst, q->msatoshi, &fees[i]);
+		if (routes[i])
+			route_cache_add(rstate->route_cache, &key, from, now,
+					routes[i], fees[i]);
+
+		for (size_t j = 0; j < tal_count(touched); j++) {
+			for (size_t h = 0; h <= ROUTING_MAX_HOPS; h++) {
+				touched[j]->bfg[h].total = INFINITE;
+				touched[j]->bfg[h].risk = 0;
+			}
+		}
+		tal_free(touched);
+	}
+	return routes;
+}
+
 /* Verify the signature of a channel_update message */
 static u8 *check_channel_update(const tal_t *ctx,
 				const struct pubkey *node_key,
@@ -719,24 +1468,124 @@ static void add_channel_announce_to_broadcast(struct routing_state *rstate,
 	}
 }
 
+/* A node id, keyed by its DER encoding. */
+struct cached_node_id {
+	u8 der[PUBKEY_DER_LEN];
+	struct pubkey id;
+};
+
+static const u8 *cached_node_id_keyof(const struct cached_node_id *c)
+{
+	return c->der;
+}
+
+static size_t der_hash(const u8 *der)
+{
+	return siphash24(siphash_seed(), der, PUBKEY_DER_LEN);
+}
+
+static bool cached_node_id_eq(const struct cached_node_id *c, const u8 *der)
+{
+	return memcmp(c->der, der, PUBKEY_DER_LEN) == 0;
+}
+HTABLE_DEFINE_TYPE(struct cached_node_id, cached_node_id_keyof, der_hash,
+		   cached_node_id_eq, cached_node_id_map);
+
+struct node_id_cache {
+	struct cached_node_id_map map;
+};
+
+static void destroy_node_id_cache(struct node_id_cache *cache)
+{
+	cached_node_id_map_clear(&cache->map);
+}
+
+void routing_cache_node_ids(struct routing_state *rstate, bool enable)
+{
+	rstate->id_cache = tal_free(rstate->id_cache);
+	if (enable) {
+		rstate->id_cache = tal(rstate, struct node_id_cache);
+		cached_node_id_map_init(&rstate->id_cache->map);
+		tal_add_destructor(rstate->id_cache, destroy_node_id_cache);
+	}
+}
+
+/* Like fromwire_pubkey(), but only decompresses ids the cache hasn't seen. */
+static void fromwire_node_id(struct node_id_cache *cache,
+			     const u8 **cursor, size_t *max,
+			     struct pubkey *id)
+{
+	struct cached_node_id *c;
+	const u8 *der = *cursor;
+
+	if (!cache || *max < PUBKEY_DER_LEN) {
+		fromwire_pubkey(cursor, max, id);
+		return;
+	}
+
+	c = cached_node_id_map_get(&cache->map, der);
+	if (c) {
+		*id = c->id;
+		fromwire_pad(cursor, max, PUBKEY_DER_LEN);
+		return;
+	}
+
+	fromwire_pubkey(cursor, max, id);
+	if (!*cursor)
+		return;
+	c = tal(cache, struct cached_node_id);
+	memcpy(c->der, der, PUBKEY_DER_LEN);
+	c->id = *id;
+	cached_node_id_map_add(&cache->map, c);
+}
+
+static bool parse_channel_announcement_ids(struct node_id_cache *cache,
+					   const u8 *msg,
+					   struct short_channel_id *scid,
+					   struct pubkey *node_id_1,
+					   struct pubkey *node_id_2)
+{
+	const u8 *cursor = msg;
+	size_t max = tal_count(msg);
+
+	if (fromwire_u16(&cursor, &max) != WIRE_CHANNEL_ANNOUNCEMENT)
+		return false;
+	/* node_signature_1, node_signature_2, bitcoin_signature_1,
+	 * bitcoin_signature_2 */
+	fromwire_pad(&cursor, &max, 4 * 64);
+	/* features */
+	fromwire_pad(&cursor, &max, fromwire_u16(&cursor, &max));
+	/* chain_hash */
+	fromwire_pad(&cursor, &max, sizeof(struct bitcoin_blkid));
+	fromwire_short_channel_id(&cursor, &max, scid);
+	fromwire_node_id(cache, &cursor, &max, node_id_1);
+	fromwire_node_id(cache, &cursor, &max, node_id_2);
+	/* bitcoin_key_1, bitcoin_key_2 */
+	fromwire_pad(&cursor, &max, 2 * PUBKEY_DER_LEN);
+	return cursor != NULL;
+}
+
+bool channel_announcement_ids(const u8 *msg,
+			      struct short_channel_id *scid,
+			      struct pubkey *node_id_1,
+			      struct pubkey *node_id_2)
+{
+	return parse_channel_announcement_ids(NULL, msg, scid,
+					      node_id_1, node_id_2);
+}
+
 bool routing_add_channel_announcement(struct routing_state *rstate,
 				      const u8 *msg TAKES, u64 satoshis)
 {
 	struct chan *chan;
-	secp256k1_ecdsa_signature node_signature_1, node_signature_2;
-	secp256k1_ecdsa_signature bitcoin_signature_1, bitcoin_signature_2;
-	u8 *features;
-	struct bitcoin_blkid chain_hash;
 	struct short_channel_id scid;
 	struct pubkey node_id_1;
 	struct pubkey node_id_2;
-	struct pubkey bitcoin_key_1;
-	struct pubkey bitcoin_key_2;
 
-	if (!fromwire_channel_announcement(
-		    tmpctx, msg, &node_signature_1, &node_signature_2,
-		    &bitcoin_signature_1, &bitcoin_signature_2, &features, &chain_hash,
-		    &scid, &node_id_1, &node_id_2, &bitcoin_key_1, &bitcoin_key_2))
+	/* We only need the ids here: signatures were checked before this
+	 * was added (or stored), so don't pay for parsing them again. */
+	if (!parse_channel_announcement_ids(rstate->id_cache, msg, &scid,
+					    &node_id_1, &node_id_2))
 		return false;
 
 	/* The channel may already exist if it was non-public from
@@ -1068,6 +1917,12 @@ bool routing_add_channel_update(struct routing_state *rstate,
 	set_connection_values(chan, direction, fee_base_msat,
 			      fee_proportional_millionths, expiry,
 			      flags, timestamp, htlc_minimum_msat);
+	routing_channel_changed(rstate, chan);
+
+	if (prune_bucket_of(chan) != chan->prune_bucket) {
+		prune_bucket_del(rstate, chan);
+		prune_bucket_add(rstate, chan);
+	}
 
 	/* Replace any old one. */
 	tal_free(chan->half[direction].channel_update);
@@ -1276,12 +2131,43 @@ static struct wireaddr *read_addresses(const tal_t *ctx, const u8 *ser)
 	return wireaddrs;
 }
 
+/* fromwire_node_announcement(), without the signature: we only replay
+ * announcements we've checked, and while loading the store the node_id
+ * is one we decompressed for its channel_announcement. */
+static bool parse_node_announcement(const tal_t *ctx,
+				    struct node_id_cache *cache,
+				    const u8 *msg,
+				    u8 **features, u32 *timestamp,
+				    struct pubkey *node_id,
+				    u8 rgb_color[3], u8 alias[32],
+				    u8 **addresses)
+{
+	const u8 *cursor = msg;
+	size_t max = tal_count(msg);
+	u16 len;
+
+	if (fromwire_u16(&cursor, &max) != WIRE_NODE_ANNOUNCEMENT)
+		return false;
+	/* signature */
+	fromwire_pad(&cursor, &max, 64);
+	len = fromwire_u16(&cursor, &max);
+	*features = len ? tal_arr(ctx, u8, len) : NULL;
+	fromwire_u8_array(&cursor, &max, *features, len);
+	*timestamp = fromwire_u32(&cursor, &max);
+	fromwire_node_id(cache, &cursor, &max, node_id);
+	fromwire_u8_array(&cursor, &max, rgb_color, 3);
+	fromwire_u8_array(&cursor, &max, alias, 32);
+	len = fromwire_u16(&cursor, &max);
+	*addresses = len ? tal_arr(ctx, u8, len) : NULL;
+	fromwire_u8_array(&cursor, &max, *addresses, len);
+	return cursor != NULL;
+}
+
 bool routing_add_node_announcement(struct routing_state *rstate,
 				   const u8 *msg TAKES,
 				   bool *unknown_node)
 {
 	struct node *node;
-	secp256k1_ecdsa_signature signature;
 	u32 timestamp;
 	struct pubkey node_id;
 	u8 rgb_color[3];
@@ -1289,10 +2175,9 @@ bool routing_add_node_announcement(struct routing_state *rstate,
 	u8 *features, *addresses;
 	struct wireaddr *wireaddrs;
 
-	if (!fromwire_node_announcement(tmpctx, msg,
-					&signature, &features, &timestamp,
-					&node_id, rgb_color, alias,
-					&addresses)) {
+	if (!parse_node_announcement(tmpctx, rstate->id_cache, msg,
+				     &features, &timestamp, &node_id,
+				     rgb_color, alias, &addresses)) {
 		if (unknown_node)
 			*unknown_node = false;
 		return false;
@@ -1464,36 +2349,27 @@ u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node_ann)
 	return NULL;
 }
 
-struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
-			    const struct pubkey *source,
-			    const struct pubkey *destination,
-			    const u64 msatoshi, double riskfactor,
-			    u32 final_cltv,
-			    double fuzz, const struct siphash_seed *base_seed)
+/* Fees, delays need to be calculated backwards along route. */
+static struct route_hop *route_hops(const tal_t *ctx,
+				    struct chan **route,
+				    const struct pubkey *source,
+				    const struct pubkey *destination,
+				    u64 msatoshi, u32 final_cltv)
 {
-	struct chan **route;
 	u64 total_amount;
 	unsigned int total_delay;
-	u64 fee;
 	struct route_hop *hops;
 	int i;
 	struct node *n;
 
-	route = find_route(ctx, rstate, source, destination, msatoshi,
-			   riskfactor / BLOCKS_PER_YEAR / 10000,
-			   fuzz, base_seed, &fee);
-
-	if (!route) {
-		return NULL;
-	}
-
-	/* Fees, delays need to be calculated backwards along route. */
 	hops = tal_arr(ctx, struct route_hop, tal_count(route));
 	total_amount = msatoshi;
 	total_delay = final_cltv;
 
-	/* Start at destination node. */
-	n = get_node(rstate, destination);
+	/* Start at destination node (which only a route hint may know). */
+	n = route[tal_count(route) - 1]->nodes[0];
+	if (!pubkey_eq(&n->id, destination))
+		n = route[tal_count(route) - 1]->nodes[1];
 	for (i = tal_count(route) - 1; i >= 0; i--) {
 		const struct half_chan *c;
 		int idx = half_chan_to(n, route[i]);
@@ -1512,12 +2388,359 @@ struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 	return hops;
 }
 
+struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
+			    const struct pubkey *source,
+			    const struct pubkey *destination,
+			    const u64 msatoshi, double riskfactor,
+			    u32 final_cltv,
+			    double fuzz, const struct siphash_seed *base_seed,
+			    const struct route_hint *hints)
+{
+	struct chan **route;
+	struct hint_graph *hg = NULL;
+	struct route_hop *hops;
+	u64 fee;
+
+	if (tal_count(hints)) {
+		hg = new_hint_graph(tmpctx, rstate, hints);
+		if (tal_count(hg->chans) == 0)
+			hg = tal_free(hg);
+	}
+
+	route = find_route(ctx, rstate, source, destination, msatoshi,
+			   riskfactor / BLOCKS_PER_YEAR / 10000,
+			   fuzz, base_seed, hg, &fee);
+
+	if (!route) {
+		tal_free(hg);
+		return NULL;
+	}
+
+	hops = route_hops(ctx, route, source, destination,
+			  msatoshi, final_cltv);
+	tal_free(hg);
+	return hops;
+}
+
+struct route_hop **get_routes(const tal_t *ctx, struct routing_state *rstate,
+			      const struct pubkey *source,
+			      const struct route_query *queries,
+			      double riskfactor,
+			      double fuzz, const struct siphash_seed *base_seed)
+{
+	struct chan ***routes;
+	struct route_hop **hops;
+	u64 *fees = tal_arr(tmpctx, u64, tal_count(queries));
+
+	routes = find_routes(tmpctx, rstate, source, queries,
+			     riskfactor / BLOCKS_PER_YEAR / 10000,
+			     fuzz, base_seed, fees);
+
+	hops = tal_arrz(ctx, struct route_hop *, tal_count(queries));
+	for (size_t i = 0; i < tal_count(queries); i++) {
+		if (!routes[i])
+			continue;
+		hops[i] = route_hops(hops, routes[i], source,
+				     &queries[i].destination,
+				     queries[i].msatoshi,
+				     queries[i].final_cltv);
+	}
+	tal_free(routes);
+	tal_free(fees);
+	return hops;
+}
+
+/* An edge index which isn't one. */
+#define NO_EDGE UINT32_MAX
+
+static void route_graph_unref(struct route_graph *graph)
+{
+	if (--graph->refcount == 0)
+		tal_free(graph);
+}
+
+/* A copy of the graph as it is now (shared, if it hasn't changed since
+ * the last one). */
+static struct route_graph *route_graph_get(struct routing_state *rstate)
+{
+	struct route_graph *g = rstate->graph;
+	struct node *n;
+	struct node_map_iter it;
+	size_t num_nodes = 0, num_edges = 0;
+
+	if (g && g->version == rstate->graph_version)
+		return g;
+	if (g)
+		route_graph_unref(g);
+
+	for (n = node_map_first(rstate->nodes, &it);
+	     n;
+	     n = node_map_next(rstate->nodes, &it)) {
+		n->graph_index = num_nodes++;
+		num_edges += tal_count(n->chans);
+	}
+
+	g = rstate->graph = tal(rstate, struct route_graph);
+	g->version = rstate->graph_version;
+	g->refcount = 1;
+	g->num_nodes = num_nodes;
+	g->nodes = tal_arr(g, struct route_graph_node, num_nodes);
+	g->edges = tal_arr(g, struct route_graph_edge, num_edges);
+
+	num_edges = 0;
+	for (n = node_map_first(rstate->nodes, &it);
+	     n;
+	     n = node_map_next(rstate->nodes, &it)) {
+		struct route_graph_node *gn = &g->nodes[n->graph_index];
+
+		gn->id = n->id;
+		gn->node = n;
+		gn->first_edge = num_edges;
+		for (size_t i = 0; i < tal_count(n->chans); i++) {
+			struct chan *chan = n->chans[i];
+			int idx = half_chan_to(n, chan);
+			struct route_graph_edge *e;
+
+			/* Changing either of these bumps graph_version;
+			 * unroutable_until can expire without doing so. */
+			if (chan->local_disabled
+			    || !is_halfchan_enabled(&chan->half[idx]))
+				continue;
+
+			e = &g->edges[num_edges++];
+			e->hc = chan->half[idx];
+			/* That's not ours to keep. */
+			e->hc.channel_update = NULL;
+			e->capacity_msat = chan->satoshis * 1000;
+			e->scid = chan->scid;
+			e->from = chan->nodes[idx]->graph_index;
+			e->to = n->graph_index;
+			e->chan = chan;
+		}
+		gn->num_edges = num_edges - gn->first_edge;
+	}
+	tal_resize(&g->edges, num_edges);
+	return g;
+}
+
+static void destroy_route_job(struct route_job *job)
+{
+	route_graph_unref(job->graph);
+}
+
+/* The job's bfg[] for this node. */
+static struct route_job_bfg *job_bfg(const struct route_job *job, u32 node)
+{
+	return job->bfg + (size_t)node * (ROUTING_MAX_HOPS + 1);
+}
+
+struct route_job *route_job_new(const tal_t *ctx, struct routing_state *rstate,
+				const struct pubkey *source,
+				const struct pubkey *destination,
+				const u64 msatoshi, double riskfactor,
+				u32 final_cltv,
+				double fuzz,
+				const struct siphash_seed *base_seed,
+				struct route_hop **hops)
+{
+	struct route_job *job;
+	struct node *src, *dst;
+	struct route_key key;
+	time_t now = time_now().ts.tv_sec;
+
+	*hops = NULL;
+	if (!route_ends(rstate, NULL, source, destination, msatoshi,
+			&src, &dst))
+		return NULL;
+
+	/* Scaled the same as get_route() does. */
+	route_key_init(&key, destination, msatoshi,
+		       riskfactor / BLOCKS_PER_YEAR / 10000, fuzz, base_seed);
+
+	/* No need for a thread if find_route won't search. */
+	if (route_cache_find(rstate->route_cache, &key, source, now)
+	    || route_search_repairable(rstate->search, &key, now)) {
+		*hops = get_route(ctx, rstate, source, destination, msatoshi,
+				  riskfactor, final_cltv, fuzz, base_seed,
+				  NULL);
+		return NULL;
+	}
+
+	job = tal(ctx, struct route_job);
+	job->graph = route_graph_get(rstate);
+	job->graph->refcount++;
+	tal_add_destructor(job, destroy_route_job);
+	job->key = key;
+	/* The graph is current, so their graph_index is right. */
+	job->src = src->graph_index;
+	job->dst = dst->graph_index;
+	job->now = now;
+	job->final_cltv = final_cltv;
+	job->bfg = tal_arr(job, struct route_job_bfg,
+			   job->graph->num_nodes * (ROUTING_MAX_HOPS + 1));
+	return job;
+}
+
+void route_job_run(struct route_job *job)
+{
+	const struct route_graph *g = job->graph;
+	const struct route_key *key = &job->key;
+	struct route_job_bfg *b;
+	size_t best;
+	u32 n;
+
+	for (size_t i = 0; i < g->num_nodes * (ROUTING_MAX_HOPS + 1); i++) {
+		job->bfg[i].total = INFINITE;
+		job->bfg[i].risk = 0;
+		job->bfg[i].prev = NO_EDGE;
+	}
+	job->valid_until = UINT64_MAX;
+	job->num_hops = 0;
+	job_bfg(job, job->src)[0].total = key->msatoshi;
+
+	/* Same as bfg_search(), but since bfg[h+1] only depends on bfg[h],
+	 * one pass for each hop is enough. */
+	for (size_t h = 0; h < ROUTING_MAX_HOPS; h++) {
+		for (n = 0; n < g->num_nodes; n++) {
+			const struct route_graph_node *gn = &g->nodes[n];
+			const struct route_job_bfg *here = &job_bfg(job, n)[h];
+
+			if (here->total == INFINITE)
+				continue;
+
+			for (u32 i = gn->first_edge;
+			     i < gn->first_edge + gn->num_edges;
+			     i++) {
+				const struct route_graph_edge *e = &g->edges[i];
+				struct route_job_bfg *there
+					= &job_bfg(job, e->from)[h + 1];
+				u64 requiredcap, risk;
+
+				if (e->hc.unroutable_until >= job->now) {
+					if ((u64)e->hc.unroutable_until
+					    < job->valid_until)
+						job->valid_until
+							= e->hc.unroutable_until;
+					continue;
+				}
+				if (!hop_cost(&e->hc, e->capacity_msat,
+					      here->total, here->risk,
+					      key->riskfactor,
+					      fuzz_fee_scale(&e->scid, key->fuzz,
+							     &key->base_seed),
+					      &requiredcap, &risk))
+					continue;
+				if (requiredcap + risk
+				    < there->total + there->risk) {
+					there->total = requiredcap;
+					there->risk = risk;
+					there->prev = i;
+				}
+			}
+		}
+	}
+
+	b = job_bfg(job, job->dst);
+	best = 0;
+	for (size_t h = 1; h <= ROUTING_MAX_HOPS; h++) {
+		if (b[h].total < b[best].total)
+			best = h;
+	}
+	if (b[best].total >= INFINITE)
+		return;
+
+	n = job->dst;
+	for (size_t i = 0; i < best; i++) {
+		job->route[i] = job_bfg(job, n)[best - i].prev;
+		n = g->edges[job->route[i]].to;
+	}
+	assert(n == job->src);
+
+	/* We (dst) don't charge ourselves fees, so skip first hop */
+	job->fee = job_bfg(job, g->edges[job->route[0]].to)[best - 1].total
+		- key->msatoshi;
+	job->num_hops = best;
+}
+
+/* Nothing changed since the job copied the graph, so its search is ours
+ * too: keep it for find_route to repair, and its route for the cache. */
+static void route_job_adopt(struct routing_state *rstate,
+			    const struct route_job *job)
+{
+	const struct route_graph *g = job->graph;
+	struct route_search *search = rstate->search;
+	struct chan **route;
+
+	for (u32 i = 0; i < g->num_nodes; i++) {
+		struct node *n = g->nodes[i].node;
+		const struct route_job_bfg *b = job_bfg(job, i);
+
+		for (size_t h = 0; h <= ROUTING_MAX_HOPS; h++) {
+			n->bfg[h].total = b[h].total;
+			n->bfg[h].risk = b[h].risk;
+			if (b[h].prev == NO_EDGE)
+				n->bfg[h].prev = NULL;
+			else
+				n->bfg[h].prev = g->edges[b[h].prev].chan;
+		}
+	}
+	search->valid = true;
+	search->key = job->key;
+	search->valid_until = job->valid_until;
+	tal_resize(&search->changed, 0);
+
+	if (!job->num_hops)
+		return;
+
+	route = tal_arr(tmpctx, struct chan *, job->num_hops);
+	for (size_t i = 0; i < job->num_hops; i++)
+		route[i] = g->edges[job->route[i]].chan;
+	route_cache_add(rstate->route_cache, &job->key,
+			&g->nodes[job->dst].id, job->now, route, job->fee);
+	tal_free(route);
+}
+
+struct route_hop *route_job_finish(const tal_t *ctx,
+				   struct routing_state *rstate,
+				   const struct route_job *job)
+{
+	const struct route_graph *g = job->graph;
+	struct route_hop *hops;
+	u64 total_amount = job->key.msatoshi;
+	u32 total_delay = job->final_cltv;
+
+	if (g->version == rstate->graph_version)
+		route_job_adopt(rstate, job);
+
+	if (!job->num_hops) {
+		status_trace("find_route: No route to %s",
+			     type_to_string(tmpctx, struct pubkey,
+					    &job->key.to));
+		return NULL;
+	}
+
+	/* Like route_hops(), but the channels may be gone by now. */
+	hops = tal_arr(ctx, struct route_hop, job->num_hops);
+	for (int i = job->num_hops - 1; i >= 0; i--) {
+		const struct route_graph_edge *e = &g->edges[job->route[i]];
+
+		hops[i].channel_id = e->scid;
+		hops[i].nodeid = g->nodes[e->to].id;
+		hops[i].amount = total_amount;
+		hops[i].delay = total_delay;
+		total_amount += connection_fee(&e->hc, total_amount);
+		total_delay += e->hc.delay;
+	}
+	return hops;
+}
+
 /**
  * routing_failure_channel_out - Handle routing failure on a specific channel
  *
  * If we want to delete the channel, we reparent it to disposal_context.
  */
-static void routing_failure_channel_out(const tal_t *disposal_context,
+static void routing_failure_channel_out(struct routing_state *rstate,
+					const tal_t *disposal_context,
 					struct node *node,
 					enum onion_type failcode,
 					struct chan *chan,
@@ -1530,10 +2753,11 @@ static void routing_failure_channel_out(const tal_t *disposal_context,
 	 * - if the PERM bit is NOT set:
 	 *   - SHOULD restore the channels as it receives new `channel_update`s.
 	 */
-	if (!(failcode & PERM))
+	if (!(failcode & PERM)) {
 		/* Prevent it for 20 seconds. */
 		hc->unroutable_until = now + 20;
-	else
+		routing_channel_changed(rstate, chan);
+	} else
 		/* Set it up to be pruned. */
 		tal_steal(disposal_context, chan);
 }
@@ -1573,7 +2797,8 @@ void routing_failure(struct routing_state *rstate,
 	 */
 	if (failcode & NODE) {
 		for (int i = 0; i < tal_count(node->chans); ++i) {
-			routing_failure_channel_out(tmpctx, node, failcode,
+			routing_failure_channel_out(rstate, tmpctx,
+						    node, failcode,
 						    node->chans[i],
 						    now);
 		}
@@ -1595,7 +2820,7 @@ void routing_failure(struct routing_state *rstate,
 				       type_to_string(tmpctx, struct pubkey,
 						      erring_node_pubkey));
 		else
-			routing_failure_channel_out(tmpctx,
+			routing_failure_channel_out(rstate, tmpctx,
 						    node, failcode, chan, now);
 	}
 
@@ -1652,6 +2877,7 @@ void mark_channel_unroutable(struct routing_state *rstate,
 	}
 	chan->half[0].unroutable_until = now + 20;
 	chan->half[1].unroutable_until = now + 20;
+	routing_channel_changed(rstate, chan);
 }
 
 void route_prune(struct routing_state *rstate)
@@ -1660,19 +2886,24 @@ void route_prune(struct routing_state *rstate)
 	/* Anything below this highwater mark ought to be pruned */
 	const s64 highwater = now - rstate->prune_timeout;
 	const tal_t *pruned = tal(NULL, char);
+	struct prune_bucket *b;
 	struct chan *chan;
 	u64 idx;
 
-	/* Now iterate through all channels and see if it is still alive */
-	for (chan = uintmap_first(&rstate->chanmap, &idx);
-	     chan;
-	     chan = uintmap_after(&rstate->chanmap, &idx)) {
-		/* Local-only?  Don't prune. */
-		if (!is_chan_public(chan))
-			continue;
+	/* Nothing after highwater's bucket can be old enough; everything
+	 * before it is, unless it's local-only. */
+	for (b = uintmap_first(&rstate->prune_buckets, &idx);
+	     b && highwater >= 0 && idx <= (u64)highwater / PRUNE_BUCKET_SECS;
+	     b = uintmap_after(&rstate->prune_buckets, &idx)) {
+		list_for_each(&b->chans, chan, prune_list) {
+			/* Local-only?  Don't prune. */
+			if (!is_chan_public(chan))
+				continue;
+
+			if (chan->half[0].last_timestamp >= highwater
+			    || chan->half[1].last_timestamp >= highwater)
+				continue;
 
-		if (chan->half[0].last_timestamp < highwater
-		    && chan->half[1].last_timestamp < highwater) {
 			status_trace(
 			    "Pruning channel %s from network view (ages %"PRIu64" and %"PRIu64"s)",
 			    type_to_string(tmpctx, struct short_channel_id,
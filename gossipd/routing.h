@@ -4,6 +4,7 @@
 #include <bitcoin/pubkey.h>
 #include <ccan/crypto/siphash24/siphash24.h>
 #include <ccan/htable/htable_type.h>
+#include <ccan/list/list.h>
 #include <ccan/time/time.h>
 #include <gossipd/broadcast.h>
 #include <gossipd/gossip_constants.h>
@@ -59,6 +60,10 @@ struct chan {
 	bool local_disabled;
 
 	u64 satoshis;
+
+	/* In rstate->prune_buckets[prune_bucket], by its newest update. */
+	struct list_node prune_list;
+	u64 prune_bucket;
 };
 
 /* A local channel can exist which isn't announcable. */
@@ -106,6 +111,15 @@ struct node {
 		struct chan *prev;
 	} bfg[ROUTING_MAX_HOPS+1];
 
+	/* Last bfg_repair() level which queued this node. */
+	u64 bfg_mark;
+
+	/* Hops from the source of the current get_routes() batch. */
+	u32 hops_from_source;
+
+	/* Index in rstate->graph, while that's current. */
+	u32 graph_index;
+
 	/* UTF-8 encoded alias as tal_arr, not zero terminated */
 	u8 *alias;
 
@@ -127,7 +141,13 @@ bool node_map_node_eq(const struct node *n, const struct pubkey *key);
 HTABLE_DEFINE_TYPE(struct node, node_map_keyof_node, node_map_hash_key, node_map_node_eq, node_map);
 
 struct pending_node_map;
+struct node_id_cache;
 struct pending_cannouncement;
+struct route_search;
+struct route_cache;
+struct route_graph;
+struct route_job;
+struct prune_bucket;
 
 /* If the two nodes[] are id1 and id2, which index would id1 be? */
 static inline int pubkey_idx(const struct pubkey *id1, const struct pubkey *id2)
@@ -191,8 +211,30 @@ struct routing_state {
         /* A map of channels indexed by short_channel_ids */
 	UINTMAP(struct chan *) chanmap;
 
+	/* The same channels, by when they were last updated, so route_prune
+	 * only needs to look at the old ones. */
+	UINTMAP(struct prune_bucket *) prune_buckets;
+
 	/* Has one of our own channels been announced? */
 	bool local_channel_announced;
+
+	/* The search the nodes' bfg[] holds, which find_route repairs
+	 * instead of redoing if asked the same thing again. */
+	struct route_search *search;
+	u64 bfg_mark;
+
+	/* Recently found routes. */
+	struct route_cache *route_cache;
+
+	/* Bumped whenever anything a route search looks at changes. */
+	u64 graph_version;
+
+	/* The last copy of the graph we made for route_job_run() (or NULL);
+	 * jobs may still be searching older ones. */
+	struct route_graph *graph;
+
+	/* Node ids we've already parsed, while loading the store (or NULL). */
+	struct node_id_cache *id_cache;
 };
 
 static inline struct chan *
@@ -209,6 +251,22 @@ struct route_hop {
 	u32 delay;
 };
 
+/* One channel of a bolt11 route hint: usually a private channel near the
+ * payee, which we can use for that route though it's not in our graph. */
+struct route_hint {
+	struct pubkey source, destination;
+	struct short_channel_id scid;
+	u32 fee_base_msat, fee_proportional_millionths;
+	u16 cltv_expiry_delta;
+};
+
+/* One destination of a get_routes() batch. */
+struct route_query {
+	struct pubkey destination;
+	u64 msatoshi;
+	u32 final_cltv;
+};
+
 struct routing_state *new_routing_state(const tal_t *ctx,
 					const struct bitcoin_blkid *chain_hash,
 					const struct pubkey *local_id,
@@ -257,14 +315,58 @@ u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node);
 /* Get a node: use this instead of node_map_get() */
 struct node *get_node(struct routing_state *rstate, const struct pubkey *id);
 
-/* Compute a route to a destination, for a given amount and riskfactor. */
+/* Compute a route to a destination, for a given amount and riskfactor,
+ * also using the channels in @hints (a tal_arr, or NULL). */
 struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    const struct pubkey *source,
 			    const struct pubkey *destination,
 			    const u64 msatoshi, double riskfactor,
 			    u32 final_cltv,
 			    double fuzz,
-			    const struct siphash_seed *base_seed);
+			    const struct siphash_seed *base_seed,
+			    const struct route_hint *hints);
+
+/**
+ * get_routes - Compute routes from one source to many destinations
+ *
+ * Same as calling get_route() for each of @queries, but shares the work
+ * which only depends on the source.  Returns an array of routes in the
+ * same order as @queries, with NULL where there is no route.
+ */
+struct route_hop **get_routes(const tal_t *ctx, struct routing_state *rstate,
+			      const struct pubkey *source,
+			      const struct route_query *queries,
+			      double riskfactor,
+			      double fuzz,
+			      const struct siphash_seed *base_seed);
+
+/**
+ * route_job_new - get_route(), but with the search done by route_job_run()
+ *
+ * If we can answer at once (from the route cache, by repairing the last
+ * search, or because there's no route at all) this returns NULL and sets
+ * *hops as get_route() would.  Otherwise route_job_run() can search a
+ * copy of the graph in another thread, while we go on changing this one.
+ */
+struct route_job *route_job_new(const tal_t *ctx, struct routing_state *rstate,
+				const struct pubkey *source,
+				const struct pubkey *destination,
+				const u64 msatoshi, double riskfactor,
+				u32 final_cltv,
+				double fuzz,
+				const struct siphash_seed *base_seed,
+				struct route_hop **hops);
+
+/* Do the search.  Safe from any thread: it touches only @job and its copy
+ * of the graph, and doesn't allocate or log. */
+void route_job_run(struct route_job *job);
+
+/* Back on the main thread, once route_job_run() is done: the route, or
+ * NULL.  The caller frees @job. */
+struct route_hop *route_job_finish(const tal_t *ctx,
+				   struct routing_state *rstate,
+				   const struct route_job *job);
+
 /* Disable channel(s) based on the given routing failure. */
 void routing_failure(struct routing_state *rstate,
 		     const struct pubkey *erring_node,
@@ -277,10 +379,34 @@ void mark_channel_unroutable(struct routing_state *rstate,
 
 void route_prune(struct routing_state *rstate);
 
+/* Tell routing a channel's fees, limits or routability changed under it. */
+void routing_channel_changed(struct routing_state *rstate, struct chan *chan);
+
 /* Utility function that, given a source and a destination, gives us
  * the direction bit the matching channel should get */
 #define get_channel_direction(from, to) (pubkey_cmp(from, to) > 0)
 
+/**
+ * Extract the short_channel_id and node ids from a channel_announcement
+ *
+ * Unlike fromwire_channel_announcement() this skips over the signatures,
+ * features and bitcoin keys without parsing them, which makes it much
+ * cheaper when replaying announcements we already checked.
+ */
+bool channel_announcement_ids(const u8 *msg,
+			      struct short_channel_id *scid,
+			      struct pubkey *node_id_1,
+			      struct pubkey *node_id_2);
+
+/**
+ * Remember parsed node ids while replaying channel_announcements
+ *
+ * Parsing a node id means decompressing the point, and every node turns up
+ * in several channel_announcements: gossip_store_load() turns this on for
+ * the duration of the load.
+ */
+void routing_cache_node_ids(struct routing_state *rstate, bool enable);
+
 /**
  * Add a channel_announcement to the network view without checking it
  *
@@ -77,6 +77,9 @@ bool fromwire_gossip_store_channel_delete(const void *p UNNEEDED, struct short_c
 /* Generated stub for fromwire_gossip_store_channel_update */
 bool fromwire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_checkpoint */
+bool fromwire_gossip_store_checkpoint(const void *p UNNEEDED, u32 *blockheight UNNEEDED, u32 *count UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_checkpoint called!\n"); abort(); }
 /* Generated stub for fromwire_gossip_store_local_add_channel */
 bool fromwire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **local_add UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_store_local_add_channel called!\n"); abort(); }
@@ -86,12 +89,31 @@ bool fromwire_gossip_store_node_announcement(const tal_t *ctx UNNEEDED, const vo
 /* Generated stub for fromwire_node_announcement */
 bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct pubkey *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
 { fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_pad */
+void fromwire_pad(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_pad called!\n"); abort(); }
 /* Generated stub for fromwire_peektype */
 int fromwire_peektype(const u8 *cursor UNNEEDED)
 { fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
+/* Generated stub for fromwire_pubkey */
+void fromwire_pubkey(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct pubkey *pubkey UNNEEDED)
+{ fprintf(stderr, "fromwire_pubkey called!\n"); abort(); }
+/* Generated stub for fromwire_short_channel_id */
+void fromwire_short_channel_id(const u8 **cursor UNNEEDED, size_t *max UNNEEDED,
+			       struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_short_channel_id called!\n"); abort(); }
+/* Generated stub for fromwire_u16 */
+u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
+/* Generated stub for fromwire_u32 */
+u32 fromwire_u32(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u32 called!\n"); abort(); }
 /* Generated stub for fromwire_u8 */
 u8 fromwire_u8(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
 { fprintf(stderr, "fromwire_u8 called!\n"); abort(); }
+/* Generated stub for fromwire_u8_array */
+void fromwire_u8_array(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, u8 *arr UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_u8_array called!\n"); abort(); }
 /* Generated stub for fromwire_wireaddr */
 bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
 { fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
@@ -129,6 +151,9 @@ u8 *towire_gossip_store_channel_delete(const tal_t *ctx UNNEEDED, const struct s
 /* Generated stub for towire_gossip_store_channel_update */
 u8 *towire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
 { fprintf(stderr, "towire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_checkpoint */
+u8 *towire_gossip_store_checkpoint(const tal_t *ctx UNNEEDED, u32 blockheight UNNEEDED, u32 count UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_checkpoint called!\n"); abort(); }
 /* Generated stub for towire_gossip_store_local_add_channel */
 u8 *towire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const u8 *local_add UNNEEDED)
 { fprintf(stderr, "towire_gossip_store_local_add_channel called!\n"); abort(); }
@@ -262,7 +287,7 @@ int main(int argc, char *argv[])
 				  pseudorand(100000),
 				  riskfactor,
 				  0.75, &base_seed,
-				  &fee);
+				  NULL, &fee);
 		num_success += (route != NULL);
 		tal_free(route);
 	}
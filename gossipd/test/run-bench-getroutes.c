@@ -0,0 +1,350 @@
+#include <assert.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
+#include <common/pseudorand.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+
+void status_fmt(enum log_level level, const char *fmt, ...)
+{
+	va_list ap;
+
+	/* Every search traces, which we don't want to see. */
+	if (level < LOG_UNUSUAL)
+		return;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+static bool in_bench = 0;
+
+/* We use made-up pubkeys, so don't try to format them. */
+static char *fake_type_to_string_(const tal_t *ctx, const char *typename,
+				  union printable_types u)
+{
+	/* We *do* call this at end of route setup. */
+	if (streq(typename, "struct pubkey")) {
+		size_t n;
+		memcpy(&n, u.pubkey, sizeof(n));
+		return tal_fmt(ctx, "pubkey-#%zu", n);
+	}
+	return type_to_string_(ctx, typename, u);
+}
+
+/* Only used on setup: if it was in benchmark run, we'd need the real one */
+static int fake_pubkey_cmp(const struct pubkey *a, const struct pubkey *b)
+{
+	assert(!in_bench);
+	return memcmp(a, b, sizeof(*a));
+}
+
+#define pubkey_cmp fake_pubkey_cmp
+#define type_to_string_ fake_type_to_string_
+#include "../routing.c"
+#include "../gossip_store.c"
+#undef type_to_string_
+
+struct broadcast_state *new_broadcast_state(tal_t *ctx UNNEEDED)
+{
+	return NULL;
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for broadcast_del */
+void broadcast_del(struct broadcast_state *bstate UNNEEDED, u64 index UNNEEDED, const u8 *payload UNNEEDED)
+{ fprintf(stderr, "broadcast_del called!\n"); abort(); }
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *node_id_1 UNNEEDED, struct pubkey *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u16 *flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, u64 *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_local_add_channel */
+bool fromwire_gossip_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *remote_node_id UNNEEDED, u64 *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_announcement */
+bool fromwire_gossip_store_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **announcement UNNEEDED, u64 *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_delete */
+bool fromwire_gossip_store_channel_delete(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_delete called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_update */
+bool fromwire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_checkpoint */
+bool fromwire_gossip_store_checkpoint(const void *p UNNEEDED, u32 *blockheight UNNEEDED, u32 *count UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_checkpoint called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_local_add_channel */
+bool fromwire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **local_add UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_node_announcement */
+bool fromwire_gossip_store_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **announcement UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct pubkey *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_pad */
+void fromwire_pad(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_pad called!\n"); abort(); }
+/* Generated stub for fromwire_peektype */
+int fromwire_peektype(const u8 *cursor UNNEEDED)
+{ fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
+/* Generated stub for fromwire_pubkey */
+void fromwire_pubkey(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct pubkey *pubkey UNNEEDED)
+{ fprintf(stderr, "fromwire_pubkey called!\n"); abort(); }
+/* Generated stub for fromwire_short_channel_id */
+void fromwire_short_channel_id(const u8 **cursor UNNEEDED, size_t *max UNNEEDED,
+			       struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_short_channel_id called!\n"); abort(); }
+/* Generated stub for fromwire_u16 */
+u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
+/* Generated stub for fromwire_u32 */
+u32 fromwire_u32(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u32 called!\n"); abort(); }
+/* Generated stub for fromwire_u8 */
+u8 fromwire_u8(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u8 called!\n"); abort(); }
+/* Generated stub for fromwire_u8_array */
+void fromwire_u8_array(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, u8 *arr UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_u8_array called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for insert_broadcast */
+u64 insert_broadcast(struct broadcast_state *bstate UNNEEDED, const u8 *msg UNNEEDED,
+		     u32 timestamp UNNEEDED)
+{ fprintf(stderr, "insert_broadcast called!\n"); abort(); }
+/* Generated stub for next_broadcast */
+const u8 *next_broadcast(struct broadcast_state *bstate UNNEEDED,
+			 u32 timestamp_min UNNEEDED, u32 timestamp_max UNNEEDED,
+			 u64 *last_index UNNEEDED)
+{ fprintf(stderr, "next_broadcast called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_announcement */
+u8 *towire_gossip_store_channel_announcement(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED, u64 satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_announcement called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_delete */
+u8 *towire_gossip_store_channel_delete(const tal_t *ctx UNNEEDED, const struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_delete called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_update */
+u8 *towire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_checkpoint */
+u8 *towire_gossip_store_checkpoint(const tal_t *ctx UNNEEDED, u32 blockheight UNNEEDED, u32 count UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_checkpoint called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_local_add_channel */
+u8 *towire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const u8 *local_add UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_local_add_channel called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_node_announcement */
+u8 *towire_gossip_store_node_announcement(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_node_announcement called!\n"); abort(); }
+/* Generated stub for wire_type_name */
+const char *wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "wire_type_name called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static struct pubkey nodeid(size_t n)
+{
+	struct pubkey id;
+
+	memset(&id, 0, sizeof(id));
+	memcpy(&id, &n, sizeof(n));
+	return id;
+}
+
+static void add_half(struct chan *chan, int idx)
+{
+	struct half_chan *c = &chan->half[idx];
+
+	/* Make sure it's seen as initialized (update non-NULL). */
+	c->channel_update = (void *)c;
+	c->base_fee = pseudorand(100);
+	c->proportional_fee = pseudorand(100);
+	c->delay = pseudorand(144);
+	c->flags = idx;
+	c->htlc_minimum_msat = 0;
+}
+
+static void add_channel(struct routing_state *rstate, size_t a, size_t b)
+{
+	static u64 next_scid;
+	struct short_channel_id scid;
+	struct pubkey ida = nodeid(a), idb = nodeid(b);
+	struct chan *chan;
+
+	scid.u64 = ++next_scid;
+	chan = new_chan(rstate, &scid, &ida, &idb, pseudorand(1000000) + 1);
+	add_half(chan, 0);
+	add_half(chan, 1);
+}
+
+/* We're node 0, with a dozen channels; everyone else has a few random
+ * ones, of random capacity, so some payments won't find a route. */
+static struct routing_state *make_graph(size_t num_nodes)
+{
+	static const struct bitcoin_blkid zerohash;
+	struct pubkey me = nodeid(0);
+	struct routing_state *rstate;
+
+	rstate = new_routing_state(NULL, &zerohash, &me, 0);
+	for (size_t i = 1; i < num_nodes; i++) {
+		for (size_t j = 0; j < 2; j++) {
+			size_t peer = pseudorand(num_nodes);
+			if (peer != i)
+				add_channel(rstate, i, peer);
+		}
+	}
+	for (size_t i = 0; i < 12; i++)
+		add_channel(rstate, 0, 1 + pseudorand(num_nodes - 1));
+	return rstate;
+}
+
+/* Invoices to pay: anyone but us, for up to 1 mBTC. */
+static struct route_query *make_queries(const tal_t *ctx,
+					size_t num_nodes, size_t num)
+{
+	struct route_query *queries = tal_arr(ctx, struct route_query, num);
+
+	for (size_t i = 0; i < num; i++) {
+		queries[i].destination = nodeid(1 + pseudorand(num_nodes - 1));
+		queries[i].msatoshi = 1 + pseudorand(100000000);
+		queries[i].final_cltv = 9 + pseudorand(100);
+	}
+	return queries;
+}
+
+/* So each phase has to search for itself. */
+static void forget_routes(struct routing_state *rstate)
+{
+	for (size_t i = 0; i < ROUTE_CACHE_SIZE; i++)
+		rstate->route_cache->routes[i].route
+			= tal_free(rstate->route_cache->routes[i].route);
+	route_search_forget(rstate->search);
+}
+
+static struct route_hop **routes_one_by_one(const tal_t *ctx,
+					    struct routing_state *rstate,
+					    const struct route_query *queries,
+					    const struct siphash_seed *seed)
+{
+	struct pubkey me = nodeid(0);
+	struct route_hop **routes;
+
+	routes = tal_arr(ctx, struct route_hop *, tal_count(queries));
+	for (size_t i = 0; i < tal_count(queries); i++)
+		routes[i] = get_route(routes, rstate, &me,
+				      &queries[i].destination,
+				      queries[i].msatoshi, 1,
+				      queries[i].final_cltv, 0.75, seed, NULL);
+	return routes;
+}
+
+static struct route_hop **routes_batched(const tal_t *ctx,
+					 struct routing_state *rstate,
+					 const struct route_query *queries,
+					 const struct siphash_seed *seed)
+{
+	struct pubkey me = nodeid(0);
+
+	return get_routes(ctx, rstate, &me, queries, 1, 0.75, seed);
+}
+
+/* The batch must find the same routes as asking one at a time. */
+static void check_routes(struct route_hop **a, struct route_hop **b)
+{
+	assert(tal_count(a) == tal_count(b));
+	for (size_t i = 0; i < tal_count(a); i++) {
+		assert(!a[i] == !b[i]);
+		if (!a[i])
+			continue;
+		assert(tal_count(a[i]) == tal_count(b[i]));
+		assert(a[i][0].amount == b[i][0].amount);
+		assert(a[i][0].delay == b[i][0].delay);
+		assert(pubkey_eq(&a[i][tal_count(a[i])-1].nodeid,
+				 &b[i][tal_count(b[i])-1].nodeid));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct route_query *queries;
+	struct route_hop **one_by_one, **batched;
+	size_t num_nodes = 100, num_queries = 10, num_found = 0;
+	struct timemono start;
+	struct timerel sequential, batch;
+	struct siphash_seed seed;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_nodes = atoi(argv[1]);
+	if (argc > 2)
+		num_queries = atoi(argv[2]);
+	if (argc > 3 || num_nodes < 2)
+		opt_usage_and_exit("[num_nodes [num_queries]]");
+
+	memset(&seed, 7, sizeof(seed));
+	rstate = make_graph(num_nodes);
+	queries = make_queries(rstate, num_nodes, num_queries);
+
+	in_bench = true;
+	start = time_mono();
+	one_by_one = routes_one_by_one(rstate, rstate, queries, &seed);
+	sequential = timemono_since(start);
+	clean_tmpctx();
+
+	forget_routes(rstate);
+	start = time_mono();
+	batched = routes_batched(rstate, rstate, queries, &seed);
+	batch = timemono_since(start);
+	clean_tmpctx();
+
+	check_routes(one_by_one, batched);
+	for (size_t i = 0; i < num_queries; i++)
+		num_found += (batched[i] != NULL);
+
+	/* Once we've done a batch, a single getroute still works. */
+	forget_routes(rstate);
+	tal_free(one_by_one);
+	one_by_one = routes_one_by_one(rstate, rstate, queries, &seed);
+	check_routes(one_by_one, batched);
+	tal_free(rstate);
+
+	printf("%zu nodes, %zu routes (%zu found): %"PRIu64" usec each one by one, %"PRIu64" usec each batched\n",
+	       num_nodes, num_queries, num_found,
+	       time_to_usec(time_divide(sequential, num_queries)),
+	       time_to_usec(time_divide(batch, num_queries)));
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
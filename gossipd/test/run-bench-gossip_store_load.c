@@ -0,0 +1,256 @@
+#include <assert.h>
+#include <bitcoin/privkey.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/crc/crc.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
+#include <common/pseudorand.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+
+void status_fmt(enum log_level level, const char *fmt, ...)
+{
+	va_list ap;
+
+	/* gossip_store_load() traces its totals, which we print ourselves. */
+	if (level < LOG_UNUSUAL)
+		return;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+#include "../../common/base32.c"
+#include "../../common/wireaddr.c"
+#include "../../wire/fromwire.c"
+#include "../../wire/gen_peer_wire.c"
+#include "../../wire/towire.c"
+#include "../broadcast.c"
+#include "../gen_gossip_store.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossip_local_add_channel */
+bool fromwire_gossip_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *remote_node_id UNNEEDED, u64 *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_local_add_channel called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static struct pubkey nodeid(size_t n)
+{
+	struct privkey privkey;
+	struct pubkey id;
+
+	memset(&privkey, 0, sizeof(privkey));
+	memcpy(&privkey, &n, sizeof(n));
+	privkey.secret.data[31] = 1;
+	if (!pubkey_from_privkey(&privkey, &id))
+		abort();
+	return id;
+}
+
+/* Frame it as gossip_store_append() would. */
+static void add_record(u8 **buf, const u8 *msg)
+{
+	beint32_t belen = cpu_to_be32(tal_count(msg));
+	beint32_t checksum = cpu_to_be32(crc32c(0, msg, tal_count(msg)));
+
+	tal_expand(buf, (const u8 *)&belen, sizeof(belen));
+	tal_expand(buf, (const u8 *)&checksum, sizeof(checksum));
+	tal_expand(buf, msg, tal_count(msg));
+}
+
+/* A store like mainnet's: channels between random nodes, an update for
+ * each direction, and an announcement for every node with a channel. */
+static size_t write_store(const struct bitcoin_blkid *chain_hash,
+			  size_t num_nodes, size_t num_chans)
+{
+	struct pubkey *ids = tal_arr(tmpctx, struct pubkey, num_nodes);
+	bool *announced = tal_arrz(tmpctx, bool, num_nodes);
+	secp256k1_ecdsa_signature sig;
+	u8 *buf = tal_arr(tmpctx, u8, 0), *features = tal_arr(tmpctx, u8, 0);
+	u8 version = GOSSIP_STORE_VERSION;
+	u32 now = time_now().ts.tv_sec;
+	size_t num_records = 0;
+	int fd;
+
+	memset(&sig, 0, sizeof(sig));
+	for (size_t i = 0; i < num_nodes; i++)
+		ids[i] = nodeid(i + 1);
+
+	tal_expand(&buf, &version, sizeof(version));
+	for (size_t i = 0; i < num_chans; i++) {
+		struct short_channel_id scid;
+		size_t a = pseudorand(num_nodes), b = pseudorand(num_nodes - 1);
+		const struct pubkey *id1, *id2;
+		u8 *msg;
+
+		if (b >= a)
+			b++;
+		if (pubkey_idx(&ids[a], &ids[b]) == 0) {
+			id1 = &ids[a];
+			id2 = &ids[b];
+		} else {
+			id1 = &ids[b];
+			id2 = &ids[a];
+		}
+		announced[a] = announced[b] = true;
+		mk_short_channel_id(&scid, 500000 + i / 1000, i % 1000, 0);
+		msg = towire_channel_announcement(tmpctx, &sig, &sig, &sig, &sig,
+						  features, chain_hash, &scid,
+						  id1, id2, id1, id2);
+		add_record(&buf,
+			   towire_gossip_store_channel_announcement(tmpctx, msg,
+								    1000000));
+		for (int dir = 0; dir < 2; dir++) {
+			msg = towire_channel_update(tmpctx, &sig, chain_hash,
+						    &scid, now - pseudorand(1000),
+						    dir, 144, 1000, 1000, 10);
+			add_record(&buf,
+				   towire_gossip_store_channel_update(tmpctx, msg));
+		}
+		num_records += 3;
+	}
+
+	for (size_t i = 0; i < num_nodes; i++) {
+		struct wireaddr addr;
+		u8 rgb[3], alias[32], *addrs = tal_arr(tmpctx, u8, 0), *msg;
+
+		if (!announced[i])
+			continue;
+		memset(rgb, i, sizeof(rgb));
+		memset(alias, 0, sizeof(alias));
+		snprintf((char *)alias, sizeof(alias), "node %zu", i);
+		memset(&addr, 0, sizeof(addr));
+		addr.type = ADDR_TYPE_IPV4;
+		addr.addrlen = 4;
+		memcpy(addr.addr, &i, 4);
+		addr.port = 9735;
+		towire_wireaddr(&addrs, &addr);
+		msg = towire_node_announcement(tmpctx, &sig, features, now,
+					       &ids[i], rgb, alias, addrs);
+		add_record(&buf,
+			   towire_gossip_store_node_announcement(tmpctx, msg));
+		num_records++;
+	}
+	add_record(&buf, towire_gossip_store_checkpoint(tmpctx, 500000 + num_chans / 1000,
+							num_records));
+	num_records++;
+
+	fd = open(GOSSIP_STORE_FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (fd < 0 || !write_all(fd, buf, tal_count(buf)))
+		err(1, "Writing %s", GOSSIP_STORE_FILENAME);
+	close(fd);
+	return num_records;
+}
+
+static size_t count_chans(struct routing_state *rstate)
+{
+	struct chan *chan;
+	u64 idx;
+	size_t num = 0;
+
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx)) {
+		assert(is_chan_public(chan));
+		assert(is_halfchan_defined(&chan->half[0]));
+		assert(is_halfchan_defined(&chan->half[1]));
+		num++;
+	}
+	return num;
+}
+
+/* Every node has a channel, so its announcement must have been applied. */
+static void check_nodes(struct routing_state *rstate)
+{
+	struct node *n;
+	struct node_map_iter it;
+
+	for (n = node_map_first(rstate->nodes, &it);
+	     n;
+	     n = node_map_next(rstate->nodes, &it)) {
+		assert(n->node_announcement);
+		assert(n->last_timestamp > 0);
+		assert(tal_count(n->addresses) == 1);
+		assert(n->addresses[0].port == 9735);
+		assert(strstarts((char *)n->alias, "node "));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	static const struct bitcoin_blkid zerohash;
+	struct routing_state *rstate;
+	struct pubkey me;
+	size_t num_nodes = 100, num_chans = 400, num_records;
+	char dir[] = "/tmp/run-bench-gossip_store_load.XXXXXX";
+	struct timemono start;
+	struct timerel load;
+	struct stat st;
+	u32 rollback_height;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_nodes = atoi(argv[1]);
+	if (argc > 2)
+		num_chans = atoi(argv[2]);
+	if (argc > 3 || num_nodes < 2 || num_chans > 1000 * 1000)
+		opt_usage_and_exit("[num_nodes [num_channels]]");
+
+	/* The store lives in the current directory. */
+	if (!mkdtemp(dir) || chdir(dir) != 0)
+		err(1, "Making %s", dir);
+
+	me = nodeid(0);
+	num_records = write_store(&zerohash, num_nodes, num_chans);
+	clean_tmpctx();
+	stat(GOSSIP_STORE_FILENAME, &st);
+
+	rstate = new_routing_state(NULL, &zerohash, &me, 1209600);
+	start = time_mono();
+	assert(gossip_store_load(rstate, rstate->store, &rollback_height));
+	load = timemono_since(start);
+	assert(rstate->store->count == num_records);
+	assert(count_chans(rstate) == num_chans);
+	check_nodes(rstate);
+
+	printf("%zu nodes, %zu channels (%zu records, %"PRIu64" bytes): loaded in %"PRIu64" msec\n",
+	       num_nodes, num_chans, num_records, (u64)st.st_size,
+	       time_to_msec(load));
+
+	tal_free(rstate);
+	unlink(GOSSIP_STORE_FILENAME);
+	if (chdir("/") != 0 || rmdir(dir) != 0)
+		err(1, "Removing %s", dir);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
@@ -0,0 +1,335 @@
+#include <assert.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
+#include <common/pseudorand.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+
+void status_fmt(enum log_level level, const char *fmt, ...)
+{
+	va_list ap;
+
+	/* Every pruned channel traces, which we don't want to see. */
+	if (level < LOG_UNUSUAL)
+		return;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* We use made-up pubkeys, so don't try to format them. */
+static char *fake_type_to_string_(const tal_t *ctx, const char *typename,
+				  union printable_types u)
+{
+	if (streq(typename, "struct pubkey")) {
+		size_t n;
+		memcpy(&n, u.pubkey, sizeof(n));
+		return tal_fmt(ctx, "pubkey-#%zu", n);
+	}
+	return type_to_string_(ctx, typename, u);
+}
+
+static int fake_pubkey_cmp(const struct pubkey *a, const struct pubkey *b)
+{
+	return memcmp(a, b, sizeof(*a));
+}
+#define pubkey_cmp fake_pubkey_cmp
+#define type_to_string_ fake_type_to_string_
+#include "../routing.c"
+#include "../gossip_store.c"
+#undef type_to_string_
+
+struct broadcast_state *new_broadcast_state(tal_t *ctx UNNEEDED)
+{
+	return NULL;
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for broadcast_del */
+void broadcast_del(struct broadcast_state *bstate UNNEEDED, u64 index UNNEEDED, const u8 *payload UNNEEDED)
+{ fprintf(stderr, "broadcast_del called!\n"); abort(); }
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *node_id_1 UNNEEDED, struct pubkey *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u16 *flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, u64 *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_local_add_channel */
+bool fromwire_gossip_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *remote_node_id UNNEEDED, u64 *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_announcement */
+bool fromwire_gossip_store_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **announcement UNNEEDED, u64 *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_delete */
+bool fromwire_gossip_store_channel_delete(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_delete called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_update */
+bool fromwire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_checkpoint */
+bool fromwire_gossip_store_checkpoint(const void *p UNNEEDED, u32 *blockheight UNNEEDED, u32 *count UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_checkpoint called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_local_add_channel */
+bool fromwire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **local_add UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_node_announcement */
+bool fromwire_gossip_store_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **announcement UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct pubkey *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_pad */
+void fromwire_pad(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_pad called!\n"); abort(); }
+/* Generated stub for fromwire_peektype */
+int fromwire_peektype(const u8 *cursor UNNEEDED)
+{ fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
+/* Generated stub for fromwire_pubkey */
+void fromwire_pubkey(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct pubkey *pubkey UNNEEDED)
+{ fprintf(stderr, "fromwire_pubkey called!\n"); abort(); }
+/* Generated stub for fromwire_short_channel_id */
+void fromwire_short_channel_id(const u8 **cursor UNNEEDED, size_t *max UNNEEDED,
+			       struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_short_channel_id called!\n"); abort(); }
+/* Generated stub for fromwire_u16 */
+u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
+/* Generated stub for fromwire_u32 */
+u32 fromwire_u32(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u32 called!\n"); abort(); }
+/* Generated stub for fromwire_u8 */
+u8 fromwire_u8(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u8 called!\n"); abort(); }
+/* Generated stub for fromwire_u8_array */
+void fromwire_u8_array(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, u8 *arr UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_u8_array called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for insert_broadcast */
+u64 insert_broadcast(struct broadcast_state *bstate UNNEEDED, const u8 *msg UNNEEDED,
+		     u32 timestamp UNNEEDED)
+{ fprintf(stderr, "insert_broadcast called!\n"); abort(); }
+/* Generated stub for next_broadcast */
+const u8 *next_broadcast(struct broadcast_state *bstate UNNEEDED,
+			 u32 timestamp_min UNNEEDED, u32 timestamp_max UNNEEDED,
+			 u64 *last_index UNNEEDED)
+{ fprintf(stderr, "next_broadcast called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_announcement */
+u8 *towire_gossip_store_channel_announcement(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED, u64 satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_announcement called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_delete */
+u8 *towire_gossip_store_channel_delete(const tal_t *ctx UNNEEDED, const struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_delete called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_update */
+u8 *towire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_checkpoint */
+u8 *towire_gossip_store_checkpoint(const tal_t *ctx UNNEEDED, u32 blockheight UNNEEDED, u32 count UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_checkpoint called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_local_add_channel */
+u8 *towire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const u8 *local_add UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_local_add_channel called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_node_announcement */
+u8 *towire_gossip_store_node_announcement(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_node_announcement called!\n"); abort(); }
+/* Generated stub for wire_type_name */
+const char *wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "wire_type_name called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static struct pubkey nodeid(size_t n)
+{
+	struct pubkey id;
+
+	memset(&id, 0, sizeof(id));
+	memcpy(&id, &n, sizeof(n));
+	return id;
+}
+
+/* Give it these updates, as routing_add_channel_update() would. */
+static void set_timestamps(struct routing_state *rstate, struct chan *chan,
+			   s64 t0, s64 t1)
+{
+	chan->half[0].last_timestamp = t0;
+	chan->half[1].last_timestamp = t1;
+	if (prune_bucket_of(chan) != chan->prune_bucket) {
+		prune_bucket_del(rstate, chan);
+		prune_bucket_add(rstate, chan);
+	}
+}
+
+/* Public channels between random nodes, last updated at random over the
+ * last two prune periods. */
+static struct routing_state *make_graph(size_t num_nodes, size_t num_chans,
+					u32 prune_timeout, u64 now)
+{
+	static const struct bitcoin_blkid zerohash;
+	struct pubkey me = nodeid(0);
+	struct routing_state *rstate;
+
+	rstate = new_routing_state(NULL, &zerohash, &me, prune_timeout);
+	for (size_t i = 0; i < num_chans; i++) {
+		struct short_channel_id scid;
+		struct pubkey a = nodeid(1 + pseudorand(num_nodes - 1));
+		struct pubkey b = nodeid(1 + pseudorand(num_nodes - 1));
+		struct chan *chan;
+
+		if (pubkey_eq(&a, &b))
+			continue;
+		scid.u64 = i + 1;
+		chan = new_chan(rstate, &scid, &a, &b, 1000000);
+		/* Not a real announcement, but now it's public. */
+		chan->channel_announce = (const u8 *)chan;
+		set_timestamps(rstate, chan,
+			       now - pseudorand(2 * prune_timeout),
+			       now - pseudorand(2 * prune_timeout));
+	}
+	return rstate;
+}
+
+/* What route_prune() used to look at: every channel. */
+static size_t count_prunable(struct routing_state *rstate, u64 now)
+{
+	const s64 highwater = now - rstate->prune_timeout;
+	struct chan *chan;
+	u64 idx;
+	size_t num = 0;
+
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx)) {
+		if (!is_chan_public(chan))
+			continue;
+		if (chan->half[0].last_timestamp < highwater
+		    && chan->half[1].last_timestamp < highwater)
+			num++;
+	}
+	return num;
+}
+
+static size_t count_chans(struct routing_state *rstate)
+{
+	struct chan *chan;
+	u64 idx;
+	size_t num = 0;
+
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx))
+		num++;
+	return num;
+}
+
+/* Every channel is in the bucket its newest update says. */
+static void check_buckets(struct routing_state *rstate)
+{
+	struct prune_bucket *b;
+	struct chan *chan;
+	u64 idx;
+	size_t num = 0;
+
+	for (b = uintmap_first(&rstate->prune_buckets, &idx);
+	     b;
+	     b = uintmap_after(&rstate->prune_buckets, &idx)) {
+		assert(!list_empty(&b->chans));
+		list_for_each(&b->chans, chan, prune_list) {
+			assert(chan->prune_bucket == idx);
+			assert(prune_bucket_of(chan) == idx);
+			num++;
+		}
+	}
+	assert(num == count_chans(rstate));
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	size_t num_nodes = 100, num_chans = 1000, num_prunable, before;
+	u32 prune_timeout = 1209600;
+	u64 now = time_now().ts.tv_sec;
+	struct timemono start;
+	struct timerel scan, prune;
+	struct chan *chan, *local;
+	u64 idx;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_chans = atoi(argv[1]);
+	if (argc > 2)
+		num_nodes = atoi(argv[2]);
+	if (argc > 3 || num_chans < 2 || num_nodes < 3)
+		opt_usage_and_exit("[num_channels [num_nodes]]");
+
+	rstate = make_graph(num_nodes, num_chans, prune_timeout, now);
+	check_buckets(rstate);
+
+	/* A stale channel which just got an update survives. */
+	chan = uintmap_first(&rstate->chanmap, &idx);
+	set_timestamps(rstate, chan, now - 2 * prune_timeout, now);
+	/* A local-only one is never pruned. */
+	local = uintmap_after(&rstate->chanmap, &idx);
+	set_timestamps(rstate, local, 0, 0);
+	local->channel_announce = NULL;
+	check_buckets(rstate);
+
+	before = count_chans(rstate);
+	num_prunable = count_prunable(rstate, now);
+	route_prune(rstate);
+	assert(count_prunable(rstate, now) == 0);
+	assert(count_chans(rstate) == before - num_prunable);
+	assert(get_channel(rstate, &chan->scid) == chan);
+	assert(get_channel(rstate, &local->scid) == local);
+	check_buckets(rstate);
+
+	/* Now nothing's due: time a full scan against a prune. */
+	start = time_mono();
+	for (size_t i = 0; i < 100; i++)
+		assert(count_prunable(rstate, now) == 0);
+	scan = timemono_since(start);
+
+	before = count_chans(rstate);
+	start = time_mono();
+	for (size_t i = 0; i < 100; i++)
+		route_prune(rstate);
+	prune = timemono_since(start);
+	assert(count_chans(rstate) == before);
+
+	printf("%zu channels (%zu pruned): %"PRIu64" nsec to scan them all, %"PRIu64" nsec to prune\n",
+	       before + num_prunable, num_prunable,
+	       time_to_nsec(time_divide(scan, 100)),
+	       time_to_nsec(time_divide(prune, 100)));
+
+	tal_free(rstate);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
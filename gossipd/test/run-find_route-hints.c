@@ -0,0 +1,297 @@
+#include <assert.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/tal/str/str.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+
+#define status_fmt(level, fmt, ...)					\
+	do { printf((fmt) ,##__VA_ARGS__); printf("\n"); } while(0)
+
+/* We use made-up pubkeys, so don't try to format them. */
+static char *fake_type_to_string_(const tal_t *ctx, const char *typename,
+				  union printable_types u)
+{
+	if (streq(typename, "struct pubkey")) {
+		size_t n;
+		memcpy(&n, u.pubkey, sizeof(n));
+		return tal_fmt(ctx, "pubkey-#%zu", n);
+	}
+	return type_to_string_(ctx, typename, u);
+}
+
+static int fake_pubkey_cmp(const struct pubkey *a, const struct pubkey *b)
+{
+	return memcmp(a, b, sizeof(*a));
+}
+
+#define pubkey_cmp fake_pubkey_cmp
+#define type_to_string_ fake_type_to_string_
+#include "../routing.c"
+#include "../gossip_store.c"
+#undef type_to_string_
+
+struct broadcast_state *new_broadcast_state(tal_t *ctx UNNEEDED)
+{
+	return NULL;
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for broadcast_del */
+void broadcast_del(struct broadcast_state *bstate UNNEEDED, u64 index UNNEEDED, const u8 *payload UNNEEDED)
+{ fprintf(stderr, "broadcast_del called!\n"); abort(); }
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *node_id_1 UNNEEDED, struct pubkey *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u16 *flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, u64 *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_local_add_channel */
+bool fromwire_gossip_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *remote_node_id UNNEEDED, u64 *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_announcement */
+bool fromwire_gossip_store_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **announcement UNNEEDED, u64 *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_delete */
+bool fromwire_gossip_store_channel_delete(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_delete called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_update */
+bool fromwire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_checkpoint */
+bool fromwire_gossip_store_checkpoint(const void *p UNNEEDED, u32 *blockheight UNNEEDED, u32 *count UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_checkpoint called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_local_add_channel */
+bool fromwire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **local_add UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_node_announcement */
+bool fromwire_gossip_store_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **announcement UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct pubkey *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_pad */
+void fromwire_pad(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_pad called!\n"); abort(); }
+/* Generated stub for fromwire_peektype */
+int fromwire_peektype(const u8 *cursor UNNEEDED)
+{ fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
+/* Generated stub for fromwire_pubkey */
+void fromwire_pubkey(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct pubkey *pubkey UNNEEDED)
+{ fprintf(stderr, "fromwire_pubkey called!\n"); abort(); }
+/* Generated stub for fromwire_short_channel_id */
+void fromwire_short_channel_id(const u8 **cursor UNNEEDED, size_t *max UNNEEDED,
+			       struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_short_channel_id called!\n"); abort(); }
+/* Generated stub for fromwire_u16 */
+u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
+/* Generated stub for fromwire_u32 */
+u32 fromwire_u32(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u32 called!\n"); abort(); }
+/* Generated stub for fromwire_u8 */
+u8 fromwire_u8(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_u8 called!\n"); abort(); }
+/* Generated stub for fromwire_u8_array */
+void fromwire_u8_array(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, u8 *arr UNNEEDED, size_t num UNNEEDED)
+{ fprintf(stderr, "fromwire_u8_array called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for insert_broadcast */
+u64 insert_broadcast(struct broadcast_state *bstate UNNEEDED, const u8 *msg UNNEEDED,
+		     u32 timestamp UNNEEDED)
+{ fprintf(stderr, "insert_broadcast called!\n"); abort(); }
+/* Generated stub for next_broadcast */
+const u8 *next_broadcast(struct broadcast_state *bstate UNNEEDED,
+			 u32 timestamp_min UNNEEDED, u32 timestamp_max UNNEEDED,
+			 u64 *last_index UNNEEDED)
+{ fprintf(stderr, "next_broadcast called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_announcement */
+u8 *towire_gossip_store_channel_announcement(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED, u64 satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_announcement called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_delete */
+u8 *towire_gossip_store_channel_delete(const tal_t *ctx UNNEEDED, const struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_delete called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_update */
+u8 *towire_gossip_store_channel_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_update called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_checkpoint */
+u8 *towire_gossip_store_checkpoint(const tal_t *ctx UNNEEDED, u32 blockheight UNNEEDED, u32 count UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_checkpoint called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_local_add_channel */
+u8 *towire_gossip_store_local_add_channel(const tal_t *ctx UNNEEDED, const u8 *local_add UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_local_add_channel called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_node_announcement */
+u8 *towire_gossip_store_node_announcement(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_node_announcement called!\n"); abort(); }
+/* Generated stub for wire_type_name */
+const char *wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "wire_type_name called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static struct pubkey nodeid(size_t n)
+{
+	struct pubkey id;
+
+	memset(&id, 0, sizeof(id));
+	memcpy(&id, &n, sizeof(n));
+	return id;
+}
+
+static struct short_channel_id scid(u64 n)
+{
+	struct short_channel_id scid;
+
+	scid.u64 = n;
+	return scid;
+}
+
+static void add_half(struct chan *chan, int idx)
+{
+	struct half_chan *c = &chan->half[idx];
+
+	/* Make sure it's seen as initialized (update non-NULL). */
+	c->channel_update = (void *)c;
+	c->base_fee = 1;
+	c->proportional_fee = 1;
+	c->delay = 6;
+	c->flags = idx;
+	c->htlc_minimum_msat = 0;
+}
+
+static struct chan *add_channel(struct routing_state *rstate,
+				size_t a, size_t b, u64 n)
+{
+	struct short_channel_id s = scid(n);
+	struct pubkey ida = nodeid(a), idb = nodeid(b);
+	struct chan *chan;
+
+	chan = new_chan(rstate, &s, &ida, &idb, 1000000);
+	add_half(chan, 0);
+	add_half(chan, 1);
+	return chan;
+}
+
+static struct route_hint hint(size_t from, size_t to, u64 n)
+{
+	struct route_hint h;
+
+	h.source = nodeid(from);
+	h.destination = nodeid(to);
+	h.scid = scid(n);
+	h.fee_base_msat = 1000;
+	h.fee_proportional_millionths = 10;
+	h.cltv_expiry_delta = 20;
+	return h;
+}
+
+static struct route_hint *hints_of(const tal_t *ctx, size_t num, ...)
+{
+	struct route_hint *hints = tal_arr(ctx, struct route_hint, num);
+	va_list ap;
+
+	va_start(ap, num);
+	for (size_t i = 0; i < num; i++)
+		hints[i] = va_arg(ap, struct route_hint);
+	va_end(ap);
+	return hints;
+}
+
+static struct route_hop *route_to(struct routing_state *rstate, size_t to,
+				  const struct route_hint *hints)
+{
+	struct pubkey me = nodeid(0), dest = nodeid(to);
+
+	return get_route(tmpctx, rstate, &me, &dest, 100000, 1.0, 9,
+			 0.0, NULL, hints);
+}
+
+int main(void)
+{
+	setup_locale();
+
+	static const struct bitcoin_blkid zerohash;
+	struct pubkey me = nodeid(0), id;
+	struct routing_state *rstate;
+	struct route_hop *hops;
+	struct short_channel_id s;
+	struct node *n2;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	/* We're 0, with public channels 0-1-2.  3 and 4 are private, behind
+	 * 2: only route hints tell us about 2->3 and 3->4. */
+	rstate = new_routing_state(tmpctx, &zerohash, &me, 0);
+	add_channel(rstate, 0, 1, 1);
+	add_channel(rstate, 1, 2, 2);
+	id = nodeid(2);
+	n2 = get_node(rstate, &id);
+
+	assert(route_to(rstate, 2, NULL));
+	assert(!route_to(rstate, 3, NULL));
+
+	/* The payee's channel is enough. */
+	hops = route_to(rstate, 3, hints_of(tmpctx, 1, hint(2, 3, 100)));
+	assert(tal_count(hops) == 3);
+	s = scid(100);
+	assert(short_channel_id_eq(&hops[2].channel_id, &s));
+	id = nodeid(3);
+	assert(pubkey_eq(&hops[2].nodeid, &id));
+	assert(hops[2].amount == 100000);
+	assert(hops[2].delay == 9);
+	/* 2 charges what the hint says to go through it. */
+	assert(hops[1].amount == 100000 + 1000 + 100000 * 10 / 1000000);
+	assert(hops[1].delay == 9 + 20);
+
+	/* Which didn't add anything to our graph. */
+	id = nodeid(3);
+	assert(!get_node(rstate, &id));
+	assert(!get_channel(rstate, &s));
+	assert(tal_count(n2->chans) == 1);
+
+	/* Hints can be more than one hop long. */
+	hops = route_to(rstate, 4, hints_of(tmpctx, 2,
+					    hint(2, 3, 100), hint(3, 4, 101)));
+	assert(tal_count(hops) == 4);
+	s = scid(101);
+	assert(short_channel_id_eq(&hops[3].channel_id, &s));
+	assert(hops[2].amount == 100000 + 1000 + 100000 * 10 / 1000000);
+
+	/* But they have to join up with our graph. */
+	assert(!route_to(rstate, 3, hints_of(tmpctx, 1, hint(5, 3, 100))));
+
+	/* They only go one way. */
+	assert(!route_to(rstate, 3, hints_of(tmpctx, 1, hint(3, 2, 100))));
+
+	/* We know better about our own and public channels. */
+	assert(!route_to(rstate, 3, hints_of(tmpctx, 1, hint(2, 3, 2))));
+	assert(!route_to(rstate, 3, hints_of(tmpctx, 1, hint(0, 3, 100))));
+
+	/* And without them, we're back to what we knew before. */
+	assert(!route_to(rstate, 3, NULL));
+	hops = route_to(rstate, 2, NULL);
+	assert(tal_count(hops) == 2);
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
@@ -1,9 +1,24 @@
+#include <ccan/list/list.h>
+#include <common/daemon_conn.h>
+#include <common/status.h>
+#include <common/utils.h>
 #include <hsmd/client.h>
 #include <hsmd/gen_hsm_client_wire.h>
 #include <wire/wire_sync.h>
 
 static int hsm_fd = -1;
 
+/* For hsm_do_ecdh_async: the HSM answers in order, so replies match the
+ * head of this queue. */
+struct hsm_ecdh_pending {
+	struct list_node list;
+	void (*cb)(const struct secret *ss, void *arg);
+	void *arg;
+};
+
+static struct daemon_conn *hsm_conn;
+static struct list_head hsm_ecdh_pending;
+
 void hsm_setup(int fd)
 {
 	hsm_fd = fd;
@@ -27,3 +42,56 @@ fail:
 	tal_free(req);
 	return false;
 }
+
+/* Caller freed arg before the HSM answered: just drop the answer. */
+static void cancel_ecdh(void *arg UNUSED, struct hsm_ecdh_pending *p)
+{
+	p->cb = NULL;
+}
+
+static struct io_plan *hsm_ecdh_reply(struct io_conn *conn,
+				      struct daemon_conn *dc)
+{
+	struct hsm_ecdh_pending *p;
+	struct secret ss;
+	bool ok;
+
+	p = list_pop(&hsm_ecdh_pending, struct hsm_ecdh_pending, list);
+	if (!p)
+		status_failed(STATUS_FAIL_HSM_IO, "Unexpected HSM reply %s",
+			      tal_hex(tmpctx, dc->msg_in));
+
+	ok = fromwire_hsm_ecdh_resp(dc->msg_in, &ss);
+	if (p->cb) {
+		tal_del_destructor2(p->arg, cancel_ecdh, p);
+		p->cb(ok ? &ss : NULL, p->arg);
+	}
+	tal_free(p);
+	return daemon_conn_read_next(conn, dc);
+}
+
+static void hsm_gone(struct io_conn *conn UNUSED, struct daemon_conn *dc UNUSED)
+{
+	status_failed(STATUS_FAIL_HSM_IO, "HSM connection closed");
+}
+
+void hsm_setup_async(const tal_t *ctx, int fd)
+{
+	hsm_fd = fd;
+	hsm_conn = tal(ctx, struct daemon_conn);
+	list_head_init(&hsm_ecdh_pending);
+	daemon_conn_init(hsm_conn, hsm_conn, fd, hsm_ecdh_reply, hsm_gone);
+}
+
+void hsm_do_ecdh_async_(const struct pubkey *point,
+			void (*cb)(const struct secret *ss, void *arg),
+			void *arg)
+{
+	struct hsm_ecdh_pending *p = tal(hsm_conn, struct hsm_ecdh_pending);
+
+	p->cb = cb;
+	p->arg = arg;
+	list_add_tail(&hsm_ecdh_pending, &p->list);
+	tal_add_destructor2(arg, cancel_ecdh, p);
+	daemon_conn_send(hsm_conn, take(towire_hsm_ecdh_req(NULL, point)));
+}
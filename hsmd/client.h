@@ -4,6 +4,8 @@
 #include "config.h"
 #include <ccan/endian/endian.h>
 #include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
 #include <stdbool.h>
 
 struct pubkey;
@@ -14,4 +16,20 @@ void hsm_setup(int fd);
 
 /* Do ECDH using this node id secret. */
 bool hsm_do_ecdh(struct secret *ss, const struct pubkey *point);
+
+/* Setup asynchronous communication to the HSM: requests are pipelined, so
+ * many can be outstanding at once.  Don't mix with the sync calls. */
+void hsm_setup_async(const tal_t *ctx, int fd);
+
+/* Do ECDH using this node id secret, calling cb with the result (NULL on
+ * failure).  If arg is freed first, cb is not called. */
+#define hsm_do_ecdh_async(point, cb, arg)				\
+	hsm_do_ecdh_async_((point),					\
+			   typesafe_cb_preargs(void, void *, (cb), (arg), \
+					       const struct secret *),	\
+			   (arg))
+
+void hsm_do_ecdh_async_(const struct pubkey *point,
+			void (*cb)(const struct secret *ss, void *arg),
+			void *arg);
 #endif /* LIGHTNING_HSMD_CLIENT_H */
@@ -213,6 +213,40 @@ static struct io_plan *handle_ecdh(struct io_conn *conn, struct daemon_conn *dc)
 	return daemon_conn_read_next(conn, dc);
 }
 
+/* Like handle_ecdh, but for every new HTLC in a commitment at once. */
+static struct io_plan *handle_ecdh_batch(struct io_conn *conn,
+					 struct daemon_conn *dc)
+{
+	struct client *c = container_of(dc, struct client, dc);
+	struct privkey privkey;
+	struct pubkey *points;
+	struct secret *ss;
+
+	if (!fromwire_hsm_ecdh_batch_req(tmpctx, dc->msg_in, &points)) {
+		daemon_conn_send(c->master,
+				 take(towire_hsmstatus_client_bad_request(NULL,
+								&c->id,
+								dc->msg_in)));
+		return io_close(conn);
+	}
+
+	node_key(&privkey, NULL);
+	ss = tal_arr(tmpctx, struct secret, tal_count(points));
+	for (size_t i = 0; i < tal_count(points); i++) {
+		if (secp256k1_ecdh(secp256k1_ctx, ss[i].data,
+				   &points[i].pubkey,
+				   privkey.secret.data) != 1) {
+			status_broken("secp256k1_ecdh fail for client %s",
+				      type_to_string(tmpctx, struct pubkey,
+						     &c->id));
+			memset(&ss[i], 0, sizeof(ss[i]));
+		}
+	}
+
+	daemon_conn_send(dc, take(towire_hsm_ecdh_batch_resp(NULL, ss)));
+	return daemon_conn_read_next(conn, dc);
+}
+
 static struct io_plan *handle_cannouncement_sig(struct io_conn *conn,
 						struct client *c)
 {
@@ -838,6 +872,7 @@ static bool check_client_capabilities(struct client *client,
 {
 	switch (t) {
 	case WIRE_HSM_ECDH_REQ:
+	case WIRE_HSM_ECDH_BATCH_REQ:
 		return (client->capabilities & HSM_CAP_ECDH) != 0;
 
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REQ:
@@ -873,6 +908,7 @@ static bool check_client_capabilities(struct client *client,
 
 	/* These are messages sent by the HSM so we should never receive them */
 	case WIRE_HSM_ECDH_RESP:
+	case WIRE_HSM_ECDH_BATCH_RESP:
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REPLY:
 	case WIRE_HSM_CUPDATE_SIG_REPLY:
 	case WIRE_HSM_CLIENT_HSMFD_REPLY:
@@ -926,6 +962,9 @@ static struct io_plan *handle_client(struct io_conn *conn,
 	case WIRE_HSM_ECDH_REQ:
 		return handle_ecdh(conn, dc);
 
+	case WIRE_HSM_ECDH_BATCH_REQ:
+		return handle_ecdh_batch(conn, dc);
+
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REQ:
 		return handle_cannouncement_sig(conn, c);
 
@@ -979,6 +1018,7 @@ static struct io_plan *handle_client(struct io_conn *conn,
 		return handle_sign_mutual_close_tx(conn, c);
 
 	case WIRE_HSM_ECDH_RESP:
+	case WIRE_HSM_ECDH_BATCH_RESP:
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REPLY:
 	case WIRE_HSM_CUPDATE_SIG_REPLY:
 	case WIRE_HSM_CLIENT_HSMFD_REPLY:
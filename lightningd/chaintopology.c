@@ -576,7 +576,8 @@ static void topo_update_spends(struct chain_topology *topo, struct block *b)
 						     b->height, &input->txid,
 						     input->index);
 			if (scid) {
-				gossipd_notify_spend(topo->bitcoind->ld, scid);
+				gossipd_notify_spend(topo->bitcoind->ld, scid,
+						     b->height);
 				tal_free(scid);
 			}
 		}
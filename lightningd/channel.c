@@ -234,6 +234,7 @@ struct channel *new_channel(struct peer *peer, u64 dbid,
 	channel->local_funding_pubkey = *local_funding_pubkey;
 	channel->future_per_commitment_point
 		= tal_steal(channel, future_per_commitment_point);
+	channel->saved_columns = NULL;
 
 	list_add_tail(&peer->channels, &channel->list);
 	tal_add_destructor(channel, destroy_channel);
@@ -6,6 +6,7 @@
 #include <lightningd/peer_htlcs.h>
 #include <wallet/wallet.h>
 
+struct channel_column;
 struct uncommitted_channel;
 
 struct billboard {
@@ -109,6 +110,10 @@ struct channel {
 	/* Do we have an "impossible" future per_commitment_point from
 	 * peer via option_data_loss_protect? */
 	const struct pubkey *future_per_commitment_point;
+
+	/* What wallet_channel_save last wrote (NULL if nothing yet), so it
+	 * can skip unchanged columns. */
+	struct channel_column *saved_columns;
 };
 
 struct channel *new_channel(struct peer *peer, u64 dbid,
@@ -379,6 +379,7 @@ int connectd_init(struct lightningd *ld)
 	    listen_announce,
 	    ld->proxyaddr, ld->use_proxy_always || ld->pure_tor_setup,
 	    allow_localhost, ld->config.use_dns,
+	    ld->config.max_concurrent_dials,
 	    ld->tor_service_password ? ld->tor_service_password : "");
 
 	subd_req(ld->connectd, ld->connectd, take(msg), -1, 0,
@@ -93,6 +93,24 @@ static void get_txout(struct subd *gossip, const u8 *msg)
 	}
 }
 
+/* gossipd lost the tail of its store: replay the spends it may have missed. */
+static void resend_spends(struct subd *gossip, const u8 *msg)
+{
+	u32 blockheight;
+	struct short_channel_id *scids;
+
+	if (!fromwire_gossip_resend_spends(msg, &blockheight))
+		fatal("Gossip gave bad GOSSIP_RESEND_SPENDS message %s",
+		      tal_hex(msg, msg));
+
+	scids = wallet_utxoset_spent_since(gossip->ld->wallet, tmpctx,
+					   blockheight);
+	log_debug(gossip->log, "Resending %zu spends since block %u",
+		  tal_count(scids), blockheight);
+	for (size_t i = 0; i < tal_count(scids); i++)
+		gossipd_notify_spend(gossip->ld, &scids[i], blockheight);
+}
+
 static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 {
 	enum gossip_wire_type t = fromwire_peektype(msg);
@@ -102,6 +120,7 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIPCTL_INIT:
 	case WIRE_GOSSIP_GETNODES_REQUEST:
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 	case WIRE_GOSSIP_PING:
 	case WIRE_GOSSIP_RESOLVE_CHANNEL_REQUEST:
@@ -120,6 +139,7 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIP_GET_UPDATE_REPLY:
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_PING_REPLY:
 	case WIRE_GOSSIP_SCIDS_REPLY:
@@ -134,6 +154,9 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIP_GET_TXOUT:
 		get_txout(gossip, msg);
 		break;
+	case WIRE_GOSSIP_RESEND_SPENDS:
+		resend_spends(gossip, msg);
+		break;
 	}
 	return 0;
 }
@@ -170,14 +193,15 @@ void gossip_init(struct lightningd *ld, int connectd_fd)
 	    get_offered_global_features(tmpctx),
 	    ld->rgb,
 	    ld->alias, ld->config.channel_update_interval,
-	    ld->announcable);
+	    ld->config.route_threads, ld->announcable);
 	subd_send_msg(ld->gossip, msg);
 }
 
 void gossipd_notify_spend(struct lightningd *ld,
-			  const struct short_channel_id *scid)
+			  const struct short_channel_id *scid,
+			  u32 blockheight)
 {
-	u8 *msg = towire_gossip_outpoint_spent(tmpctx, scid);
+	u8 *msg = towire_gossip_outpoint_spent(tmpctx, scid, blockheight);
 	subd_send_msg(ld->gossip, msg);
 }
 
@@ -269,6 +293,26 @@ static void json_getroute_reply(struct subd *gossip UNUSED, const u8 *reply, con
 	command_success(cmd, response);
 }
 
+/* The seed to fuzz routes with: @seedtok if given, otherwise random. */
+static bool json_route_seed(struct command *cmd, const char *buffer,
+			    const jsmntok_t *seedtok,
+			    struct siphash_seed *seed)
+{
+	if (seedtok) {
+		if (seedtok->end - seedtok->start > sizeof(*seed)) {
+			command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				     "seed must be < %zu bytes", sizeof(*seed));
+			return false;
+		}
+
+		memset(seed, 0, sizeof(*seed));
+		memcpy(seed, buffer + seedtok->start,
+		       seedtok->end - seedtok->start);
+	} else
+		randombytes_buf(seed, sizeof(*seed));
+	return true;
+}
+
 static void json_getroute(struct command *cmd, const char *buffer, const jsmntok_t *params)
 {
 	struct lightningd *ld = cmd->ld;
@@ -300,20 +344,12 @@ static void json_getroute(struct command *cmd, const char *buffer, const jsmntok
 	/* Convert from percentage */
 	*fuzz = *fuzz / 100.0;
 
-	if (seedtok) {
-		if (seedtok->end - seedtok->start > sizeof(seed))
-			command_fail(cmd, JSONRPC2_INVALID_PARAMS,
-				     "seed must be < %zu bytes", sizeof(seed));
-
-		memset(&seed, 0, sizeof(seed));
-		memcpy(&seed, buffer + seedtok->start,
-		       seedtok->end - seedtok->start);
-	} else
-		randombytes_buf(&seed, sizeof(seed));
+	if (!json_route_seed(cmd, buffer, seedtok, &seed))
+		return;
 
 	u8 *req = towire_gossip_getroute_request(cmd, source, destination,
 						 *msatoshi, *riskfactor * 1000,
-						 *cltv, fuzz, &seed);
+						 *cltv, fuzz, &seed, NULL);
 	subd_req(ld->gossip, ld->gossip, req, -1, 0, json_getroute_reply, cmd);
 	command_still_pending(cmd);
 }
@@ -328,6 +364,114 @@ static const struct json_command getroute_command = {
 };
 AUTODATA(json_command, &getroute_command);
 
+static void json_getroutes_reply(struct subd *gossip UNUSED, const u8 *reply,
+				 const int *fds UNUSED,
+				 struct command *cmd)
+{
+	struct json_result *response;
+	struct route_hop *hops;
+	u16 *route_lens;
+	size_t off = 0;
+
+	if (!fromwire_gossip_getroutes_reply(reply, reply, &route_lens, &hops)) {
+		command_fail(cmd, LIGHTNINGD, "Bad getroutes reply from gossipd");
+		return;
+	}
+
+	response = new_json_result(cmd);
+	json_object_start(response, NULL);
+	json_array_start(response, "routes");
+	for (size_t i = 0; i < tal_count(route_lens); i++) {
+		/* Don't trust gossipd's lengths to add up. */
+		if (off + route_lens[i] > tal_count(hops))
+			route_lens[i] = 0;
+		json_object_start(response, NULL);
+		json_add_route(response, "route", hops + off, route_lens[i]);
+		json_object_end(response);
+		off += route_lens[i];
+	}
+	json_array_end(response);
+	json_object_end(response);
+	command_success(cmd, response);
+}
+
+static void json_getroutes(struct command *cmd, const char *buffer,
+			   const jsmntok_t *params)
+{
+	struct lightningd *ld = cmd->ld;
+	const jsmntok_t *routestok, *t, *end;
+	struct pubkey *source;
+	const jsmntok_t *seedtok;
+	double *riskfactor;
+	double *fuzz;
+	struct siphash_seed seed;
+	struct route_query *queries;
+	size_t n;
+
+	if (!param(cmd, buffer, params,
+		   p_req("routes", json_tok_array, &routestok),
+		   p_req("riskfactor", json_tok_double, &riskfactor),
+		   p_opt_def("fromid", json_tok_pubkey, &source, ld->id),
+		   p_opt("seed", json_tok_tok, &seedtok),
+		   p_opt_def("fuzzpercent", json_tok_percent, &fuzz, 75.0),
+		   NULL))
+		return;
+
+	end = json_next(routestok);
+	n = 0;
+	queries = tal_arr(cmd, struct route_query, n);
+
+	for (t = routestok + 1; t < end; t = json_next(t)) {
+		struct pubkey *destination;
+		u64 *msatoshi;
+		unsigned *cltv;
+
+		if (!param(cmd, buffer, t,
+			   p_req("id", json_tok_pubkey, &destination),
+			   p_req("msatoshi", json_tok_u64, &msatoshi),
+			   p_opt_def("cltv", json_tok_number, &cltv, 9),
+			   NULL))
+			return;
+
+		tal_resize(&queries, n + 1);
+		queries[n].destination = *destination;
+		queries[n].msatoshi = *msatoshi;
+		queries[n].final_cltv = *cltv;
+		n++;
+	}
+
+	/* All the routes have to fit in one reply. */
+	if (n * ROUTING_MAX_HOPS > UINT16_MAX) {
+		command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+			     "Too many routes: maximum is %u",
+			     UINT16_MAX / ROUTING_MAX_HOPS);
+		return;
+	}
+
+	/* Convert from percentage */
+	*fuzz = *fuzz / 100.0;
+
+	if (!json_route_seed(cmd, buffer, seedtok, &seed))
+		return;
+
+	u8 *req = towire_gossip_getroutes_request(cmd, source,
+						  *riskfactor * 1000,
+						  fuzz, &seed, queries);
+	subd_req(ld->gossip, ld->gossip, req, -1, 0, json_getroutes_reply, cmd);
+	command_still_pending(cmd);
+}
+
+static const struct json_command getroutes_command = {
+	"getroutes",
+	json_getroutes,
+	"Show routes for each of {routes}, an array of {id}, {msatoshi} and optional "
+	"{cltv} (default 9), using {riskfactor}.  An empty route means there is none. "
+	"If specified search from {fromid} otherwise use this node as source. "
+	"Randomize the routes with up to {fuzzpercent} (0.0 -> 100.0, default 75.0) "
+	"using {seed} as an arbitrary-size string seed."
+};
+AUTODATA(json_command, &getroutes_command);
+
 /* Called upon receiving a getchannels_reply from `gossipd` */
 static void json_listchannels_reply(struct subd *gossip UNUSED, const u8 *reply,
 				   const int *fds UNUSED, struct command *cmd)
@@ -10,6 +10,7 @@ struct lightningd;
 void gossip_init(struct lightningd *ld, int connectd_fd);
 
 void gossipd_notify_spend(struct lightningd *ld,
-			  const struct short_channel_id *scid);
+			  const struct short_channel_id *scid,
+			  u32 blockheight);
 
 #endif /* LIGHTNING_LIGHTNINGD_GOSSIP_CONTROL_H */
@@ -77,6 +77,40 @@ void towire_route_hop(u8 **pptr, const struct route_hop *entry)
 	towire_u32(pptr, entry->delay);
 }
 
+void fromwire_route_hint(const u8 **pptr, size_t *max,
+			 struct route_hint *entry)
+{
+	fromwire_pubkey(pptr, max, &entry->source);
+	fromwire_pubkey(pptr, max, &entry->destination);
+	fromwire_short_channel_id(pptr, max, &entry->scid);
+	entry->fee_base_msat = fromwire_u32(pptr, max);
+	entry->fee_proportional_millionths = fromwire_u32(pptr, max);
+	entry->cltv_expiry_delta = fromwire_u16(pptr, max);
+}
+void towire_route_hint(u8 **pptr, const struct route_hint *entry)
+{
+	towire_pubkey(pptr, &entry->source);
+	towire_pubkey(pptr, &entry->destination);
+	towire_short_channel_id(pptr, &entry->scid);
+	towire_u32(pptr, entry->fee_base_msat);
+	towire_u32(pptr, entry->fee_proportional_millionths);
+	towire_u16(pptr, entry->cltv_expiry_delta);
+}
+
+void fromwire_route_query(const u8 **pptr, size_t *max,
+			  struct route_query *entry)
+{
+	fromwire_pubkey(pptr, max, &entry->destination);
+	entry->msatoshi = fromwire_u64(pptr, max);
+	entry->final_cltv = fromwire_u32(pptr, max);
+}
+void towire_route_query(u8 **pptr, const struct route_query *entry)
+{
+	towire_pubkey(pptr, &entry->destination);
+	towire_u64(pptr, entry->msatoshi);
+	towire_u32(pptr, entry->final_cltv);
+}
+
 void fromwire_gossip_getchannels_entry(const u8 **pptr, size_t *max,
 				       struct gossip_getchannels_entry *entry)
 {
@@ -43,6 +43,14 @@ void towire_peer_features(u8 **pptr, const struct peer_features *features);
 void fromwire_route_hop(const u8 **pprt, size_t *max, struct route_hop *entry);
 void towire_route_hop(u8 **pprt, const struct route_hop *entry);
 
+void fromwire_route_hint(const u8 **pptr, size_t *max,
+			 struct route_hint *entry);
+void towire_route_hint(u8 **pptr, const struct route_hint *entry);
+
+void fromwire_route_query(const u8 **pptr, size_t *max,
+			  struct route_query *entry);
+void towire_route_query(u8 **pptr, const struct route_query *entry);
+
 void fromwire_gossip_getchannels_entry(const u8 **pptr, size_t *max,
 				       struct gossip_getchannels_entry *entry);
 void towire_gossip_getchannels_entry(
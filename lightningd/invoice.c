@@ -126,6 +126,62 @@ static bool parse_fallback(struct command *cmd,
 	return true;
 }
 
+#if DEVELOPER
+/* dev-routes is an array of route hints, each an array of
+ * {id, short_channel_id, fee_base_msat, fee_proportional_millionths,
+ *  cltv_expiry_delta}. */
+static struct route_info **unpack_routes(const tal_t *ctx,
+					 const char *buffer,
+					 const jsmntok_t *routestok)
+{
+	const jsmntok_t *t, *end;
+	struct route_info **routes = tal_arr(ctx, struct route_info *, 0);
+
+	end = json_next(routestok);
+	for (t = routestok + 1; t < end; t = json_next(t)) {
+		const jsmntok_t *t2, *end2;
+		struct route_info *r = tal_arr(routes, struct route_info, 0);
+		size_t n = tal_count(routes);
+
+		if (t->type != JSMN_ARRAY)
+			return tal_free(routes);
+
+		end2 = json_next(t);
+		for (t2 = t + 1; t2 < end2; t2 = json_next(t2)) {
+			const jsmntok_t *pubkey, *scid, *fee_base, *fee_prop,
+				*cltv;
+			unsigned int cltv_expiry_delta;
+			size_t m = tal_count(r);
+
+			pubkey = json_get_member(buffer, t2, "id");
+			scid = json_get_member(buffer, t2, "short_channel_id");
+			fee_base = json_get_member(buffer, t2, "fee_base_msat");
+			fee_prop = json_get_member(buffer, t2,
+						   "fee_proportional_millionths");
+			cltv = json_get_member(buffer, t2, "cltv_expiry_delta");
+			if (!pubkey || !scid || !fee_base || !fee_prop || !cltv)
+				return tal_free(routes);
+
+			tal_resize(&r, m + 1);
+			if (!json_to_pubkey(buffer, pubkey, &r[m].pubkey)
+			    || !json_to_short_channel_id(buffer, scid,
+							 &r[m].short_channel_id)
+			    || !json_to_number(buffer, fee_base,
+					       &r[m].fee_base_msat)
+			    || !json_to_number(buffer, fee_prop,
+					       &r[m].fee_proportional_millionths)
+			    || !json_to_number(buffer, cltv, &cltv_expiry_delta)
+			    || cltv_expiry_delta > UINT16_MAX)
+				return tal_free(routes);
+			r[m].cltv_expiry_delta = cltv_expiry_delta;
+		}
+		tal_resize(&routes, n + 1);
+		routes[n] = r;
+	}
+	return routes;
+}
+#endif /* DEVELOPER */
+
 static void json_invoice(struct command *cmd,
 			 const char *buffer, const jsmntok_t *params)
 {
@@ -133,6 +189,9 @@ static void json_invoice(struct command *cmd,
 	const struct invoice_details *details;
 	const jsmntok_t *fallbacks;
 	const jsmntok_t *preimagetok;
+#if DEVELOPER
+	const jsmntok_t *routes;
+#endif
 	u64 *msatoshi_val;
 	struct json_escaped *label_val;
 	const char *desc_val;
@@ -151,6 +210,9 @@ static void json_invoice(struct command *cmd,
 		   p_opt_def("expiry", json_tok_u64, &expiry, 3600),
 		   p_opt("fallbacks", json_tok_array, &fallbacks),
 		   p_opt("preimage", json_tok_tok, &preimagetok),
+#if DEVELOPER
+		   p_opt("dev-routes", json_tok_array, &routes),
+#endif
 		   NULL))
 		return;
 
@@ -232,6 +294,19 @@ static void json_invoice(struct command *cmd,
 	if (fallback_scripts)
 		b11->fallbacks = tal_steal(b11, fallback_scripts);
 
+#if DEVELOPER
+	/* So tests can pay us through route hints. */
+	if (routes) {
+		b11->routes = unpack_routes(b11, buffer, routes);
+		if (!b11->routes) {
+			command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				     "dev-routes must be an array of arrays of"
+				     " route hints");
+			return;
+		}
+	}
+#endif
+
 	/* FIXME: add private routes if necessary! */
 	b11enc = bolt11_encode(cmd, b11, false, hsm_sign_b11, cmd->ld);
 
@@ -130,6 +130,28 @@ static const struct json_command dev_crash_command = {
 	"Crash lightningd by calling fatal()"
 };
 AUTODATA(json_command, &dev_crash_command);
+
+static void json_dbstats(struct command *cmd,
+			 const char *buffer UNUSED,
+			 const jsmntok_t *params UNUSED)
+{
+	struct json_result *response = new_json_result(cmd);
+	const struct db *db = cmd->ld->wallet->db;
+
+	json_object_start(response, NULL);
+	json_add_u64(response, "transactions", db->num_transactions);
+	json_add_u64(response, "transactions_avoided",
+		     db->num_transactions_avoided);
+	json_object_end(response);
+	command_success(cmd, response);
+}
+
+static const struct json_command dev_dbstats_command = {
+	"dev-dbstats",
+	json_dbstats,
+	"Show how many database transactions we committed, and avoided"
+};
+AUTODATA(json_command, &dev_dbstats_command);
 #endif /* DEVELOPER */
 
 static void json_getinfo(struct command *cmd,
@@ -156,6 +156,7 @@ static struct lightningd *new_lightningd(const tal_t *ctx)
 	 * I was in a premature optimization mood when I wrote this: */
 	htlc_in_map_init(&ld->htlcs_in);
 	htlc_out_map_init(&ld->htlcs_out);
+	ld->onion_replay = onion_replay_new(ld, ONION_REPLAY_MAX_ENTRIES);
 
 	/*~ We have a two-level log-book infrastructure: we define a 20MB log
 	 * book to hold all the entries (and trims as necessary), and multiple
@@ -167,6 +168,8 @@ static struct lightningd *new_lightningd(const tal_t *ctx)
 	 * is. */
 	ld->log = new_log(ld, ld->log_book, "lightningd(%u):", (int)getpid());
 	ld->logfile = NULL;
+	ld->log_flush_msec = 100;
+	ld->log_drop = false;
 
 	/*~ We explicitly set these to NULL: if they're still NULL after option
 	 * parsing, we know they're to be set to the defaults. */
@@ -679,6 +682,10 @@ int main(int argc, char *argv[])
 	 * changes our pid! */
 	pidfile_create(ld);
 
+	/*~ Similarly, threads don't survive fork(), so only now can we hand
+	 * log file writing off to a thread of its own. */
+	log_writer_start(ld);
+
 	/*~ Activate connect daemon.  Needs to be after the initialization of
 	 * chaintopology, otherwise peers may connect and ask for
 	 * uninitialized data. */
@@ -7,6 +7,7 @@
 #include <ccan/time/time.h>
 #include <ccan/timer/timer.h>
 #include <common/json_escaped.h>
+#include <common/onion_replay.h>
 #include <lightningd/htlc_end.h>
 #include <stdio.h>
 #include <wallet/txfilter.h>
@@ -67,6 +68,12 @@ struct config {
 
 	/* Are we allowed to use DNS lookup for peers. */
 	bool use_dns;
+
+	/* How many addresses do we try at once when connecting to a peer. */
+	u32 max_concurrent_dials;
+
+	/* How many threads gossipd searches for routes in (0 for none). */
+	u32 route_threads;
 };
 
 struct lightningd {
@@ -99,6 +106,10 @@ struct lightningd {
 	/* Log for general stuff. */
 	struct log *log;
 	const char *logfile;
+	/* How often the log writer thread writes out, and whether it
+	 * drops lines rather than making us wait when it falls behind. */
+	unsigned int log_flush_msec;
+	bool log_drop;
 
 	/* This is us. */
 	struct pubkey id;
@@ -154,6 +165,9 @@ struct lightningd {
 	struct htlc_in_map htlcs_in;
 	struct htlc_out_map htlcs_out;
 
+	/* Onions we've accepted, so we can spot replays. */
+	struct onion_replay *onion_replay;
+
 	struct wallet *wallet;
 
 	/* Outstanding waitsendpay commands. */
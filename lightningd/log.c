@@ -4,18 +4,18 @@
 #include <ccan/array_size/array_size.h>
 #include <ccan/err/err.h>
 #include <ccan/io/io.h>
-#include <ccan/list/list.h>
 #include <ccan/opt/opt.h>
 #include <ccan/read_write_all/read_write_all.h>
 #include <ccan/str/hex/hex.h>
 #include <ccan/tal/link/link.h>
 #include <ccan/tal/str/str.h>
 #include <common/memleak.h>
-#include <common/pseudorand.h>
 #include <common/utils.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/jsonrpc_errors.h>
 #include <lightningd/lightningd.h>
@@ -30,16 +30,46 @@
 /* Once we're up and running, this is set up. */
 struct log *crashlog;
 
-struct log_entry {
-	struct list_node list;
+/* Each level has its own fixed-size ring of records, so appending is O(1):
+ * a flood of IO or debug messages only ever pushes out older messages of
+ * the same level, and we never walk the whole log to make room. */
+struct log_record {
+	/* Position in the log book: used to merge the rings back into order,
+	 * and to tell how many records were pushed out in between. */
+	u64 seq;
 	struct timeabs time;
-	enum log_level level;
-	unsigned int skipped;
 	const char *prefix;
-	char *log;
-	/* Iff LOG_IO */
-	const u8 *io;
+	/* Total size of this record, including padding. */
+	u32 size;
+	/* strlen() of the log string, and length of the io data after it. */
+	u32 loglen, iolen;
+	char data[];
+};
+
+struct log_ring {
+	/* Allocated on first use. */
+	u8 *buf;
+	size_t size;
+	/* Offsets of the oldest record, the end of the newest one, and the
+	 * newest one itself. */
+	size_t head, tail, newest;
+	/* If wrapped, the records from head run up to end, then from 0. */
+	bool wrapped;
+	size_t end;
+	size_t count;
+};
+
+/* How max_mem is divided between the levels, in sixteenths. */
+static const size_t log_ring_share[LOG_LEVEL_MAX+1] = {
+	[LOG_IO_OUT] = 4,
+	[LOG_IO_IN] = 4,
+	[LOG_DBG] = 4,
+	[LOG_INFORM] = 2,
+	[LOG_UNUSUAL] = 1,
+	[LOG_BROKEN] = 1,
 };
+#define LOG_RING_SHARES 16
+#define LOG_RING_MIN 1024
 
 struct log_book {
 	size_t mem_used;
@@ -53,7 +83,13 @@ struct log_book {
 	enum log_level print_level;
 	struct timeabs init_time;
 
-	struct list_head log;
+	struct log_ring rings[LOG_LEVEL_MAX+1];
+	/* Sequence number for the next record. */
+	u64 next_seq;
+	/* Which ring holds the most recent record (for log_add) */
+	enum log_level last_level;
+	/* Reused for formatting, so we don't allocate for every line. */
+	char *fmtbuf;
 };
 
 struct log {
@@ -61,13 +97,13 @@ struct log {
 	const char *prefix;
 };
 
-static void log_to_file(const char *prefix,
-			enum log_level level,
-			bool continued,
-			const struct timeabs *time,
-			const char *str,
-			const u8 *io,
-			FILE *logf)
+static char *fmt_log_line(const tal_t *ctx,
+			  const char *prefix,
+			  enum log_level level,
+			  bool continued,
+			  const struct timeabs *time,
+			  const char *str,
+			  const u8 *io)
 {
 	char iso8601_msec_fmt[sizeof("YYYY-mm-ddTHH:MM:SS.%03dZ")];
 	strftime(iso8601_msec_fmt, sizeof(iso8601_msec_fmt), "%FT%T.%%03dZ", gmtime(&time->ts.tv_sec));
@@ -76,16 +112,30 @@ static void log_to_file(const char *prefix,
 
 	if (level == LOG_IO_IN || level == LOG_IO_OUT) {
 		const char *dir = level == LOG_IO_IN ? "[IN]" : "[OUT]";
-		char *hex = tal_hex(NULL, io);
-		fprintf(logf, "%s %s%s%s %s\n",
-			iso8601_s, prefix, str, dir, hex);
+		char *hex = tal_hex(NULL, io), *line;
+		line = tal_fmt(ctx, "%s %s%s%s %s\n",
+			       iso8601_s, prefix, str, dir, hex);
 		tal_free(hex);
+		return line;
 	} else 	if (!continued) {
-		fprintf(logf, "%s %s %s\n", iso8601_s, prefix, str);
+		return tal_fmt(ctx, "%s %s %s\n", iso8601_s, prefix, str);
 	} else {
-		fprintf(logf, "%s %s \t%s\n", iso8601_s, prefix, str);
+		return tal_fmt(ctx, "%s %s \t%s\n", iso8601_s, prefix, str);
 	}
+}
+
+static void log_to_file(const char *prefix,
+			enum log_level level,
+			bool continued,
+			const struct timeabs *time,
+			const char *str,
+			const u8 *io,
+			FILE *logf)
+{
+	char *line = fmt_log_line(NULL, prefix, level, continued, time, str, io);
+	fputs(line, logf);
 	fflush(logf);
+	tal_free(line);
 }
 
 static void log_to_stdout(const char *prefix,
@@ -98,36 +148,140 @@ static void log_to_stdout(const char *prefix,
 	log_to_file(prefix, level, continued, time, str, io, stdout);
 }
 
-static size_t mem_used(const struct log_entry *e)
+static struct log_record *ring_rec(const struct log_ring *ring, size_t off)
 {
-	return sizeof(*e) + strlen(e->log) + 1 + tal_count(e->io);
+	return (struct log_record *)(ring->buf + off);
 }
 
-static size_t prune_log(struct log_book *log)
+static size_t ring_next(const struct log_ring *ring, size_t off)
 {
-	struct log_entry *i, *next, *tail;
-	size_t skipped = 0, deleted = 0;
+	off += ring_rec(ring, off)->size;
+	if (ring->wrapped && off == ring->end)
+		off = 0;
+	return off;
+}
 
-	/* Never delete the last one. */
-	tail = list_tail(&log->log, struct log_entry, list);
+static void ring_evict(struct log_book *lr, struct log_ring *ring)
+{
+	lr->mem_used -= ring_rec(ring, ring->head)->size;
+	if (--ring->count == 0) {
+		ring->head = ring->tail = 0;
+		ring->wrapped = false;
+		return;
+	}
+	ring->head = ring_next(ring, ring->head);
+	if (ring->head == 0)
+		ring->wrapped = false;
+}
 
-	list_for_each_safe(&log->log, i, next, list) {
-		/* 50% chance of deleting IO_IN, 25% IO_OUT, 12.5% DEBUG... */
-		if (i == tail || !pseudorand(2 << i->level)) {
-			i->skipped += skipped;
-			skipped = 0;
-			continue;
+/* Returns offset for a new record of size len, pushing out old ones. */
+static size_t ring_reserve(struct log_book *lr, struct log_ring *ring,
+			   size_t len)
+{
+	assert(len <= ring->size);
+	for (;;) {
+		if (!ring->wrapped) {
+			if (ring->size - ring->tail >= len)
+				return ring->tail;
+			ring->end = ring->tail;
+			ring->tail = 0;
+			ring->wrapped = true;
 		}
+		if (ring->head - ring->tail >= len)
+			return ring->tail;
+		ring_evict(lr, ring);
+	}
+}
 
-		list_del_from(&log->log, &i->list);
-		log->mem_used -= mem_used(i);
-		tal_free(i);
-		skipped++;
-		deleted++;
+/* Take the newest record off again (it's about to be replaced). */
+static void ring_unappend(struct log_book *lr, struct log_ring *ring)
+{
+	lr->mem_used -= ring_rec(ring, ring->newest)->size;
+	ring->tail = ring->newest;
+	if (--ring->count == 0) {
+		ring->head = ring->tail = 0;
+		ring->wrapped = false;
 	}
+}
 
-	assert(!skipped);
-	return deleted;
+static size_t record_size(size_t loglen, size_t iolen)
+{
+	return (sizeof(struct log_record) + loglen + 1 + iolen + 7) & ~(size_t)7;
+}
+
+static const struct log_record *add_record(struct log_book *lr,
+					   enum log_level level,
+					   u64 seq,
+					   const struct timeabs *time,
+					   const char *prefix,
+					   const char *str, size_t loglen,
+					   const u8 *io, size_t iolen)
+{
+	struct log_ring *ring = &lr->rings[level];
+	struct log_record *r;
+	size_t room, off;
+
+	if (!ring->buf)
+		ring->buf = tal_arr(lr, u8, ring->size);
+
+	/* Anything too big for the ring at all gets truncated. */
+	room = ring->size - sizeof(struct log_record) - 8;
+	if (loglen > room)
+		loglen = room;
+	if (iolen > room - loglen)
+		iolen = room - loglen;
+
+	off = ring_reserve(lr, ring, record_size(loglen, iolen));
+	r = ring_rec(ring, off);
+	r->seq = seq;
+	r->time = *time;
+	r->prefix = prefix;
+	r->size = record_size(loglen, iolen);
+	r->loglen = loglen;
+	r->iolen = iolen;
+	memcpy(r->data, str, loglen);
+	r->data[loglen] = '\0';
+	if (iolen)
+		memcpy(r->data + loglen + 1, io, iolen);
+
+	ring->newest = off;
+	ring->tail = off + r->size;
+	ring->count++;
+	lr->mem_used += r->size;
+	lr->last_level = level;
+	return r;
+}
+
+static const u8 *record_io(const struct log_record *r)
+{
+	return (const u8 *)r->data + r->loglen + 1;
+}
+
+/* Formats into lr->fmtbuf at offset off; returns length added. */
+static size_t log_vfmt(struct log_book *lr, size_t off,
+		       const char *fmt, va_list ap)
+{
+	va_list ap2;
+	int len;
+
+	va_copy(ap2, ap);
+	len = vsnprintf(lr->fmtbuf + off, tal_count(lr->fmtbuf) - off, fmt, ap2);
+	va_end(ap2);
+	if (len < 0)
+		len = 0;
+	else if (off + len >= tal_count(lr->fmtbuf)) {
+		tal_resize(&lr->fmtbuf, off + len + 1);
+		vsnprintf(lr->fmtbuf + off, len + 1, fmt, ap);
+	}
+	return len;
+}
+
+/* Sanitize any non-printable characters, and replace with '?' */
+static void sanitize(char *str, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		if (str[i] < ' ' || str[i] >= 0x7f)
+			str[i] = '?';
 }
 
 struct log_book *new_log_book(size_t max_mem,
@@ -142,7 +296,16 @@ struct log_book *new_log_book(size_t max_mem,
 	lr->print = log_to_stdout;
 	lr->print_level = printlevel;
 	lr->init_time = time_now();
-	list_head_init(&lr->log);
+	memset(lr->rings, 0, sizeof(lr->rings));
+	for (size_t i = 0; i < ARRAY_SIZE(lr->rings); i++) {
+		size_t size = max_mem / LOG_RING_SHARES * log_ring_share[i];
+		if (size < LOG_RING_MIN)
+			size = LOG_RING_MIN;
+		lr->rings[i].size = size & ~(size_t)7;
+	}
+	lr->next_seq = 0;
+	lr->last_level = LOG_BROKEN;
+	lr->fmtbuf = tal_arr(lr, char, 1024);
 
 	return lr;
 }
@@ -217,58 +380,30 @@ const struct timeabs *log_init_time(const struct log_book *lr)
 	return &lr->init_time;
 }
 
-static void add_entry(struct log *log, struct log_entry *l)
-{
-	log->lr->mem_used += mem_used(l);
-	list_add_tail(&log->lr->log, &l->list);
-
-	if (log->lr->mem_used > log->lr->max_mem) {
-		size_t old_mem = log->lr->mem_used, deleted;
-		deleted = prune_log(log->lr);
-		log_debug(log, "Log pruned %zu entries (mem %zu -> %zu)",
-			  deleted, old_mem, log->lr->mem_used);
-	}
-}
-
-static struct log_entry *new_log_entry(struct log *log, enum log_level level)
-{
-	struct log_entry *l = tal(log->lr, struct log_entry);
-
-	l->time = time_now();
-	l->level = level;
-	l->skipped = 0;
-	l->prefix = log->prefix;
-	l->io = NULL;
-
-	return l;
-}
-
-static void maybe_print(const struct log *log, const struct log_entry *l,
+static void maybe_print(const struct log *log, enum log_level level,
+			const struct log_record *r, const u8 *io,
 			size_t offset)
 {
-	if (l->level >= log->lr->print_level)
-		log->lr->print(log->prefix, l->level, offset != 0,
-			       &l->time, l->log + offset,
-			       l->io, log->lr->print_arg);
+	if (level >= log->lr->print_level)
+		log->lr->print(log->prefix, level, offset != 0,
+			       &r->time, r->data + offset,
+			       io, log->lr->print_arg);
 }
 
 void logv(struct log *log, enum log_level level, const char *fmt, va_list ap)
 {
 	int save_errno = errno;
-	struct log_entry *l = new_log_entry(log, level);
-
-	l->log = tal_vfmt(l, fmt, ap);
+	struct log_book *lr = log->lr;
+	struct timeabs now = time_now();
+	const struct log_record *r;
+	size_t len;
 
-	size_t log_len = strlen(l->log);
+	len = log_vfmt(lr, 0, fmt, ap);
+	sanitize(lr->fmtbuf, len);
 
-	/* Sanitize any non-printable characters, and replace with '?' */
-	for (size_t i=0; i<log_len; i++)
-		if (l->log[i] < ' ' || l->log[i] >= 0x7f)
-			l->log[i] = '?';
-
-	maybe_print(log, l, 0);
-
-	add_entry(log, l);
+	r = add_record(lr, level, lr->next_seq++, &now, log->prefix,
+		       lr->fmtbuf, len, NULL, 0);
+	maybe_print(log, level, r, NULL, 0);
 	errno = save_errno;
 }
 
@@ -277,37 +412,61 @@ void log_io(struct log *log, enum log_level dir,
 	    const void *data TAKES, size_t len)
 {
 	int save_errno = errno;
-	struct log_entry *l = new_log_entry(log, dir);
+	struct log_book *lr = log->lr;
+	struct timeabs now = time_now();
+	const struct log_record *r;
 
 	assert(dir == LOG_IO_IN || dir == LOG_IO_OUT);
 
-	l->log = tal_strdup(l, str);
-	l->io = tal_dup_arr(l, u8, data, len, 0);
-
-	maybe_print(log, l, 0);
-	add_entry(log, l);
+	r = add_record(lr, dir, lr->next_seq++, &now, log->prefix,
+		       str, strlen(str), data, len);
+	if (taken(str))
+		tal_free(str);
+	if (taken(data))
+		tal_free(data);
+
+	/* The printer wants a tal array. */
+	if (dir >= lr->print_level) {
+		const u8 *io = tal_dup_arr(NULL, u8, record_io(r), r->iolen, 0);
+		maybe_print(log, dir, r, io, 0);
+		tal_free(io);
+	}
 	errno = save_errno;
 }
 
 void logv_add(struct log *log, const char *fmt, va_list ap)
 {
-	struct log_entry *l = list_tail(&log->lr->log, struct log_entry, list);
-	size_t oldlen = strlen(l->log);
-
-	/* Remove from list, so it doesn't get pruned. */
-	log->lr->mem_used -= mem_used(l);
-	list_del_from(&log->lr->log, &l->list);
-
-	tal_append_vfmt(&l->log, fmt, ap);
-
-	/* Sanitize any non-printable characters, and replace with '?' */
-	for (size_t i=oldlen; i<strlen(l->log); i++)
-		if (l->log[i] < ' ' || l->log[i] >= 0x7f)
-			l->log[i] = '?';
-
-	add_entry(log, l);
-
-	maybe_print(log, l, oldlen);
+	struct log_book *lr = log->lr;
+	enum log_level level = lr->last_level;
+	struct log_ring *ring = &lr->rings[level];
+	const struct log_record *r;
+	u64 seq;
+	struct timeabs time;
+	const char *prefix;
+	const u8 *io;
+	size_t oldlen, len;
+
+	assert(ring->count);
+	r = ring_rec(ring, ring->newest);
+	seq = r->seq;
+	time = r->time;
+	prefix = r->prefix;
+	io = tal_dup_arr(NULL, u8, record_io(r), r->iolen, 0);
+	oldlen = r->loglen;
+
+	if (tal_count(lr->fmtbuf) < oldlen + 1)
+		tal_resize(&lr->fmtbuf, oldlen + 1);
+	memcpy(lr->fmtbuf, r->data, oldlen);
+
+	len = log_vfmt(lr, oldlen, fmt, ap);
+	sanitize(lr->fmtbuf + oldlen, len);
+
+	/* It's the newest in its ring, so we can simply replace it. */
+	ring_unappend(lr, ring);
+	r = add_record(lr, level, seq, &time, prefix,
+		       lr->fmtbuf, oldlen + len, io, tal_count(io));
+	maybe_print(log, level, r, tal_count(io) ? io : NULL, oldlen);
+	tal_free(io);
 }
 
 void log_(struct log *log, enum log_level level, const char *fmt, ...)
@@ -334,15 +493,43 @@ void log_each_line_(const struct log_book *lr,
 				 enum log_level level,
 				 const char *prefix,
 				 const char *log,
-				 const u8 *io,
+				 const u8 *io, size_t io_len,
 				 void *arg),
 		    void *arg)
 {
-	const struct log_entry *i;
+	/* No allocations: may be in signal handler. */
+	size_t off[LOG_LEVEL_MAX+1], left[LOG_LEVEL_MAX+1];
+	u64 next_seq = 0;
 
-	list_for_each(&lr->log, i, list) {
-		func(i->skipped, time_between(i->time, lr->init_time),
-		     i->level, i->prefix, i->log, i->io, arg);
+	for (size_t i = 0; i < ARRAY_SIZE(lr->rings); i++) {
+		off[i] = lr->rings[i].head;
+		left[i] = lr->rings[i].count;
+	}
+
+	/* Merge the rings back into order. */
+	for (;;) {
+		const struct log_record *r = NULL;
+		enum log_level level = LOG_BROKEN;
+
+		for (size_t i = 0; i < ARRAY_SIZE(lr->rings); i++) {
+			const struct log_record *ri;
+			if (!left[i])
+				continue;
+			ri = ring_rec(&lr->rings[i], off[i]);
+			if (!r || ri->seq < r->seq) {
+				r = ri;
+				level = i;
+			}
+		}
+		if (!r)
+			break;
+
+		func(r->seq - next_seq, time_between(r->time, lr->init_time),
+		     level, r->prefix, r->data,
+		     level <= LOG_IO_IN ? record_io(r) : NULL, r->iolen, arg);
+		next_seq = r->seq + 1;
+		off[level] = ring_next(&lr->rings[level], off[level]);
+		left[level]--;
 	}
 }
 
@@ -356,7 +543,7 @@ static void log_one_line(unsigned int skipped,
 			 enum log_level level,
 			 const char *prefix,
 			 const char *log,
-			 const u8 *io,
+			 const u8 *io, size_t io_len,
 			 struct log_data *data)
 {
 	char buf[101];
@@ -383,11 +570,11 @@ static void log_one_line(unsigned int skipped,
 	write_all(data->fd, buf, strlen(buf));
 	write_all(data->fd, log, strlen(log));
 	if (level == LOG_IO_IN || level == LOG_IO_OUT) {
-		size_t off, used, len = tal_count(io);
+		size_t off, used;
 
 		/* No allocations, may be in signal handler. */
-		for (off = 0; off < len; off += used) {
-			used = len - off;
+		for (off = 0; off < io_len; off += used) {
+			used = io_len - off;
 			if (hex_str_size(used) > sizeof(buf))
 				used = hex_data_size(sizeof(buf));
 			hex_encode(io + off, used, buf, hex_str_size(used));
@@ -446,6 +633,271 @@ static void show_log_prefix(char buf[OPT_SHOW_LEN], const struct log *log)
 	strncpy(buf, log->prefix, OPT_SHOW_LEN);
 }
 
+/* Once we're up, log file writes are handed to a thread, so a slow disk
+ * doesn't hold up the main loop.  The queue is a single-producer,
+ * single-consumer ring: only the main thread moves tail, only the writer
+ * thread moves head, so neither needs a lock. */
+#define LOG_WRITER_BUFSIZE (1024 * 1024)
+
+enum log_writer_cmd {
+	LOG_WRITER_LINE,
+	/* Close and reopen the file (SIGHUP) */
+	LOG_WRITER_REOPEN,
+};
+
+struct log_writer {
+	char *buf;
+	/* Always increasing: use __atomic to access the other side's. */
+	size_t head, tail;
+	int fd;
+	const char *filename;
+	/* Main thread writes here to wake the writer before it's due. */
+	int wake[2];
+	unsigned int flush_msec;
+	bool drop;
+	/* Main thread only: lines dropped since the queue was last full. */
+	size_t dropped;
+	bool stopping;
+	pthread_t thread;
+	/* Forked children must not try to stop it. */
+	pid_t pid;
+};
+
+static struct log_writer *log_writer;
+
+static size_t writer_space(const struct log_writer *w)
+{
+	return LOG_WRITER_BUFSIZE
+		- (w->tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE));
+}
+
+static void writer_copy_in(struct log_writer *w, size_t pos,
+			   const void *p, size_t len)
+{
+	size_t off = pos % LOG_WRITER_BUFSIZE;
+	size_t n = LOG_WRITER_BUFSIZE - off < len ? LOG_WRITER_BUFSIZE - off : len;
+
+	memcpy(w->buf + off, p, n);
+	memcpy(w->buf, (const char *)p + n, len - n);
+}
+
+static void writer_copy_out(const struct log_writer *w, size_t pos,
+			    void *p, size_t len)
+{
+	size_t off = pos % LOG_WRITER_BUFSIZE;
+	size_t n = LOG_WRITER_BUFSIZE - off < len ? LOG_WRITER_BUFSIZE - off : len;
+
+	memcpy(p, w->buf + off, n);
+	memcpy((char *)p + n, w->buf, len - n);
+}
+
+static void writer_wake(struct log_writer *w)
+{
+	/* Non-blocking: if the pipe is full, it's going to wake anyway. */
+	if (write(w->wake[1], "", 1))
+		;
+}
+
+/* Returns false if the queue was full and we're told to drop. */
+static bool writer_push(struct log_writer *w, enum log_writer_cmd cmd,
+			const char *str, size_t len)
+{
+	u32 hdr[2];
+
+	/* Anything absurdly long gets truncated. */
+	if (len > LOG_WRITER_BUFSIZE / 2)
+		len = LOG_WRITER_BUFSIZE / 2;
+	hdr[0] = cmd;
+	hdr[1] = len;
+
+	while (writer_space(w) < sizeof(hdr) + len) {
+		if (w->drop && cmd == LOG_WRITER_LINE)
+			return false;
+		writer_wake(w);
+		nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+	}
+
+	writer_copy_in(w, w->tail, hdr, sizeof(hdr));
+	writer_copy_in(w, w->tail + sizeof(hdr), str, len);
+	__atomic_store_n(&w->tail, w->tail + sizeof(hdr) + len,
+			 __ATOMIC_RELEASE);
+
+	/* Don't wait for the timer if we're filling up. */
+	if (writer_space(w) < LOG_WRITER_BUFSIZE / 2)
+		writer_wake(w);
+	return true;
+}
+
+static void log_to_writer(const char *prefix,
+			  enum log_level level,
+			  bool continued,
+			  const struct timeabs *time,
+			  const char *str,
+			  const u8 *io,
+			  struct log_writer *w)
+{
+	char *line;
+
+	if (w->dropped) {
+		line = tal_fmt(NULL, "... %zu log lines dropped ...\n",
+			       w->dropped);
+		if (writer_push(w, LOG_WRITER_LINE, line, strlen(line)))
+			w->dropped = 0;
+		tal_free(line);
+	}
+
+	line = fmt_log_line(NULL, prefix, level, continued, time, str, io);
+	if (!writer_push(w, LOG_WRITER_LINE, line, strlen(line)))
+		w->dropped++;
+	tal_free(line);
+}
+
+/* We batch up lines, rather than doing a write() for each. */
+struct writer_out {
+	int fd;
+	size_t len;
+	char buf[65536];
+};
+
+static void writer_out_flush(struct writer_out *out)
+{
+	/* Nothing sensible to do if this fails. */
+	write_all(out->fd, out->buf, out->len);
+	out->len = 0;
+}
+
+static void *log_writer_thread(void *arg)
+{
+	struct log_writer *w = arg;
+	static struct writer_out out;
+	struct pollfd pollfd;
+	char discard[64];
+
+	out.fd = w->fd;
+	out.len = 0;
+	for (;;) {
+		size_t tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+		bool stopping = __atomic_load_n(&w->stopping, __ATOMIC_ACQUIRE);
+
+		while (w->head != tail) {
+			u32 hdr[2];
+
+			writer_copy_out(w, w->head, hdr, sizeof(hdr));
+			if (hdr[0] == LOG_WRITER_REOPEN) {
+				writer_out_flush(&out);
+				close(out.fd);
+				out.fd = open(w->filename,
+					      O_WRONLY|O_APPEND|O_CREAT, 0666);
+				if (out.fd < 0)
+					err(1, "failed to reopen log file %s",
+					    w->filename);
+			} else {
+				if (out.len + hdr[1] > sizeof(out.buf))
+					writer_out_flush(&out);
+				/* It fits, since it's at most half the ring */
+				if (hdr[1] > sizeof(out.buf)) {
+					char *line = malloc(hdr[1]);
+					writer_copy_out(w, w->head + sizeof(hdr),
+							line, hdr[1]);
+					write_all(out.fd, line, hdr[1]);
+					free(line);
+				} else {
+					writer_copy_out(w, w->head + sizeof(hdr),
+							out.buf + out.len,
+							hdr[1]);
+					out.len += hdr[1];
+				}
+			}
+			__atomic_store_n(&w->head,
+					 w->head + sizeof(hdr) + hdr[1],
+					 __ATOMIC_RELEASE);
+		}
+		writer_out_flush(&out);
+
+		if (stopping)
+			return NULL;
+
+		pollfd.fd = w->wake[0];
+		pollfd.events = POLLIN;
+		if (poll(&pollfd, 1, w->flush_msec) == 1)
+			if (read(w->wake[0], discard, sizeof(discard)))
+				;
+	}
+}
+
+/* Wait (briefly!) for everything queued to hit the file. */
+static void log_writer_flush(void)
+{
+	if (!log_writer)
+		return;
+
+	writer_wake(log_writer);
+	for (size_t i = 0; i < 1000; i++) {
+		if (__atomic_load_n(&log_writer->head, __ATOMIC_ACQUIRE)
+		    == log_writer->tail)
+			break;
+		nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+	}
+}
+
+static void log_writer_stop(void)
+{
+	if (!log_writer || log_writer->pid != getpid())
+		return;
+
+	__atomic_store_n(&log_writer->stopping, true, __ATOMIC_RELEASE);
+	writer_wake(log_writer);
+	pthread_join(log_writer->thread, NULL);
+	close(log_writer->fd);
+	log_writer = tal_free(log_writer);
+}
+
+void log_writer_start(struct lightningd *ld)
+{
+	struct log_writer *w;
+	FILE *logf;
+
+	if (!ld->logfile)
+		return;
+
+	w = tal(NULL, struct log_writer);
+	w->buf = tal_arr(w, char, LOG_WRITER_BUFSIZE);
+	w->head = w->tail = 0;
+	w->filename = tal_strdup(w, ld->logfile);
+	/* 0 would have it spinning. */
+	w->flush_msec = ld->log_flush_msec ? ld->log_flush_msec : 1;
+	w->drop = ld->log_drop;
+	w->dropped = 0;
+	w->stopping = false;
+	if (pipe(w->wake) != 0)
+		err(1, "Pipe for log writer");
+	io_fd_block(w->wake[1], false);
+
+	/* The thread takes over the file. */
+	logf = ld->log_book->print_arg;
+	fflush(logf);
+	w->fd = dup(fileno(logf));
+	if (w->fd < 0)
+		err(1, "Duplicating log file fd");
+
+	w->pid = getpid();
+	errno = pthread_create(&w->thread, NULL, log_writer_thread, w);
+	if (errno != 0) {
+		log_unusual(ld->log, "Could not start log writer: %s",
+			    strerror(errno));
+		close(w->fd);
+		close(w->wake[0]);
+		close(w->wake[1]);
+		tal_free(w);
+		return;
+	}
+
+	fclose(logf);
+	log_writer = notleak(w);
+	set_log_outfn(ld->log_book, log_to_writer, w);
+	atexit(log_writer_stop);
+}
+
 static int signalfds[2];
 
 static void handle_sighup(int sig)
@@ -464,6 +916,12 @@ static struct io_plan *rotate_log(struct io_conn *conn, struct lightningd *ld)
 	FILE *logf;
 
 	log_info(ld->log, "Ending log due to SIGHUP");
+	if (log_writer) {
+		/* It reopens the file in order with the lines around it. */
+		writer_push(log_writer, LOG_WRITER_REOPEN, "", 0);
+		log_info(ld->log, "Started log due to SIGHUP");
+		return setup_read(conn, ld);
+	}
 	fclose(ld->log->lr->print_arg);
 
 	logf = fopen(ld->logfile, "a");
@@ -526,6 +984,11 @@ void opt_register_logging(struct lightningd *ld)
 			 "log prefix");
 	opt_register_arg("--log-file=<file>", arg_log_to_file, NULL, ld,
 			 "log to file instead of stdout");
+	opt_register_arg("--log-file-flush-msec", opt_set_uintval,
+			 opt_show_uintval, &ld->log_flush_msec,
+			 "Write buffered lines to the log file this often");
+	opt_register_noarg("--log-file-drop", opt_set_bool, &ld->log_drop,
+			   "Drop log file lines, rather than wait, if the disk can't keep up");
 }
 
 void log_backtrace_print(const char *fmt, ...)
@@ -542,14 +1005,12 @@ void log_backtrace_print(const char *fmt, ...)
 
 static void log_dump_to_file(int fd, const struct log_book *lr)
 {
-	const struct log_entry *i;
 	char buf[100];
 	int len;
 	struct log_data data;
 	time_t start;
 
-	i = list_top(&lr->log, const struct log_entry, list);
-	if (!i) {
+	if (lr->next_seq == 0) {
 		write_all(fd, "0 bytes:\n\n", strlen("0 bytes:\n\n"));
 		return;
 	}
@@ -578,6 +1039,9 @@ void log_backtrace_exit(void)
 	if (!crashlog)
 		return;
 
+	/* Get what we already said into the log file. */
+	log_writer_flush();
+
 	/* We expect to be in config dir. */
 	snprintf(logfile, sizeof(logfile), "crash.log.%s", timebuf);
 
@@ -611,6 +1075,7 @@ void fatal(const char *fmt, ...)
 	va_start(ap, fmt);
 	logv(crashlog, LOG_BROKEN, fmt, ap);
 	va_end(ap);
+	log_writer_flush();
 	abort();
 }
 
@@ -647,7 +1112,7 @@ static void log_to_json(unsigned int skipped,
 			enum log_level level,
 			const char *prefix,
 			const char *log,
-			const u8 *io,
+			const u8 *io, size_t io_len,
 			struct log_info *info)
 {
 	info->num_skipped += skipped;
@@ -672,7 +1137,7 @@ static void log_to_json(unsigned int skipped,
 	json_add_string(info->response, "source", prefix);
 	json_add_string(info->response, "log", log);
 	if (io)
-		json_add_hex_talarr(info->response, "data", io);
+		json_add_hex(info->response, "data", io, io_len);
 
 	json_object_end(info->response);
 }
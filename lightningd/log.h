@@ -75,15 +75,17 @@ const struct timeabs *log_init_time(const struct log_book *lr);
 					   enum log_level,		\
 					   const char *,		\
 					   const char *,		\
-					   const u8 *), (arg))
+					   const u8 *,			\
+					   size_t), (arg))
 
+/* io is NULL unless level is LOG_IO_IN/LOG_IO_OUT. */
 void log_each_line_(const struct log_book *lr,
 		    void (*func)(unsigned int skipped,
 				 struct timerel time,
 				 enum log_level level,
 				 const char *prefix,
 				 const char *log,
-				 const u8 *io,
+				 const u8 *io, size_t io_len,
 				 void *arg),
 		    void *arg);
 
@@ -92,6 +94,9 @@ void opt_register_logging(struct lightningd *ld);
 
 char *arg_log_to_file(const char *arg, struct lightningd *ld);
 
+/* Hand log file writes to a background thread (after any fork!) */
+void log_writer_start(struct lightningd *ld);
+
 /* Once this is set, we dump fatal with a backtrace to this log */
 extern struct log *crashlog;
 void NORETURN PRINTF_FMT(1,2) fatal(const char *fmt, ...);
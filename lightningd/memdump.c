@@ -11,6 +11,8 @@
 #include <lightningd/lightningd.h>
 #include <lightningd/log.h>
 #include <stdio.h>
+#include <wallet/invoices.h>
+#include <wallet/wallet.h>
 
 static void json_add_ptr(struct json_result *response, const char *name,
 			 const void *ptr)
@@ -120,6 +122,8 @@ static void scan_mem(struct command *cmd,
 	memleak_remove_htable(memtable, &ld->topology->txowatches.raw);
 	memleak_remove_htable(memtable, &ld->htlcs_in.raw);
 	memleak_remove_htable(memtable, &ld->htlcs_out.raw);
+	memleak_remove_onion_replay(memtable, ld->onion_replay);
+	memleak_remove_invoices(memtable, ld->wallet->invoices);
 
 	/* Now delete ld and those which it has pointers to. */
 	memleak_remove_referenced(memtable, ld);
@@ -103,6 +103,21 @@ static char *opt_set_u32(const char *arg, u32 *u)
 	return NULL;
 }
 
+/* gossipd is told this as a u16, but each is a thread: keep it sane. */
+#define ROUTE_THREADS_MAX 64
+
+static char *opt_set_route_threads(const char *arg, u32 *u)
+{
+	char *err = opt_set_u32(arg, u);
+
+	if (err)
+		return err;
+	if (*u > ROUTE_THREADS_MAX)
+		return tal_fmt(NULL, "'%s' is more than %u route threads",
+			       arg, ROUTE_THREADS_MAX);
+	return NULL;
+}
+
 static char *opt_set_s32(const char *arg, s32 *u)
 {
 	char *endp;
@@ -387,6 +402,14 @@ static void config_register_opts(struct lightningd *ld)
 	opt_register_noarg("--disable-dns", opt_set_invbool, &ld->config.use_dns,
 			   "Disable DNS lookups of peers");
 
+	opt_register_arg("--max-concurrent-dials", opt_set_u32, opt_show_u32,
+			 &ld->config.max_concurrent_dials,
+			 "Maximum addresses to try at once when connecting to a peer");
+
+	opt_register_arg("--route-threads", opt_set_route_threads, opt_show_u32,
+			 &ld->config.route_threads,
+			 "Threads to search for routes in, so gossip isn't held up (0 for none)");
+
 #if DEVELOPER
 	opt_register_arg("--dev-max-funding-unconfirmed-blocks",
 			 opt_set_u32, opt_show_u32,
@@ -483,6 +506,12 @@ static const struct config testnet_config = {
 	.max_fee_multiplier = 10,
 
 	.use_dns = true,
+
+	/* Try up to 3 of a peer's addresses at once when connecting. */
+	.max_concurrent_dials = 3,
+
+	/* Two route searches at once is plenty for one node's payments. */
+	.route_threads = 2,
 };
 
 /* aka. "Dude, where's my coins?" */
@@ -546,6 +575,12 @@ static const struct config mainnet_config = {
 	.max_fee_multiplier = 10,
 
 	.use_dns = true,
+
+	/* Try up to 3 of a peer's addresses at once when connecting. */
+	.max_concurrent_dials = 3,
+
+	/* Two route searches at once is plenty for one node's payments. */
+	.route_threads = 2,
 };
 
 static void check_config(struct lightningd *ld)
@@ -561,6 +596,9 @@ static void check_config(struct lightningd *ld)
 	if (ld->config.anchor_confirms == 0)
 		fatal("anchor-confirms must be greater than zero");
 
+	if (ld->config.max_concurrent_dials == 0)
+		fatal("max-concurrent-dials must be greater than zero");
+
 	if (ld->use_proxy_always && !ld->proxyaddr)
 		fatal("--always-use-proxy needs --proxy");
 }
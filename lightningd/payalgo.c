@@ -113,6 +113,16 @@ struct pay {
 	/* Current fuzz we pass into getroute. */
 	double fuzz;
 
+	/* Seed and overpayment for that fuzz.  We keep them across retries,
+	 * so gossipd sees the same request and only has to route around
+	 * what failed. */
+	struct siphash_seed seed;
+	u64 overpayment;
+
+	/* The channels in the invoice's route hints, less any which
+	 * failed us. */
+	struct route_hint *hints;
+
 	/* Parent of the current pay attempt. This object is
 	 * freed, then allocated at the start of each pay
 	 * attempt to ensure no leaks across long pay attempts */
@@ -310,6 +320,21 @@ static const char *should_delay_retry(const tal_t *ctx,
 /* Start a payment attempt. */
 static bool json_pay_try(struct pay *pay);
 
+/* gossipd doesn't know the channels in route hints, so can't mark them
+ * unroutable when they fail: we simply stop offering them. */
+static void json_pay_drop_hint(struct pay *pay,
+			       const struct short_channel_id *scid)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < tal_count(pay->hints); i++) {
+		if (short_channel_id_eq(&pay->hints[i].scid, scid))
+			continue;
+		pay->hints[n++] = pay->hints[i];
+	}
+	tal_resize(&pay->hints, n);
+}
+
 /* Used when delaying. */
 static void do_pay_try(struct pay *pay)
 {
@@ -343,6 +368,8 @@ static void json_pay_sendpay_resolve(const struct sendpay_result *r,
 	}
 
 	add_pay_failure(pay, r);
+	if (r->errorcode == PAY_TRY_OTHER_ROUTE)
+		json_pay_drop_hint(pay, &r->routing_failure->erring_channel);
 
 	/* Should retry here, question is whether to retry now or later */
 
@@ -406,6 +433,32 @@ static void json_pay_sendpay_resume(const struct sendpay_result *r,
 	}
 }
 
+/* Pick a new seed and overpayment, for a new fuzz. */
+static void json_pay_set_fuzz(struct pay *pay, double fuzz)
+{
+	u64 maxoverpayment;
+
+	pay->fuzz = fuzz;
+
+	/* Generate random seed */
+	randombytes_buf(&pay->seed, sizeof(pay->seed));
+
+	/* Generate an overpayment, from fuzz * maxfee. */
+	/* Now normally the use of double for money is very bad.
+	 * Note however that a later stage will ensure that
+	 * we do not end up paying more than maxfeepercent
+	 * of the msatoshi we intend to pay. */
+	maxoverpayment = ((double) pay->msatoshi * pay->fuzz * pay->maxfeepercent)
+		/ 100.0;
+	if (maxoverpayment > 0) {
+		/* We will never generate the maximum computed
+		 * overpayment this way. Maybe OK for most
+		 * purposes. */
+		pay->overpayment = pseudorand(maxoverpayment);
+	} else
+		pay->overpayment = 0;
+}
+
 static void json_pay_getroute_reply(struct subd *gossip UNUSED,
 				    const u8 *reply, const int *fds UNUSED,
 				    struct pay *pay)
@@ -484,9 +537,10 @@ static void json_pay_getroute_reply(struct subd *gossip UNUSED,
 	}
 	if (fee_too_high || delay_too_high) {
 		/* Retry with lower fuzz */
-		pay->fuzz -= 0.15;
-		if (pay->fuzz <= 0.0)
-			pay->fuzz = 0.0;
+		if (pay->fuzz - 0.15 <= 0.0)
+			json_pay_set_fuzz(pay, 0.0);
+		else
+			json_pay_set_fuzz(pay, pay->fuzz - 0.15);
 		json_pay_try(pay);
 		return;
 	}
@@ -513,9 +567,6 @@ static bool json_pay_try(struct pay *pay)
 	u8 *req;
 	struct command *cmd = pay->cmd;
 	struct timeabs now = time_now();
-	struct siphash_seed seed;
-	u64 maxoverpayment;
-	u64 overpayment;
 
 	/* If too late anyway, fail now. */
 	if (time_after(now, pay->expiry)) {
@@ -539,35 +590,17 @@ static bool json_pay_try(struct pay *pay)
 	/* Clear route */
 	pay->route = tal_free(pay->route);
 
-	/* Generate random seed */
-	randombytes_buf(&seed, sizeof(seed));
-
-	/* Generate an overpayment, from fuzz * maxfee. */
-	/* Now normally the use of double for money is very bad.
-	 * Note however that a later stage will ensure that
-	 * we do not end up paying more than maxfeepercent
-	 * of the msatoshi we intend to pay. */
-	maxoverpayment = ((double) pay->msatoshi * pay->fuzz * pay->maxfeepercent)
-		/ 100.0;
-	if (maxoverpayment > 0) {
-		/* We will never generate the maximum computed
-		 * overpayment this way. Maybe OK for most
-		 * purposes. */
-		overpayment = pseudorand(maxoverpayment);
-	} else
-		overpayment = 0;
-
 	++pay->getroute_tries;
 
-	/* FIXME: use b11->routes */
 	req = towire_gossip_getroute_request(pay->try_parent,
 					     &cmd->ld->id,
 					     &pay->receiver_id,
-					     pay->msatoshi + overpayment,
+					     pay->msatoshi + pay->overpayment,
 					     pay->riskfactor,
 					     pay->min_final_cltv_expiry,
 					     &pay->fuzz,
-					     &seed);
+					     &pay->seed,
+					     pay->hints);
 	subd_req(pay->try_parent, cmd->ld->gossip, req, -1, 0, json_pay_getroute_reply, pay);
 
 	return true;
@@ -596,6 +629,35 @@ static void json_pay_stop_retrying(struct pay *pay)
 	json_pay_failure(pay, sr);
 }
 
+/* Each hop of each route hint is a channel from its pubkey to the next
+ * hop's, or to the payee for the last. */
+static struct route_hint *route_hints(const tal_t *ctx,
+				      const struct bolt11 *b11)
+{
+	struct route_hint *hints = tal_arr(ctx, struct route_hint, 0);
+
+	for (size_t i = 0; i < tal_count(b11->routes); i++) {
+		const struct route_info *r = b11->routes[i];
+
+		for (size_t j = 0; j < tal_count(r); j++) {
+			size_t n = tal_count(hints);
+
+			tal_resize(&hints, n + 1);
+			hints[n].source = r[j].pubkey;
+			if (j + 1 < tal_count(r))
+				hints[n].destination = r[j + 1].pubkey;
+			else
+				hints[n].destination = b11->receiver_id;
+			hints[n].scid = r[j].short_channel_id;
+			hints[n].fee_base_msat = r[j].fee_base_msat;
+			hints[n].fee_proportional_millionths
+				= r[j].fee_proportional_millionths;
+			hints[n].cltv_expiry_delta = r[j].cltv_expiry_delta;
+		}
+	}
+	return hints;
+}
+
 static void json_pay(struct command *cmd,
 		     const char *buffer, const jsmntok_t *params)
 {
@@ -637,6 +699,7 @@ static void json_pay(struct command *cmd,
 	pay->expiry.ts.tv_sec = b11->timestamp + b11->expiry;
 	pay->min_final_cltv_expiry = b11->min_final_cltv_expiry;
 	pay->exemptfee = *exemptfee;
+	pay->hints = route_hints(pay, b11);
 
 	if (b11->msatoshi) {
 		if (msatoshi) {
@@ -677,7 +740,7 @@ static void json_pay(struct command *cmd,
 	 * fuzz means, if the user allows high fee/locktime, we can take
 	 * advantage of that to increase randomization and
 	 * improve privacy somewhat. */
-	pay->fuzz = 0.75;
+	json_pay_set_fuzz(pay, 0.75);
 	pay->try_parent = NULL;
 	/* Start with no route */
 	pay->route = NULL;
@@ -948,28 +948,27 @@ void activate_peers(struct lightningd *ld)
 /* Pull peers, channels and HTLCs from db, and wire them up. */
 void load_channels_from_wallet(struct lightningd *ld)
 {
-	struct peer *peer;
+	u32 min_blockheight, max_blockheight;
 
 	/* Load peers from database */
 	if (!wallet_channels_load_active(ld, ld->wallet))
 		fatal("Could not load channels from the database");
 
-	/* This is a poor-man's db join :( */
-	list_for_each(&ld->peers, peer, list) {
-		struct channel *channel;
-
-		list_for_each(&peer->channels, channel, list) {
-			if (!wallet_htlcs_load_for_channel(ld->wallet,
-							   channel,
-							   &ld->htlcs_in,
-							   &ld->htlcs_out)) {
-				fatal("could not load htlcs for channel");
-			}
-		}
-	}
+	/* Load all HTLCs in one go, indexed by their channel's dbid. */
+	if (!wallet_htlcs_load(ld->wallet, &ld->peers,
+			       &ld->htlcs_in, &ld->htlcs_out))
+		fatal("could not load htlcs from the database");
 
 	/* Now connect HTLC pointers together */
 	htlcs_reconnect(ld, &ld->htlcs_in, &ld->htlcs_out);
+
+	/* Remember every onion we've accepted, even for resolved HTLCs.
+	 * Topology isn't up yet, so use the last block we processed. */
+	wallet_blocks_heights(ld->wallet, 0, &min_blockheight, &max_blockheight);
+	if (!wallet_onion_replay_load(ld->wallet, ld->onion_replay,
+				      max_blockheight,
+				      onion_replay_max_blocks(ld)))
+		fatal("could not load onion secrets from the database");
 }
 
 static void json_disconnect(struct command *cmd,
@@ -1,6 +1,7 @@
 #include <bitcoin/tx.h>
 #include <ccan/build_assert/build_assert.h>
 #include <ccan/cast/cast.h>
+#include <ccan/intmap/intmap.h>
 #include <ccan/crypto/ripemd160/ripemd160.h>
 #include <ccan/mem/mem.h>
 #include <ccan/tal/str/str.h>
@@ -242,6 +243,27 @@ static void fulfill_htlc(struct htlc_in *hin, const struct preimage *preimage)
 	subd_send_msg(channel->owner, take(msg));
 }
 
+u32 onion_replay_max_blocks(const struct lightningd *ld)
+{
+	/* We won't forward with an outgoing cltv further out than
+	 * locktime_max, so the incoming one should be within this. */
+	return ld->config.locktime_max + ld->config.cltv_expiry_delta;
+}
+
+/* Only onions which passed every check go in the replay cache, so a peer
+ * can't fill it with junk.  Nor can they make us remember one forever with
+ * a silly cltv_expiry. */
+static void remember_onion(struct lightningd *ld, const struct htlc_in *hin)
+{
+	u32 expiry = get_block_height(ld->topology)
+		+ onion_replay_max_blocks(ld);
+
+	if (hin->cltv_expiry < expiry)
+		expiry = hin->cltv_expiry;
+	onion_replay_add(ld->onion_replay, &hin->shared_secret,
+			 expiry, hin->dbid);
+}
+
 static void handle_localpay(struct htlc_in *hin,
 			    u32 cltv_expiry,
 			    const struct sha256 *payment_hash,
@@ -328,6 +350,7 @@ static void handle_localpay(struct htlc_in *hin,
 		 details->label->s, hin->key.id);
 	log_debug(ld->log, "%s: Actual amount %"PRIu64"msat, HTLC expiry %u",
 		  details->label->s, hin->msatoshi, cltv_expiry);
+	remember_onion(ld, hin);
 	fulfill_htlc(hin, &details->r);
 	wallet_invoice_resolve(ld->wallet, invoice, hin->msatoshi);
 
@@ -542,8 +565,10 @@ static void forward_htlc(struct htlc_in *hin,
 	failcode = send_htlc_out(next, amt_to_forward,
 				 outgoing_cltv_value, &hin->payment_hash,
 				 next_onion, hin, NULL);
-	if (!failcode)
+	if (!failcode) {
+		remember_onion(ld, hin);
 		return;
+	}
 
 fail:
 	local_fail_htlc(hin, failcode, next->scid);
@@ -666,6 +691,16 @@ static bool peer_accepted_htlc(struct channel *channel,
 		goto out;
 	}
 
+	/* A replayed onion has the same shared secret: catch it before we
+	 * do any more work on it. */
+	if (onion_replay_seen(ld->onion_replay, &hin->shared_secret,
+			      hin->dbid)) {
+		log_unusual(channel->log, "their htlc %"PRIu64" replays an onion",
+			    id);
+		*failcode = WIRE_TEMPORARY_NODE_FAILURE;
+		goto out;
+	}
+
 	/* If it's crap, not channeld's fault, just fail it */
 	rs = process_onionpacket(tmpctx, op, hin->shared_secret.data,
 				 hin->payment_hash.u.u8,
@@ -1583,6 +1618,9 @@ void htlcs_notify_new_block(struct lightningd *ld, u32 height)
 {
 	bool removed;
 
+	/* Any replay of these would fail the cltv checks anyway. */
+	onion_replay_expire(ld->onion_replay, height);
+
 	/* BOLT #2:
 	 *
 	 *   - if an HTLC which it offered is in either node's current
@@ -1686,6 +1724,14 @@ void htlcs_reconnect(struct lightningd *ld,
 	struct htlc_out_map_iter outi;
 	struct htlc_in *hin;
 	struct htlc_out *hout;
+	UINTMAP(struct htlc_in *) hin_by_dbid;
+
+	/* htlcs_in is keyed by channel and id, so index by dbid first
+	 * rather than scanning all of them for each htlc_out. */
+	uintmap_init(&hin_by_dbid);
+	for (hin = htlc_in_map_first(htlcs_in, &ini); hin;
+	     hin = htlc_in_map_next(htlcs_in, &ini))
+		uintmap_add(&hin_by_dbid, hin->dbid, hin);
 
 	for (hout = htlc_out_map_first(htlcs_out, &outi); hout;
 	     hout = htlc_out_map_next(htlcs_out, &outi)) {
@@ -1694,22 +1740,18 @@ void htlcs_reconnect(struct lightningd *ld,
 			continue;
 		}
 
-		for (hin = htlc_in_map_first(htlcs_in, &ini); hin;
-		     hin = htlc_in_map_next(htlcs_in, &ini)) {
-			if (hout->origin_htlc_id == hin->dbid) {
-				log_debug(ld->log,
-					  "Found corresponding htlc_in %" PRIu64
-					  " for htlc_out %" PRIu64,
-					  hin->dbid, hout->dbid);
-				hout->in = hin;
-				break;
-			}
-		}
-
-		if (!hout->in)
+		hin = uintmap_get(&hin_by_dbid, hout->origin_htlc_id);
+		if (!hin)
 			fatal("Unable to find corresponding htlc_in %"PRIu64" for htlc_out %"PRIu64,
 			      hout->origin_htlc_id, hout->dbid);
+
+		log_debug(ld->log,
+			  "Found corresponding htlc_in %" PRIu64
+			  " for htlc_out %" PRIu64,
+			  hin->dbid, hout->dbid);
+		hout->in = hin;
 	}
+	uintmap_clear(&hin_by_dbid);
 }
 
 
@@ -25,6 +25,9 @@ struct channel_info {
 	u32 feerate_per_kw[NUM_SIDES];
 };
 
+/* How many blocks past the current height we remember an onion for. */
+u32 onion_replay_max_blocks(const struct lightningd *ld);
+
 /* Get all HTLCs for a peer, to send in init message. */
 void peer_htlcs(const tal_t *ctx,
 		const struct channel *channel,
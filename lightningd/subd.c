@@ -136,6 +136,7 @@ static void close_taken_fds(va_list *ap)
 /* We use sockets, not pipes, because fds are bidir. */
 static int subd(const char *dir, const char *name,
 		const char *debug_subdaemon,
+		enum log_level log_level,
 		int *msgfd, int dev_disconnect_fd, va_list *ap)
 {
 	int childmsg[2], execfail[2];
@@ -160,7 +161,7 @@ static int subd(const char *dir, const char *name,
 		int fdnum = 3, i, stdin_is_now = STDIN_FILENO;
 		long max;
 		size_t num_args;
-		char *args[] = { NULL, NULL, NULL, NULL };
+		char *args[] = { NULL, NULL, NULL, NULL, NULL };
 
 		close(childmsg[0]);
 		close(execfail[0]);
@@ -199,6 +200,8 @@ static int subd(const char *dir, const char *name,
 
 		num_args = 0;
 		args[num_args++] = path_join(NULL, dir, name);
+		/* So it doesn't send us things we'd only throw away. */
+		args[num_args++] = tal_fmt(NULL, "--log-level=%u", log_level);
 #if DEVELOPER
 		if (dev_disconnect_fd != -1)
 			args[num_args++] = tal_fmt(NULL, "--dev-disconnect=%i", dev_disconnect_fd);
@@ -401,8 +404,9 @@ static struct io_plan *sd_msg_read(struct io_conn *conn, struct subd *sd)
 	struct db *db = sd->ld->wallet->db;
 	struct io_plan *plan;
 
-	/* Everything we do, we wrap in a database transaction */
-	db_begin_transaction(db);
+	/* Everything we do, we wrap in a database transaction; it's lazy, so
+	 * status messages (which don't touch the db) don't cost a BEGIN. */
+	db_begin_lazy_transaction(db);
 
 	if (type == -1)
 		goto malformed;
@@ -558,7 +562,7 @@ static void destroy_subd(struct subd *sd)
 		/* We can be freed both inside msg handling, or spontaneously. */
 		outer_transaction = db->in_transaction;
 		if (!outer_transaction)
-			db_begin_transaction(db);
+			db_begin_lazy_transaction(db);
 		if (sd->errcb)
 			sd->errcb(channel, -1, -1, NULL, NULL,
 				  tal_fmt(sd, "Owning subdaemon %s died (%i)",
@@ -624,6 +628,7 @@ static struct subd *new_subd(struct lightningd *ld,
 	int msg_fd;
 	const char *debug_subd = NULL;
 	int disconnect_fd = -1;
+	struct log_book *log_book;
 
 	assert(name != NULL);
 
@@ -632,7 +637,10 @@ static struct subd *new_subd(struct lightningd *ld,
 	disconnect_fd = ld->dev_disconnect_fd;
 #endif /* DEVELOPER */
 
+	/* Per-peer logs have their own log book. */
+	log_book = base_log ? get_log_book(base_log) : ld->log_book;
 	sd->pid = subd(ld->daemon_dir, name, debug_subd,
+		       get_log_level(log_book),
 		       &msg_fd, disconnect_fd, ap);
 	if (sd->pid == (pid_t)-1) {
 		log_unusual(ld->log, "subd %s failed: %s",
@@ -641,10 +649,10 @@ static struct subd *new_subd(struct lightningd *ld,
 	}
 	sd->ld = ld;
 	if (base_log) {
-		sd->log = new_log(sd, get_log_book(base_log), "%s-%s", name,
+		sd->log = new_log(sd, log_book, "%s-%s", name,
 				  log_prefix(base_log));
 	} else {
-		sd->log = new_log(sd, ld->log_book, "%s(%u):", name, sd->pid);
+		sd->log = new_log(sd, log_book, "%s(%u):", name, sd->pid);
 	}
 
 	sd->name = name;
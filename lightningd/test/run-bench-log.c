@@ -0,0 +1,263 @@
+#include "../log.c"
+#include <ccan/opt/opt.h>
+#include <ccan/tal/grab_file/grab_file.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for command_fail */
+void  command_fail(struct command *cmd UNNEEDED, int code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "command_fail called!\n"); abort(); }
+/* Generated stub for command_success */
+void command_success(struct command *cmd UNNEEDED, struct json_result *response UNNEEDED)
+{ fprintf(stderr, "command_success called!\n"); abort(); }
+/* Generated stub for json_add_hex */
+void json_add_hex(struct json_result *result UNNEEDED, const char *fieldname UNNEEDED,
+		  const void *data UNNEEDED, size_t len UNNEEDED)
+{ fprintf(stderr, "json_add_hex called!\n"); abort(); }
+/* Generated stub for json_add_num */
+void json_add_num(struct json_result *result UNNEEDED, const char *fieldname UNNEEDED,
+		  unsigned int value UNNEEDED)
+{ fprintf(stderr, "json_add_num called!\n"); abort(); }
+/* Generated stub for json_add_string */
+void json_add_string(struct json_result *result UNNEEDED, const char *fieldname UNNEEDED, const char *value UNNEEDED)
+{ fprintf(stderr, "json_add_string called!\n"); abort(); }
+/* Generated stub for json_array_end */
+void json_array_end(struct json_result *ptr UNNEEDED)
+{ fprintf(stderr, "json_array_end called!\n"); abort(); }
+/* Generated stub for json_array_start */
+void json_array_start(struct json_result *ptr UNNEEDED, const char *fieldname UNNEEDED)
+{ fprintf(stderr, "json_array_start called!\n"); abort(); }
+/* Generated stub for json_object_end */
+void json_object_end(struct json_result *ptr UNNEEDED)
+{ fprintf(stderr, "json_object_end called!\n"); abort(); }
+/* Generated stub for json_object_start */
+void json_object_start(struct json_result *ptr UNNEEDED, const char *fieldname UNNEEDED)
+{ fprintf(stderr, "json_object_start called!\n"); abort(); }
+/* Generated stub for json_tok_streq */
+bool json_tok_streq(const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED, const char *str UNNEEDED)
+{ fprintf(stderr, "json_tok_streq called!\n"); abort(); }
+/* Generated stub for new_json_result */
+struct json_result *new_json_result(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "new_json_result called!\n"); abort(); }
+/* Generated stub for param */
+bool param(struct command *cmd UNNEEDED, const char *buffer UNNEEDED,
+	   const jsmntok_t params[] UNNEEDED, ...)
+{ fprintf(stderr, "param called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static size_t num_printed;
+
+static void count_print(const char *prefix UNUSED,
+			enum log_level level UNUSED,
+			bool continued UNUSED,
+			const struct timeabs *time UNUSED,
+			const char *str UNUSED, const u8 *io UNUSED,
+			void *unused UNUSED)
+{
+	num_printed++;
+}
+
+struct check_state {
+	u64 expect_seq;
+	size_t lines;
+	enum log_level last_level;
+	const char *last_log;
+};
+
+static void check_line(unsigned int skipped,
+		       struct timerel diff UNUSED,
+		       enum log_level level,
+		       const char *prefix,
+		       const char *log,
+		       const u8 *io, size_t io_len,
+		       struct check_state *state)
+{
+	u64 seq;
+
+	/* Lines come out in order, and skips account for the rest. */
+	state->expect_seq += skipped;
+	assert(strstarts(prefix, "test"));
+	assert(sscanf(log, "line %"SCNu64, &seq) == 1);
+	assert(seq == state->expect_seq);
+	assert(level == seq % (LOG_LEVEL_MAX + 1));
+	if (level <= LOG_IO_IN)
+		assert(io && io_len == seq % 100);
+	else
+		assert(!io && io_len == 0);
+	state->expect_seq++;
+	state->lines++;
+	state->last_level = level;
+	state->last_log = log;
+}
+
+static void log_line(struct log *log, u64 seq, const u8 *io)
+{
+	enum log_level level = seq % (LOG_LEVEL_MAX + 1);
+
+	if (level <= LOG_IO_IN)
+		log_io(log, level, tal_fmt(tmpctx, "line %"PRIu64, seq),
+		       io, seq % 100);
+	else
+		log_(log, level, "line %"PRIu64, seq);
+}
+
+static void check_log_book(void)
+{
+	struct log_book *lr = new_log_book(64 * 1024, LOG_BROKEN);
+	struct log *log = new_log(tmpctx, lr, "test");
+	struct check_state state;
+	u8 io[100];
+	char *big;
+
+	memset(io, 0xAA, sizeof(io));
+	set_log_outfn(lr, count_print, NULL);
+
+	/* Empty */
+	state.expect_seq = state.lines = 0;
+	log_each_line(lr, check_line, &state);
+	assert(state.lines == 0);
+	assert(log_used(lr) == 0);
+
+	/* Fill all the rings a few times over. */
+	for (u64 i = 0; i < 10000; i++) {
+		log_line(log, i, io);
+		assert(log_used(lr) <= log_max_mem(lr));
+	}
+
+	state.expect_seq = state.lines = 0;
+	log_each_line(lr, check_line, &state);
+	assert(state.lines > 0 && state.lines < 10000);
+	assert(state.expect_seq == 10000);
+	assert(state.last_level == 9999 % (LOG_LEVEL_MAX + 1));
+
+	/* Continuing the last line replaces it. */
+	log_add(log, " and more");
+	state.expect_seq = state.lines = 0;
+	log_each_line(lr, check_line, &state);
+	assert(state.expect_seq == 10000);
+	assert(streq(state.last_log, "line 9999 and more"));
+
+	/* Something too large for its ring gets truncated. */
+	big = tal_arr(tmpctx, char, 64 * 1024);
+	memset(big, 'x', tal_count(big) - 1);
+	big[tal_count(big) - 1] = '\0';
+	log_line(log, 10000, NULL);
+	log_(log, 10001 % (LOG_LEVEL_MAX + 1), "line 10001 %s", big);
+	state.expect_seq = state.lines = 0;
+	log_each_line(lr, check_line, &state);
+	assert(state.expect_seq == 10002);
+	assert(strlen(state.last_log) < lr->rings[LOG_BROKEN].size);
+
+	/* Only LOG_BROKEN was printed. */
+	assert(num_printed == 10002 / (LOG_LEVEL_MAX + 1));
+	tal_free(log);
+}
+
+/* With --log-file-drop, a full queue drops lines rather than waiting. */
+static void check_writer_drop(void)
+{
+	struct log_writer *w = tal(tmpctx, struct log_writer);
+	char filename[] = "/tmp/run-bench-log.XXXXXX";
+	struct timeabs now = time_now();
+	size_t queued = 0, lines = 0;
+	char *contents, *p;
+
+	w->buf = tal_arr(w, char, LOG_WRITER_BUFSIZE);
+	w->head = w->tail = 0;
+	w->filename = filename;
+	w->flush_msec = 1;
+	w->drop = true;
+	w->dropped = 0;
+	w->stopping = false;
+	if (pipe(w->wake) != 0)
+		err(1, "pipe");
+	io_fd_block(w->wake[1], false);
+	w->fd = mkstemp(filename);
+	if (w->fd < 0)
+		err(1, "mkstemp");
+
+	/* No thread is emptying it yet: if it waited, we'd never finish. */
+	while (w->dropped < 3) {
+		log_to_writer("test", LOG_INFORM, false, &now, "line", NULL, w);
+		if (!w->dropped)
+			queued++;
+	}
+	assert(queued > 0 && queued < LOG_WRITER_BUFSIZE);
+
+	/* Once it's drained, the next line owns up to the gap. */
+	errno = pthread_create(&w->thread, NULL, log_writer_thread, w);
+	if (errno != 0)
+		err(1, "pthread_create");
+	while (__atomic_load_n(&w->head, __ATOMIC_ACQUIRE) != w->tail)
+		nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+	log_to_writer("test", LOG_INFORM, false, &now, "last", NULL, w);
+	assert(w->dropped == 0);
+
+	__atomic_store_n(&w->stopping, true, __ATOMIC_RELEASE);
+	writer_wake(w);
+	pthread_join(w->thread, NULL);
+
+	contents = grab_file(tmpctx, filename);
+	assert(contents);
+	for (p = contents; (p = strchr(p, '\n')) != NULL; p++)
+		lines++;
+	assert(lines == queued + 2);
+	/* The note comes right before the last line. */
+	p = strstr(contents, "... 3 log lines dropped ...\n");
+	assert(p);
+	p = strchr(p, '\n') + 1;
+	assert(strchr(p, '\n') == contents + strlen(contents) - 1);
+	assert(strends(contents, " test last\n"));
+
+	close(w->fd);
+	close(w->wake[0]);
+	close(w->wake[1]);
+	unlink(filename);
+}
+
+int main(int argc, char *argv[])
+{
+	struct log_book *lr;
+	struct log *log;
+	size_t num = 1000;
+	struct timemono start;
+	u8 io[100];
+
+	setup_locale();
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num = atoi(argv[1]);
+	if (argc > 2 || num == 0)
+		opt_usage_and_exit("[num_lines]");
+
+	check_log_book();
+	check_writer_drop();
+
+	/* Same size as lightningd's, printing everything as --log-level=io
+	 * would (but to nowhere). */
+	lr = new_log_book(20*1024*1024, LOG_IO_OUT);
+	log = new_log(NULL, lr, "test");
+	set_log_outfn(lr, count_print, NULL);
+	memset(io, 0xAA, sizeof(io));
+
+	start = time_mono();
+	for (size_t i = 0; i < num; i++) {
+		log_line(log, i, io);
+		if (i % 1000 == 0)
+			clean_tmpctx();
+	}
+
+	printf("%zu log lines in %"PRIu64" nanoseconds each (%zu bytes used)\n",
+	       num,
+	       time_to_nsec(time_divide(timemono_since(start), num)),
+	       log_used(lr));
+
+	tal_free(log);
+	tal_free(tmpctx);
+	opt_free_table();
+	return 0;
+}
@@ -36,6 +36,9 @@ void daemon_shutdown(void)
 /* Generated stub for db_assert_no_outstanding_statements */
 void db_assert_no_outstanding_statements(void)
 { fprintf(stderr, "db_assert_no_outstanding_statements called!\n"); abort(); }
+/* Generated stub for db_begin_lazy_transaction_ */
+void db_begin_lazy_transaction_(struct db *db UNNEEDED, const char *location UNNEEDED)
+{ fprintf(stderr, "db_begin_lazy_transaction_ called!\n"); abort(); }
 /* Generated stub for db_begin_transaction_ */
 void db_begin_transaction_(struct db *db UNNEEDED, const char *location UNNEEDED)
 { fprintf(stderr, "db_begin_transaction_ called!\n"); abort(); }
@@ -69,6 +72,9 @@ bool fromwire_status_peer_error(const tal_t *ctx UNNEEDED, const void *p UNNEEDE
 /* Generated stub for get_log_book */
 struct log_book *get_log_book(const struct log *log UNNEEDED)
 { fprintf(stderr, "get_log_book called!\n"); abort(); }
+/* Generated stub for get_log_level */
+enum log_level get_log_level(struct log_book *lr UNNEEDED)
+{ fprintf(stderr, "get_log_level called!\n"); abort(); }
 /* Generated stub for gossip_init */
 void gossip_init(struct lightningd *ld UNNEEDED, int connectd_fd UNNEEDED)
 { fprintf(stderr, "gossip_init called!\n"); abort(); }
@@ -106,6 +112,9 @@ const char *log_prefix(const struct log *log UNNEEDED)
 /* Generated stub for log_status_msg */
 bool log_status_msg(struct log *log UNNEEDED, const u8 *msg UNNEEDED)
 { fprintf(stderr, "log_status_msg called!\n"); abort(); }
+/* Generated stub for log_writer_start */
+void log_writer_start(struct lightningd *ld UNNEEDED)
+{ fprintf(stderr, "log_writer_start called!\n"); abort(); }
 /* Generated stub for new_log */
 struct log *new_log(const tal_t *ctx UNNEEDED, struct log_book *record UNNEEDED, const char *fmt UNNEEDED, ...)
 { fprintf(stderr, "new_log called!\n"); abort(); }
@@ -119,6 +128,9 @@ struct chain_topology *new_topology(struct lightningd *ld UNNEEDED, struct log *
 /* Generated stub for onchaind_replay_channels */
 void onchaind_replay_channels(struct lightningd *ld UNNEEDED)
 { fprintf(stderr, "onchaind_replay_channels called!\n"); abort(); }
+/* Generated stub for onion_replay_new */
+struct onion_replay *onion_replay_new(const tal_t *ctx UNNEEDED, size_t max_entries UNNEEDED)
+{ fprintf(stderr, "onion_replay_new called!\n"); abort(); }
 /* Generated stub for register_opts */
 void register_opts(struct lightningd *ld UNNEEDED)
 { fprintf(stderr, "register_opts called!\n"); abort(); }
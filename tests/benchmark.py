@@ -7,6 +7,7 @@ from tqdm import tqdm
 import logging
 import pytest
 import random
+import subprocess
 import utils
 
 
@@ -72,6 +73,44 @@ def test_single_hop(node_factory, executor):
     print("Done. %d payments performed in %f seconds (%f payments per second)" % (num_payments, diff, num_payments / diff))
 
 
+def test_forward(node_factory, executor):
+    """HTLCs per second forwarded through l2's channeld"""
+    l1, l2, l3 = node_factory.line_graph(3, fundamount=4000000, announce=True)
+
+    print("Collecting invoices")
+    fs = []
+    invoices = []
+    for i in tqdm(range(num_payments)):
+        invoices.append(l3.rpc.invoice(1000, 'invoice-%d' % (i), 'desc')['payment_hash'])
+
+    route = l1.rpc.getroute(l3.rpc.getinfo()['id'], 1000, 1)['route']
+    print("Sending payments")
+    start_time = time()
+
+    def do_pay(i):
+        p = l1.rpc.sendpay(route, i)
+        r = l1.rpc.waitsendpay(p['payment_hash'])
+        return r
+
+    for i in invoices:
+        fs.append(executor.submit(do_pay, i))
+
+    for f in tqdm(futures.as_completed(fs), total=len(fs)):
+        f.result()
+
+    diff = time() - start_time
+    print("Done. %d HTLCs forwarded in %f seconds (%f HTLCs per second)" % (num_payments, diff, num_payments / diff))
+
+
+def test_handshakes(node_factory):
+    """Many concurrent handshakes, so hsmd ECDH requests get pipelined"""
+    l1 = node_factory.get_node()
+
+    out = subprocess.check_output(['devtools/bench-handshake',
+                                   l1.info['id'], str(l1.port), '1000'])
+    print(out.decode('utf-8'))
+
+
 def test_single_payment(node_factory, benchmark):
     l1 = node_factory.get_node()
     l2 = node_factory.get_node()
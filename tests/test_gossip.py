@@ -1,9 +1,11 @@
 from fixtures import *  # noqa: F401,F403
+from lightning import RpcError
 from utils import wait_for
 
 import json
 import logging
 import os
+import pytest
 import subprocess
 import time
 import unittest
@@ -545,6 +547,53 @@ def test_routing_gossip(node_factory, bitcoind):
         wait_for(lambda: check_gossip(n), interval=1)
 
 
+def test_getroutes(node_factory, bitcoind):
+    """getroutes finds the same routes as a getroute for each"""
+    l1, l2, l3, l4 = node_factory.line_graph(4, announce=True)
+    wait_for(lambda: len(l1.rpc.listchannels()['channels']) == 6)
+
+    # Nobody knows this node.
+    unknown = '031a8dc444e41bb989653a4501e11175a488a57439b0c4947704fd6e3de5dca607'
+
+    queries = [{'id': l4.info['id'], 'msatoshi': 1000, 'cltv': 9},
+               {'id': unknown, 'msatoshi': 1000},
+               {'id': l2.info['id'], 'msatoshi': 12345},
+               {'id': l3.info['id'], 'msatoshi': 10**6, 'cltv': 20},
+               {'id': l4.info['id'], 'msatoshi': 5000, 'cltv': 5}]
+    routes = l1.rpc.getroutes(queries, 1, fuzzpercent=0)['routes']
+
+    # The flattened reply is split back into one route per query, in order;
+    # an unreachable destination gets an empty one.
+    assert [len(r['route']) for r in routes] == [3, 0, 1, 2, 3]
+    for q, r in zip(queries, routes):
+        if q['id'] == unknown:
+            with pytest.raises(RpcError):
+                l1.rpc.getroute(q['id'], q['msatoshi'], 1, fuzzpercent=0)
+            continue
+        route = l1.rpc.getroute(q['id'], q['msatoshi'], 1,
+                                cltv=q.get('cltv', 9), fuzzpercent=0)['route']
+        assert r['route'] == route
+
+    assert l1.rpc.getroutes([], 1)['routes'] == []
+
+    # Each element is checked like getroute's parameters.
+    with pytest.raises(RpcError):
+        l1.rpc.getroutes([{'id': l2.info['id']}], 1)
+    with pytest.raises(RpcError):
+        l1.rpc.getroutes([{'id': 'not-a-node', 'msatoshi': 1000}], 1)
+    with pytest.raises(RpcError):
+        l1.rpc.getroutes([{'id': l2.info['id'], 'msatoshi': 1000},
+                          {'id': l3.info['id'], 'msatoshi': 1000, 'cltv': 'x'}], 1)
+
+    # All the hops have to fit in one reply: ROUTING_MAX_HOPS is 20.
+    max_routes = 65535 // 20
+    routes = l1.rpc.getroutes([{'id': l2.info['id'], 'msatoshi': 1000}] * max_routes, 1)['routes']
+    assert len(routes) == max_routes
+    assert all(len(r['route']) == 1 for r in routes)
+    with pytest.raises(RpcError, match=r'Too many routes'):
+        l1.rpc.getroutes([{'id': l2.info['id'], 'msatoshi': 1000}] * (max_routes + 1), 1)
+
+
 @unittest.skipIf(not DEVELOPER, "needs DEVELOPER=1")
 def test_gossip_query_channel_range(node_factory, bitcoind):
     l1, l2, l3, l4 = node_factory.line_graph(4, opts={'log-level': 'io'},
@@ -837,5 +886,22 @@ def test_gossip_store_load(node_factory):
 
     l1.start()
     # May preceed the Started msg waited for in 'start'.
-    wait_for(lambda: l1.daemon.is_in_log('gossip_store: Read 1/1/1/0 cannounce/cupdate/nannounce/cdelete from store in 744 bytes'))
+    wait_for(lambda: l1.daemon.is_in_log('gossip_store: Read 1/1/1/0 cannounce/cupdate/nannounce/cdelete from store in 756 bytes'))
     assert not l1.daemon.is_in_log('gossip_store.*truncating')
+
+
+def test_gossip_store_load_truncated(node_factory):
+    """A store cut off mid-record is truncated after the last good record"""
+    l1 = node_factory.get_node(start=False)
+    with open(os.path.join(l1.daemon.lightning_dir, 'gossip_store'), 'wb') as f:
+        f.write(bytearray.fromhex("02"  # GOSSIP_VERSION
+                                  "0000000a"  # len
+                                  "88255345"  # csum
+                                  "1005"  # WIRE_GOSSIP_STORE_CHECKPOINT
+                                  "00000064"  # blockheight
+                                  "00000000"  # count
+                                  "0000"))  # partial header
+
+    l1.start()
+    wait_for(lambda: l1.daemon.is_in_log('gossip_store: truncated file'))
+    wait_for(lambda: l1.daemon.is_in_log('Resending 0 spends since block 100'))
@@ -981,3 +981,56 @@ def test_forward_pad_fees_and_cltv(node_factory, bitcoind):
     l1.rpc.sendpay(route, rhash)
     l1.rpc.waitsendpay(rhash)
     assert only_one(l3.rpc.listinvoices('test_forward_pad_fees_and_cltv')['invoices'])['status'] == 'paid'
+
+
+@unittest.skipIf(not DEVELOPER, "needs DEVELOPER=1 for dev-routes")
+def test_pay_routehints(node_factory, bitcoind):
+    """pay reaches a node behind an unannounced channel using the invoice's
+    route hints, and drops a hint which fails"""
+    l1, l2 = node_factory.line_graph(2, announce=True)
+    l3 = node_factory.get_node()
+    l2.rpc.connect(l3.info['id'], 'localhost', l3.port)
+
+    # One confirmation: usable, but too shallow to be announced.
+    l2.fund_channel(l3, 10**6)
+    wait_for(lambda: l2.channel_state(l3) == 'CHANNELD_NORMAL')
+    scid = l2.get_channel_scid(l3)
+    l2.daemon.wait_for_log(r'Received channel_update for channel {}\(.\) now ACTIVE'.format(scid))
+
+    # l1 knows l2, but nothing about l3.
+    wait_for(lambda: len(l1.rpc.listchannels()['channels']) == 2)
+    assert l3.info['id'] not in [c['destination'] for c in l1.rpc.listchannels()['channels']]
+    with pytest.raises(RpcError):
+        l1.rpc.getroute(l3.info['id'], 10**7, 1)
+
+    def hint(scid, fee_base_msat):
+        return [{'id': l2.info['id'],
+                 'short_channel_id': scid,
+                 'fee_base_msat': fee_base_msat,
+                 'fee_proportional_millionths': 10,
+                 'cltv_expiry_delta': 6}]
+
+    inv = l3.rpc.call('invoice', {'msatoshi': 10**7,
+                                  'label': 'hinted',
+                                  'description': 'desc',
+                                  'dev-routes': [hint(scid, 1)]})['bolt11']
+    assert only_one(only_one(l1.rpc.decodepay(inv)['routes']))['short_channel_id'] == scid
+
+    ret = l1.rpc.pay(inv)
+    assert ret['getroute_tries'] == 1
+    assert [r['channel'] for r in ret['route']] == [l1.get_channel_scid(l2), scid]
+    assert only_one(l3.rpc.listinvoices('hinted')['invoices'])['status'] == 'paid'
+
+    # The cheaper hint is through a channel l2 doesn't have: it fails, so
+    # pay stops offering it and the next try uses the other.
+    inv = l3.rpc.call('invoice', {'msatoshi': 10**7,
+                                  'label': 'badhint',
+                                  'description': 'desc',
+                                  'dev-routes': [hint('1:1:1', 1),
+                                                 hint(scid, 1000)]})['bolt11']
+    ret = l1.rpc.pay(inv)
+    assert ret['getroute_tries'] == 2
+    assert ret['sendpay_tries'] == 2
+    assert only_one(ret['failures'])['erring_channel'] == '1:1:1'
+    assert ret['route'][1]['channel'] == scid
+    assert only_one(l3.rpc.listinvoices('badhint')['invoices'])['status'] == 'paid'
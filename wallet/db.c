@@ -339,6 +339,10 @@ char *dbmigrations[] = {
     "ALTER TABLE channels ADD future_per_commitment_point BLOB;",
     /* last_sent_commit array fix */
     "ALTER TABLE channels ADD last_sent_commit BLOB;",
+    /* Expiry scans: label and payment_hash are already UNIQUE (indexed). */
+    "CREATE INDEX invoices_state_expiry ON invoices (state, expiry_time);",
+    /* Whole shachain as one blob: NULL means it's still in shachain_known */
+    "ALTER TABLE shachains ADD chain BLOB;",
     NULL,
 };
 
@@ -407,12 +411,25 @@ void db_stmt_done(sqlite3_stmt *stmt)
 	sqlite3_finalize(stmt);
 }
 
+static void db_do_exec(const char *caller, struct db *db, const char *cmd);
+
+/* We must be in a transaction: if it was lazy, really start it now. */
+static void db_start_transaction(struct db *db)
+{
+	assert(db->in_transaction);
+
+	if (!db->transaction_started) {
+		db_do_exec(db->in_transaction, db, "BEGIN TRANSACTION;");
+		db->transaction_started = true;
+	}
+}
+
 sqlite3_stmt *db_prepare_(const char *location, struct db *db, const char *query)
 {
 	int err;
 	sqlite3_stmt *stmt;
 
-	assert(db->in_transaction);
+	db_start_transaction(db);
 
 	err = sqlite3_prepare_v2(db->sql, query, -1, &stmt, NULL);
 
@@ -425,7 +442,7 @@ sqlite3_stmt *db_prepare_(const char *location, struct db *db, const char *query
 
 void db_exec_prepared_(const char *caller, struct db *db, sqlite3_stmt *stmt)
 {
-	assert(db->in_transaction);
+	db_start_transaction(db);
 
 	if (sqlite3_step(stmt) !=  SQLITE_DONE)
 		db_fatal("%s: %s", caller, sqlite3_errmsg(db->sql));
@@ -453,7 +470,7 @@ static void PRINTF_FMT(3, 4)
 	va_list ap;
 	char *cmd;
 
-	assert(db->in_transaction);
+	db_start_transaction(db);
 
 	va_start(ap, fmt);
 	cmd = tal_vfmt(db, fmt, ap);
@@ -465,7 +482,7 @@ static void PRINTF_FMT(3, 4)
 
 bool db_exec_prepared_mayfail_(const char *caller UNUSED, struct db *db, sqlite3_stmt *stmt)
 {
-	assert(db->in_transaction);
+	db_start_transaction(db);
 
 	if (sqlite3_step(stmt) != SQLITE_DONE) {
 		goto fail;
@@ -485,7 +502,7 @@ sqlite3_stmt *PRINTF_FMT(3, 4)
 	char *query;
 	sqlite3_stmt *stmt;
 
-	assert(db->in_transaction);
+	db_start_transaction(db);
 
 	va_start(ap, fmt);
 	query = tal_vfmt(db, fmt, ap);
@@ -512,14 +529,29 @@ void db_begin_transaction_(struct db *db, const char *location)
 
 	db_do_exec(location, db, "BEGIN TRANSACTION;");
 	db->in_transaction = location;
+	db->transaction_started = true;
+}
+
+void db_begin_lazy_transaction_(struct db *db, const char *location)
+{
+	if (db->in_transaction)
+		db_fatal("Already in transaction from %s", db->in_transaction);
+
+	db->in_transaction = location;
+	db->transaction_started = false;
 }
 
 void db_commit_transaction(struct db *db)
 {
 	assert(db->in_transaction);
 	db_assert_no_outstanding_statements();
-	db_exec(__func__, db, "COMMIT;");
+	if (db->transaction_started) {
+		db_exec(__func__, db, "COMMIT;");
+		db->num_transactions++;
+	} else
+		db->num_transactions_avoided++;
 	db->in_transaction = NULL;
+	db->transaction_started = false;
 }
 
 /**
@@ -548,6 +580,8 @@ static struct db *db_open(const tal_t *ctx, char *filename)
 	db->sql = sql;
 	tal_add_destructor(db, destroy_db);
 	db->in_transaction = NULL;
+	db->transaction_started = false;
+	db->num_transactions = db->num_transactions_avoided = 0;
 	db_do_exec(__func__, db, "PRAGMA foreign_keys = ON;");
 
 	return db;
@@ -17,7 +17,12 @@ struct log;
 struct db {
 	char *filename;
 	const char *in_transaction;
+	/* False if db_begin_lazy_transaction hasn't needed to BEGIN yet. */
+	bool transaction_started;
 	sqlite3 *sql;
+
+	/* Transactions committed, and lazy ones we never had to begin. */
+	u64 num_transactions, num_transactions_avoided;
 };
 
 /**
@@ -50,6 +55,16 @@ sqlite3_stmt *PRINTF_FMT(3, 4)
 	db_begin_transaction_((db), __FILE__ ":" stringify(__LINE__))
 void db_begin_transaction_(struct db *db, const char *location);
 
+/**
+ * db_begin_lazy_transaction - Begin a transaction on first use
+ *
+ * Like db_begin_transaction, but the BEGIN is deferred until the first
+ * statement: if there is none, db_commit_transaction does nothing.
+ */
+#define db_begin_lazy_transaction(db) \
+	db_begin_lazy_transaction_((db), __FILE__ ":" stringify(__LINE__))
+void db_begin_lazy_transaction_(struct db *db, const char *location);
+
 /**
  * db_commit_transaction - Commit a running transaction
  *
@@ -2,10 +2,14 @@
 #include "invoices.h"
 #include "wallet.h"
 #include <assert.h>
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/htable/htable_type.h>
 #include <ccan/list/list.h>
 #include <ccan/tal/str/str.h>
 #include <ccan/time/time.h>
 #include <ccan/timer/timer.h>
+#include <common/memleak.h>
+#include <common/pseudorand.h>
 #include <common/timeout.h>
 #include <common/utils.h>
 #include <lightningd/invoice.h>
@@ -23,6 +27,8 @@ struct invoice_waiter {
 	bool any;
 	/* If !any, the specific invoice this is waiting on */
 	u64 id;
+	/* So we can remove ourselves from the index on destruction. */
+	struct invoices *invoices;
 
 	struct list_node list;
 
@@ -31,6 +37,31 @@ struct invoice_waiter {
 	void *cbarg;
 };
 
+/* All the waitinvoice waiters for one invoice. */
+struct invoice_id_waiters {
+	u64 id;
+	struct list_head waiters;
+};
+
+static const u64 *keyof_invoice_id_waiters(const struct invoice_id_waiters *iw)
+{
+	return &iw->id;
+}
+
+static size_t hash_invoice_id(const u64 *id)
+{
+	return siphash24(siphash_seed(), id, sizeof(*id));
+}
+
+static bool invoice_id_waiters_eq(const struct invoice_id_waiters *iw,
+				  const u64 *id)
+{
+	return iw->id == *id;
+}
+
+HTABLE_DEFINE_TYPE(struct invoice_id_waiters, keyof_invoice_id_waiters,
+		   hash_invoice_id, invoice_id_waiters_eq, invoice_waiter_map);
+
 struct invoices {
 	/* The database connection to use. */
 	struct db *db;
@@ -38,8 +69,16 @@ struct invoices {
 	struct log *log;
 	/* The timers object to use for expirations. */
 	struct timers *timers;
-	/* Waiters waiting for invoices to be paid, expired, or deleted. */
-	struct list_head waiters;
+	/* Waiters waiting for a specific invoice to be paid, expired, or
+	 * deleted, indexed by invoice id. */
+	struct invoice_waiter_map waiters;
+	/* Waiters waiting for any invoice to be paid. */
+	struct list_head waitany;
+	/* Min-heap of expiry times of unpaid invoices.  Entries for invoices
+	 * paid or deleted since are left in place: they just cause one
+	 * spurious trigger_expiration. */
+	u64 *expiries;
+	size_t num_expiries;
 	/* Earliest time for some invoice to expire */
 	u64 min_expiry_time;
 	/* Expiration timer */
@@ -57,36 +96,54 @@ static void trigger_invoice_waiter(struct invoice_waiter *w,
 	w->cb(invoice, w->cbarg);
 }
 
-static void trigger_invoice_waiter_resolve(struct invoices *invoices,
-					   u64 id,
-					   const struct invoice *invoice)
+/* Trigger every waiter on @waiters.  Waiters added by the callbacks are
+ * not on this list, so they wait for the next event. */
+static void trigger_invoice_waiters(struct list_head *waiters,
+				    const struct invoice *invoice)
 {
 	struct invoice_waiter *w;
-	struct invoice_waiter *n;
 
-	list_for_each_safe(&invoices->waiters, w, n, list) {
-		if (!w->any && w->id != id)
-			continue;
-		list_del_from(&invoices->waiters, &w->list);
+	while ((w = list_pop(waiters, struct invoice_waiter, list)) != NULL) {
 		tal_steal(tmpctx, w);
 		trigger_invoice_waiter(w, invoice);
 	}
 }
+
+/* Trigger the waiters on this specific invoice. */
+static void trigger_invoice_id_waiters(struct invoices *invoices,
+				       u64 id,
+				       const struct invoice *invoice)
+{
+	struct invoice_id_waiters *iw;
+
+	iw = invoice_waiter_map_get(&invoices->waiters, &id);
+	if (!iw)
+		return;
+
+	/* Unindex first, so waiters added by callbacks get a fresh entry. */
+	invoice_waiter_map_del(&invoices->waiters, iw);
+	trigger_invoice_waiters(&iw->waiters, invoice);
+	tal_free(iw);
+}
+
+static void trigger_invoice_waiter_resolve(struct invoices *invoices,
+					   u64 id,
+					   const struct invoice *invoice)
+{
+	struct list_head waitany;
+
+	list_head_init(&waitany);
+	list_append_list(&waitany, &invoices->waitany);
+
+	trigger_invoice_id_waiters(invoices, id, invoice);
+	trigger_invoice_waiters(&waitany, invoice);
+}
 static void
 trigger_invoice_waiter_expire_or_delete(struct invoices *invoices,
 					u64 id,
 					const struct invoice *invoice)
 {
-	struct invoice_waiter *w;
-	struct invoice_waiter *n;
-
-	list_for_each_safe(&invoices->waiters, w, n, list) {
-		if (w->any || w->id != id)
-			continue;
-		list_del_from(&invoices->waiters, &w->list);
-		tal_steal(tmpctx, w);
-		trigger_invoice_waiter(w, invoice);
-	}
+	trigger_invoice_id_waiters(invoices, id, invoice);
 }
 
 static struct invoice_details *wallet_stmt2invoice_details(const tal_t *ctx,
@@ -143,8 +200,72 @@ static void update_db_expirations(struct invoices *invoices, u64 now)
 	db_exec_prepared(invoices->db, stmt);
 }
 
+/* The expiry heap: expiries[0] is the earliest. */
+static void expiry_heap_push(struct invoices *invoices, u64 expiry_time)
+{
+	size_t i = invoices->num_expiries++;
+
+	if (invoices->num_expiries > tal_count(invoices->expiries))
+		tal_resize(&invoices->expiries, invoices->num_expiries * 2);
+
+	while (i > 0 && invoices->expiries[(i - 1) / 2] > expiry_time) {
+		invoices->expiries[i] = invoices->expiries[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	invoices->expiries[i] = expiry_time;
+}
+
+static void expiry_heap_pop(struct invoices *invoices)
+{
+	u64 last = invoices->expiries[--invoices->num_expiries];
+	size_t i = 0, n = invoices->num_expiries;
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n
+		    && invoices->expiries[child + 1] < invoices->expiries[child])
+			child++;
+		if (invoices->expiries[child] >= last)
+			break;
+		invoices->expiries[i] = invoices->expiries[child];
+		i = child;
+	}
+	invoices->expiries[i] = last;
+}
+
+/* Load every unpaid invoice's expiry: in order, that's already a heap. */
+static void load_expiry_heap(struct invoices *invoices)
+{
+	sqlite3_stmt *stmt;
+
+	invoices->expiries = tal_arr(invoices, u64, 0);
+	invoices->num_expiries = 0;
+
+	stmt = db_prepare(invoices->db,
+			  "SELECT expiry_time"
+			  "  FROM invoices"
+			  " WHERE state = ?"
+			  " ORDER BY expiry_time;");
+	sqlite3_bind_int(stmt, 1, UNPAID);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		if (invoices->num_expiries == tal_count(invoices->expiries))
+			tal_resize(&invoices->expiries,
+				   (invoices->num_expiries + 1) * 2);
+		invoices->expiries[invoices->num_expiries++]
+			= sqlite3_column_int64(stmt, 0);
+	}
+	db_stmt_done(stmt);
+}
+
 static void install_expiration_timer(struct invoices *invoices);
 
+static void destroy_invoices(struct invoices *invoices)
+{
+	invoice_waiter_map_clear(&invoices->waiters);
+}
+
 struct invoices *invoices_new(const tal_t *ctx,
 			      struct db *db,
 			      struct log *log,
@@ -156,12 +277,15 @@ struct invoices *invoices_new(const tal_t *ctx,
 	invs->log = log;
 	invs->timers = timers;
 
-	list_head_init(&invs->waiters);
+	invoice_waiter_map_init(&invs->waiters);
+	list_head_init(&invs->waitany);
+	tal_add_destructor(invs, destroy_invoices);
 
 	invs->expiration_timer = NULL;
 	invs->autoclean_timer = NULL;
 
 	update_db_expirations(invs, time_now().ts.tv_sec);
+	load_expiry_heap(invs);
 	install_expiration_timer(invs);
 	return invs;
 }
@@ -201,6 +325,10 @@ static void trigger_expiration(struct invoices *invoices)
 	/* Expire all those invoices */
 	update_db_expirations(invoices, now);
 
+	/* Everything due by now is expired (or was paid or deleted). */
+	while (invoices->num_expiries && invoices->expiries[0] <= now)
+		expiry_heap_pop(invoices);
+
 	/* Trigger expirations */
 	list_for_each(&idlist, idn, list) {
 		/* Trigger expiration */
@@ -215,8 +343,6 @@ static void trigger_expiration(struct invoices *invoices)
 
 static void install_expiration_timer(struct invoices *invoices)
 {
-	int res;
-	sqlite3_stmt *stmt;
 	struct timerel rel;
 	struct timeabs expiry;
 	struct timeabs now = time_now();
@@ -224,20 +350,9 @@ static void install_expiration_timer(struct invoices *invoices)
 	assert(!invoices->expiration_timer);
 
 	/* Find unpaid invoice with nearest expiry time */
-	stmt = db_prepare(invoices->db,
-			  "SELECT MIN(expiry_time)"
-			  "  FROM invoices"
-			  " WHERE state = ?;");
-	sqlite3_bind_int(stmt, 1, UNPAID);
-	res = sqlite3_step(stmt);
-	assert(res == SQLITE_ROW);
-	if (sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
-		/* Nothing to install */
-		db_stmt_done(stmt);
+	if (invoices->num_expiries == 0)
 		return;
-	} else
-		invoices->min_expiry_time = sqlite3_column_int64(stmt, 0);
-	db_stmt_done(stmt);
+	invoices->min_expiry_time = invoices->expiries[0];
 
 	memset(&expiry, 0, sizeof(expiry));
 	expiry.ts.tv_sec = invoices->min_expiry_time;
@@ -313,6 +428,7 @@ bool invoices_create(struct invoices *invoices,
 	db_exec_prepared(invoices->db, stmt);
 
 	pinvoice->id = sqlite3_last_insert_rowid(invoices->db->sql);
+	expiry_heap_push(invoices, expiry_time);
 
 	/* Install expiration trigger. */
 	if (!invoices->expiration_timer ||
@@ -539,25 +655,50 @@ void invoices_resolve(struct invoices *invoices,
 /* Called when an invoice waiter is destructed. */
 static void destroy_invoice_waiter(struct invoice_waiter *w)
 {
+	struct invoice_id_waiters *iw;
+
 	/* Already triggered. */
 	if (w->triggered)
 		return;
 	list_del(&w->list);
+	if (w->any)
+		return;
+
+	/* Drop the index entry once its last waiter goes. */
+	iw = invoice_waiter_map_get(&w->invoices->waiters, &w->id);
+	if (iw && list_empty(&iw->waiters)) {
+		invoice_waiter_map_del(&w->invoices->waiters, iw);
+		tal_free(iw);
+	}
 }
 
-/* Add an invoice waiter to the specified list of invoice waiters. */
+/* Add an invoice waiter, either for any invoice or for invoice @id. */
 static void add_invoice_waiter(const tal_t *ctx,
-			       struct list_head *waiters,
+			       struct invoices *invoices,
 			       bool any,
 			       u64 id,
 			       void (*cb)(const struct invoice *, void*),
 			       void* cbarg)
 {
 	struct invoice_waiter *w = tal(ctx, struct invoice_waiter);
+	struct invoice_id_waiters *iw;
+
 	w->triggered = false;
 	w->any = any;
 	w->id = id;
-	list_add_tail(waiters, &w->list);
+	w->invoices = invoices;
+	if (any)
+		list_add_tail(&invoices->waitany, &w->list);
+	else {
+		iw = invoice_waiter_map_get(&invoices->waiters, &id);
+		if (!iw) {
+			iw = tal(invoices, struct invoice_id_waiters);
+			iw->id = id;
+			list_head_init(&iw->waiters);
+			invoice_waiter_map_add(&invoices->waiters, iw);
+		}
+		list_add_tail(&iw->waiters, &w->list);
+	}
 	w->cb = cb;
 	w->cbarg = cbarg;
 	tal_add_destructor(w, &destroy_invoice_waiter);
@@ -595,8 +736,7 @@ void invoices_waitany(const tal_t *ctx,
 	db_stmt_done(stmt);
 
 	/* None found. */
-	add_invoice_waiter(ctx, &invoices->waiters,
-			   true, 0, cb, cbarg);
+	add_invoice_waiter(ctx, invoices, true, 0, cb, cbarg);
 }
 
 
@@ -626,8 +766,7 @@ void invoices_waitone(const tal_t *ctx,
 	}
 
 	/* Not yet paid. */
-	add_invoice_waiter(ctx, &invoices->waiters,
-			   false, invoice.id, cb, cbarg);
+	add_invoice_waiter(ctx, invoices, false, invoice.id, cb, cbarg);
 }
 
 const struct invoice_details *invoices_get_details(const tal_t *ctx,
@@ -650,3 +789,11 @@ const struct invoice_details *invoices_get_details(const tal_t *ctx,
 	db_stmt_done(stmt);
 	return details;
 }
+
+#if DEVELOPER
+void memleak_remove_invoices(struct htable *memtable,
+			     const struct invoices *invoices)
+{
+	memleak_remove_htable(memtable, &invoices->waiters.raw);
+}
+#endif /* DEVELOPER */
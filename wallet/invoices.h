@@ -236,4 +236,11 @@ const struct invoice_details *invoices_get_details(const tal_t *ctx,
 						   struct invoices *invoices,
 						   struct invoice invoice);
 
+#if DEVELOPER
+struct htable;
+/* Remove any pointers inside the waiter index (opaque to memleak). */
+void memleak_remove_invoices(struct htable *memtable,
+			     const struct invoices *invoices);
+#endif /* DEVELOPER */
+
 #endif /* LIGHTNING_WALLET_INVOICES_H */
@@ -0,0 +1,204 @@
+#include <lightningd/log.h>
+
+static void db_test_fatal(const char *fmt, ...);
+#define db_fatal db_test_fatal
+
+static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, const char *fmt UNUSED, ...)
+{
+}
+#define log_ db_log_
+
+#include "wallet/db.c"
+#include "wallet/invoices.c"
+
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/memleak.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for json_escaped_string_ */
+struct json_escaped *json_escaped_string_(const tal_t *ctx UNNEEDED,
+					  const void *bytes UNNEEDED, size_t len UNNEEDED)
+{ fprintf(stderr, "json_escaped_string_ called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static void db_test_fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	verrx(1, fmt, ap);
+	va_end(ap);
+}
+
+static struct db *create_test_db(void)
+{
+	struct db *db;
+	char filename[] = "/tmp/ldb-XXXXXX";
+
+	int fd = mkstemp(filename);
+	if (fd == -1)
+		return NULL;
+	close(fd);
+
+	db = db_open(NULL, filename);
+	db_migrate(db, NULL);
+	return db;
+}
+
+static struct invoice add_unpaid_invoice(struct db *db)
+{
+	sqlite3_stmt *stmt;
+	struct invoice invoice;
+
+	stmt = db_prepare(db,
+			  "INSERT INTO invoices (state, expiry_time, bolt11)"
+			  " VALUES (?, ?, '');");
+	sqlite3_bind_int(stmt, 1, UNPAID);
+	sqlite3_bind_int64(stmt, 2, time_now().ts.tv_sec + 3600);
+	db_exec_prepared(db, stmt);
+	invoice.id = sqlite3_last_insert_rowid(db->sql);
+	return invoice;
+}
+
+/* Each waiter's cbarg is its own counter: it must fire exactly once, with
+ * the right invoice. */
+struct waiter_check {
+	u64 id;
+	size_t fired;
+};
+
+static void waiter_fired(const struct invoice *invoice, void *arg)
+{
+	struct waiter_check *check = arg;
+
+	assert(!invoice || check->id == 0 || invoice->id == check->id);
+	check->fired++;
+}
+
+static void check_waiters(void)
+{
+	struct db *db = create_test_db();
+	struct invoices *invoices;
+	struct timers timers;
+	struct invoice inv[3];
+	struct waiter_check one[3], any, freed;
+	const tal_t *ctx = tal(NULL, char), *freectx = tal(NULL, char);
+
+	timers_init(&timers, time_mono());
+	db_begin_transaction(db);
+	invoices = invoices_new(db, db, NULL, &timers);
+
+	for (size_t i = 0; i < ARRAY_SIZE(inv); i++) {
+		inv[i] = add_unpaid_invoice(db);
+		one[i].id = inv[i].id;
+		one[i].fired = 0;
+		invoices_waitone(ctx, invoices, inv[i],
+				 waiter_fired, &one[i]);
+	}
+	/* Two waiters on the same invoice; the second is freed unfired. */
+	freed.id = inv[0].id;
+	freed.fired = 0;
+	invoices_waitone(freectx, invoices, inv[0],
+			 waiter_fired, &freed);
+	any.id = 0;
+	any.fired = 0;
+	invoices_waitany(ctx, invoices, 0, waiter_fired, &any);
+
+	tal_free(freectx);
+	assert(invoice_waiter_map_get(&invoices->waiters, &inv[0].id));
+
+	/* Paying inv[1] wakes its waiter and the waitany waiter. */
+	invoices_resolve(invoices, inv[1], 100);
+	assert(one[0].fired == 0);
+	assert(one[1].fired == 1);
+	assert(one[2].fired == 0);
+	assert(any.fired == 1);
+	assert(!invoice_waiter_map_get(&invoices->waiters, &inv[1].id));
+
+	/* Deleting inv[2] wakes only its waiter. */
+	assert(invoices_delete(invoices, inv[2]));
+	assert(one[2].fired == 1);
+	assert(any.fired == 1);
+
+	/* Expiring inv[0] wakes the one remaining waiter on it. */
+	trigger_invoice_waiter_expire_or_delete(invoices, inv[0].id, &inv[0]);
+	assert(one[0].fired == 1);
+	assert(freed.fired == 0);
+	assert(!invoice_waiter_map_get(&invoices->waiters, &inv[0].id));
+	assert(list_empty(&invoices->waitany));
+
+	db_commit_transaction(db);
+	clean_tmpctx();
+	tal_free(ctx);
+	tal_free(db);
+	timers_cleanup(&timers);
+}
+
+int main(int argc, char *argv[])
+{
+	struct db *db;
+	struct invoices *invoices;
+	struct timers timers;
+	struct waiter_check *checks;
+	size_t num = 50000;
+	struct timemono start, mid, end;
+	const tal_t *ctx;
+
+	setup_locale();
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num = atoi(argv[1]);
+	if (argc > 2)
+		opt_usage_and_exit("[num_waiters]");
+
+	check_waiters();
+
+	db = create_test_db();
+	timers_init(&timers, time_mono());
+	db_begin_transaction(db);
+	invoices = invoices_new(db, db, NULL, &timers);
+	ctx = tal(NULL, char);
+
+	/* One waitinvoice per invoice, as if that many were pending; the
+	 * database isn't what we're measuring, so go straight to the index. */
+	checks = tal_arr(ctx, struct waiter_check, num);
+	start = time_mono();
+	for (size_t i = 0; i < num; i++) {
+		checks[i].id = i + 1;
+		checks[i].fired = 0;
+		add_invoice_waiter(ctx, invoices, false, i + 1,
+				   waiter_fired, &checks[i]);
+	}
+	mid = time_mono();
+	/* Now expire them all, the way trigger_expiration does. */
+	for (size_t i = 0; i < num; i++) {
+		struct invoice inv;
+		inv.id = i + 1;
+		trigger_invoice_waiter_expire_or_delete(invoices, inv.id, &inv);
+	}
+	end = time_mono();
+
+	for (size_t i = 0; i < num; i++)
+		assert(checks[i].fired == 1);
+
+	printf("%zu waiters added in %"PRIu64" nanoseconds each, expired in %"PRIu64" nanoseconds each\n",
+	       num,
+	       time_to_nsec(time_divide(timemono_between(mid, start), num)),
+	       time_to_nsec(time_divide(timemono_between(end, mid), num)));
+
+	db_commit_transaction(db);
+	tal_free(ctx);
+	tal_free(db);
+	timers_cleanup(&timers);
+	tal_free(tmpctx);
+	opt_free_table();
+	return 0;
+}
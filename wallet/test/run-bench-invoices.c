@@ -0,0 +1,270 @@
+#include <lightningd/log.h>
+
+static void db_test_fatal(const char *fmt, ...);
+#define db_fatal db_test_fatal
+
+static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, const char *fmt UNUSED, ...)
+{
+}
+#define log_ db_log_
+
+#include "common/json_escaped.c"
+#include "wallet/db.c"
+#include "wallet/invoices.c"
+
+#include <ccan/array_size/array_size.h>
+#include <ccan/crypto/sha256/sha256.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/memleak.h>
+#include <common/pseudorand.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+static void db_test_fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	verrx(1, fmt, ap);
+	va_end(ap);
+}
+
+static struct db *create_test_db(void)
+{
+	struct db *db;
+	char filename[] = "/tmp/ldb-XXXXXX";
+
+	int fd = mkstemp(filename);
+	if (fd == -1)
+		return NULL;
+	close(fd);
+
+	db = db_open(NULL, filename);
+	db_migrate(db, NULL);
+	return db;
+}
+
+static struct sha256 rhash_for(size_t i)
+{
+	struct sha256 rhash;
+
+	sha256(&rhash, &i, sizeof(i));
+	return rhash;
+}
+
+static const char *label_for(const tal_t *ctx, size_t i)
+{
+	return tal_fmt(ctx, "label-%zu", i);
+}
+
+/* A history of @num invoices, one in a hundred still unpaid. */
+static void fill_invoices(struct db *db, size_t num)
+{
+	sqlite3_stmt *stmt;
+	u64 now = time_now().ts.tv_sec;
+	size_t pay_index = 1;
+
+	if (sqlite3_prepare_v2(db->sql,
+			       "INSERT INTO invoices"
+			       " (state, payment_key, payment_hash, label,"
+			       "  msatoshi, expiry_time, pay_index,"
+			       "  msatoshi_received, paid_timestamp,"
+			       "  bolt11, description)"
+			       " VALUES (?, ?, ?, ?, 1000, ?, ?, ?, ?, 'lnbc', '');",
+			       -1, &stmt, NULL) != SQLITE_OK)
+		errx(1, "prepare: %s", sqlite3_errmsg(db->sql));
+
+	for (size_t i = 0; i < num; i++) {
+		struct sha256 rhash = rhash_for(i);
+		const char *label = label_for(tmpctx, i);
+
+		sqlite3_bind_blob(stmt, 2, &rhash, sizeof(rhash), SQLITE_TRANSIENT);
+		sqlite3_bind_blob(stmt, 3, &rhash, sizeof(rhash), SQLITE_TRANSIENT);
+		sqlite3_bind_text(stmt, 4, label, strlen(label), SQLITE_TRANSIENT);
+		if (i % 100 == 0) {
+			sqlite3_bind_int(stmt, 1, UNPAID);
+			sqlite3_bind_int64(stmt, 5, now + 3600 + pseudorand(3600));
+			sqlite3_bind_null(stmt, 6);
+			sqlite3_bind_null(stmt, 7);
+			sqlite3_bind_null(stmt, 8);
+		} else {
+			sqlite3_bind_int(stmt, 1, PAID);
+			sqlite3_bind_int64(stmt, 5, now - 3600);
+			sqlite3_bind_int64(stmt, 6, pay_index++);
+			sqlite3_bind_int64(stmt, 7, 1000);
+			sqlite3_bind_int64(stmt, 8, now - 7200);
+		}
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			errx(1, "insert: %s", sqlite3_errmsg(db->sql));
+		sqlite3_reset(stmt);
+		if (i % 1000 == 0)
+			clean_tmpctx();
+	}
+	sqlite3_finalize(stmt);
+	db_set_intvar(db, "next_pay_index", pay_index);
+}
+
+/* The queries we make on every invoice, payment and expiry must not scan
+ * the table, nor sort it. */
+static void check_query_plans(struct db *db)
+{
+	const char *queries[] = {
+		"SELECT id FROM invoices WHERE state = ? AND expiry_time <= ?;",
+		"UPDATE invoices SET state = ? WHERE state = ? AND expiry_time <= ?;",
+		"SELECT expiry_time FROM invoices WHERE state = ? ORDER BY expiry_time;",
+		"SELECT id FROM invoices WHERE label = ?;",
+		"SELECT id FROM invoices WHERE payment_hash = ?;",
+		"SELECT id FROM invoices WHERE payment_hash = ? AND state = ?;",
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(queries); i++) {
+		sqlite3_stmt *stmt;
+		const char *q = tal_fmt(tmpctx, "EXPLAIN QUERY PLAN %s",
+					queries[i]);
+
+		if (sqlite3_prepare_v2(db->sql, q, -1, &stmt, NULL) != SQLITE_OK)
+			errx(1, "prepare %s: %s", q, sqlite3_errmsg(db->sql));
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			const char *detail
+				= (const char *)sqlite3_column_text(stmt, 3);
+			if (!strstr(detail, "INDEX")
+			    || strstr(detail, "TEMP B-TREE"))
+				errx(1, "%s: %s", queries[i], detail);
+		}
+		sqlite3_finalize(stmt);
+	}
+}
+
+static void check_expiry_heap(struct invoices *invoices)
+{
+	u64 last = 0;
+
+	for (size_t i = 0; i < 1000; i++)
+		expiry_heap_push(invoices, pseudorand(500));
+	while (invoices->num_expiries) {
+		assert(invoices->expiries[0] >= last);
+		last = invoices->expiries[0];
+		expiry_heap_pop(invoices);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct db *db;
+	struct invoices *invoices;
+	struct timers timers;
+	struct invoice_iterator it;
+	struct invoice invoice;
+	size_t num = 1000, num_ops = 100, num_listed = 0;
+	struct timemono start;
+	struct timerel startup, create, by_label, by_rhash, rearm, list;
+
+	setup_locale();
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num = atoi(argv[1]);
+	if (argc > 2)
+		num_ops = atoi(argv[2]);
+	if (argc > 3 || num == 0 || num_ops == 0)
+		opt_usage_and_exit("[num_invoices [num_ops]]");
+
+	db = create_test_db();
+	timers_init(&timers, time_mono());
+	db_begin_transaction(db);
+	check_query_plans(db);
+	fill_invoices(db, num);
+
+	invoices = invoices_new(db, db, NULL, &timers);
+	check_expiry_heap(invoices);
+	tal_free(invoices);
+
+	/* Startup: expire anything overdue, load the expiry heap. */
+	start = time_mono();
+	invoices = invoices_new(db, db, NULL, &timers);
+	startup = timemono_since(start);
+	assert(invoices->num_expiries == (num + 99) / 100);
+
+	/* The `invoice` command. */
+	start = time_mono();
+	for (size_t i = 0; i < num_ops; i++) {
+		struct sha256 rhash = rhash_for(num + i);
+		struct preimage r;
+
+		memset(&r, 0, sizeof(r));
+		if (!invoices_create(invoices, &invoice, NULL,
+				     take(json_escape(NULL,
+						      label_for(tmpctx,
+								num + i))),
+				     3600, "lnbc", "", &r, &rhash))
+			errx(1, "invoices_create %zu failed", i);
+		clean_tmpctx();
+	}
+	create = timemono_since(start);
+
+	/* `listinvoices label`, and finding the invoice for an HTLC. */
+	start = time_mono();
+	for (size_t i = 0; i < num_ops; i++) {
+		const struct json_escaped *label
+			= json_escape(tmpctx, label_for(tmpctx,
+							pseudorand(num)));
+		if (!invoices_find_by_label(invoices, &invoice, label))
+			errx(1, "label %s not found", label->s);
+		clean_tmpctx();
+	}
+	by_label = timemono_since(start);
+
+	start = time_mono();
+	for (size_t i = 0; i < num_ops; i++) {
+		struct sha256 rhash = rhash_for(pseudorand(num));
+		if (!invoices_find_by_rhash(invoices, &invoice, &rhash))
+			errx(1, "rhash %zu not found", i);
+	}
+	by_rhash = timemono_since(start);
+
+	/* Expiry timer firing with nothing due, and re-arming. */
+	start = time_mono();
+	for (size_t i = 0; i < num_ops; i++)
+		trigger_expiration(invoices);
+	rearm = timemono_since(start);
+	assert(invoices->expiration_timer);
+
+	/* Plain `listinvoices`. */
+	memset(&it, 0, sizeof(it));
+	start = time_mono();
+	while (invoices_iterate(invoices, &it)) {
+		invoices_iterator_deref(tmpctx, invoices, &it);
+		if (++num_listed % 1000 == 0)
+			clean_tmpctx();
+	}
+	list = timemono_since(start);
+	assert(num_listed == num + num_ops);
+
+	printf("%zu invoices: startup %"PRIu64" msec,"
+	       " create %"PRIu64" nsec,"
+	       " find_by_label %"PRIu64" nsec,"
+	       " find_by_rhash %"PRIu64" nsec,"
+	       " expiry check %"PRIu64" nsec each,"
+	       " listinvoices %"PRIu64" nsec per invoice\n",
+	       num,
+	       time_to_msec(startup),
+	       time_to_nsec(time_divide(create, num_ops)),
+	       time_to_nsec(time_divide(by_label, num_ops)),
+	       time_to_nsec(time_divide(by_rhash, num_ops)),
+	       time_to_nsec(time_divide(rearm, num_ops)),
+	       time_to_nsec(time_divide(list, num_listed)));
+
+	db_commit_transaction(db);
+	tal_free(db);
+	timers_cleanup(&timers);
+	tal_free(tmpctx);
+	opt_free_table();
+	return 0;
+}
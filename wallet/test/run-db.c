@@ -90,6 +90,46 @@ static bool test_primitives(void)
 	return true;
 }
 
+static bool test_lazy_transaction(void)
+{
+	struct db *db = create_test_db();
+	sqlite3_stmt *stmt;
+	CHECK(db);
+	db_migrate(db, NULL);
+
+	/* Nothing done: no BEGIN or COMMIT at all. */
+	db->num_transactions = db->num_transactions_avoided = 0;
+	db_begin_lazy_transaction(db);
+	CHECK(db->in_transaction);
+	CHECK(!db->transaction_started);
+	CHECK(sqlite3_get_autocommit(db->sql));
+	db_commit_transaction(db);
+	CHECK(!db->in_transaction);
+	CHECK(db->num_transactions == 0);
+	CHECK(db->num_transactions_avoided == 1);
+
+	/* First statement begins it. */
+	db_begin_lazy_transaction(db);
+	stmt = db_prepare(db, "SELECT val FROM vars;");
+	CHECK(db->transaction_started);
+	CHECK(!sqlite3_get_autocommit(db->sql));
+	db_stmt_done(stmt);
+	db_set_intvar(db, "testvar", 7);
+	db_commit_transaction(db);
+	CHECK(sqlite3_get_autocommit(db->sql));
+	CHECK(db->num_transactions == 1);
+	CHECK(db->num_transactions_avoided == 1);
+
+	/* And it was committed. */
+	db_begin_lazy_transaction(db);
+	CHECK(db_get_intvar(db, "testvar", 42) == 7);
+	db_commit_transaction(db);
+	CHECK(db->num_transactions == 2);
+
+	tal_free(db);
+	return true;
+}
+
 static bool test_vars(void)
 {
 	struct db *db = create_test_db();
@@ -123,6 +163,7 @@ int main(void)
 	ok &= test_empty_db_migrate();
 	ok &= test_vars();
 	ok &= test_primitives();
+	ok &= test_lazy_transaction();
 
 	return !ok;
 }
@@ -17,8 +17,11 @@ static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, const c
 
 #include "wallet/db.c"
 
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
 #include <ccan/mem/mem.h>
 #include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
 #include <common/memleak.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -294,6 +297,19 @@ enum watch_result onchaind_funding_spent(struct channel *channel UNNEEDED,
 					 const struct bitcoin_tx *tx UNNEEDED,
 					 u32 blockheight UNNEEDED)
 { fprintf(stderr, "onchaind_funding_spent called!\n"); abort(); }
+/* Generated stub for onion_replay_add */
+void onion_replay_add(struct onion_replay *replay UNNEEDED,
+		      const struct secret *shared_secret UNNEEDED,
+		      u32 cltv_expiry UNNEEDED, u64 htlc_id UNNEEDED)
+{ fprintf(stderr, "onion_replay_add called!\n"); abort(); }
+/* Generated stub for onion_replay_expire */
+void onion_replay_expire(struct onion_replay *replay UNNEEDED, u32 blockheight UNNEEDED)
+{ fprintf(stderr, "onion_replay_expire called!\n"); abort(); }
+/* Generated stub for onion_replay_seen */
+bool onion_replay_seen(const struct onion_replay *replay UNNEEDED,
+		       const struct secret *shared_secret UNNEEDED,
+		       u64 htlc_id UNNEEDED)
+{ fprintf(stderr, "onion_replay_seen called!\n"); abort(); }
 /* Generated stub for onion_type_name */
 const char *onion_type_name(int e UNNEEDED)
 { fprintf(stderr, "onion_type_name called!\n"); abort(); }
@@ -576,6 +592,7 @@ static struct wallet *create_test_wallet(struct lightningd *ld, const tal_t *ctx
 	tal_add_destructor2(w, cleanup_test_wallet, filename);
 
 	list_head_init(&w->unstored_payments);
+	w->available_utxos = NULL;
 	w->ld = ld;
 	ld->wallet = w;
 
@@ -791,16 +808,15 @@ static struct channel *wallet_channel_load(struct wallet *w, const u64 dbid)
 static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 {
 	struct wallet *w = create_test_wallet(ld, ctx);
-	struct channel c1, *c2 = tal(w, struct channel);
+	struct channel *c1 = talz(w, struct channel), *c2 = tal(w, struct channel);
 	struct peer *p;
-	struct channel_info *ci = &c1.channel_info;
+	struct channel_info *ci = &c1->channel_info;
 	struct bitcoin_txid *hash = tal(w, struct bitcoin_txid);
 	struct pubkey pk;
 	struct changed_htlc *last_commit;
 	secp256k1_ecdsa_signature *sig = tal(w, secp256k1_ecdsa_signature);
 	u8 *scriptpubkey = tal_arr(ctx, u8, 100);
 
-	memset(&c1, 0, sizeof(c1));
 	memset(c2, 0, sizeof(*c2));
 	memset(ci, 3, sizeof(*ci));
 	mempat(hash, sizeof(*hash));
@@ -810,12 +826,12 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 	pubkey_from_der(tal_hexdata(w, "02a1633cafcc01ebfb6d78e39f687a1f0995c62fc95f51ead10a02ee0be551b5dc", 66), 33, &pk);
 	ci->feerate_per_kw[LOCAL] = ci->feerate_per_kw[REMOTE] = 31337;
 	mempat(scriptpubkey, tal_count(scriptpubkey));
-	c1.first_blocknum = 1;
-	c1.final_key_idx = 1337;
+	c1->first_blocknum = 1;
+	c1->final_key_idx = 1337;
 	p = new_peer(ld, 0, &pk, NULL, NULL, NULL);
-	c1.peer = p;
-	c1.dbid = wallet_get_channel_dbid(w);
-	c1.state = CHANNELD_NORMAL;
+	c1->peer = p;
+	c1->dbid = wallet_get_channel_dbid(w);
+	c1->state = CHANNELD_NORMAL;
 	memset(&ci->their_config, 0, sizeof(struct channel_config));
 	ci->remote_fundingkey = pk;
 	ci->theirbase.revocation = pk;
@@ -825,64 +841,64 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 	ci->remote_per_commit = pk;
 	ci->old_remote_per_commit = pk;
 	/* last_tx taken from BOLT #3 */
-	c1.last_tx = bitcoin_tx_from_hex(w, "02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220", strlen("02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220"));
-	c1.last_sig = *sig;
+	c1->last_tx = bitcoin_tx_from_hex(w, "02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220", strlen("02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220"));
+	c1->last_sig = *sig;
 
 	db_begin_transaction(w->db);
 	CHECK(!wallet_err);
 
-	wallet_channel_insert(w, &c1);
+	wallet_channel_insert(w, c1);
 
 	/* Variant 1: insert with null for scid, last_sent_commit */
-	wallet_channel_save(w, &c1);
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Load from DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v1)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v1)");
 	tal_free(c2);
 
 	/* We just inserted them into an empty DB so this must be 1 */
-	CHECK(c1.dbid == 1);
-	CHECK(c1.peer->dbid == 1);
-	CHECK(c1.their_shachain.id == 1);
+	CHECK(c1->dbid == 1);
+	CHECK(c1->peer->dbid == 1);
+	CHECK(c1->their_shachain.id == 1);
 
 	/* Variant 2: update with scid set */
-	c1.scid = talz(w, struct short_channel_id);
-	c1.last_was_revoke = !c1.last_was_revoke;
-	wallet_channel_save(w, &c1);
+	c1->scid = talz(w, struct short_channel_id);
+	c1->last_was_revoke = !c1->last_was_revoke;
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v2)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v2)");
 	tal_free(c2);
 
 	/* Updates should not result in new ids */
-	CHECK(c1.dbid == 1);
-	CHECK(c1.peer->dbid == 1);
-	CHECK(c1.their_shachain.id == 1);
+	CHECK(c1->dbid == 1);
+	CHECK(c1->peer->dbid == 1);
+	CHECK(c1->their_shachain.id == 1);
 
 	/* Variant 3: update with last_commit_sent */
-	c1.last_sent_commit = last_commit;
-	wallet_channel_save(w, &c1);
+	c1->last_sent_commit = last_commit;
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v6)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v6)");
 	tal_free(c2);
 
 	/* Variant 4: update and add remote_shutdown_scriptpubkey */
-	c1.remote_shutdown_scriptpubkey = scriptpubkey;
-	wallet_channel_save(w, &c1);
+	c1->remote_shutdown_scriptpubkey = scriptpubkey;
+	wallet_channel_save(w, c1);
 	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1->dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
-	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v8)");
+	CHECK_MSG(channelseq(c1, c2), "Compare loaded with saved (v8)");
 	tal_free(c2);
 
 	db_commit_transaction(w->db);
@@ -927,12 +943,17 @@ static bool test_htlc_crud(struct lightningd *ld, const tal_t *ctx)
 	struct wallet *w = create_test_wallet(ld, ctx);
 	struct htlc_in_map *htlcs_in = tal(ctx, struct htlc_in_map);
 	struct htlc_out_map *htlcs_out = tal(ctx, struct htlc_out_map);
+	struct list_head peers;
 
 	/* Make sure we have our references correct */
 	CHECK(transaction_wrap(w->db,
 			       db_exec(__func__, w->db, "INSERT INTO channels (id) VALUES (1);")));
 	chan->dbid = 1;
 	chan->peer = peer;
+	list_head_init(&peers);
+	list_head_init(&peer->channels);
+	list_add_tail(&peers, &peer->list);
+	list_add_tail(&peer->channels, &chan->list);
 
 	memset(&in, 0, sizeof(in));
 	memset(&out, 0, sizeof(out));
@@ -981,7 +1002,7 @@ static bool test_htlc_crud(struct lightningd *ld, const tal_t *ctx)
 	db_begin_transaction(w->db);
 	CHECK(!wallet_err);
 
-	CHECK_MSG(wallet_htlcs_load_for_channel(w, chan, htlcs_in, htlcs_out),
+	CHECK_MSG(wallet_htlcs_load(w, &peers, htlcs_in, htlcs_out),
 		  "Failed loading HTLCs");
 	db_commit_transaction(w->db);
 
@@ -993,6 +1014,7 @@ static bool test_htlc_crud(struct lightningd *ld, const tal_t *ctx)
 
 	CHECK(hin != NULL);
 	CHECK(hout != NULL);
+	CHECK(hout->in == hin);
 
 	/* Have to free manually, otherwise we get our dependencies
 	 * twisted */
@@ -1055,7 +1077,603 @@ static bool test_wallet_payment_status_enum(void)
 	return true;
 }
 
-int main(void)
+/* Benchmarks free tmpctx as they go, so their ld can't live there. */
+static struct lightningd *new_bench_ld(void)
+{
+	struct lightningd *ld = tal(NULL, struct lightningd);
+
+	list_head_init(&ld->peers);
+	htlc_in_map_init(&ld->htlcs_in);
+	htlc_out_map_init(&ld->htlcs_out);
+	return ld;
+}
+
+/* A commitment transaction from BOLT #3, so last_tx is its usual size. */
+static const char commit_tx_hex[] = "02000000000101bef67e4e2fb9ddeeb3461973cd4c62abb35050b1add772995b820b584a488489000000000038b02b8003a00f0000000000002200208c48d15160397c9731df9bc3b236656efb6665fbfe92b4a6878e88a499f741c4c0c62d0000000000160014ccf1af2f2aabee14bb40fa3851ab2301de843110ae8f6a00000000002200204adb4e2f00643db396dd120d4e7dc17625f5f2c11a40d857accc862d6b7dd80e040047304402206a2679efa3c7aaffd2a447fd0df7aba8792858b589750f6a1203f9259173198a022008d52a0e77a99ab533c36206cb15ad7aeb2aa72b93d4b571e728cb5ec2f6fe260147304402206d6cb93969d39177a09d5d45b583f34966195b77c7e585cf47ac5cce0c90cefb022031d71ae4e33a4e80df7f981d696fbdee517337806a3c7138b7491e2cbb077a0e01475221023da092f6980e58d2c037173180e9a465476026ee50f96695963e8efe436f54eb21030e9f7b623d2ccc7c9bd44d66d5ce21ce504c0acf6385a132cec6d3c39fa711c152ae3e195220";
+
+static struct channel *new_test_channel(struct lightningd *ld,
+					struct wallet *w)
+{
+	struct channel *chan;
+	struct channel_info *ci;
+	struct secret secret;
+	struct pubkey pk;
+
+	memset(&secret, 1, sizeof(secret));
+	pubkey_from_secret(&secret, &pk);
+
+	chan = talz(w, struct channel);
+	chan->peer = new_peer(ld, 0, &pk, NULL, NULL, NULL);
+	chan->dbid = wallet_get_channel_dbid(w);
+	chan->state = CHANNELD_NORMAL;
+	chan->first_blocknum = 1;
+	chan->funding_satoshi = 1000000;
+	chan->our_msatoshi = 500000000;
+	chan->our_config.dust_limit_satoshis = 546;
+	chan->our_config.to_self_delay = 144;
+	chan->last_tx = bitcoin_tx_from_hex(chan, commit_tx_hex,
+					    strlen(commit_tx_hex));
+	ci = &chan->channel_info;
+	ci->remote_fundingkey = ci->theirbase.revocation
+		= ci->theirbase.payment = ci->theirbase.htlc
+		= ci->theirbase.delayed_payment = ci->remote_per_commit
+		= ci->old_remote_per_commit = pk;
+	ci->feerate_per_kw[LOCAL] = ci->feerate_per_kw[REMOTE] = 253;
+	ci->their_config.max_accepted_htlcs = 483;
+	return chan;
+}
+
+static u64 saved_column(struct wallet *w, const struct channel *chan,
+			const char *column)
+{
+	sqlite3_stmt *stmt;
+	u64 val;
+
+	stmt = db_query(w->db, "SELECT %s FROM channels WHERE id=%"PRIu64,
+			column, chan->dbid);
+	assert(sqlite3_step(stmt) == SQLITE_ROW);
+	val = sqlite3_column_int64(stmt, 0);
+	db_stmt_done(stmt);
+	return val;
+}
+
+/* The four saves each side of a commitment round makes, in
+ * peer_htlcs.c, with the fields each one changes. */
+static void commitment_round(struct wallet *w, struct channel *chan,
+			     struct changed_htlc *changed, u64 round)
+{
+	db_begin_transaction(w->db);
+	chan->next_htlc_id++;
+	chan->last_was_revoke = false;
+	changed->id = chan->next_htlc_id;
+	tal_free(chan->last_sent_commit);
+	chan->last_sent_commit = tal_dup_arr(chan, struct changed_htlc,
+					     changed, 1, 0);
+	wallet_channel_save(w, chan);
+	db_commit_transaction(w->db);
+
+	db_begin_transaction(w->db);
+	chan->next_index[LOCAL]++;
+	chan->last_tx->output[0].amount = round;
+	memcpy(&chan->last_sig, &round, sizeof(round));
+	wallet_channel_save(w, chan);
+	db_commit_transaction(w->db);
+
+	db_begin_transaction(w->db);
+	chan->last_was_revoke = true;
+	wallet_channel_save(w, chan);
+	db_commit_transaction(w->db);
+
+	db_begin_transaction(w->db);
+	chan->next_index[REMOTE]++;
+	chan->our_msatoshi += 1000;
+	wallet_channel_save(w, chan);
+	db_commit_transaction(w->db);
+}
+
+static bool test_channel_save(struct lightningd *ld, const tal_t *ctx)
+{
+	struct wallet *w = create_test_wallet(ld, ctx);
+	struct channel *chan = new_test_channel(ld, w);
+	int changes;
+
+	db_begin_transaction(w->db);
+	wallet_channel_insert(w, chan);
+	CHECK(saved_column(w, chan, "msatoshi_local") == 500000000);
+
+	/* Nothing changed: nothing written. */
+	changes = sqlite3_total_changes(w->db->sql);
+	wallet_channel_save(w, chan);
+	CHECK_MSG(sqlite3_total_changes(w->db->sql) == changes,
+		  "Unchanged channel was written");
+
+	/* Just what changed is written. */
+	chan->next_htlc_id = 7;
+	chan->scid = talz(chan, struct short_channel_id);
+	wallet_channel_save(w, chan);
+	CHECK(sqlite3_total_changes(w->db->sql) == changes + 1);
+	CHECK(saved_column(w, chan, "next_htlc_id") == 7);
+
+	/* Configs were written when we inserted, and don't get rewritten. */
+	chan->our_config.dust_limit_satoshis = 1;
+	wallet_channel_save(w, chan);
+	CHECK_MSG(sqlite3_total_changes(w->db->sql) == changes + 1,
+		  "Channel config was rewritten");
+	CHECK(wallet_channel_config_load(w, chan->our_config.id,
+					 &chan->our_config));
+	CHECK(chan->our_config.dust_limit_satoshis == 546);
+	CHECK(chan->our_config.to_self_delay == 144);
+	db_commit_transaction(w->db);
+	CHECK(!wallet_err);
+	return true;
+}
+
+/* How much we hand sqlite to write, counting blobs in hex. */
+static size_t update_bytes;
+
+static int count_update(unsigned type UNUSED, void *arg UNUSED,
+			void *stmt, void *unused UNUSED)
+{
+	char *sql = sqlite3_expanded_sql(stmt);
+
+	if (sql && strstarts(sql, "UPDATE"))
+		update_bytes += strlen(sql);
+	sqlite3_free(sql);
+	return 0;
+}
+
+static void bench_channel_save(const size_t *sizes)
+{
+	struct lightningd *ld = new_bench_ld();
+	struct wallet *w;
+	struct channel *chan;
+	struct changed_htlc changed;
+	struct timemono start;
+	struct timerel elapsed;
+	size_t num_htlcs = sizes[0];
+	int pages, unused, page_size;
+	sqlite3_stmt *stmt;
+
+	w = create_test_wallet(ld, ld);
+	chan = new_test_channel(ld, w);
+	db_begin_transaction(w->db);
+	wallet_channel_insert(w, chan);
+	stmt = db_query(w->db, "PRAGMA page_size;");
+	assert(sqlite3_step(stmt) == SQLITE_ROW);
+	page_size = sqlite3_column_int(stmt, 0);
+	db_stmt_done(stmt);
+	db_commit_transaction(w->db);
+
+	/* Each forwarded HTLC takes two rounds: adding, then removing it. */
+	memset(&changed, 0, sizeof(changed));
+	changed.newstate = RCVD_ADD_COMMIT;
+	update_bytes = 0;
+	sqlite3_db_status(w->db->sql, SQLITE_DBSTATUS_CACHE_WRITE,
+			  &pages, &unused, true);
+	sqlite3_trace_v2(w->db->sql, SQLITE_TRACE_STMT, count_update, NULL);
+	start = time_mono();
+	for (size_t i = 0; i < num_htlcs * 2; i++) {
+		commitment_round(w, chan, &changed, i);
+		clean_tmpctx();
+	}
+	elapsed = timemono_since(start);
+	sqlite3_db_status(w->db->sql, SQLITE_DBSTATUS_CACHE_WRITE,
+			  &pages, &unused, false);
+	sqlite3_trace_v2(w->db->sql, 0, NULL, NULL);
+	db_begin_transaction(w->db);
+	assert(saved_column(w, chan, "next_htlc_id") == num_htlcs * 2);
+	db_commit_transaction(w->db);
+	assert(!wallet_err);
+
+	printf("%zu HTLCs: %zu bytes of UPDATE, %zu bytes (%.1f pages) written,"
+	       " %"PRIu64" usec per HTLC\n",
+	       num_htlcs, update_bytes / num_htlcs,
+	       (size_t)pages * page_size / num_htlcs,
+	       (double)pages / num_htlcs,
+	       time_to_usec(time_divide(elapsed, num_htlcs)));
+
+	tal_free(ld);
+}
+
+static void save_htlcs(struct wallet *w, struct channel *chan,
+			size_t num_htlcs, u64 *htlc_id)
+{
+	struct htlc_in in;
+	struct htlc_out out;
+
+	memset(&in, 0, sizeof(in));
+	memset(&out, 0, sizeof(out));
+	in.key.channel = chan;
+	in.msatoshi = 42;
+	in.hstate = RCVD_ADD_ACK_REVOCATION;
+	out.key.channel = chan;
+	out.msatoshi = 41;
+	out.hstate = SENT_ADD_ACK_REVOCATION;
+	out.in = &in;
+
+	/* Every incoming HTLC is forwarded, so each needs reconnecting. */
+	for (size_t i = 0; i < num_htlcs / 2; i++) {
+		in.key.id = out.key.id = (*htlc_id)++;
+		memcpy(&in.payment_hash, htlc_id, sizeof(*htlc_id));
+		out.payment_hash = in.payment_hash;
+		wallet_htlc_save_in(w, chan, &in);
+		wallet_htlc_save_out(w, chan, &out);
+	}
+}
+
+static void bench_htlcs_load(const size_t *sizes)
+{
+	struct lightningd *ld = new_bench_ld();
+	struct wallet *w;
+	struct list_head peers;
+	struct htlc_in_map *htlcs_in;
+	struct htlc_out_map *htlcs_out;
+	struct timemono start, end;
+	size_t num_htlcs = sizes[0], num_channels = sizes[1];
+	u64 htlc_id = 0;
+
+	w = create_test_wallet(ld, tmpctx);
+	assert(w);
+
+	list_head_init(&peers);
+	db_begin_transaction(w->db);
+	for (size_t i = 0; i < num_channels; i++) {
+		struct peer *peer = talz(tmpctx, struct peer);
+		struct channel *chan = talz(peer, struct channel);
+
+		list_head_init(&peer->channels);
+		list_add_tail(&peers, &peer->list);
+		chan->dbid = i + 1;
+		chan->peer = peer;
+		list_add_tail(&peer->channels, &chan->list);
+		db_exec(__func__, w->db,
+			"INSERT INTO channels (id) VALUES (%"PRIu64");",
+			chan->dbid);
+		save_htlcs(w, chan, num_htlcs / num_channels, &htlc_id);
+	}
+	db_commit_transaction(w->db);
+	assert(!wallet_err);
+
+	/* The HTLCs remove themselves from these when freed. */
+	htlcs_in = tal(ld, struct htlc_in_map);
+	htlcs_out = tal(ld, struct htlc_out_map);
+	htlc_in_map_init(htlcs_in);
+	htlc_out_map_init(htlcs_out);
+
+	start = time_mono();
+	db_begin_transaction(w->db);
+	if (!wallet_htlcs_load(w, &peers, htlcs_in, htlcs_out))
+		errx(1, "Failed loading HTLCs");
+	db_commit_transaction(w->db);
+	htlcs_reconnect(ld, htlcs_in, htlcs_out);
+	end = time_mono();
+
+	printf("%"PRIu64" HTLCs in %zu channels loaded and reconnected in %"PRIu64" msec\n",
+	       htlc_id * 2, num_channels,
+	       time_to_msec(timemono_between(end, start)));
+
+	clean_tmpctx();
+	htlc_in_map_clear(htlcs_in);
+	htlc_out_map_clear(htlcs_out);
+	tal_free(ld);
+}
+
+static void add_utxo(struct wallet *w, u32 n, u64 amount, bool is_p2sh)
+{
+	struct utxo u;
+
+	memset(&u, 0, sizeof(u));
+	memcpy(&u.txid, &n, sizeof(n));
+	u.outnum = n % 4;
+	u.amount = amount;
+	if (!wallet_add_utxo(w, &u, is_p2sh ? p2sh_wpkh : our_change))
+		errx(1, "Failed adding utxo %u", n);
+}
+
+static u64 total_amount(const struct utxo **utxos)
+{
+	u64 total = 0;
+
+	for (size_t i = 0; i < tal_count(utxos); i++)
+		total += utxos[i]->amount;
+	return total;
+}
+
+static void check_selection(struct lightningd *ld)
+{
+	struct wallet *w = create_test_wallet(ld, tmpctx);
+	const struct utxo **utxos, **first;
+	u64 fee_estimate, change;
+
+	db_begin_transaction(w->db);
+	add_utxo(w, 1, 50000, false);
+	add_utxo(w, 2, 30000, false);
+	add_utxo(w, 3, 20000, true);
+	add_utxo(w, 4, 100000, false);
+
+	/* At 1000 perkw, spending one P2WPKH costs 437 sat: so this is
+	 * exactly one input, with no change. */
+	first = wallet_select_coins(w, w, 50000 - 437, 1000, 22,
+				    &fee_estimate, &change);
+	assert(tal_count(first) == 1 && first[0]->amount == 50000);
+	assert(change == 0 && fee_estimate == 437);
+	assert(tal_count(w->available_utxos->by_amount) == 3);
+
+	/* No changeless set for this: largest first, with change. */
+	utxos = wallet_select_coins(w, w, 120000, 1000, 22,
+				    &fee_estimate, &change);
+	assert(tal_count(utxos) == 2);
+	assert(utxos[0]->amount == 100000 && utxos[1]->amount == 30000);
+	assert(total_amount(utxos) == 120000 + fee_estimate + change);
+
+	/* Can't afford it: nothing reserved. */
+	assert(!wallet_select_coins(w, w, 100000, 1000, 22,
+				    &fee_estimate, &change));
+	assert(tal_count(w->available_utxos->by_amount) == 1);
+
+	/* Freeing unreserves. */
+	tal_free(utxos);
+	assert(tal_count(w->available_utxos->by_amount) == 3);
+	tal_free(first);
+	assert(tal_count(wallet_get_utxos(tmpctx, w, output_state_available))
+	       == 4);
+	db_commit_transaction(w->db);
+	assert(!wallet_err);
+}
+
+static void bench_utxo_select(const size_t *sizes)
+{
+	struct lightningd *ld = new_bench_ld();
+	struct wallet *w;
+	struct timemono start;
+	struct timerel load, select;
+	size_t num_utxos = sizes[0], num_selects = sizes[1], num_inputs = 0;
+
+	check_selection(ld);
+
+	w = create_test_wallet(ld, ld);
+	assert(w);
+
+	/* An exchange-style wallet: lots of deposits of all sizes. */
+	db_begin_transaction(w->db);
+	for (size_t i = 0; i < num_utxos; i++)
+		add_utxo(w, i, 10000 + pseudorand(10000000), i % 2);
+	db_commit_transaction(w->db);
+	assert(!wallet_err);
+
+	start = time_mono();
+	db_begin_transaction(w->db);
+	wallet_utxo_index(w);
+	db_commit_transaction(w->db);
+	load = timemono_since(start);
+
+	/* withdraw/fundchannel of a few times a typical deposit. */
+	start = time_mono();
+	for (size_t i = 0; i < num_selects; i++) {
+		const struct utxo **utxos;
+		u64 fee_estimate, change;
+
+		db_begin_transaction(w->db);
+		utxos = wallet_select_coins(w, w, 10000 + pseudorand(50000000),
+					    253 + pseudorand(10000), 22,
+					    &fee_estimate, &change);
+		if (!utxos)
+			errx(1, "Selection %zu failed", i);
+		num_inputs += tal_count(utxos);
+		tal_free(utxos);
+		db_commit_transaction(w->db);
+		clean_tmpctx();
+	}
+	select = timemono_since(start);
+	assert(!wallet_err);
+
+	printf("%zu utxos: index loaded in %"PRIu64" msec,"
+	       " %zu selections (%.1f inputs each) in %"PRIu64" usec each\n",
+	       num_utxos, time_to_msec(load), num_selects,
+	       (double)num_inputs / num_selects,
+	       time_to_usec(time_divide(select, num_selects)));
+
+	tal_free(ld);
+}
+
+static struct secret secret_for(u64 index)
+{
+	struct sha256 seed, hash;
+	struct secret secret;
+
+	memset(&seed, 'A', sizeof(seed));
+	shachain_from_seed(&seed, index, &hash);
+	memcpy(&secret, &hash, sizeof(secret));
+	return secret;
+}
+
+/* Which shachain_known row the hash for @index went in. */
+static unsigned int known_pos(u64 index)
+{
+	unsigned int pos = 0;
+
+	while (pos < SHACHAIN_BITS && !(index & (1ULL << pos)))
+		pos++;
+	return pos;
+}
+
+/* Chains written before the blob column are still loaded from their
+ * rows, and move to the blob as they're loaded. */
+static bool test_shachain_known_rows(struct lightningd *ld, const tal_t *ctx)
+{
+	struct wallet *w = create_test_wallet(ld, ctx);
+	struct wallet_shachain a, b;
+	struct secret s;
+	sqlite3_stmt *stmt;
+	u64 index;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	shachain_init(&a.chain);
+	index = shachain_next_index(&a.chain);
+
+	db_begin_transaction(w->db);
+	wallet_shachain_init(w, &a);
+	for (size_t i = 0; i < 10; i++, index--) {
+		sqlite3_stmt *stmt;
+
+		s = secret_for(index);
+		CHECK(shachain_add_hash(&a.chain, index, (struct sha256 *)&s));
+		stmt = db_prepare(w->db, "REPLACE INTO shachain_known"
+				  " (shachain_id, pos, idx, hash)"
+				  " VALUES (?, ?, ?, ?);");
+		sqlite3_bind_int64(stmt, 1, a.id);
+		sqlite3_bind_int(stmt, 2, known_pos(index));
+		sqlite3_bind_int64(stmt, 3, index);
+		sqlite3_bind_blob(stmt, 4, &s, sizeof(s), SQLITE_TRANSIENT);
+		db_exec_prepared(w->db, stmt);
+	}
+	db_exec(__func__, w->db,
+		"UPDATE shachains SET min_index=%"PRIu64", num_valid=%u,"
+		" chain=NULL WHERE id=%"PRIu64";",
+		a.chain.min_index, a.chain.num_valid, a.id);
+
+	CHECK(wallet_shachain_load(w, a.id, &b));
+	CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+
+	/* Nothing is left behind in the old columns and rows. */
+	stmt = db_query(w->db,
+			"SELECT chain IS NOT NULL, min_index IS NULL,"
+			" num_valid IS NULL FROM shachains WHERE id=%"PRIu64";",
+			a.id);
+	CHECK(sqlite3_step(stmt) == SQLITE_ROW);
+	CHECK(sqlite3_column_int(stmt, 0) && sqlite3_column_int(stmt, 1)
+	      && sqlite3_column_int(stmt, 2));
+	db_stmt_done(stmt);
+	stmt = db_query(w->db,
+			"SELECT COUNT(*) FROM shachain_known"
+			" WHERE shachain_id=%"PRIu64";", a.id);
+	CHECK(sqlite3_step(stmt) == SQLITE_ROW);
+	CHECK(sqlite3_column_int(stmt, 0) == 0);
+	db_stmt_done(stmt);
+
+	memset(&b, 0, sizeof(b));
+	CHECK(wallet_shachain_load(w, a.id, &b));
+	CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+
+	s = secret_for(index);
+	CHECK(wallet_shachain_add_hash(w, &a, index, &s));
+	memset(&b, 0, sizeof(b));
+	CHECK(wallet_shachain_load(w, a.id, &b));
+	CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+	db_commit_transaction(w->db);
+	CHECK(!wallet_err);
+	return true;
+}
+
+static void bench_shachain(const size_t *sizes)
+{
+	struct lightningd *ld = new_bench_ld();
+	struct wallet *w;
+	struct wallet_shachain chain, loaded;
+	struct secret *secrets;
+	struct timemono start;
+	struct timerel add, load;
+	size_t num_revocations = sizes[0], num_loads = sizes[1];
+	u64 index;
+
+
+	w = create_test_wallet(ld, ld);
+	memset(&chain, 0, sizeof(chain));
+	db_begin_transaction(w->db);
+	wallet_shachain_init(w, &chain);
+	db_commit_transaction(w->db);
+
+	/* Deriving them isn't what we're measuring. */
+	index = shachain_next_index(&chain.chain);
+	secrets = tal_arr(ld, struct secret, num_revocations);
+	for (size_t i = 0; i < num_revocations; i++)
+		secrets[i] = secret_for(index - i);
+
+	/* Each revoke_and_ack is handled in its own transaction. */
+	start = time_mono();
+	for (size_t i = 0; i < num_revocations; i++) {
+		db_begin_transaction(w->db);
+		if (!wallet_shachain_add_hash(w, &chain, index - i, &secrets[i]))
+			errx(1, "Revocation %zu rejected", i);
+		db_commit_transaction(w->db);
+		clean_tmpctx();
+	}
+	add = timemono_since(start);
+
+	start = time_mono();
+	db_begin_transaction(w->db);
+	for (size_t i = 0; i < num_loads; i++) {
+		memset(&loaded, 0, sizeof(loaded));
+		if (!wallet_shachain_load(w, chain.id, &loaded))
+			errx(1, "Loading failed");
+	}
+	db_commit_transaction(w->db);
+	load = timemono_since(start);
+	assert(memcmp(&chain, &loaded, sizeof(chain)) == 0);
+	assert(!wallet_err);
+
+	printf("%zu revocations: %.0f per second, %zu loads in %"PRIu64" usec each\n",
+	       num_revocations,
+	       num_revocations / (time_to_nsec(add) / 1000000000.0),
+	       num_loads, time_to_usec(time_divide(load, num_loads)));
+
+	tal_free(ld);
+}
+
+/* The benchmarks share this file's mocks and test wallet.  With no
+ * arguments we run each at a size small enough for `make check`; name one
+ * to run it at a real size, eg. `run-wallet channel_save 10000`. */
+static const struct wallet_bench {
+	const char *name;
+	const char *usage;
+	size_t num_sizes;
+	size_t sizes[2];
+	void (*run)(const size_t *sizes);
+} benches[] = {
+	{ "channel_save", "[num_htlcs]", 1, { 100 }, bench_channel_save },
+	{ "htlcs_load", "[num_htlcs [num_channels]]", 2, { 1000, 10 },
+	  bench_htlcs_load },
+	{ "utxo_select", "[num_utxos [num_selects]]", 2, { 100, 10 },
+	  bench_utxo_select },
+	{ "shachain", "[num_revocations [num_loads]]", 2, { 100, 10 },
+	  bench_shachain },
+};
+
+static const struct wallet_bench *find_bench(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(benches); i++)
+		if (streq(benches[i].name, name))
+			return &benches[i];
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [benchmark [sizes...]]\n", argv0);
+	for (size_t i = 0; i < ARRAY_SIZE(benches); i++)
+		fprintf(stderr, "  %s %s\n", benches[i].name, benches[i].usage);
+	exit(1);
+}
+
+static void run_bench(int argc, char *argv[])
+{
+	const struct wallet_bench *bench = find_bench(argv[1]);
+	size_t sizes[ARRAY_SIZE(bench->sizes)];
+
+	if (!bench || argc - 2 > bench->num_sizes)
+		usage(argv[0]);
+
+	memcpy(sizes, bench->sizes, sizeof(sizes));
+	for (size_t i = 0; i < argc - 2; i++) {
+		sizes[i] = atoi(argv[i + 2]);
+		if (sizes[i] == 0)
+			usage(argv[0]);
+	}
+	bench->run(sizes);
+}
+
+int main(int argc, char *argv[])
 {
 	setup_locale();
 
@@ -1064,6 +1682,14 @@ int main(void)
 
 	setup_tmpctx();
 	secp256k1_ctx = wally_get_secp_context();
+
+	if (argc > 1) {
+		run_bench(argc, argv);
+		tal_free(tmpctx);
+		wally_cleanup(0);
+		return 0;
+	}
+
 	ld = tal(tmpctx, struct lightningd);
 
 	/* Only elements in ld we should access */
@@ -1075,12 +1701,18 @@ int main(void)
 
 	ok &= test_wallet_outputs(ld, tmpctx);
 	ok &= test_shachain_crud(ld, tmpctx);
+	ok &= test_shachain_known_rows(ld, tmpctx);
 	ok &= test_channel_crud(ld, tmpctx);
+	ok &= test_channel_save(ld, tmpctx);
 	ok &= test_channel_config_crud(ld, tmpctx);
 	ok &= test_htlc_crud(ld, tmpctx);
 	ok &= test_payment_crud(ld, tmpctx);
 	ok &= test_wallet_payment_status_enum();
 
+	/* These free tmpctx as they go, so only once the tests pass. */
+	for (size_t i = 0; ok && i < ARRAY_SIZE(benches); i++)
+		benches[i].run(benches[i].sizes);
+
 	/* Do not clean up in the case of an error, we might want to debug the
 	 * database. */
 	if (ok) {
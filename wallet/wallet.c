@@ -2,8 +2,16 @@
 #include "wallet.h"
 
 #include <bitcoin/script.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/htable/htable_type.h>
+#include <ccan/intmap/intmap.h>
+#include <ccan/mem/mem.h>
 #include <ccan/tal/str/str.h>
+#include <common/htlc_wire.h>
 #include <common/key_derive.h>
+#include <common/onion_replay.h>
+#include <common/pseudorand.h>
 #include <common/wireaddr.h>
 #include <inttypes.h>
 #include <lightningd/lightningd.h>
@@ -12,7 +20,6 @@
 #include <onchaind/gen_onchain_wire.h>
 #include <string.h>
 
-#define SQLITE_MAX_UINT 0x7FFFFFFFFFFFFFFF
 #define DIRECTION_INCOMING 0
 #define DIRECTION_OUTGOING 1
 /* How many blocks must a UTXO entry be buried under to be considered old enough
@@ -52,6 +59,7 @@ struct wallet *wallet_new(struct lightningd *ld,
 	wallet->db = db_setup(wallet, log);
 	wallet->log = log;
 	wallet->bip32_base = NULL;
+	wallet->available_utxos = NULL;
 	list_head_init(&wallet->unstored_payments);
 
 	db_begin_transaction(wallet->db);
@@ -66,6 +74,165 @@ struct wallet *wallet_new(struct lightningd *ld,
 	"channel_id, peer_id, commitment_point, confirmation_height, "	\
 	"spend_height"
 
+/* What coin selection needs to know about an available output. */
+struct avail_utxo {
+	struct bitcoin_txid txid;
+	u32 outnum;
+	u64 amount;
+	bool is_p2sh;
+};
+
+static const struct avail_utxo *avail_utxo_keyof(const struct avail_utxo *u)
+{
+	return u;
+}
+
+static size_t avail_utxo_hash(const struct avail_utxo *u)
+{
+	struct siphash24_ctx ctx;
+	siphash24_init(&ctx, siphash_seed());
+	siphash24_update(&ctx, &u->txid, sizeof(u->txid));
+	siphash24_u32(&ctx, u->outnum);
+	return siphash24_done(&ctx);
+}
+
+static bool avail_utxo_eq(const struct avail_utxo *a,
+			  const struct avail_utxo *b)
+{
+	return bitcoin_txid_eq(&a->txid, &b->txid) && a->outnum == b->outnum;
+}
+
+HTABLE_DEFINE_TYPE(struct avail_utxo, avail_utxo_keyof, avail_utxo_hash,
+		   avail_utxo_eq, avail_utxo_map);
+
+struct utxo_index {
+	/* Every available output, by outpoint. */
+	struct avail_utxo_map map;
+	/* The same, largest amount first; equal amounts in the order added. */
+	struct avail_utxo **by_amount;
+};
+
+static void destroy_utxo_index(struct utxo_index *idx)
+{
+	avail_utxo_map_clear(&idx->map);
+}
+
+/* First position in by_amount holding less than @amount. */
+static size_t utxo_index_after(const struct utxo_index *idx, u64 amount)
+{
+	size_t lo = 0, hi = tal_count(idx->by_amount);
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (idx->by_amount[mid]->amount >= amount)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void utxo_index_add(struct utxo_index *idx,
+			   const struct bitcoin_txid *txid, u32 outnum,
+			   u64 amount, bool is_p2sh)
+{
+	struct avail_utxo *u = tal(idx, struct avail_utxo);
+	size_t n = tal_count(idx->by_amount), pos;
+
+	u->txid = *txid;
+	u->outnum = outnum;
+	u->amount = amount;
+	u->is_p2sh = is_p2sh;
+	if (avail_utxo_map_get(&idx->map, u)) {
+		tal_free(u);
+		return;
+	}
+	avail_utxo_map_add(&idx->map, u);
+
+	pos = utxo_index_after(idx, amount);
+	tal_resize(&idx->by_amount, n + 1);
+	memmove(idx->by_amount + pos + 1, idx->by_amount + pos,
+		(n - pos) * sizeof(idx->by_amount[0]));
+	idx->by_amount[pos] = u;
+}
+
+static void utxo_index_del(struct utxo_index *idx,
+			   const struct bitcoin_txid *txid, u32 outnum)
+{
+	struct avail_utxo key, *u;
+	size_t n = tal_count(idx->by_amount), pos;
+
+	key.txid = *txid;
+	key.outnum = outnum;
+	u = avail_utxo_map_get(&idx->map, &key);
+	if (!u)
+		return;
+	avail_utxo_map_del(&idx->map, u);
+
+	/* It's in the run of equal amounts just before this. */
+	pos = utxo_index_after(idx, u->amount);
+	while (idx->by_amount[--pos] != u);
+	memmove(idx->by_amount + pos, idx->by_amount + pos + 1,
+		(n - pos - 1) * sizeof(idx->by_amount[0]));
+	tal_resize(&idx->by_amount, n - 1);
+	tal_free(u);
+}
+
+/* The index is loaded the first time we select coins. */
+static struct utxo_index *wallet_utxo_index(struct wallet *w)
+{
+	struct utxo_index *idx;
+	sqlite3_stmt *stmt;
+
+	if (w->available_utxos)
+		return w->available_utxos;
+
+	idx = w->available_utxos = tal(w, struct utxo_index);
+	avail_utxo_map_init(&idx->map);
+	idx->by_amount = tal_arr(idx, struct avail_utxo *, 0);
+	tal_add_destructor(idx, destroy_utxo_index);
+
+	stmt = db_prepare(w->db, "SELECT prev_out_tx, prev_out_index, value, type"
+			  " FROM outputs WHERE status=?"
+			  " ORDER BY value DESC, rowid;");
+	sqlite3_bind_int(stmt, 1, output_status_in_db(output_state_available));
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		struct bitcoin_txid txid;
+		sqlite3_column_sha256_double(stmt, 0, &txid.shad);
+		utxo_index_add(idx, &txid, sqlite3_column_int(stmt, 1),
+			       sqlite3_column_int64(stmt, 2),
+			       sqlite3_column_int(stmt, 3) == p2sh_wpkh);
+	}
+	db_stmt_done(stmt);
+	return idx;
+}
+
+/* An output changed status in the db: keep the index in step. */
+static void utxo_index_update(struct wallet *w,
+			      const struct bitcoin_txid *txid, u32 outnum,
+			      enum output_status newstatus)
+{
+	sqlite3_stmt *stmt;
+
+	if (!w->available_utxos)
+		return;
+
+	if (newstatus != output_state_available) {
+		utxo_index_del(w->available_utxos, txid, outnum);
+		return;
+	}
+
+	stmt = db_prepare(w->db, "SELECT value, type FROM outputs"
+			  " WHERE prev_out_tx=? AND prev_out_index=?");
+	sqlite3_bind_blob(stmt, 1, txid, sizeof(*txid), SQLITE_TRANSIENT);
+	sqlite3_bind_int(stmt, 2, outnum);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		utxo_index_add(w->available_utxos, txid, outnum,
+			       sqlite3_column_int64(stmt, 0),
+			       sqlite3_column_int(stmt, 1) == p2sh_wpkh);
+	db_stmt_done(stmt);
+}
+
 /* We actually use the db constraints to uniquify, so OK if this fails. */
 bool wallet_add_utxo(struct wallet *w, struct utxo *utxo,
 		     enum wallet_output_type type)
@@ -103,7 +270,13 @@ bool wallet_add_utxo(struct wallet *w, struct utxo *utxo,
 
 	/* May fail if we already know about the tx, e.g., because
 	 * it's change or some internal tx. */
-	return db_exec_prepared_mayfail(w->db, stmt);
+	if (!db_exec_prepared_mayfail(w->db, stmt))
+		return false;
+
+	if (w->available_utxos)
+		utxo_index_add(w->available_utxos, &utxo->txid, utxo->outnum,
+			       utxo->amount, type == p2sh_wpkh);
+	return true;
 }
 
 /**
@@ -168,7 +341,11 @@ bool wallet_update_output_status(struct wallet *w,
 		sqlite3_bind_int(stmt, 3, outnum);
 	}
 	db_exec_prepared(w->db, stmt);
-	return sqlite3_changes(w->db->sql) > 0;
+	if (sqlite3_changes(w->db->sql) == 0)
+		return false;
+
+	utxo_index_update(w, txid, outnum, newstatus);
+	return true;
 }
 
 struct utxo **wallet_get_utxos(const tal_t *ctx, struct wallet *w, const enum output_status state)
@@ -250,68 +427,244 @@ void wallet_confirm_utxos(struct wallet *w, const struct utxo **utxos)
 	}
 }
 
-static const struct utxo **wallet_select(const tal_t *ctx, struct wallet *w,
-					 const u64 value,
-					 const u32 feerate_per_kw,
-					 size_t outscriptlen,
-					 bool may_have_change,
-					 u64 *satoshi_in,
-					 u64 *fee_estimate)
+/* Weight of one of our inputs. */
+static u64 utxo_input_weight(bool is_p2sh)
 {
-	size_t i = 0;
-	struct utxo **available;
-	u64 weight;
-	const struct utxo **utxos = tal_arr(ctx, const struct utxo *, 0);
-	tal_add_destructor2(utxos, destroy_utxos, w);
+	/* Input weight: txid + index + sequence */
+	u64 weight = (32 + 4 + 4) * 4;
+
+	/* We always encode the length of the script, even if empty */
+	weight += 1 * 4;
+
+	/* P2SH variants include push of <0 <20-byte-key-hash>> */
+	if (is_p2sh)
+		weight += 23 * 4;
+
+	/* Account for witness (1 byte count + sig + key) */
+	weight += 1 + (1 + 73 + 1 + 33);
 
+	return weight;
+}
+
+/* Weight of the transaction without inputs. */
+static u64 tx_base_weight(size_t outscriptlen, bool with_change)
+{
 	/* version, input count, output count, locktime */
-	weight = (4 + 1 + 1 + 4) * 4;
+	u64 weight = (4 + 1 + 1 + 4) * 4;
 
 	/* The main output: amount, len, scriptpubkey */
 	weight += (8 + 1 + outscriptlen) * 4;
 
 	/* Change output will be P2WPKH */
-	if (may_have_change)
+	if (with_change)
 		weight += (8 + 1 + BITCOIN_SCRIPTPUBKEY_P2WPKH_LEN) * 4;
 
-	*fee_estimate = 0;
-	*satoshi_in = 0;
+	return weight;
+}
 
-	available = wallet_get_utxos(ctx, w, output_state_available);
+/* Fee for part of a transaction: rounded up, so the parts cover the whole. */
+static u64 weight_fee(u64 weight, u32 feerate_per_kw)
+{
+	return (weight * feerate_per_kw + 999) / 1000;
+}
 
-	for (i = 0; i < tal_count(available); i++) {
-		size_t input_weight;
+/* How many steps branch-and-bound takes before we fall back to
+ * largest-first. */
+#define BNB_MAX_TRIES 100000
 
-		tal_resize(&utxos, i + 1);
-		utxos[i] = tal_steal(utxos, available[i]);
+struct bnb_candidate {
+	struct avail_utxo *u;
+	/* Amount, less the fee to spend it. */
+	u64 effective;
+};
 
-		if (!wallet_update_output_status(
-			w, &available[i]->txid, available[i]->outnum,
-			output_state_available, output_state_reserved))
-			fatal("Unable to reserve output");
+/* Merge @a and @b (each sorted largest first) into @out. */
+static void merge_candidates(struct bnb_candidate *out,
+			     const struct bnb_candidate *a, size_t num_a,
+			     const struct bnb_candidate *b, size_t num_b)
+{
+	size_t i = 0, j = 0, n = 0;
+
+	while (i < num_a || j < num_b) {
+		if (j == num_b || (i < num_a && a[i].effective >= b[j].effective))
+			out[n++] = a[i++];
+		else
+			out[n++] = b[j++];
+	}
+}
+
+/* Branch-and-bound search (as in Bitcoin Core) for inputs whose total
+ * effective value lies in [target, target + cost_of_change]: those need no
+ * change output.  We prefer the fewest inputs, then the least excess.
+ * Returns NULL if there's no such set (or we ran out of tries). */
+static struct avail_utxo **select_bnb(const tal_t *ctx,
+				      const struct utxo_index *idx,
+				      u64 target, u64 cost_of_change,
+				      u32 feerate_per_kw)
+{
+	struct bnb_candidate *cands, *type[2];
+	size_t num_avail = tal_count(idx->by_amount), num_type[2] = { 0, 0 };
+	size_t *sel, *best, num_sel = 0, num_best = 0, i = 0;
+	u64 value = 0, available = 0, best_excess = 0;
+	u64 fee[2] = { weight_fee(utxo_input_weight(false), feerate_per_kw),
+		       weight_fee(utxo_input_weight(true), feerate_per_kw) };
+	struct avail_utxo **chosen;
+
+	/* Inputs which are worth spending, and don't overshoot on their own.
+	 * Spending costs depend only on type, so each type is already in
+	 * order; merge them. */
+	type[false] = tal_arr(tmpctx, struct bnb_candidate, num_avail);
+	type[true] = tal_arr(tmpctx, struct bnb_candidate, num_avail);
+	for (size_t j = 0; j < num_avail; j++) {
+		struct avail_utxo *u = idx->by_amount[j];
+		struct bnb_candidate *c;
+
+		if (u->amount <= fee[u->is_p2sh])
+			continue;
+		if (u->amount - fee[u->is_p2sh] > target + cost_of_change)
+			continue;
+		c = &type[u->is_p2sh][num_type[u->is_p2sh]++];
+		c->u = u;
+		c->effective = u->amount - fee[u->is_p2sh];
+		available += c->effective;
+	}
+	if (available < target)
+		return NULL;
+
+	cands = tal_arr(tmpctx, struct bnb_candidate,
+			num_type[false] + num_type[true]);
+	merge_candidates(cands, type[false], num_type[false],
+			 type[true], num_type[true]);
+	sel = tal_arr(tmpctx, size_t, tal_count(cands));
+	best = tal_arr(tmpctx, size_t, tal_count(cands));
+
+	/* Depth-first: at each candidate, try including it, then excluding
+	 * it.  available is the sum of candidates from i onwards. */
+	for (size_t tries = 0; tries < BNB_MAX_TRIES; tries++) {
+		bool backtrack;
+
+		if (value + available < target
+		    || value > target + cost_of_change)
+			backtrack = true;
+		else if (value >= target) {
+			if (!num_best || num_sel < num_best
+			    || (num_sel == num_best
+				&& value - target < best_excess)) {
+				memcpy(best, sel, num_sel * sizeof(*sel));
+				num_best = num_sel;
+				best_excess = value - target;
+			}
+			backtrack = true;
+		} else
+			/* Anything deeper needs at least one more input. */
+			backtrack = num_best && num_sel + 1 >= num_best;
+
+		if (backtrack) {
+			/* Walk back to the last input we included... */
+			while (num_sel && sel[num_sel - 1] != i - 1) {
+				i--;
+				available += cands[i].effective;
+			}
+			if (!num_sel)
+				break;
+			/* ... and try without it. */
+			i--;
+			value -= cands[i].effective;
+			num_sel--;
+		} else {
+			available -= cands[i].effective;
+			/* Including one we just excluded an identical twin of
+			 * would only repeat that search. */
+			if (!num_sel || sel[num_sel - 1] == i - 1
+			    || cands[i].effective != cands[i - 1].effective) {
+				sel[num_sel++] = i;
+				value += cands[i].effective;
+			}
+		}
+		i++;
+	}
 
-		/* Input weight: txid + index + sequence */
-		input_weight = (32 + 4 + 4) * 4;
+	if (!num_best)
+		return NULL;
 
-		/* We always encode the length of the script, even if empty */
-		input_weight += 1 * 4;
+	chosen = tal_arr(ctx, struct avail_utxo *, num_best);
+	for (size_t j = 0; j < num_best; j++)
+		chosen[j] = cands[best[j]].u;
+	return chosen;
+}
 
-		/* P2SH variants include push of <0 <20-byte-key-hash>> */
-		if (utxos[i]->is_p2sh)
-			input_weight += 23 * 4;
+/* Most outpoints we name in one statement: well within sqlite's default
+ * limit of 999 parameters. */
+#define OUTPOINT_BATCH 100
 
-		/* Account for witness (1 byte count + sig + key) */
-		input_weight += 1 + (1 + 73 + 1 + 33);
+static const char *outpoints_clause(const tal_t *ctx, size_t n)
+{
+	char *clause = tal_strdup(ctx, "(");
 
-		weight += input_weight;
+	for (size_t i = 0; i < n; i++)
+		tal_append_fmt(&clause, "%s(prev_out_tx=? AND prev_out_index=?)",
+			       i ? " OR " : "");
+	tal_append_fmt(&clause, ")");
+	return clause;
+}
 
-		*fee_estimate = weight * feerate_per_kw / 1000;
-		*satoshi_in += utxos[i]->amount;
-		if (*satoshi_in >= *fee_estimate + value)
-			break;
+static void bind_outpoints(sqlite3_stmt *stmt, int col,
+			   struct avail_utxo **outs, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		sqlite3_bind_blob(stmt, col++, &outs[i]->txid,
+				  sizeof(outs[i]->txid), SQLITE_TRANSIENT);
+		sqlite3_bind_int(stmt, col++, outs[i]->outnum);
+	}
+}
+
+/* Load and reserve the chosen outputs, in batches. */
+static const struct utxo **reserve_utxos(const tal_t *ctx, struct wallet *w,
+					 struct avail_utxo **chosen)
+{
+	size_t num = tal_count(chosen);
+	const struct utxo **utxos = tal_arr(ctx, const struct utxo *, num);
+
+	for (size_t off = 0; off < num; off += OUTPOINT_BATCH) {
+		size_t n = num - off < OUTPOINT_BATCH ? num - off : OUTPOINT_BATCH;
+		const char *clause = outpoints_clause(tmpctx, n);
+		sqlite3_stmt *stmt;
+
+		stmt = db_prepare(w->db, tal_fmt(tmpctx, "SELECT "UTXO_FIELDS
+						 " FROM outputs WHERE %s",
+						 clause));
+		bind_outpoints(stmt, 1, chosen + off, n);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			struct utxo *u = tal(utxos, struct utxo);
+			wallet_stmt2output(stmt, u);
+			/* Keep them in the order we chose them. */
+			for (size_t i = off; i < off + n; i++) {
+				if (bitcoin_txid_eq(&u->txid, &chosen[i]->txid)
+				    && u->outnum == chosen[i]->outnum)
+					utxos[i] = u;
+			}
+		}
+		db_stmt_done(stmt);
+
+		stmt = db_prepare(w->db, tal_fmt(tmpctx, "UPDATE outputs"
+						 " SET status=?"
+						 " WHERE status=? AND %s",
+						 clause));
+		sqlite3_bind_int(stmt, 1,
+				 output_status_in_db(output_state_reserved));
+		sqlite3_bind_int(stmt, 2,
+				 output_status_in_db(output_state_available));
+		bind_outpoints(stmt, 3, chosen + off, n);
+		db_exec_prepared(w->db, stmt);
+		if (sqlite3_changes(w->db->sql) != n)
+			fatal("Unable to reserve output");
 	}
-	tal_free(available);
 
+	for (size_t i = 0; i < num; i++)
+		utxo_index_del(w->available_utxos,
+			       &chosen[i]->txid, chosen[i]->outnum);
+
+	tal_add_destructor2(utxos, destroy_utxos, w);
 	return utxos;
 }
 
@@ -321,19 +674,44 @@ const struct utxo **wallet_select_coins(const tal_t *ctx, struct wallet *w,
 					size_t outscriptlen,
 					u64 *fee_estimate, u64 *changesatoshi)
 {
-	u64 satoshi_in;
-	const struct utxo **utxo;
-
-	utxo = wallet_select(ctx, w, value, feerate_per_kw,
-			     outscriptlen, true,
-			     &satoshi_in, fee_estimate);
-
-	/* Couldn't afford it? */
-	if (satoshi_in < *fee_estimate + value)
-		return tal_free(utxo);
+	struct utxo_index *idx = wallet_utxo_index(w);
+	size_t num_avail = tal_count(idx->by_amount);
+	struct avail_utxo **chosen;
+	u64 weight, satoshi_in = 0;
+
+	/* Best is a set of inputs which needs no change output at all: any
+	 * excess less than a change output would cost goes to fees. */
+	weight = tx_base_weight(outscriptlen, false);
+	chosen = select_bnb(tmpctx, idx,
+			    value + weight_fee(weight, feerate_per_kw),
+			    weight_fee(tx_base_weight(outscriptlen, true)
+				       - weight + utxo_input_weight(false),
+				       feerate_per_kw),
+			    feerate_per_kw);
+	if (chosen) {
+		for (size_t i = 0; i < tal_count(chosen); i++)
+			satoshi_in += chosen[i]->amount;
+		*fee_estimate = satoshi_in - value;
+		*changesatoshi = 0;
+		return reserve_utxos(ctx, w, chosen);
+	}
+
+	/* Otherwise, fewest inputs: largest first, with change. */
+	weight = tx_base_weight(outscriptlen, true);
+	for (size_t i = 0; i < num_avail; i++) {
+		weight += utxo_input_weight(idx->by_amount[i]->is_p2sh);
+		*fee_estimate = weight * feerate_per_kw / 1000;
+		satoshi_in += idx->by_amount[i]->amount;
+		if (satoshi_in >= *fee_estimate + value) {
+			chosen = tal_dup_arr(tmpctx, struct avail_utxo *,
+					     idx->by_amount, i + 1, 0);
+			*changesatoshi = satoshi_in - value - *fee_estimate;
+			return reserve_utxos(ctx, w, chosen);
+		}
+	}
 
-	*changesatoshi = satoshi_in - value - *fee_estimate;
-	return utxo;
+	/* Couldn't afford it. */
+	return NULL;
 }
 
 const struct utxo **wallet_select_all(const tal_t *ctx, struct wallet *w,
@@ -342,20 +720,24 @@ const struct utxo **wallet_select_all(const tal_t *ctx, struct wallet *w,
 				      u64 *value,
 				      u64 *fee_estimate)
 {
-	u64 satoshi_in;
-	const struct utxo **utxo;
+	struct utxo_index *idx = wallet_utxo_index(w);
+	size_t num_avail = tal_count(idx->by_amount);
+	u64 weight = tx_base_weight(outscriptlen, false), satoshi_in = 0;
 
-	/* Huge value, but won't overflow on addition */
-	utxo = wallet_select(ctx, w, (1ULL << 56), feerate_per_kw,
-			     outscriptlen, false,
-			     &satoshi_in, fee_estimate);
+	for (size_t i = 0; i < num_avail; i++) {
+		weight += utxo_input_weight(idx->by_amount[i]->is_p2sh);
+		satoshi_in += idx->by_amount[i]->amount;
+	}
+	*fee_estimate = weight * feerate_per_kw / 1000;
 
 	/* Can't afford fees? */
 	if (*fee_estimate > satoshi_in)
-		return tal_free(utxo);
+		return NULL;
 
 	*value = satoshi_in - *fee_estimate;
-	return utxo;
+	return reserve_utxos(ctx, w,
+			     tal_dup_arr(tmpctx, struct avail_utxo *,
+					 idx->by_amount, num_avail, 0));
 }
 
 bool wallet_can_spend(struct wallet *w, const u8 *script,
@@ -408,84 +790,76 @@ s64 wallet_get_newindex(struct lightningd *ld)
 	return newidx;
 }
 
+/* The whole chain is one small blob, in the same form we hand channeld. */
+static u8 *shachain_blob(const tal_t *ctx, const struct wallet_shachain *chain)
+{
+	u8 *blob = tal_arr(ctx, u8, 0);
+
+	towire_shachain(&blob, &chain->chain);
+	return blob;
+}
+
+static void wallet_shachain_save(struct wallet *wallet,
+				 const struct wallet_shachain *chain)
+{
+	sqlite3_stmt *stmt;
+	u8 *blob = shachain_blob(tmpctx, chain);
+
+	stmt = db_prepare(wallet->db, "UPDATE shachains SET chain=? WHERE id=?");
+	sqlite3_bind_blob(stmt, 1, blob, tal_count(blob), SQLITE_TRANSIENT);
+	sqlite3_bind_int64(stmt, 2, chain->id);
+	db_exec_prepared(wallet->db, stmt);
+}
+
 static void wallet_shachain_init(struct wallet *wallet,
 				 struct wallet_shachain *chain)
 {
 	sqlite3_stmt *stmt;
+	u8 *blob;
 
 	assert(chain->id == 0);
 
 	/* Create shachain */
 	shachain_init(&chain->chain);
-	stmt = db_prepare(wallet->db, "INSERT INTO shachains (min_index, num_valid) VALUES (?, 0);");
-	sqlite3_bind_int64(stmt, 1, chain->chain.min_index);
+	blob = shachain_blob(tmpctx, chain);
+	stmt = db_prepare(wallet->db, "INSERT INTO shachains (chain) VALUES (?);");
+	sqlite3_bind_blob(stmt, 1, blob, tal_count(blob), SQLITE_TRANSIENT);
 	db_exec_prepared(wallet->db, stmt);
 
 	chain->id = sqlite3_last_insert_rowid(wallet->db->sql);
 }
 
-/* TODO(cdecker) Stolen from shachain, move to some appropriate location */
-static unsigned int count_trailing_zeroes(uint64_t index)
-{
-#if HAVE_BUILTIN_CTZLL
-	return index ? (unsigned int)__builtin_ctzll(index) : SHACHAIN_BITS;
-#else
-	unsigned int i;
-
-	for (i = 0; i < SHACHAIN_BITS; i++) {
-		if (index & (1ULL << i))
-			break;
-	}
-	return i;
-#endif
-}
-
 bool wallet_shachain_add_hash(struct wallet *wallet,
 			      struct wallet_shachain *chain,
 			      uint64_t index,
 			      const struct secret *hash)
 {
-	sqlite3_stmt *stmt;
-	u32 pos = count_trailing_zeroes(index);
 	struct sha256 s;
 
 	BUILD_ASSERT(sizeof(s) == sizeof(*hash));
 	memcpy(&s, hash, sizeof(s));
 
-	assert(index < SQLITE_MAX_UINT);
 	if (!shachain_add_hash(&chain->chain, index, &s)) {
 		return false;
 	}
 
-	stmt = db_prepare(wallet->db, "UPDATE shachains SET num_valid=?, min_index=? WHERE id=?");
-	sqlite3_bind_int(stmt, 1, chain->chain.num_valid);
-	sqlite3_bind_int64(stmt, 2, index);
-	sqlite3_bind_int64(stmt, 3, chain->id);
-	db_exec_prepared(wallet->db, stmt);
-
-	stmt = db_prepare(
-		wallet->db,
-		"REPLACE INTO shachain_known (shachain_id, pos, idx, hash) VALUES (?, ?, ?, ?);");
-	sqlite3_bind_int64(stmt, 1, chain->id);
-	sqlite3_bind_int(stmt, 2, pos);
-	sqlite3_bind_int64(stmt, 3, index);
-	sqlite3_bind_blob(stmt, 4, hash, sizeof(*hash), SQLITE_TRANSIENT);
-	db_exec_prepared(wallet->db, stmt);
-
+	/* One write per revocation, in the transaction of the revoke_and_ack
+	 * which brought it. */
+	wallet_shachain_save(wallet, chain);
 	return true;
 }
 
-bool wallet_shachain_load(struct wallet *wallet, u64 id,
-			  struct wallet_shachain *chain)
+/* Chains last written before we stored them as a blob: we move them to
+ * the blob as we load them, so their rows don't linger. */
+static bool wallet_shachain_load_known(struct wallet *wallet,
+				       struct wallet_shachain *chain)
 {
 	int err;
 	sqlite3_stmt *stmt;
-	chain->id = id;
-	shachain_init(&chain->chain);
 
 	/* Load shachain metadata */
 	stmt = db_prepare(wallet->db, "SELECT min_index, num_valid FROM shachains WHERE id=?");
-	sqlite3_bind_int64(stmt, 1, id);
+	sqlite3_bind_int64(stmt, 1, chain->id);
 
 	err = sqlite3_step(stmt);
 	if (err != SQLITE_ROW) {
@@ -499,7 +873,7 @@ bool wallet_shachain_load(struct wallet *wallet, u64 id,
 
 	/* Load shachain known entries */
 	stmt = db_prepare(wallet->db, "SELECT idx, hash, pos FROM shachain_known WHERE shachain_id=?");
-	sqlite3_bind_int64(stmt, 1, id);
+	sqlite3_bind_int64(stmt, 1, chain->id);
 
 	while (sqlite3_step(stmt) == SQLITE_ROW) {
 		int pos = sqlite3_column_int(stmt, 2);
@@ -508,9 +882,45 @@ bool wallet_shachain_load(struct wallet *wallet, u64 id,
 	}
 
 	db_stmt_done(stmt);
+
+	wallet_shachain_save(wallet, chain);
+	stmt = db_prepare(wallet->db, "DELETE FROM shachain_known WHERE shachain_id=?");
+	sqlite3_bind_int64(stmt, 1, chain->id);
+	db_exec_prepared(wallet->db, stmt);
+	stmt = db_prepare(wallet->db, "UPDATE shachains SET min_index=NULL, num_valid=NULL WHERE id=?");
+	sqlite3_bind_int64(stmt, 1, chain->id);
+	db_exec_prepared(wallet->db, stmt);
 	return true;
 }
 
+bool wallet_shachain_load(struct wallet *wallet, u64 id,
+			  struct wallet_shachain *chain)
+{
+	sqlite3_stmt *stmt;
+	const u8 *blob;
+	size_t len;
+
+	chain->id = id;
+	shachain_init(&chain->chain);
+
+	stmt = db_prepare(wallet->db, "SELECT chain FROM shachains WHERE id=?");
+	sqlite3_bind_int64(stmt, 1, id);
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
+		db_stmt_done(stmt);
+		return false;
+	}
+	if (sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
+		db_stmt_done(stmt);
+		return wallet_shachain_load_known(wallet, chain);
+	}
+
+	blob = sqlite3_column_blob(stmt, 0);
+	len = sqlite3_column_bytes(stmt, 0);
+	fromwire_shachain(&blob, &len, &chain->chain);
+	db_stmt_done(stmt);
+	return blob != NULL;
+}
+
 static struct peer *wallet_peer_load(struct wallet *w, const u64 dbid)
 {
 	const unsigned char *addrstr;
@@ -736,7 +1146,9 @@ bool wallet_channels_load_active(const tal_t *ctx, struct wallet *w)
 	bool ok = true;
 	sqlite3_stmt *stmt;
 
-	/* We load all channels */
+	/* We load all channels: once a channel is fully resolved onchain
+	 * delete_channel() removes its row, so everything left here is
+	 * either active or still needs onchaind to be restarted for it. */
 	stmt = db_query(w->db, "SELECT %s FROM channels;",
 			channel_fields);
 
@@ -904,130 +1316,230 @@ u64 wallet_get_channel_dbid(struct wallet *wallet)
 	return ++wallet->max_channel_dbid;
 }
 
-void wallet_channel_save(struct wallet *w, struct channel *chan)
-{
-	sqlite3_stmt *stmt;
-	u8 *last_sent_commit;
-	assert(chan->first_blocknum);
-
-	wallet_channel_config_save(w, &chan->our_config);
+/* One column of a channel's row, as we bind it. */
+struct channel_column {
+	enum { COLUMN_NULL, COLUMN_INT, COLUMN_BLOB } type;
+	s64 num;
+	u8 *blob;
+};
+
+/* In the order channel_columns() fills them. */
+static const char *channel_column_names[] = {
+	"shachain_remote_id",
+	"short_channel_id",
+	"state",
+	"funder",
+	"channel_flags",
+	"minimum_depth",
+	"next_index_local",
+	"next_index_remote",
+	"next_htlc_id",
+	"funding_tx_id",
+	"funding_tx_outnum",
+	"funding_satoshi",
+	"funding_locked_remote",
+	"push_msatoshi",
+	"msatoshi_local",
+	"shutdown_scriptpubkey_remote",
+	"shutdown_keyidx_local",
+	"channel_config_local",
+	"last_tx",
+	"last_sig",
+	"last_was_revoke",
+	"min_possible_feerate",
+	"max_possible_feerate",
+	"msatoshi_to_us_min",
+	"msatoshi_to_us_max",
+	"fundingkey_remote",
+	"revocation_basepoint_remote",
+	"payment_basepoint_remote",
+	"htlc_basepoint_remote",
+	"delayed_payment_basepoint_remote",
+	"per_commit_remote",
+	"old_per_commit_remote",
+	"local_feerate_per_kw",
+	"remote_feerate_per_kw",
+	"channel_config_remote",
+	"future_per_commitment_point",
+	"last_sent_commit",
+};
+
+static void column_int(struct channel_column **col, s64 num)
+{
+	(*col)->type = COLUMN_INT;
+	(*col)->num = num;
+	(*col)++;
+}
+
+/* @blob is allocated off the columns array; NULL means SQL NULL. */
+static void column_blob(struct channel_column **col, u8 *blob)
+{
+	if (blob) {
+		(*col)->type = COLUMN_BLOB;
+		(*col)->blob = blob;
+	} else
+		(*col)->type = COLUMN_NULL;
+	(*col)++;
+}
 
-	stmt = db_prepare(w->db, "UPDATE channels SET"
-			  "  shachain_remote_id=?,"
-			  "  short_channel_id=?,"
-			  "  state=?,"
-			  "  funder=?,"
-			  "  channel_flags=?,"
-			  "  minimum_depth=?,"
-			  "  next_index_local=?,"
-			  "  next_index_remote=?,"
-			  "  next_htlc_id=?,"
-			  "  funding_tx_id=?,"
-			  "  funding_tx_outnum=?,"
-			  "  funding_satoshi=?,"
-			  "  funding_locked_remote=?,"
-			  "  push_msatoshi=?,"
-			  "  msatoshi_local=?,"
-			  "  shutdown_scriptpubkey_remote=?,"
-			  "  shutdown_keyidx_local=?,"
-			  "  channel_config_local=?,"
-			  "  last_tx=?, last_sig=?,"
-			  "  last_was_revoke=?,"
-			  "  min_possible_feerate=?,"
-			  "  max_possible_feerate=?,"
-			  "  msatoshi_to_us_min=?,"
-			  "  msatoshi_to_us_max=?"
-			  " WHERE id=?");
-	sqlite3_bind_int64(stmt, 1, chan->their_shachain.id);
-	if (chan->scid)
-		sqlite3_bind_short_channel_id(stmt, 2, chan->scid);
-	else
-		sqlite3_bind_null(stmt, 2);
-	sqlite3_bind_int(stmt, 3, chan->state);
-	sqlite3_bind_int(stmt, 4, chan->funder);
-	sqlite3_bind_int(stmt, 5, chan->channel_flags);
-	sqlite3_bind_int(stmt, 6, chan->minimum_depth);
+static u8 *pubkey_blob(const tal_t *ctx, const struct pubkey *pk)
+{
+	u8 *der = tal_arr(ctx, u8, PUBKEY_DER_LEN);
 
-	sqlite3_bind_int64(stmt, 7, chan->next_index[LOCAL]);
-	sqlite3_bind_int64(stmt, 8, chan->next_index[REMOTE]);
-	sqlite3_bind_int64(stmt, 9, chan->next_htlc_id);
+	pubkey_to_der(der, pk);
+	return der;
+}
 
-	sqlite3_bind_sha256_double(stmt, 10, &chan->funding_txid.shad);
+static struct channel_column *channel_columns(const tal_t *ctx,
+					      const struct channel *chan)
+{
+	struct channel_column *cols, *col;
+	const struct channel_info *ci = &chan->channel_info;
+	u8 *blob;
 
-	sqlite3_bind_int(stmt, 11, chan->funding_outnum);
-	sqlite3_bind_int64(stmt, 12, chan->funding_satoshi);
-	sqlite3_bind_int(stmt, 13, chan->remote_funding_locked);
-	sqlite3_bind_int64(stmt, 14, chan->push_msat);
-	sqlite3_bind_int64(stmt, 15, chan->our_msatoshi);
+	cols = col = tal_arr(ctx, struct channel_column,
+			     ARRAY_SIZE(channel_column_names));
 
-	if (chan->remote_shutdown_scriptpubkey)
-		sqlite3_bind_blob(stmt, 16, chan->remote_shutdown_scriptpubkey,
+	column_int(&col, chan->their_shachain.id);
+	if (chan->scid) {
+		char *str = short_channel_id_to_str(tmpctx, chan->scid);
+		blob = tal_dup_arr(cols, u8, (u8 *)str, strlen(str), 0);
+	} else
+		blob = NULL;
+	column_blob(&col, blob);
+	column_int(&col, chan->state);
+	column_int(&col, chan->funder);
+	column_int(&col, chan->channel_flags);
+	column_int(&col, chan->minimum_depth);
+	column_int(&col, chan->next_index[LOCAL]);
+	column_int(&col, chan->next_index[REMOTE]);
+	column_int(&col, chan->next_htlc_id);
+	column_blob(&col,
+		    tal_dup_arr(cols, u8, (u8 *)&chan->funding_txid.shad,
+				sizeof(chan->funding_txid.shad), 0));
+	column_int(&col, chan->funding_outnum);
+	column_int(&col, chan->funding_satoshi);
+	column_int(&col, chan->remote_funding_locked);
+	column_int(&col, chan->push_msat);
+	column_int(&col, chan->our_msatoshi);
+	column_blob(&col,
+		    chan->remote_shutdown_scriptpubkey
+		    ? tal_dup_arr(cols, u8, chan->remote_shutdown_scriptpubkey,
 				  tal_count(chan->remote_shutdown_scriptpubkey),
-				  SQLITE_TRANSIENT);
-	else
-		sqlite3_bind_null(stmt, 16);
-
-	sqlite3_bind_int64(stmt, 17, chan->final_key_idx);
-	sqlite3_bind_int64(stmt, 18, chan->our_config.id);
-	sqlite3_bind_tx(stmt, 19, chan->last_tx);
-	sqlite3_bind_signature(stmt, 20, &chan->last_sig);
-	sqlite3_bind_int(stmt, 21, chan->last_was_revoke);
-	sqlite3_bind_int(stmt, 22, chan->min_possible_feerate);
-	sqlite3_bind_int(stmt, 23, chan->max_possible_feerate);
-	sqlite3_bind_int64(stmt, 24, chan->msatoshi_to_us_min);
-	sqlite3_bind_int64(stmt, 25, chan->msatoshi_to_us_max);
-	sqlite3_bind_int64(stmt, 26, chan->dbid);
-	db_exec_prepared(w->db, stmt);
-
-	wallet_channel_config_save(w, &chan->channel_info.their_config);
-	stmt = db_prepare(w->db, "UPDATE channels SET"
-			  "  fundingkey_remote=?,"
-			  "  revocation_basepoint_remote=?,"
-			  "  payment_basepoint_remote=?,"
-			  "  htlc_basepoint_remote=?,"
-			  "  delayed_payment_basepoint_remote=?,"
-			  "  per_commit_remote=?,"
-			  "  old_per_commit_remote=?,"
-			  "  local_feerate_per_kw=?,"
-			  "  remote_feerate_per_kw=?,"
-			  "  channel_config_remote=?,"
-			  "  future_per_commitment_point=?"
-			  " WHERE id=?");
-	sqlite3_bind_pubkey(stmt, 1,  &chan->channel_info.remote_fundingkey);
-	sqlite3_bind_pubkey(stmt, 2,  &chan->channel_info.theirbase.revocation);
-	sqlite3_bind_pubkey(stmt, 3,  &chan->channel_info.theirbase.payment);
-	sqlite3_bind_pubkey(stmt, 4,  &chan->channel_info.theirbase.htlc);
-	sqlite3_bind_pubkey(stmt, 5,  &chan->channel_info.theirbase.delayed_payment);
-	sqlite3_bind_pubkey(stmt, 6,  &chan->channel_info.remote_per_commit);
-	sqlite3_bind_pubkey(stmt, 7,  &chan->channel_info.old_remote_per_commit);
-	sqlite3_bind_int(stmt, 8, chan->channel_info.feerate_per_kw[LOCAL]);
-	sqlite3_bind_int(stmt, 9, chan->channel_info.feerate_per_kw[REMOTE]);
-	sqlite3_bind_int64(stmt, 10, chan->channel_info.their_config.id);
-	if (chan->future_per_commitment_point)
-		sqlite3_bind_pubkey(stmt, 11, chan->future_per_commitment_point);
-	else
-		sqlite3_bind_null(stmt, 11);
-	sqlite3_bind_int64(stmt, 12, chan->dbid);
-	db_exec_prepared(w->db, stmt);
+				  0)
+		    : NULL);
+	column_int(&col, chan->final_key_idx);
+	column_int(&col, chan->our_config.id);
+	column_blob(&col, linearize_tx(cols, chan->last_tx));
+	blob = tal_arr(cols, u8, 64);
+	secp256k1_ecdsa_signature_serialize_compact(secp256k1_ctx, blob,
+						    &chan->last_sig);
+	column_blob(&col, blob);
+	column_int(&col, chan->last_was_revoke);
+	column_int(&col, chan->min_possible_feerate);
+	column_int(&col, chan->max_possible_feerate);
+	column_int(&col, chan->msatoshi_to_us_min);
+	column_int(&col, chan->msatoshi_to_us_max);
+
+	column_blob(&col, pubkey_blob(cols, &ci->remote_fundingkey));
+	column_blob(&col, pubkey_blob(cols, &ci->theirbase.revocation));
+	column_blob(&col, pubkey_blob(cols, &ci->theirbase.payment));
+	column_blob(&col, pubkey_blob(cols, &ci->theirbase.htlc));
+	column_blob(&col,
+		    pubkey_blob(cols, &ci->theirbase.delayed_payment));
+	column_blob(&col, pubkey_blob(cols, &ci->remote_per_commit));
+	column_blob(&col, pubkey_blob(cols, &ci->old_remote_per_commit));
+	column_int(&col, ci->feerate_per_kw[LOCAL]);
+	column_int(&col, ci->feerate_per_kw[REMOTE]);
+	column_int(&col, ci->their_config.id);
+	column_blob(&col,
+		    chan->future_per_commitment_point
+		    ? pubkey_blob(cols, chan->future_per_commitment_point)
+		    : NULL);
 
 	/* If we have a last_sent_commit, store it */
-	last_sent_commit = tal_arr(tmpctx, u8, 0);
+	blob = tal_arr(cols, u8, 0);
 	for (size_t i = 0; i < tal_count(chan->last_sent_commit); i++)
-		towire_changed_htlc(&last_sent_commit,
-				    &chan->last_sent_commit[i]);
+		towire_changed_htlc(&blob, &chan->last_sent_commit[i]);
+	column_blob(&col, tal_count(blob) ? blob : tal_free(blob));
 
-	stmt = db_prepare(w->db,
-			  "UPDATE channels SET"
-			  "  last_sent_commit=?"
-			  " WHERE id=?");
-	if (tal_count(last_sent_commit))
-		sqlite3_bind_blob(stmt, 1,
-				  last_sent_commit, tal_count(last_sent_commit),
-				  SQLITE_TRANSIENT);
-	else
-		sqlite3_bind_null(stmt, 1);
-	sqlite3_bind_int64(stmt, 2, chan->dbid);
+	assert(col == cols + ARRAY_SIZE(channel_column_names));
+	return cols;
+}
+
+static bool channel_column_eq(const struct channel_column *a,
+			      const struct channel_column *b)
+{
+	if (a->type != b->type)
+		return false;
+	switch (a->type) {
+	case COLUMN_NULL:
+		return true;
+	case COLUMN_INT:
+		return a->num == b->num;
+	case COLUMN_BLOB:
+		return memeq(a->blob, tal_count(a->blob),
+			     b->blob, tal_count(b->blob));
+	}
+	abort();
+}
+
+/* Most saves are for an HTLC changing hands, and only touch a few
+ * counters: so we remember what we wrote last time, and only write the
+ * columns which differ. */
+void wallet_channel_save(struct wallet *w, struct channel *chan)
+{
+	sqlite3_stmt *stmt;
+	struct channel_column *cols;
+	bool dirty[ARRAY_SIZE(channel_column_names)];
+	char *query;
+	int pos = 1;
+
+	assert(chan->first_blocknum);
+
+	cols = channel_columns(chan, chan);
+	query = tal_strdup(tmpctx, "UPDATE channels SET");
+	for (size_t i = 0; i < ARRAY_SIZE(channel_column_names); i++) {
+		dirty[i] = !chan->saved_columns
+			|| !channel_column_eq(&cols[i], &chan->saved_columns[i]);
+		if (!dirty[i])
+			continue;
+		tal_append_fmt(&query, "%s %s=?", pos == 1 ? "" : ",",
+			       channel_column_names[i]);
+		pos++;
+	}
+
+	/* Nothing changed? */
+	if (pos == 1) {
+		tal_free(cols);
+		return;
+	}
+
+	tal_append_fmt(&query, " WHERE id=?");
+	stmt = db_prepare(w->db, query);
+	pos = 1;
+	for (size_t i = 0; i < ARRAY_SIZE(channel_column_names); i++) {
+		if (!dirty[i])
+			continue;
+		switch (cols[i].type) {
+		case COLUMN_NULL:
+			sqlite3_bind_null(stmt, pos++);
+			break;
+		case COLUMN_INT:
+			sqlite3_bind_int64(stmt, pos++, cols[i].num);
+			break;
+		case COLUMN_BLOB:
+			sqlite3_bind_blob(stmt, pos++, cols[i].blob,
+					  tal_count(cols[i].blob),
+					  SQLITE_TRANSIENT);
+			break;
+		}
+	}
+	sqlite3_bind_int64(stmt, pos, chan->dbid);
 	db_exec_prepared(w->db, stmt);
+
+	tal_free(chan->saved_columns);
+	chan->saved_columns = cols;
 }
 
 void wallet_channel_insert(struct wallet *w, struct channel *chan)
@@ -1057,8 +1569,11 @@ void wallet_channel_insert(struct wallet *w, struct channel *chan)
 	sqlite3_bind_int(stmt, 3, chan->dbid);
 	db_exec_prepared(w->db, stmt);
 
+	/* The configs never change, so this is the only time we write them. */
 	wallet_channel_config_insert(w, &chan->our_config);
+	wallet_channel_config_save(w, &chan->our_config);
 	wallet_channel_config_insert(w, &chan->channel_info.their_config);
+	wallet_channel_config_save(w, &chan->channel_info.their_config);
 	wallet_shachain_init(w, &chan->their_shachain);
 
 	/* Now save path as normal */
@@ -1348,29 +1863,49 @@ static bool wallet_stmt2htlc_out(struct channel *channel,
 	return ok;
 }
 
-bool wallet_htlcs_load_for_channel(struct wallet *wallet,
-				   struct channel *chan,
-				   struct htlc_in_map *htlcs_in,
-				   struct htlc_out_map *htlcs_out)
+bool wallet_htlcs_load(struct wallet *wallet,
+		       struct list_head *peers,
+		       struct htlc_in_map *htlcs_in,
+		       struct htlc_out_map *htlcs_out)
 {
 	bool ok = true;
 	int incount = 0, outcount = 0;
+	struct peer *peer;
+	struct channel *chan;
+	UINTMAP(struct channel *) channels;
+	sqlite3_stmt *stmt;
+
+	/* Index channels by dbid so we can load all HTLCs in one pass,
+	 * rather than issuing two queries per channel. */
+	uintmap_init(&channels);
+	list_for_each(peers, peer, list)
+		list_for_each(&peer->channels, chan, list)
+			uintmap_add(&channels, chan->dbid, chan);
 
-	log_debug(wallet->log, "Loading HTLCs for channel %"PRIu64, chan->dbid);
-	sqlite3_stmt *stmt = db_query(
+	log_debug(wallet->log, "Loading HTLCs for all channels");
+	stmt = db_query(
 	    wallet->db,
 	    "SELECT id, channel_htlc_id, msatoshi, cltv_expiry, hstate, "
-	    "payment_hash, shared_secret, payment_key, routing_onion FROM channel_htlcs WHERE "
-	    "direction=%d AND channel_id=%" PRIu64 " AND hstate != %d",
-	    DIRECTION_INCOMING, chan->dbid, SENT_REMOVE_ACK_REVOCATION);
+	    "payment_hash, shared_secret, payment_key, routing_onion, "
+	    "channel_id FROM channel_htlcs WHERE "
+	    "direction=%d AND hstate != %d",
+	    DIRECTION_INCOMING, SENT_REMOVE_ACK_REVOCATION);
 
 	if (!stmt) {
 		log_broken(wallet->log, "Could not select htlc_ins");
-		return false;
+		ok = false;
+		goto out;
 	}
 
 	while (ok && sqlite3_step(stmt) == SQLITE_ROW) {
-		struct htlc_in *in = tal(chan, struct htlc_in);
+		struct htlc_in *in;
+
+		chan = uintmap_get(&channels, sqlite3_column_int64(stmt, 9));
+		/* HTLCs of channels we did not load (e.g., closed). */
+		if (!chan)
+			continue;
+
+		in = tal(chan, struct htlc_in);
 		ok &= wallet_stmt2htlc_in(chan, stmt, in);
 		connect_htlc_in(htlcs_in, in);
 		ok &=  htlc_in_check(in, "wallet_htlcs_load") != NULL;
@@ -1381,17 +1916,25 @@ bool wallet_htlcs_load_for_channel(struct wallet *wallet,
 	stmt = db_query(
 	    wallet->db,
 	    "SELECT id, channel_htlc_id, msatoshi, cltv_expiry, hstate, "
-	    "payment_hash, origin_htlc, payment_key, routing_onion FROM channel_htlcs WHERE "
-	    "direction=%d AND channel_id=%" PRIu64 " AND hstate != %d",
-	    DIRECTION_OUTGOING, chan->dbid, RCVD_REMOVE_ACK_REVOCATION);
+	    "payment_hash, origin_htlc, payment_key, routing_onion, "
+	    "channel_id FROM channel_htlcs WHERE "
+	    "direction=%d AND hstate != %d",
+	    DIRECTION_OUTGOING, RCVD_REMOVE_ACK_REVOCATION);
 
 	if (!stmt) {
 		log_broken(wallet->log, "Could not select htlc_outs");
-		return false;
+		ok = false;
+		goto out;
 	}
 
 	while (ok && sqlite3_step(stmt) == SQLITE_ROW) {
-		struct htlc_out *out = tal(chan, struct htlc_out);
+		struct htlc_out *out;
+
+		chan = uintmap_get(&channels, sqlite3_column_int64(stmt, 9));
+		if (!chan)
+			continue;
+
+		out = tal(chan, struct htlc_out);
 		ok &= wallet_stmt2htlc_out(chan, stmt, out);
 		connect_htlc_out(htlcs_out, out);
 		/* Cannot htlc_out_check because we haven't wired the
@@ -1401,9 +1944,53 @@ bool wallet_htlcs_load_for_channel(struct wallet *wallet,
 	db_stmt_done(stmt);
 	log_debug(wallet->log, "Restored %d incoming and %d outgoing HTLCS", incount, outcount);
 
+out:
+	uintmap_clear(&channels);
 	return ok;
 }
 
+bool wallet_onion_replay_load(struct wallet *wallet,
+			      struct onion_replay *replay,
+			      u32 blockheight, u32 max_blocks)
+{
+	sqlite3_stmt *stmt;
+	struct secret shared_secret;
+	size_t count = 0;
+	u32 expiry;
+
+	/* Only onions we know were genuine: we either got paid, or we
+	 * forwarded them.  Otherwise a forged onion could poison the cache
+	 * for the real one. */
+	stmt = db_query(
+	    wallet->db,
+	    "SELECT id, shared_secret, cltv_expiry FROM channel_htlcs WHERE "
+	    "direction=%d AND cltv_expiry >= %u AND (payment_key IS NOT NULL "
+	    "OR id IN (SELECT origin_htlc FROM channel_htlcs WHERE direction=%d "
+	    "AND origin_htlc IS NOT NULL))",
+	    DIRECTION_INCOMING, blockheight, DIRECTION_OUTGOING);
+
+	if (!stmt) {
+		log_broken(wallet->log, "Could not select onion secrets");
+		return false;
+	}
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		if (sqlite3_column_bytes(stmt, 1) != sizeof(shared_secret))
+			continue;
+		memcpy(&shared_secret, sqlite3_column_blob(stmt, 1),
+		       sizeof(shared_secret));
+		expiry = sqlite3_column_int(stmt, 2);
+		if (expiry > blockheight + max_blocks)
+			expiry = blockheight + max_blocks;
+		onion_replay_add(replay, &shared_secret, expiry,
+				 sqlite3_column_int64(stmt, 0));
+		count++;
+	}
+	db_stmt_done(stmt);
+	log_debug(wallet->log, "Restored %zu onion secrets", count);
+	return true;
+}
+
 bool wallet_invoice_create(struct wallet *wallet,
 			   struct invoice *pinvoice,
 			   u64 *msatoshi TAKES,
@@ -2096,6 +2683,31 @@ wallet_outpoint_spend(struct wallet *w, const tal_t *ctx, const u32 blockheight,
 	return NULL;
 }
 
+struct short_channel_id *
+wallet_utxoset_spent_since(struct wallet *w, const tal_t *ctx,
+			   const u32 blockheight)
+{
+	sqlite3_stmt *stmt;
+	struct short_channel_id *scids = tal_arr(ctx, struct short_channel_id, 0);
+
+	stmt = db_prepare(w->db,
+			  "SELECT blockheight, txindex, outnum "
+			  "FROM utxoset "
+			  "WHERE spendheight >= ? "
+			  "ORDER BY spendheight");
+	sqlite3_bind_int(stmt, 1, blockheight);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		size_t n = tal_count(scids);
+		tal_resize(&scids, n + 1);
+		mk_short_channel_id(&scids[n], sqlite3_column_int(stmt, 0),
+				    sqlite3_column_int(stmt, 1),
+				    sqlite3_column_int(stmt, 2));
+	}
+	db_stmt_done(stmt);
+	return scids;
+}
+
 void wallet_utxoset_add(struct wallet *w, const struct bitcoin_tx *tx,
 			const u32 outnum, const u32 blockheight,
 			const u32 txindex, const u8 *scriptpubkey,
@@ -23,9 +23,11 @@ struct invoices;
 struct channel;
 struct lightningd;
 struct oneshot;
+struct onion_replay;
 struct peer;
 struct pubkey;
 struct timers;
+struct utxo_index;
 
 struct wallet {
 	struct lightningd *ld;
@@ -43,6 +45,10 @@ struct wallet {
 	/* Filter matching all outpoints that might be a funding transaction on
 	 * the blockchain. This is currently all P2WSH outputs */
 	struct outpointfilter *utxoset_outpoints;
+
+	/* Available outputs by amount, for coin selection.  Loaded on first
+	 * use, then kept in sync with the outputs table. */
+	struct utxo_index *available_utxos;
 };
 
 /* Possible states for tracked outputs in the database. Not sure yet
@@ -323,6 +329,9 @@ bool wallet_shachain_add_hash(struct wallet *wallet,
  * @wallet: the wallet to load from
  * @id: the shachain id to load
  * @chain: where to load the shachain into
+ *
+ * A chain still in the old shachain_known rows is rewritten as a blob,
+ * so this needs a transaction.
  */
 bool wallet_shachain_load(struct wallet *wallet, u64 id,
 			  struct wallet_shachain *chain);
@@ -464,29 +473,45 @@ void wallet_htlc_update(struct wallet *wallet, const u64 htlc_dbid,
 			const struct preimage *payment_key);
 
 /**
- * wallet_htlcs_load_for_channel - Load HTLCs associated with chan from DB.
+ * wallet_htlcs_load - Load HTLCs of all channels from DB.
  *
  * @wallet: wallet to load from
- * @chan: load HTLCs associated with this channel
+ * @peers: list of `struct peer` whose channels' HTLCs should be loaded
  * @htlcs_in: htlc_in_map to store loaded htlc_in in
  * @htlcs_out: htlc_out_map to store loaded htlc_out in
  *
- * This function looks for HTLCs that are associated with the given
- * channel and loads them into the provided maps. One caveat is that
- * the `struct htlc_out` instances are not wired up with the
- * corresponding `struct htlc_in` in the forwarding case nor are they
- * associated with a `struct pay_command` in the case we originated
- * the payment. In the former case the corresponding `struct htlc_in`
- * may not have been loaded yet. In the latter case the pay_command
- * does not exist anymore since we restarted.
+ * This function loads the HTLCs of every channel in @peers with a
+ * single query per direction, and stores them in the provided
+ * maps. HTLCs belonging to channels not in @peers are skipped. One
+ * caveat is that the `struct htlc_out` instances are not wired up
+ * with the corresponding `struct htlc_in` in the forwarding case nor
+ * are they associated with a `struct pay_command` in the case we
+ * originated the payment. In the former case the corresponding
+ * `struct htlc_in` may not have been loaded yet. In the latter case
+ * the pay_command does not exist anymore since we restarted.
  *
  * Use `htlcs_reconnect` to wire htlc_out instances to the
  * corresponding htlc_in after loading all channels.
  */
-bool wallet_htlcs_load_for_channel(struct wallet *wallet,
-				   struct channel *chan,
-				   struct htlc_in_map *htlcs_in,
-				   struct htlc_out_map *htlcs_out);
+bool wallet_htlcs_load(struct wallet *wallet,
+		       struct list_head *peers,
+		       struct htlc_in_map *htlcs_in,
+		       struct htlc_out_map *htlcs_out);
+
+/**
+ * wallet_onion_replay_load - Remember onions from stored HTLCs
+ *
+ * @wallet: wallet to load from
+ * @replay: the onion replay cache to add them to
+ * @blockheight: the current blockheight
+ * @max_blocks: remember none for longer than this past @blockheight
+ *
+ * Adds the shared secret of every unexpired incoming HTLC we fulfilled or
+ * forwarded, so replays are still caught after a restart.
+ */
+bool wallet_onion_replay_load(struct wallet *wallet,
+			      struct onion_replay *replay,
+			      u32 blockheight, u32 max_blocks);
 
 
 /* /!\ This is a DB ENUM, please do not change the numbering of any
@@ -917,6 +942,23 @@ wallet_outpoint_spend(struct wallet *w, const tal_t *ctx, const u32 blockheight,
 struct outpoint *wallet_outpoint_for_scid(struct wallet *w, tal_t *ctx,
 					  const struct short_channel_id *scid);
 
+/**
+ * wallet_utxoset_spent_since -- Get outpoints spent at or after a height
+ *
+ * Used to replay spends to gossipd when its store lost channel deletions.
+ * Spent entries are pruned after 144 blocks, so older spends
+ * are no longer available.
+ *
+ * @w: the wallet
+ * @ctx: the tal context to allocate the result from
+ * @blockheight: the lowest spend height to return
+ *
+ * Returns a tal_arr of short_channel_ids, in spend order.
+ */
+struct short_channel_id *
+wallet_utxoset_spent_since(struct wallet *w, const tal_t *ctx,
+			   const u32 blockheight);
+
 void wallet_utxoset_add(struct wallet *w, const struct bitcoin_tx *tx,
 			const u32 outnum, const u32 blockheight,
 			const u32 txindex, const u8 *scriptpubkey,